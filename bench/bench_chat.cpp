@@ -0,0 +1,426 @@
+#include "../client/client.hpp"
+#include "bench_util.hpp"
+#include <algorithm>
+#include <boost/asio.hpp>
+#include <chrono>
+#include <cstdlib>
+#include <iostream>
+#include <memory>
+#include <nlohmann/json.hpp>
+#include <random>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+typedef std::chrono::steady_clock benchClock;
+
+/**
+ * @struct benchOptions
+ * @brief Параметры нагрузки.
+ */
+struct benchOptions {
+  std::string host = "127.0.0.1";
+  std::vector<int> ports = {12345};
+  /// Число одновременных сессий.
+  std::size_t sessions = 1000;
+  /// Число комнат на каждом порту.
+  std::size_t rooms = 10;
+  /// Суммарная частота отправки, сообщений в секунду.
+  double rate = 1000;
+  /// Длительность отправки, с.
+  double duration = 10;
+  /// Время на подключение сессий перед началом отправки, с.
+  double warmup = 2;
+  /// Время ожидания последних доставок после окончания отправки, с.
+  double drain = 2;
+  /// Размер полезной нагрузки сообщения, байт.
+  std::size_t size = 64;
+  /// Число потоков генератора.
+  unsigned threads = std::max(1u, std::thread::hardware_concurrency());
+  /// Процесс сервера для замера RSS (0 — найти процесс "server").
+  int server_pid = 0;
+  /// Административный порт сервера для снимков метрик (0 — не
+  /// запрашивать).
+  int admin_port = 12399;
+};
+
+/**
+ * @class loadWorker
+ * @brief Поток генератора нагрузки: свой io_service и часть сессий.
+ *
+ * Сообщение несёт метку запуска и время отправки по монотонным часам,
+ * поэтому задержка доставки считается прямо в обработчике получателя без
+ * общего состояния между потоками.
+ */
+class loadWorker {
+public:
+  loadWorker(std::uint64_t nonce, double rate, std::size_t size)
+      : timer_(io_service_), nonce_(nonce), rate_(rate), size_(size),
+        credit_(0), next_(0), sending_(false), sent_(0), expected_(0),
+        delivered_(0) {}
+
+  /**
+   * @brief Создание сессии и вход в комнату.
+   * @param nickname Никнейм.
+   * @param endpoints Конечные точки сервера.
+   * @param room Имя комнаты.
+   * @param room_size Число сессий в комнате (для ожидаемого числа доставок).
+   */
+  void addSession(const std::string &nickname,
+                  tcp::resolver::iterator endpoints, const std::string &room,
+                  std::size_t room_size) {
+    std::array<char, MAX_NICKNAME> name;
+    name.fill('\0');
+    std::copy(nickname.begin(), nickname.end(), name.begin());
+    clients_.emplace_back(new client(name, io_service_, endpoints));
+    clients_.back()->setMessageHandler(
+        [this](const std::string &msg) { onDelivery(msg); });
+    clients_.back()->write("/join " + room);
+    room_sizes_.push_back(room_size);
+  }
+
+  /**
+   * @brief Запуск потока обработки событий.
+   */
+  void run() {
+    thread_ = std::thread([this]() { io_service_.run(); });
+  }
+
+  /**
+   * @brief Начало отправки с заданной частотой.
+   */
+  void startSending() {
+    io_service_.post([this]() {
+      sending_ = true;
+      last_tick_ = benchClock::now();
+      tick();
+    });
+  }
+
+  /**
+   * @brief Окончание отправки.
+   */
+  void stopSending() {
+    io_service_.post([this]() {
+      sending_ = false;
+      timer_.cancel();
+    });
+  }
+
+  /**
+   * @brief Остановка потока и закрытие сессий.
+   */
+  void stop() {
+    io_service_.stop();
+    thread_.join();
+    clients_.clear();
+  }
+
+  std::uint64_t sent() const { return sent_; }
+  std::uint64_t expected() const { return expected_; }
+  std::uint64_t delivered() const { return delivered_; }
+  const std::vector<std::uint64_t> &latencies() const { return latencies_; }
+
+private:
+  void tick() {
+    if (!sending_) {
+      return;
+    }
+    auto now = benchClock::now();
+    credit_ += rate_ * std::chrono::duration<double>(now - last_tick_).count();
+    last_tick_ = now;
+    while (credit_ >= 1.0 && !clients_.empty()) {
+      std::size_t i = next_++ % clients_.size();
+      clients_[i]->write(payload());
+      expected_ += room_sizes_[i];
+      ++sent_;
+      credit_ -= 1.0;
+    }
+    timer_.expires_after(std::chrono::milliseconds(5));
+    timer_.async_wait([this](const boost::system::error_code &error) {
+      if (!error) {
+        tick();
+      }
+    });
+  }
+
+  std::string payload() const {
+    std::uint64_t now = std::chrono::duration_cast<std::chrono::nanoseconds>(
+                            benchClock::now().time_since_epoch())
+                            .count();
+    std::string text =
+        "#" + std::to_string(nonce_) + ":" + std::to_string(now) + "#";
+    if (text.size() < size_) {
+      text.append(size_ - text.size(), 'x');
+    }
+    return text;
+  }
+
+  void onDelivery(const std::string &msg) {
+    // Сообщения истории прошлых запусков отсеиваются по метке запуска.
+    std::size_t pos = msg.find('#');
+    if (pos == std::string::npos) {
+      return;
+    }
+    char *end = nullptr;
+    std::uint64_t nonce = std::strtoull(msg.c_str() + pos + 1, &end, 10);
+    if (nonce != nonce_ || *end != ':') {
+      return;
+    }
+    std::uint64_t sent_ns = std::strtoull(end + 1, nullptr, 10);
+    std::uint64_t now = std::chrono::duration_cast<std::chrono::nanoseconds>(
+                            benchClock::now().time_since_epoch())
+                            .count();
+    latencies_.push_back(now - sent_ns);
+    ++delivered_;
+  }
+
+  boost::asio::io_service io_service_;
+  boost::asio::steady_timer timer_;
+  std::thread thread_;
+  std::vector<std::unique_ptr<client>> clients_;
+  std::vector<std::size_t> room_sizes_;
+  std::uint64_t nonce_;
+  double rate_;
+  std::size_t size_;
+  double credit_;
+  std::size_t next_;
+  bool sending_;
+  benchClock::time_point last_tick_;
+  std::uint64_t sent_;
+  std::uint64_t expected_;
+  std::uint64_t delivered_;
+  std::vector<std::uint64_t> latencies_;
+};
+
+/**
+ * @brief Разбор аргументов вида --имя значение.
+ * @param argc Число аргументов.
+ * @param argv Аргументы.
+ * @return Параметры нагрузки.
+ * @throws std::runtime_error При неизвестном или неполном аргументе.
+ */
+benchOptions parseOptions(int argc, char *argv[]) {
+  benchOptions options;
+  for (int i = 1; i < argc; i += 2) {
+    std::string name = argv[i];
+    if (i + 1 >= argc) {
+      throw std::runtime_error("Нет значения для " + name);
+    }
+    std::string value = argv[i + 1];
+    if (name == "--host") {
+      options.host = value;
+    } else if (name == "--ports") {
+      options.ports.clear();
+      std::stringstream ss(value);
+      std::string port;
+      while (std::getline(ss, port, ',')) {
+        options.ports.push_back(std::stoi(port));
+      }
+    } else if (name == "--sessions") {
+      options.sessions = std::stoul(value);
+    } else if (name == "--rooms") {
+      options.rooms = std::max<std::size_t>(1, std::stoul(value));
+    } else if (name == "--rate") {
+      options.rate = std::stod(value);
+    } else if (name == "--duration") {
+      options.duration = std::stod(value);
+    } else if (name == "--warmup") {
+      options.warmup = std::stod(value);
+    } else if (name == "--drain") {
+      options.drain = std::stod(value);
+    } else if (name == "--size") {
+      options.size = std::stoul(value);
+    } else if (name == "--threads") {
+      options.threads = std::max(1, std::stoi(value));
+    } else if (name == "--server-pid") {
+      options.server_pid = std::stoi(value);
+    } else if (name == "--admin-port") {
+      options.admin_port = std::stoi(value);
+    } else {
+      throw std::runtime_error("Неизвестный аргумент: " + name);
+    }
+  }
+  if (options.ports.empty()) {
+    throw std::runtime_error("Не указаны порты сервера.");
+  }
+  return options;
+}
+
+/**
+ * @brief Снимок метрик сервера с административного порта.
+ * @param host Адрес сервера.
+ * @param port Административный порт (0 — не запрашивать).
+ * @return Снимок или null, если порт недоступен.
+ */
+nlohmann::json fetchMetrics(const std::string &host, int port) {
+  if (port == 0) {
+    return nullptr;
+  }
+  try {
+    boost::asio::io_service io_service;
+    tcp::socket socket(io_service);
+    socket.connect(
+        tcp::endpoint(boost::asio::ip::address::from_string(host), port));
+    boost::system::error_code ec;
+    boost::asio::streambuf response;
+    boost::asio::read(socket, response, ec);
+    std::string text((std::istreambuf_iterator<char>(&response)),
+                     std::istreambuf_iterator<char>());
+    std::size_t body = text.find("\r\n\r\n");
+    if (body == std::string::npos) {
+      return nullptr;
+    }
+    return nlohmann::json::parse(text.substr(body + 4));
+  } catch (std::exception &) {
+    return nullptr;
+  }
+}
+
+/**
+ * @brief Приращение числового поля снимка метрик.
+ * @param before Снимок до нагрузки.
+ * @param after Снимок после нагрузки.
+ * @param pointer Путь к полю (например, "/counters/reads").
+ * @return Разность или 0, если поля нет.
+ */
+std::uint64_t metricDelta(const nlohmann::json &before,
+                          const nlohmann::json &after,
+                          const std::string &pointer) {
+  nlohmann::json::json_pointer path(pointer);
+  if (!before.contains(path) || !after.contains(path)) {
+    return 0;
+  }
+  return after[path].get<std::uint64_t>() - before[path].get<std::uint64_t>();
+}
+
+int main(int argc, char *argv[]) {
+  try {
+    benchOptions options = parseOptions(argc, argv);
+    int server_pid = options.server_pid ? options.server_pid : findServerPid();
+    std::uint64_t nonce = std::random_device()();
+
+    boost::asio::io_service resolver_service;
+    tcp::resolver resolver(resolver_service);
+    std::vector<tcp::resolver::iterator> endpoints;
+    for (int port : options.ports) {
+      endpoints.push_back(resolver.resolve(
+          tcp::resolver::query(options.host, std::to_string(port))));
+    }
+
+    // Сессии раскладываются по портам и комнатам по кругу; одноимённые
+    // комнаты разных портов — разные комнаты.
+    std::size_t rooms_total = options.rooms * options.ports.size();
+    std::vector<std::size_t> room_sizes(rooms_total, 0);
+    for (std::size_t i = 0; i < options.sessions; ++i) {
+      ++room_sizes[i % rooms_total];
+    }
+
+    std::vector<std::unique_ptr<loadWorker>> workers;
+    for (unsigned t = 0; t < options.threads; ++t) {
+      workers.emplace_back(new loadWorker(
+          nonce, options.rate / options.threads, options.size));
+    }
+    for (std::size_t i = 0; i < options.sessions; ++i) {
+      std::size_t room = i % rooms_total;
+      std::size_t port = room % options.ports.size();
+      workers[i % workers.size()]->addSession(
+          "b" + std::to_string(i), endpoints[port],
+          "bench-" + std::to_string(room / options.ports.size()),
+          room_sizes[room]);
+    }
+
+    std::uint64_t rss_before = processStatus(server_pid, "VmRSS");
+    for (auto &worker : workers) {
+      worker->run();
+    }
+    auto seconds = [](double s) {
+      return std::chrono::microseconds(static_cast<long long>(s * 1e6));
+    };
+    std::this_thread::sleep_for(seconds(options.warmup));
+    std::uint64_t rss_idle = processStatus(server_pid, "VmRSS");
+
+    nlohmann::json metrics_before =
+        fetchMetrics(options.host, options.admin_port);
+    auto start = benchClock::now();
+    for (auto &worker : workers) {
+      worker->startSending();
+    }
+    std::this_thread::sleep_for(seconds(options.duration));
+    for (auto &worker : workers) {
+      worker->stopSending();
+    }
+    double elapsed =
+        std::chrono::duration<double>(benchClock::now() - start).count();
+    std::uint64_t rss_loaded = processStatus(server_pid, "VmRSS");
+    std::this_thread::sleep_for(seconds(options.drain));
+    std::uint64_t rss_peak = processStatus(server_pid, "VmHWM");
+    nlohmann::json metrics_after =
+        fetchMetrics(options.host, options.admin_port);
+    for (auto &worker : workers) {
+      worker->stop();
+    }
+
+    std::uint64_t sent = 0;
+    std::uint64_t expected = 0;
+    std::uint64_t delivered = 0;
+    std::vector<std::uint64_t> latencies;
+    for (auto &worker : workers) {
+      sent += worker->sent();
+      expected += worker->expected();
+      delivered += worker->delivered();
+      latencies.insert(latencies.end(), worker->latencies().begin(),
+                       worker->latencies().end());
+    }
+    std::sort(latencies.begin(), latencies.end());
+
+    auto micros = [](std::uint64_t ns) { return ns / 1000.0; };
+    nlohmann::json report;
+    report["config"] = {{"host", options.host},
+                        {"ports", options.ports},
+                        {"sessions", options.sessions},
+                        {"rooms_per_port", options.rooms},
+                        {"target_rate", options.rate},
+                        {"duration_s", options.duration},
+                        {"payload_bytes", options.size},
+                        {"threads", options.threads}};
+    report["messages_in"] = sent;
+    report["deliveries_expected"] = expected;
+    report["deliveries_out"] = delivered;
+    report["delivery_ratio"] =
+        expected ? static_cast<double>(delivered) / expected : 0.0;
+    report["throughput"] = {{"messages_in_per_s", sent / elapsed},
+                            {"deliveries_out_per_s", delivered / elapsed}};
+    report["latency_us"] = {
+        {"p50", micros(percentile(latencies, 0.50))},
+        {"p99", micros(percentile(latencies, 0.99))},
+        {"p999", micros(percentile(latencies, 0.999))},
+        {"max", micros(latencies.empty() ? 0 : latencies.back())}};
+    report["server_rss_kb"] = {{"pid", server_pid},
+                               {"before", rss_before},
+                               {"idle", rss_idle},
+                               {"loaded", rss_loaded},
+                               {"peak", rss_peak}};
+    if (metrics_before.is_object() && metrics_after.is_object()) {
+      // Операции чтения и записи сокетов сервера за время нагрузки.
+      std::uint64_t reads =
+          metricDelta(metrics_before, metrics_after, "/counters/reads");
+      std::uint64_t writes = metricDelta(metrics_before, metrics_after,
+                                         "/histograms/write_ns/count");
+      report["server_io"] = {
+          {"backend", metrics_after.value("io_backend", "")},
+          {"reads", reads},
+          {"writes", writes},
+          {"messages_per_read",
+           reads ? static_cast<double>(sent) / reads : 0.0},
+          {"deliveries_per_write",
+           writes ? static_cast<double>(delivered) / writes : 0.0}};
+    }
+    std::cout << report.dump(2) << std::endl;
+  } catch (std::exception &e) {
+    std::cerr << "Exception: " << e.what() << "\n";
+    return 1;
+  }
+  return 0;
+}
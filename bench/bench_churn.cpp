@@ -0,0 +1,332 @@
+#include "../common/protocol.hpp"
+#include "bench_util.hpp"
+#include <algorithm>
+#include <atomic>
+#include <boost/asio.hpp>
+#include <chrono>
+#include <iostream>
+#include <memory>
+#include <nlohmann/json.hpp>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+
+using boost::asio::ip::tcp;
+typedef std::chrono::steady_clock benchClock;
+
+/**
+ * @struct benchOptions
+ * @brief Параметры нагрузки.
+ */
+struct benchOptions {
+  std::string host = "127.0.0.1";
+  int port = 12345;
+  /// Число потоков, которые подключаются и отключаются.
+  unsigned threads = 4;
+  /// Длительность каждой фазы (без текучки и с ней), с.
+  double duration = 5;
+  /// Размер полезной нагрузки сообщения, байт.
+  std::size_t size = 32;
+  /// Процесс сервера (0 — найти процесс "server").
+  int server_pid = 0;
+};
+
+/**
+ * @brief Подключение и рукопожатие по кадровому протоколу.
+ * @param socket Сокет.
+ * @param endpoint Адрес сервера.
+ * @param nickname Никнейм.
+ * @param ec Код ошибки.
+ */
+void connectFramed(tcp::socket &socket, const tcp::endpoint &endpoint,
+                   const std::string &nickname,
+                   boost::system::error_code &ec) {
+  socket.connect(endpoint, ec);
+  if (ec) {
+    return;
+  }
+  handshakePacket packet;
+  packet.fill('\0');
+  std::copy(nickname.begin(), nickname.end(), packet.begin());
+  packet[MAX_NICKNAME - 1] = static_cast<char>(PROTOCOL_FRAMED);
+  boost::asio::write(socket, boost::asio::buffer(packet), ec);
+  if (ec) {
+    return;
+  }
+  char version;
+  boost::asio::read(socket, boost::asio::buffer(&version, 1), ec);
+}
+
+/**
+ * @brief Чтение одного кадра.
+ * @param socket Сокет.
+ * @param type Тип кадра.
+ * @param ec Код ошибки.
+ * @return Полезная нагрузка кадра.
+ */
+std::string readFrame(tcp::socket &socket, frameType &type,
+                      boost::system::error_code &ec) {
+  frameHeader header;
+  boost::asio::read(socket, boost::asio::buffer(header), ec);
+  std::uint32_t length = 0;
+  if (ec || !decodeHeader(header, length, type)) {
+    return std::string();
+  }
+  std::string payload(length, '\0');
+  if (length != 0) {
+    boost::asio::read(socket, boost::asio::buffer(&payload[0], length), ec);
+  }
+  return payload;
+}
+
+/**
+ * @class churnWorker
+ * @brief Поток текучки: подключение, рукопожатие, одно сообщение и
+ * закрытие сокета, без чтения истории комнаты, снова и снова.
+ */
+class churnWorker {
+public:
+  churnWorker(const tcp::endpoint &endpoint, unsigned index,
+              std::size_t size)
+      : endpoint_(endpoint), index_(index), size_(size), running_(false),
+        cycles_(0), failed_(0) {}
+
+  void start() {
+    running_ = true;
+    thread_ = std::thread([this]() { loop(); });
+  }
+
+  void stop() {
+    running_ = false;
+    thread_.join();
+  }
+
+  std::uint64_t cycles() const { return cycles_; }
+  std::uint64_t failed() const { return failed_; }
+
+private:
+  void loop() {
+    boost::asio::io_service io_service;
+    std::string frame = makeFrame(std::string(size_, 'c'));
+    std::uint64_t attempt = 0;
+    while (running_) {
+      tcp::socket socket(io_service);
+      boost::system::error_code ec;
+      connectFramed(socket, endpoint_,
+                    "c" + std::to_string(index_) + "_" +
+                        std::to_string(attempt++),
+                    ec);
+      if (!ec) {
+        boost::asio::write(socket, boost::asio::buffer(frame), ec);
+      }
+      // Каждое второе соединение обрывается сбросом, а не FIN.
+      if (!ec && cycles_ % 2 == 1) {
+        socket.set_option(tcp::socket::linger(true, 0), ec);
+      }
+      socket.close();
+      if (ec) {
+        ++failed_;
+      } else {
+        ++cycles_;
+      }
+    }
+  }
+
+  tcp::endpoint endpoint_;
+  unsigned index_;
+  std::size_t size_;
+  std::atomic<bool> running_;
+  std::thread thread_;
+  std::atomic<std::uint64_t> cycles_;
+  std::atomic<std::uint64_t> failed_;
+};
+
+/**
+ * @class probe
+ * @brief Постоянный участник в отдельной комнате: отправляет сообщение и
+ * ждёт его рассылки себе же, замеряя пропускную способность и задержку
+ * сервера, пока вокруг идёт текучка.
+ */
+class probe {
+public:
+  probe(const tcp::endpoint &endpoint, std::uint64_t nonce)
+      : socket_(io_service_), nonce_(nonce), next_(0) {
+    boost::system::error_code ec;
+    connectFramed(socket_, endpoint, "probe", ec);
+    if (!ec) {
+      std::string join =
+          makeFrame("/join probe-" + std::to_string(nonce_));
+      boost::asio::write(socket_, boost::asio::buffer(join), ec);
+    }
+    if (ec) {
+      throw std::runtime_error("Не удалось подключиться: " + ec.message());
+    }
+  }
+
+  /**
+   * @brief Обмен сообщениями в течение заданного времени.
+   * @param duration Длительность, с.
+   * @param latencies Задержки обменов, нс.
+   * @return Число завершённых обменов.
+   */
+  std::uint64_t run(double duration, std::vector<std::uint64_t> &latencies) {
+    auto until = benchClock::now() +
+                 std::chrono::microseconds(
+                     static_cast<long long>(duration * 1e6));
+    std::uint64_t rounds = 0;
+    while (benchClock::now() < until) {
+      std::string tag = "#" + std::to_string(nonce_) + ":" +
+                        std::to_string(next_++) + "#";
+      std::string frame = makeFrame(tag);
+      auto start = benchClock::now();
+      boost::system::error_code ec;
+      boost::asio::write(socket_, boost::asio::buffer(frame), ec);
+      // Рассылка приходит и отправителю; прочие кадры (уведомления,
+      // проверки связи) пропускаются.
+      bool echoed = false;
+      while (!ec && !echoed) {
+        frameType type;
+        std::string payload = readFrame(socket_, type, ec);
+        echoed = type == FRAME_TEXT && payload.size() >= tag.size() &&
+                 payload.compare(payload.size() - tag.size(), tag.size(),
+                                 tag) == 0;
+      }
+      if (ec) {
+        throw std::runtime_error("Обмен прерван: " + ec.message());
+      }
+      latencies.push_back(static_cast<std::uint64_t>(
+          std::chrono::duration_cast<std::chrono::nanoseconds>(
+              benchClock::now() - start)
+              .count()));
+      ++rounds;
+    }
+    return rounds;
+  }
+
+private:
+  boost::asio::io_service io_service_;
+  tcp::socket socket_;
+  std::uint64_t nonce_;
+  std::uint64_t next_;
+};
+
+/**
+ * @brief Разбор аргументов вида --имя значение.
+ * @param argc Число аргументов.
+ * @param argv Аргументы.
+ * @return Параметры нагрузки.
+ * @throws std::runtime_error При неизвестном или неполном аргументе.
+ */
+benchOptions parseOptions(int argc, char *argv[]) {
+  benchOptions options;
+  for (int i = 1; i < argc; i += 2) {
+    std::string name = argv[i];
+    if (i + 1 >= argc) {
+      throw std::runtime_error("Нет значения для " + name);
+    }
+    std::string value = argv[i + 1];
+    if (name == "--host") {
+      options.host = value;
+    } else if (name == "--port") {
+      options.port = std::stoi(value);
+    } else if (name == "--threads") {
+      options.threads = std::max(1, std::stoi(value));
+    } else if (name == "--duration") {
+      options.duration = std::stod(value);
+    } else if (name == "--size") {
+      options.size = std::stoul(value);
+    } else if (name == "--server-pid") {
+      options.server_pid = std::stoi(value);
+    } else {
+      throw std::runtime_error("Неизвестный аргумент: " + name);
+    }
+  }
+  return options;
+}
+
+int main(int argc, char *argv[]) {
+  try {
+    benchOptions options = parseOptions(argc, argv);
+    int server_pid = options.server_pid ? options.server_pid : findServerPid();
+    std::uint64_t nonce = std::random_device()();
+
+    boost::asio::io_service resolver_service;
+    tcp::resolver resolver(resolver_service);
+    tcp::endpoint endpoint = *resolver.resolve(
+        tcp::resolver::query(options.host, std::to_string(options.port)));
+
+    probe steady(endpoint, nonce);
+    std::uint64_t threads_before = processStatus(server_pid, "Threads");
+    std::uint64_t rss_before = processStatus(server_pid, "VmRSS");
+
+    // Фаза 1: только постоянный участник.
+    std::vector<std::uint64_t> quiet;
+    auto start = benchClock::now();
+    std::uint64_t quiet_rounds = steady.run(options.duration, quiet);
+    double quiet_elapsed =
+        std::chrono::duration<double>(benchClock::now() - start).count();
+
+    // Фаза 2: тот же обмен на фоне подключений и отключений.
+    std::vector<std::unique_ptr<churnWorker>> workers;
+    for (unsigned t = 0; t < options.threads; ++t) {
+      workers.emplace_back(new churnWorker(endpoint, t, options.size));
+    }
+    start = benchClock::now();
+    for (auto &worker : workers) {
+      worker->start();
+    }
+    std::vector<std::uint64_t> churn;
+    std::uint64_t churn_rounds = steady.run(options.duration, churn);
+    std::uint64_t threads_during = processStatus(server_pid, "Threads");
+    for (auto &worker : workers) {
+      worker->stop();
+    }
+    double churn_elapsed =
+        std::chrono::duration<double>(benchClock::now() - start).count();
+    std::uint64_t threads_after = processStatus(server_pid, "Threads");
+    std::uint64_t rss_after = processStatus(server_pid, "VmRSS");
+
+    std::uint64_t cycles = 0;
+    std::uint64_t failed = 0;
+    for (auto &worker : workers) {
+      cycles += worker->cycles();
+      failed += worker->failed();
+    }
+    std::sort(quiet.begin(), quiet.end());
+    std::sort(churn.begin(), churn.end());
+
+    auto micros = [](std::uint64_t ns) { return ns / 1000.0; };
+    auto phase = [&](std::uint64_t rounds, double elapsed,
+                     const std::vector<std::uint64_t> &latencies) {
+      return nlohmann::json{
+          {"round_trips_per_s", rounds / elapsed},
+          {"latency_us",
+           {{"p50", micros(percentile(latencies, 0.50))},
+            {"p99", micros(percentile(latencies, 0.99))},
+            {"max", micros(latencies.empty() ? 0 : latencies.back())}}}};
+    };
+    nlohmann::json report;
+    report["config"] = {{"host", options.host},
+                        {"port", options.port},
+                        {"threads", options.threads},
+                        {"duration_s", options.duration},
+                        {"payload_bytes", options.size}};
+    report["churn"] = {{"cycles", cycles},
+                       {"failed", failed},
+                       {"cycles_per_s", cycles / churn_elapsed}};
+    report["probe"] = {{"quiet", phase(quiet_rounds, quiet_elapsed, quiet)},
+                       {"churn", phase(churn_rounds, churn_elapsed, churn)}};
+    report["server"] = {{"pid", server_pid},
+                        {"threads_before", threads_before},
+                        {"threads_during", threads_during},
+                        {"threads_after", threads_after},
+                        {"rss_kb_before", rss_before},
+                        {"rss_kb_after", rss_after}};
+    std::cout << report.dump(2) << std::endl;
+  } catch (std::exception &e) {
+    std::cerr << "Exception: " << e.what() << "\n";
+    return 1;
+  }
+  return 0;
+}
@@ -0,0 +1,41 @@
+#include "metrics.hpp"
+#include <chrono>
+#include <iomanip>
+#include <iostream>
+#include <string>
+
+/**
+ * @brief Замер среднего времени одного вызова.
+ * @param name Название варианта.
+ * @param iterations Число вызовов.
+ * @param body Замеряемый вызов.
+ * @return Наносекунд на вызов.
+ */
+template <typename F>
+double measure(const char *name, std::size_t iterations, F body) {
+  auto start = std::chrono::steady_clock::now();
+  for (std::size_t i = 0; i < iterations; ++i) {
+    body(i);
+  }
+  auto elapsed = std::chrono::steady_clock::now() - start;
+  double ns =
+      std::chrono::duration<double, std::nano>(elapsed).count() / iterations;
+  std::cout << name << ": " << std::fixed << std::setprecision(1) << ns
+            << " нс/вызов\n";
+  return ns;
+}
+
+int main(int argc, char *argv[]) {
+  std::size_t iterations = argc > 1 ? std::stoul(argv[1]) : 10000000;
+
+  measure("metricAdd", iterations,
+          [](std::size_t) { metricAdd(metricCounter::messages_in); });
+  measure("metricRecord", iterations, [](std::size_t i) {
+    metricRecord(metricHistogram::write_ns, i & 0xffff);
+  });
+  measure("steady_clock + metricRecord", iterations, [](std::size_t) {
+    auto start = std::chrono::steady_clock::now();
+    metricRecord(metricHistogram::fanout_ns, elapsedNs(start));
+  });
+  return 0;
+}
@@ -0,0 +1,160 @@
+#include "participants.hpp"
+#include "server.hpp"
+#include <algorithm>
+#include <chrono>
+#include <iomanip>
+#include <iostream>
+#include <string>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+namespace {
+
+/**
+ * @class countingParticipant
+ * @brief Участник, который только считает доставленные сообщения.
+ */
+class countingParticipant : public participant {
+public:
+  void onMessage(const messagePtr &) override { ++delivered; }
+  std::size_t delivered = 0;
+};
+
+/**
+ * @class hashedRoom
+ * @brief Прежнее устройство комнаты: множество указателей и отдельная
+ * таблица никнеймов, обе с ключом shared_ptr.
+ */
+class hashedRoom {
+public:
+  void enter(const std::shared_ptr<participant> &p, const std::string &nick) {
+    participants_.insert(p);
+    name_table_[p] = nick;
+  }
+  void leave(const std::shared_ptr<participant> &p) {
+    participants_.erase(p);
+    name_table_.erase(p);
+  }
+  std::size_t broadcast(const std::shared_ptr<participant> &sender,
+                        const messagePtr &msg) {
+    std::size_t length = name_table_[sender].size();
+    for (auto &p : participants_) {
+      p->onMessage(msg);
+    }
+    return length;
+  }
+
+private:
+  std::unordered_set<std::shared_ptr<participant>> participants_;
+  std::unordered_map<std::shared_ptr<participant>, std::string> name_table_;
+};
+
+/**
+ * @class denseRoom
+ * @brief Комната на participantTable (как в chatRoom).
+ */
+class denseRoom {
+public:
+  memberHandle enter(const std::shared_ptr<participant> &p,
+                     const std::string &nick) {
+    return members_.insert(p, internedName(nick));
+  }
+  void leave(memberHandle handle) { members_.erase(handle); }
+  std::size_t broadcast(memberHandle sender, const messagePtr &msg) {
+    std::size_t length = members_.find(sender)->name().size();
+    for (const member &m : members_) {
+      m.session->onMessage(msg);
+    }
+    return length;
+  }
+
+private:
+  participantTable members_;
+};
+
+/**
+ * @brief Вывод результата замера.
+ * @param name Название варианта.
+ * @param elapsed Время.
+ * @param operations Число операций.
+ */
+void report(const std::string &name,
+            std::chrono::steady_clock::duration elapsed,
+            std::size_t operations) {
+  double ns =
+      std::chrono::duration<double, std::nano>(elapsed).count() / operations;
+  std::cout << name << ": " << std::fixed << std::setprecision(1) << ns
+            << " нс/операцию\n";
+}
+
+/**
+ * @brief Замер рассылки и входа-выхода для комнаты заданного размера.
+ * @param size Число участников.
+ * @param rounds Число рассылок.
+ */
+void run(std::size_t size, std::size_t rounds) {
+  // Участники создаются вперемешку с посторонними объектами, как сессии
+  // живого сервера, чтобы они не лежали в памяти подряд.
+  std::vector<std::shared_ptr<countingParticipant>> sessions;
+  std::vector<std::string> noise;
+  for (std::size_t i = 0; i < size; ++i) {
+    sessions.push_back(std::make_shared<countingParticipant>());
+    noise.emplace_back(200, 'x');
+  }
+  messagePtr msg;
+  std::cout << "участников: " << size << "\n";
+
+  hashedRoom hashed;
+  denseRoom dense;
+  std::vector<memberHandle> handles;
+  for (std::size_t i = 0; i < size; ++i) {
+    std::string nick = "user" + std::to_string(i) + ": ";
+    hashed.enter(sessions[i], nick);
+    handles.push_back(dense.enter(sessions[i], nick));
+  }
+
+  auto start = std::chrono::steady_clock::now();
+  for (std::size_t r = 0; r < rounds; ++r) {
+    hashed.broadcast(sessions[r % size], msg);
+  }
+  report("  рассылка, хеш-таблицы", std::chrono::steady_clock::now() - start,
+         rounds * size);
+
+  start = std::chrono::steady_clock::now();
+  for (std::size_t r = 0; r < rounds; ++r) {
+    dense.broadcast(handles[r % size], msg);
+  }
+  report("  рассылка, participantTable",
+         std::chrono::steady_clock::now() - start, rounds * size);
+
+  // Выход и повторный вход каждого участника.
+  std::size_t churn = std::max<std::size_t>(size, 100000);
+  start = std::chrono::steady_clock::now();
+  for (std::size_t i = 0; i < churn; ++i) {
+    auto &session = sessions[i % size];
+    hashed.leave(session);
+    hashed.enter(session, "churn: ");
+  }
+  report("  вход/выход, хеш-таблицы",
+         std::chrono::steady_clock::now() - start, churn);
+
+  start = std::chrono::steady_clock::now();
+  for (std::size_t i = 0; i < churn; ++i) {
+    memberHandle &handle = handles[i % size];
+    dense.leave(handle);
+    handle = dense.enter(sessions[i % size], "churn: ");
+  }
+  report("  вход/выход, participantTable",
+         std::chrono::steady_clock::now() - start, churn);
+}
+
+} // namespace
+
+int main(int argc, char *argv[]) {
+  std::size_t deliveries = argc > 1 ? std::stoul(argv[1]) : 50000000;
+  for (std::size_t size : {10, 1000, 50000}) {
+    run(size, std::max<std::size_t>(deliveries / size, 1));
+  }
+  return 0;
+}
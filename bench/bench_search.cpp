@@ -0,0 +1,149 @@
+#include "history.hpp"
+#include "timestamp.hpp"
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdlib>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <random>
+#include <string>
+#include <vector>
+
+namespace {
+
+/// Каталог истории бенчмарка (удаляется после прогона).
+const char *const BENCH_DIR = "bench_search_history";
+
+double secondsSince(std::chrono::steady_clock::time_point start) {
+  return std::chrono::duration<double>(std::chrono::steady_clock::now() -
+                                       start)
+      .count();
+}
+
+std::uint64_t fileSize(const std::string &path) {
+  std::ifstream file(path, std::ios::binary | std::ios::ate);
+  return file ? static_cast<std::uint64_t>(file.tellg()) : 0;
+}
+
+/**
+ * @brief Сообщения из словаря с распределением, близким к закону Ципфа:
+ * первые слова встречаются часто, последние — редко.
+ * @param count Число сообщений.
+ * @param vocabulary Размер словаря.
+ * @return Тексты в формате сохранённой истории.
+ */
+std::vector<std::string> makeMessages(std::size_t count,
+                                      std::size_t vocabulary) {
+  std::mt19937 random(42);
+  std::uniform_real_distribution<double> uniform(0, 1);
+  std::vector<std::string> messages;
+  messages.reserve(count);
+  char stamp[TIMESTAMP_SIZE + 1];
+  formatTimestamp(1700000000, stamp);
+  for (std::size_t i = 0; i < count; ++i) {
+    std::string text(stamp, TIMESTAMP_SIZE);
+    text += "user" + std::to_string(i % 100) + ":";
+    for (int w = 0; w < 8; ++w) {
+      std::size_t word = static_cast<std::size_t>(
+                             std::pow(double(vocabulary), uniform(random))) -
+                         1;
+      text += " word" + std::to_string(word);
+    }
+    messages.push_back(std::move(text));
+  }
+  return messages;
+}
+
+/**
+ * @brief Запись сообщений в хранилище.
+ * @return Сообщений в секунду.
+ */
+double fill(const historyConfig &config,
+            const std::vector<std::string> &messages) {
+  auto start = std::chrono::steady_clock::now();
+  {
+    historyStore store(config, "room");
+    for (std::size_t i = 0; i < messages.size(); ++i) {
+      store.append(i, messages[i]);
+    }
+  }
+  return messages.size() / secondsSince(start);
+}
+
+} // namespace
+
+int main(int argc, char *argv[]) {
+  std::size_t count = argc > 1 ? std::stoul(argv[1]) : 1000000;
+  std::size_t repeats = argc > 2 ? std::stoul(argv[2]) : 100;
+  std::vector<std::string> messages = makeMessages(count, 20000);
+  historyConfig config;
+  config.dir = BENCH_DIR;
+  config.segment_bytes = 64 * 1024 * 1024;
+  config.search_checkpoint = 100000;
+  std::string room = std::string(BENCH_DIR) + "/room";
+  std::cout << std::fixed << std::setprecision(1);
+
+  config.search = false;
+  double plain = fill(config, messages);
+  std::system((std::string("rm -rf ") + BENCH_DIR).c_str());
+  config.search = true;
+  double indexed = fill(config, messages);
+  std::cout << "Запись " << count << " сообщений: " << plain / 1000
+            << " тыс./с без индекса, " << indexed / 1000
+            << " тыс./с с индексом\n";
+  std::uint64_t segments = 0;
+  for (unsigned segment = 0;; ++segment) {
+    char number[16];
+    std::snprintf(number, sizeof(number), "/%08u.log", segment);
+    std::uint64_t size = fileSize(room + number);
+    if (!size) {
+      break;
+    }
+    segments += size;
+  }
+  std::cout << "История: " << segments / (1 << 20) << " МиБ, индекс: "
+            << fileSize(room + "/search.idx") / (1 << 20) << " МиБ\n";
+
+  historyStore store(config, "room");
+  auto start = std::chrono::steady_clock::now();
+  searchQuery first;
+  parseSearchQuery("word1", first);
+  store.search(first);
+  std::cout << "Загрузка контрольной точки: " << secondsSince(start) * 1000
+            << " мс\n";
+
+  const std::pair<const char *, const char *> queries[] = {
+      {"редкое слово", "word19000"},
+      {"частое слово", "word0"},
+      {"два слова", "word3 word7"},
+      {"отправитель и слово", "from:user42 word5"},
+      {"диапазон времени", "since:500000 until:500100"}};
+  for (const auto &entry : queries) {
+    searchQuery query;
+    parseSearchQuery(entry.second, query);
+    std::size_t found = 0;
+    start = std::chrono::steady_clock::now();
+    for (std::size_t i = 0; i < repeats; ++i) {
+      found = store.search(query).size();
+    }
+    std::cout << entry.first << " (" << entry.second
+              << "): " << secondsSince(start) * 1e6 / repeats << " мкс, "
+              << found << " совпадений\n";
+  }
+
+  // Прежний способ — просмотр всей истории подряд.
+  start = std::chrono::steady_clock::now();
+  std::size_t found = 0;
+  for (const historyRecord &record : store.tail(count)) {
+    if (record.text.find(" word19000") != std::string::npos) {
+      ++found;
+    }
+  }
+  std::cout << "Просмотр всей истории: " << secondsSince(start) * 1000
+            << " мс, " << found << " совпадений\n";
+
+  std::system((std::string("rm -rf ") + BENCH_DIR).c_str());
+  return 0;
+}
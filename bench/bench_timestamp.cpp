@@ -0,0 +1,66 @@
+#include "timestamp.hpp"
+#include <chrono>
+#include <cstring>
+#include <ctime>
+#include <iomanip>
+#include <iostream>
+#include <sstream>
+#include <string>
+
+/**
+ * @brief Прежняя реализация: localtime и std::stringstream на каждый вызов.
+ * @return Временной штамп в виде строки.
+ */
+std::string streamTimestamp() {
+  time_t t = time(0);
+  struct tm *now = localtime(&t);
+  std::stringstream ss;
+  ss << '[' << (now->tm_year + 1900) << '-' << std::setfill('0') << std::setw(2)
+     << (now->tm_mon + 1) << '-' << std::setfill('0') << std::setw(2)
+     << now->tm_mday << ' ' << std::setfill('0') << std::setw(2) << now->tm_hour
+     << ":" << std::setfill('0') << std::setw(2) << now->tm_min << ":"
+     << std::setfill('0') << std::setw(2) << now->tm_sec << "] ";
+  return ss.str();
+}
+
+/**
+ * @brief Замер среднего времени одного вызова.
+ * @param name Название варианта.
+ * @param iterations Число вызовов.
+ * @param body Замеряемый вызов.
+ * @return Наносекунд на вызов.
+ */
+template <typename F>
+double measure(const char *name, std::size_t iterations, F body) {
+  auto start = std::chrono::steady_clock::now();
+  for (std::size_t i = 0; i < iterations; ++i) {
+    body();
+  }
+  auto elapsed = std::chrono::steady_clock::now() - start;
+  double ns =
+      std::chrono::duration<double, std::nano>(elapsed).count() / iterations;
+  std::cout << name << ": " << std::fixed << std::setprecision(1) << ns
+            << " нс/вызов\n";
+  return ns;
+}
+
+int main(int argc, char *argv[]) {
+  std::size_t iterations = argc > 1 ? std::stoul(argv[1]) : 2000000;
+  std::string message = "alice: hello";
+  volatile std::size_t sink = 0;
+
+  double before = measure("stringstream + localtime", iterations, [&]() {
+    std::string formatted = streamTimestamp() + message;
+    sink = sink + formatted.size();
+  });
+  double after = measure("кэш потока", iterations, [&]() {
+    char formatted[TIMESTAMP_SIZE + 64];
+    std::memcpy(formatted, cachedTimestamp(), TIMESTAMP_SIZE);
+    std::memcpy(formatted + TIMESTAMP_SIZE, message.data(), message.size());
+    sink = sink + static_cast<std::size_t>(formatted[TIMESTAMP_SIZE]);
+  });
+
+  std::cout << "Ускорение: " << std::setprecision(1) << before / after
+            << "x\n";
+  return 0;
+}
@@ -0,0 +1,70 @@
+#ifndef BENCH_UTIL_HPP
+#define BENCH_UTIL_HPP
+
+#include <algorithm>
+#include <cctype>
+#include <cstdint>
+#include <dirent.h>
+#include <fstream>
+#include <string>
+#include <vector>
+
+/**
+ * @brief Поиск процесса сервера по имени в /proc.
+ * @return Идентификатор процесса или 0, если он не найден.
+ */
+inline int findServerPid() {
+  DIR *proc = ::opendir("/proc");
+  if (!proc) {
+    return 0;
+  }
+  int pid = 0;
+  while (struct dirent *entry = ::readdir(proc)) {
+    std::string name = entry->d_name;
+    if (name.empty() || !std::all_of(name.begin(), name.end(), ::isdigit)) {
+      continue;
+    }
+    std::ifstream comm("/proc/" + name + "/comm");
+    std::string command;
+    if (std::getline(comm, command) && command == "server") {
+      pid = std::stoi(name);
+      break;
+    }
+  }
+  ::closedir(proc);
+  return pid;
+}
+
+/**
+ * @brief Чтение числового поля из /proc/<pid>/status.
+ * @param pid Идентификатор процесса.
+ * @param field Поле (Threads; VmRSS и VmHWM — в КиБ).
+ * @return Значение поля или 0, если процесс недоступен.
+ */
+inline std::uint64_t processStatus(int pid, const std::string &field) {
+  std::ifstream status("/proc/" + std::to_string(pid) + "/status");
+  std::string line;
+  while (std::getline(status, line)) {
+    if (line.compare(0, field.size() + 1, field + ":") == 0) {
+      return std::stoull(line.substr(field.size() + 1));
+    }
+  }
+  return 0;
+}
+
+/**
+ * @brief Перцентиль отсортированной выборки.
+ * @param sorted Отсортированная выборка.
+ * @param p Доля (0.99 — p99).
+ * @return Значение перцентиля или 0 для пустой выборки.
+ */
+inline std::uint64_t percentile(const std::vector<std::uint64_t> &sorted,
+                                double p) {
+  if (sorted.empty()) {
+    return 0;
+  }
+  std::size_t rank = static_cast<std::size_t>(p * sorted.size());
+  return sorted[std::min(rank, sorted.size() - 1)];
+}
+
+#endif // BENCH_UTIL_HPP
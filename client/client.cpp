@@ -1,83 +1,357 @@
 #include "client.hpp"
+#include "replay.hpp"
+#include <algorithm>
 #include <boost/asio.hpp>
 #include <boost/bind/bind.hpp>
 #include <cstring>
+#include <fstream>
 #include <iostream>
 
 using namespace boost::placeholders;
 
 client::client(const std::array<char, MAX_NICKNAME> &nickname,
                boost::asio::io_service &io_service,
-               tcp::resolver::iterator endpoint_iterator)
-    : io_service_(io_service), socket_(io_service) {
-  if (nickname[0] == '\0') {
-    throw std::runtime_error("Empty nickname is not allowed");
+               tcp::resolver::iterator endpoint_iterator, std::uint8_t version)
+    : io_service_(io_service), socket_(io_service),
+      endpoints_(endpoint_iterator), reconnect_timer_(io_service),
+      backoff_ms_(RECONNECT_MIN_MS), closing_(false), established_(false),
+      reconnect_pending_(false), reconnects_(0), last_seq_(0),
+      resume_(false), version_(version), ack_(0), connected_(false),
+      writing_(0), write_pending_(false), read_type_(FRAME_TEXT),
+      pong_(false) {
+  // Недопустимый никнейм сервер всё равно отвергнет, а здесь причина
+  // понятнее.
+  if (!validNickname(std::string(
+          nickname.data(),
+          std::find(nickname.data(), nickname.data() + MAX_NICKNAME - 1,
+                    '\0')))) {
+    throw std::runtime_error(
+        "Nickname must be non-empty and contain no spaces or control "
+        "characters");
   }
-  strcpy(nickname_.data(), nickname.data());
+  nickname_.fill('\0');
+  strncpy(nickname_.data(), nickname.data(), MAX_NICKNAME - 1);
+  nickname_[MAX_NICKNAME - 1] = static_cast<char>(version_);
   memset(read_msg_.data(), '\0', MAX_IP_PACK_SIZE);
   boost::asio::async_connect(socket_, endpoint_iterator,
                              boost::bind(&client::onConnect, this, _1));
 }
 
 void client::write(const std::array<char, MAX_IP_PACK_SIZE> &msg) {
+  const char *end = std::find(msg.data(), msg.data() + msg.size(), '\0');
+  write(std::string(msg.data(), end));
+}
+
+void client::write(const std::string &msg) {
   io_service_.post(boost::bind(&client::writeImpl, this, msg));
 }
 
+void client::setMessageHandler(messageHandler handler) {
+  on_message_ = std::move(handler);
+}
+
 void client::close() {
   io_service_.post(boost::bind(&client::closeImpl, this));
 }
 
+std::uint64_t client::lastSeq() const { return last_seq_; }
+
+std::size_t client::reconnects() const { return reconnects_; }
+
 void client::onConnect(const boost::system::error_code &error) {
   if (!error) {
     boost::asio::async_write(socket_,
                              boost::asio::buffer(nickname_, nickname_.size()),
-                             boost::bind(&client::readHandler, this, _1));
+                             boost::bind(&client::handshakeHandler, this, _1));
+  } else if (established_) {
+    connectionLost();
   } else {
     throw std::runtime_error("Connection failed");
   }
 }
 
-void client::readHandler(const boost::system::error_code &error) {
-  std::cout << read_msg_.data() << std::endl;
-  if (!error) {
+void client::handshakeHandler(const boost::system::error_code &error) {
+  if (error) {
+    connectionLost();
+    return;
+  }
+  if (version_ == PROTOCOL_LEGACY) {
+    ackHandler(error);
+    return;
+  }
+  boost::asio::async_read(socket_, boost::asio::buffer(&ack_, 1),
+                          boost::bind(&client::ackHandler, this, _1));
+}
+
+void client::ackHandler(const boost::system::error_code &error) {
+  if (error) {
+    connectionLost();
+    return;
+  }
+  if (static_cast<std::uint8_t>(ack_) == HANDSHAKE_REJECTED) {
+    if (established_) {
+      // Прежняя сессия с этим никнеймом ещё не закрыта сервером:
+      // пробуем снова после паузы.
+      connectionLost();
+      return;
+    }
+    show("Nickname is already taken");
+    closing_ = true;
+    boost::system::error_code ignored;
+    socket_.close(ignored);
+    return;
+  }
+  if (version_ != PROTOCOL_LEGACY) {
+    // При переподключении версия согласуется заново от запрошенной.
+    std::uint8_t requested = handshakeVersion(nickname_);
+    version_ = std::min(static_cast<std::uint8_t>(ack_), requested);
+  }
+  connected_ = true;
+  established_ = true;
+  backoff_ms_ = RECONNECT_MIN_MS;
+  resume_ = version_ >= PROTOCOL_RESUMABLE;
+  startRead();
+  if (!write_msgs_.empty() || resume_) {
+    startWrite();
+  }
+}
+
+void client::startRead() {
+  if (version_ == PROTOCOL_LEGACY) {
     boost::asio::async_read(socket_,
                             boost::asio::buffer(read_msg_, read_msg_.size()),
                             boost::bind(&client::readHandler, this, _1));
   } else {
-    closeImpl();
+    boost::asio::async_read(
+        socket_, boost::asio::buffer(read_header_, read_header_.size()),
+        boost::bind(&client::readHeaderHandler, this, _1));
+  }
+}
+
+void client::readHandler(const boost::system::error_code &error) {
+  if (!error) {
+    const char *begin = read_msg_.data();
+    const char *end = std::find(begin, begin + read_msg_.size(), '\0');
+    show(std::string(begin, end));
+    startRead();
+  } else {
+    connectionLost();
   }
 }
 
-void client::writeImpl(std::array<char, MAX_IP_PACK_SIZE> msg) {
-  bool write_in_progress = !write_msgs_.empty();
-  write_msgs_.push_back(msg);
-  if (!write_in_progress) {
-    boost::asio::async_write(
-        socket_,
-        boost::asio::buffer(write_msgs_.front(), write_msgs_.front().size()),
-        boost::bind(&client::writeHandler, this, _1));
+void client::readHeaderHandler(const boost::system::error_code &error) {
+  std::uint32_t length;
+  if (error || !decodeHeader(read_header_, length, read_type_)) {
+    connectionLost();
+    return;
   }
+  read_body_.resize(length);
+  boost::asio::async_read(
+      socket_, boost::asio::buffer(&read_body_[0], read_body_.size()),
+      boost::bind(&client::readBodyHandler, this, _1));
+}
+
+void client::readBodyHandler(const boost::system::error_code &error) {
+  if (error) {
+    connectionLost();
+    return;
+  }
+  std::uint64_t seq;
+  std::string text;
+  switch (read_type_) {
+  case FRAME_TEXT:
+    show(read_body_);
+    break;
+  case FRAME_SEQUENCED:
+    if (decodeSequenced(read_body_, seq, text)) {
+      last_seq_ = seq;
+      show(text);
+    }
+    break;
+  case FRAME_ROOM:
+    // Номера дальше относятся к новой комнате.
+    room_ = read_body_;
+    last_seq_ = 0;
+    break;
+  case FRAME_GAP:
+    show("-- part of the history is no longer available --");
+    break;
+  case FRAME_PING:
+    // Проверка связи от сервера: отвечаем FRAME_PONG со следующей
+    // записью.
+    pong_ = true;
+    if (!write_pending_) {
+      startWrite();
+    }
+    break;
+  default:
+    break;
+  }
+  startRead();
+}
+
+void client::show(const std::string &msg) {
+  if (on_message_) {
+    on_message_(msg);
+  } else {
+    std::cout << msg << '\n';
+  }
+}
+
+void client::writeImpl(std::string msg) {
+  write_msgs_.push_back(std::move(msg));
+  if (!write_pending_ && connected_) {
+    startWrite();
+  }
+}
+
+void client::startWrite() {
+  // Все накопленные сообщения (в пределах ограничений пакетной записи)
+  // кодируются в один буфер и уходят одним вызовом async_write.
+  write_buf_.clear();
+  writing_ = 0;
+  write_pending_ = true;
+  if (resume_) {
+    // Первым кадром соединения сервер ждёт FRAME_RESUME.
+    write_buf_ += makeResumeFrame(last_seq_, room_);
+    resume_ = false;
+  }
+  if (pong_) {
+    write_buf_ += makeFrame(std::string(), FRAME_PONG);
+    pong_ = false;
+  }
+  for (std::string &msg : write_msgs_) {
+    if (writing_ != 0 && (writing_ >= DEFAULT_WRITE_BATCH_BUFFERS ||
+                          write_buf_.size() + msg.size() + FRAME_HEADER_SIZE >
+                              DEFAULT_WRITE_BATCH_BYTES)) {
+      break;
+    }
+    if (version_ == PROTOCOL_LEGACY) {
+      write_buf_ += makeLegacyPacket(msg);
+    } else {
+      if (msg.size() > MAX_FRAME_SIZE) {
+        msg.resize(MAX_FRAME_SIZE);
+      }
+      write_buf_ += makeFrame(msg);
+    }
+    ++writing_;
+  }
+  boost::asio::async_write(socket_, boost::asio::buffer(write_buf_),
+                           boost::bind(&client::writeHandler, this, _1));
 }
 
 void client::writeHandler(const boost::system::error_code &error) {
   if (!error) {
-    write_msgs_.pop_front();
-    if (!write_msgs_.empty()) {
-      boost::asio::async_write(
-          socket_,
-          boost::asio::buffer(write_msgs_.front(), write_msgs_.front().size()),
-          boost::bind(&client::writeHandler, this, _1));
+    write_msgs_.erase(write_msgs_.begin(), write_msgs_.begin() + writing_);
+    writing_ = 0;
+    write_pending_ = false;
+    if (!write_msgs_.empty() || pong_) {
+      startWrite();
     }
   } else {
-    closeImpl();
+    connectionLost();
+  }
+}
+
+void client::closeImpl() {
+  closing_ = true;
+  reconnect_timer_.cancel();
+  boost::system::error_code ignored;
+  socket_.close(ignored);
+}
+
+void client::connectionLost() {
+  boost::system::error_code ignored;
+  socket_.close(ignored);
+  connected_ = false;
+  if (closing_ || !established_ || reconnect_pending_) {
+    return;
   }
+  reconnect_pending_ = true;
+  reconnect_timer_.expires_after(std::chrono::milliseconds(backoff_ms_));
+  reconnect_timer_.async_wait(boost::bind(&client::reconnect, this, _1));
+  backoff_ms_ = std::min(2 * backoff_ms_, RECONNECT_MAX_MS);
 }
 
-void client::closeImpl() { socket_.close(); }
+void client::reconnect(const boost::system::error_code &error) {
+  reconnect_pending_ = false;
+  if (error || closing_) {
+    return;
+  }
+  // Незавершённая запись прервана: её сообщения остались в очереди и
+  // уйдут заново.
+  ++reconnects_;
+  write_pending_ = false;
+  writing_ = 0;
+  pong_ = false;
+  boost::asio::async_connect(socket_, endpoints_,
+                             boost::bind(&client::onConnect, this, _1));
+}
 
 #ifndef UNIT_TEST
+/**
+ * @brief Сценарный режим: client --replay <сценарий.jsonl> <host> <port>
+ * [--output buffered|count] [--linger <мс>].
+ * @param argc Число аргументов.
+ * @param argv Аргументы.
+ * @return Код завершения.
+ */
+int replayMain(int argc, char *argv[]) {
+  if (argc < 5 || argc % 2 == 0) {
+    std::cerr << "Usage: " << argv[0]
+              << " --replay <script.jsonl> <host> <port>"
+                 " [--output buffered|count] [--linger <ms>]\n";
+    return 1;
+  }
+  replayOutput output = replayOutput::buffered;
+  std::chrono::milliseconds linger(DEFAULT_REPLAY_LINGER_MS);
+  for (int i = 5; i < argc; i += 2) {
+    std::string name = argv[i];
+    std::string value = argv[i + 1];
+    if (name == "--output" && value == "buffered") {
+      output = replayOutput::buffered;
+    } else if (name == "--output" && value == "count") {
+      output = replayOutput::count;
+    } else if (name == "--linger") {
+      linger = std::chrono::milliseconds(std::stoul(value));
+    } else {
+      std::cerr << "Unknown option: " << name << " " << value << "\n";
+      return 1;
+    }
+  }
+
+  std::ifstream script(argv[2]);
+  if (!script) {
+    std::cerr << "Cannot open script: " << argv[2] << "\n";
+    return 1;
+  }
+  std::vector<scriptEvent> events = parseScript(script);
+
+  boost::asio::io_service io_service;
+  tcp::resolver resolver(io_service);
+  tcp::resolver::iterator iterator =
+      resolver.resolve(tcp::resolver::query(argv[3], argv[4]));
+
+  std::ios::sync_with_stdio(false);
+  replayRunner runner(io_service, iterator, std::move(events), output,
+                      std::cout, linger);
+  auto start = std::chrono::steady_clock::now();
+  runner.start();
+  io_service.run();
+  double elapsed = std::chrono::duration<double>(
+                       std::chrono::steady_clock::now() - start)
+                       .count();
+  std::cerr << "users: " << runner.users() << ", sent: " << runner.sent()
+            << ", received: " << runner.received() << ", elapsed: "
+            << elapsed << " s\n";
+  return 0;
+}
+
 int main(int argc, char *argv[]) {
   try {
+    if (argc >= 2 && std::string(argv[1]) == "--replay") {
+      return replayMain(argc, argv);
+    }
     if (argc != 4) {
       std::cerr << "Usage: " << argv[0] << " <username> <host> <port>\n";
       return 1;
@@ -104,12 +378,9 @@ int main(int argc, char *argv[]) {
 
     std::thread t([&io_service]() { io_service.run(); });
 
-    char line[MAX_IP_PACK_SIZE + 1];
-    while (std::cin.getline(line, MAX_IP_PACK_SIZE + 1)) {
-      std::array<char, MAX_IP_PACK_SIZE> msg;
-      std::fill(msg.begin(), msg.end(), 0);
-      std::memcpy(msg.data(), line, std::strlen(line));
-      c.write(msg);
+    std::string line;
+    while (std::getline(std::cin, line)) {
+      c.write(line);
     }
 
     c.close();
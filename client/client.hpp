@@ -1,37 +1,67 @@
 #ifndef CLIENT_HPP
 #define CLIENT_HPP
 
+#include "protocol.hpp"
 #include <array>
 #include <boost/asio.hpp>
+#include <cstdint>
 #include <deque>
+#include <functional>
 #include <string>
 
-constexpr int MAX_NICKNAME = 16;
-constexpr int MAX_IP_PACK_SIZE = 512;
 constexpr int PADDING = 24;
 
+/// Первая пауза перед переподключением, мс; дальше она удваивается.
+constexpr unsigned RECONNECT_MIN_MS = 100;
+/// Наибольшая пауза перед переподключением, мс.
+constexpr unsigned RECONNECT_MAX_MS = 5000;
+
 using boost::asio::ip::tcp;
 /**
  * @class client
  * @brief Класс клиента для подключения к серверу чата и общения с другими
  * клиентами.
+ *
+ * Если установленное соединение обрывается, клиент переподключается сам с
+ * растущей паузой. По протоколу версии 2 он помнит комнату и номер
+ * последнего полученного сообщения и после переподключения получает от
+ * сервера только пропущенное. Неотправленные сообщения остаются в очереди
+ * и уходят после переподключения. Если сервер отверг никнейм как занятый,
+ * клиент при первом подключении закрывается, а при переподключении ждёт,
+ * пока сервер закроет прежнюю сессию.
  */
 class client {
 public:
+  /// Обработчик полученного сообщения.
+  typedef std::function<void(const std::string &)> messageHandler;
+
   /**
    * @brief Конструктор клиента.
    * @param nickname Никнейм клиента.
    * @param io_service Сервис ввода-вывода Boost.Asio.
    * @param endpoint_iterator Итератор конечных точек для подключения к серверу.
+   * @param version Запрашиваемая версия протокола.
    */
   client(const std::array<char, MAX_NICKNAME> &nickname,
          boost::asio::io_service &io_service,
-         tcp::resolver::iterator endpoint_iterator);
+         tcp::resolver::iterator endpoint_iterator,
+         std::uint8_t version = PROTOCOL_VERSION);
   /**
    * @brief Отправка сообщения на сервер.
    * @param msg Сообщение для отправки.
    */
   void write(const std::array<char, MAX_IP_PACK_SIZE> &msg);
+  /**
+   * @brief Отправка сообщения произвольной длины на сервер.
+   * @param msg Сообщение для отправки.
+   */
+  void write(const std::string &msg);
+  /**
+   * @brief Замена обработчика полученных сообщений (по умолчанию сообщения
+   * выводятся в std::cout). Вызывается до запуска io_service.
+   * @param handler Обработчик.
+   */
+  void setMessageHandler(messageHandler handler);
   /**
    * @brief Закрытие подключения клиента.
    */
@@ -41,18 +71,56 @@ public:
    * @param error Код ошибки.
    */
   void onConnect(const boost::system::error_code &error);
+  /**
+   * @brief Номер последнего полученного сообщения текущей комнаты.
+   * @return Номер (0, если сообщений с номером не было).
+   */
+  std::uint64_t lastSeq() const;
+  /**
+   * @brief Число попыток переподключения.
+   * @return Число попыток.
+   */
+  std::size_t reconnects() const;
 
 private:
   /**
-   * @brief Обработчик чтения сообщения от сервера.
+   * @brief Обработчик завершения отправки никнейма.
+   * @param error Код ошибки.
+   */
+  void handshakeHandler(const boost::system::error_code &error);
+  /**
+   * @brief Обработчик ответа сервера с согласованной версией протокола.
+   * @param error Код ошибки.
+   */
+  void ackHandler(const boost::system::error_code &error);
+  /**
+   * @brief Запуск чтения следующего сообщения в согласованном протоколе.
+   */
+  void startRead();
+  /**
+   * @brief Запуск пакетной записи накопленных в очереди сообщений.
+   */
+  void startWrite();
+  /**
+   * @brief Обработчик чтения пакета старого протокола.
    * @param error Код ошибки.
    */
   void readHandler(const boost::system::error_code &error);
+  /**
+   * @brief Обработчик чтения заголовка кадра.
+   * @param error Код ошибки.
+   */
+  void readHeaderHandler(const boost::system::error_code &error);
+  /**
+   * @brief Обработчик чтения тела кадра.
+   * @param error Код ошибки.
+   */
+  void readBodyHandler(const boost::system::error_code &error);
   /**
    * @brief Реализация отправки сообщения.
    * @param msg Сообщение для отправки.
    */
-  void writeImpl(std::array<char, MAX_IP_PACK_SIZE> msg);
+  void writeImpl(std::string msg);
   /**
    * @brief Обработчик события завершения отправки сообщения.
    * @param error Код ошибки.
@@ -62,12 +130,54 @@ private:
    * @brief Реализация закрытия подключения.
    */
   void closeImpl();
+  /**
+   * @brief Обрыв соединения: сокет закрывается, и, если сессия уже была
+   * установлена и клиент не закрыт, планируется переподключение.
+   */
+  void connectionLost();
+  /**
+   * @brief Переподключение по таймеру.
+   * @param error Код ошибки.
+   */
+  void reconnect(const boost::system::error_code &error);
+  /**
+   * @brief Передача текста обработчику сообщений (или в std::cout).
+   * @param msg Текст.
+   */
+  void show(const std::string &msg);
 
   boost::asio::io_service &io_service_;
   tcp::socket socket_;
+  tcp::resolver::iterator endpoints_;
+  boost::asio::steady_timer reconnect_timer_;
+  unsigned backoff_ms_;
+  /// Клиент закрыт пользователем: переподключаться не нужно.
+  bool closing_;
+  /// Сессия хотя бы раз была установлена.
+  bool established_;
+  bool reconnect_pending_;
+  std::size_t reconnects_;
+  /// Комната и номер последнего сообщения для FRAME_RESUME.
+  std::string room_;
+  std::uint64_t last_seq_;
+  /// FRAME_RESUME ещё не отправлен в этом соединении.
+  bool resume_;
   std::array<char, MAX_IP_PACK_SIZE> read_msg_;
-  std::deque<std::array<char, MAX_IP_PACK_SIZE>> write_msgs_;
-  std::array<char, MAX_NICKNAME> nickname_;
+  frameHeader read_header_;
+  std::string read_body_;
+  std::deque<std::string> write_msgs_;
+  std::string write_buf_;
+  messageHandler on_message_;
+  handshakePacket nickname_;
+  std::uint8_t version_;
+  char ack_;
+  bool connected_;
+  std::size_t writing_;
+  /// Запись в сокет ещё не завершена.
+  bool write_pending_;
+  frameType read_type_;
+  /// Нужно ответить серверу на проверку связи.
+  bool pong_;
 };
 
 #endif // CLIENT_HPP
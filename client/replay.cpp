@@ -0,0 +1,132 @@
+#include "replay.hpp"
+#include <algorithm>
+#include <nlohmann/json.hpp>
+#include <stdexcept>
+
+std::vector<scriptEvent> parseScript(std::istream &input) {
+  std::vector<scriptEvent> events;
+  std::string line;
+  std::size_t number = 0;
+  while (std::getline(input, line)) {
+    ++number;
+    if (line.find_first_not_of(" \t\r") == std::string::npos) {
+      continue;
+    }
+    try {
+      nlohmann::json record = nlohmann::json::parse(line);
+      scriptEvent event;
+      long long at = record.at("at_ms").get<long long>();
+      if (at < 0) {
+        throw std::runtime_error("отрицательное время");
+      }
+      event.at = std::chrono::milliseconds(at);
+      event.user = record.at("user").get<std::string>();
+      if (event.user.empty() || event.user.size() >= MAX_NICKNAME) {
+        throw std::runtime_error("недопустимое имя пользователя");
+      }
+      event.text = record.at("text").get<std::string>();
+      events.push_back(std::move(event));
+    } catch (std::exception &e) {
+      throw std::runtime_error("Строка " + std::to_string(number) +
+                               " сценария: " + e.what());
+    }
+  }
+  std::stable_sort(events.begin(), events.end(),
+                   [](const scriptEvent &a, const scriptEvent &b) {
+                     return a.at < b.at;
+                   });
+  return events;
+}
+
+replayRunner::replayRunner(boost::asio::io_service &io_service,
+                           tcp::resolver::iterator endpoints,
+                           std::vector<scriptEvent> events,
+                           replayOutput output, std::ostream &out,
+                           std::chrono::milliseconds linger)
+    : io_service_(io_service), endpoints_(endpoints),
+      events_(std::move(events)), output_(output), out_(out),
+      linger_(linger), timer_(io_service), next_(0), sent_(0),
+      received_(0) {
+  // Пользователи нумеруются в порядке первого появления в сценарии.
+  std::unordered_map<std::string, std::size_t> index;
+  for (const scriptEvent &event : events_) {
+    auto it = index.emplace(event.user, names_.size()).first;
+    if (it->second == names_.size()) {
+      names_.push_back(event.user);
+    }
+    targets_.push_back(it->second);
+  }
+  if (output_ == replayOutput::buffered) {
+    buffer_.reserve(REPLAY_FLUSH_BYTES);
+  }
+}
+
+replayRunner::~replayRunner() { flush(); }
+
+void replayRunner::start() {
+  for (std::size_t i = 0; i < names_.size(); ++i) {
+    std::array<char, MAX_NICKNAME> nickname;
+    nickname.fill('\0');
+    std::copy(names_[i].begin(), names_[i].end(), nickname.begin());
+    clients_.emplace_back(new client(nickname, io_service_, endpoints_));
+    clients_.back()->setMessageHandler(
+        [this, i](const std::string &msg) { onMessage(i, msg); });
+  }
+  start_ = std::chrono::steady_clock::now();
+  onTimer(boost::system::error_code());
+}
+
+std::size_t replayRunner::users() const { return names_.size(); }
+
+std::uint64_t replayRunner::sent() const { return sent_; }
+
+std::uint64_t replayRunner::received() const { return received_; }
+
+void replayRunner::onTimer(const boost::system::error_code &error) {
+  if (error) {
+    return;
+  }
+  if (next_ == events_.size()) {
+    finish();
+    return;
+  }
+  auto elapsed = std::chrono::steady_clock::now() - start_;
+  while (next_ < events_.size() && events_[next_].at <= elapsed) {
+    clients_[targets_[next_]]->write(events_[next_].text);
+    ++sent_;
+    ++next_;
+  }
+  if (next_ < events_.size()) {
+    timer_.expires_at(start_ + events_[next_].at);
+  } else {
+    timer_.expires_after(linger_);
+  }
+  timer_.async_wait(
+      [this](const boost::system::error_code &error) { onTimer(error); });
+}
+
+void replayRunner::onMessage(std::size_t user, const std::string &msg) {
+  ++received_;
+  if (output_ == replayOutput::count) {
+    return;
+  }
+  buffer_.append(names_[user]).append(1, '\t').append(msg).append(1, '\n');
+  if (buffer_.size() >= REPLAY_FLUSH_BYTES) {
+    flush();
+  }
+}
+
+void replayRunner::finish() {
+  for (auto &c : clients_) {
+    c->close();
+  }
+  flush();
+}
+
+void replayRunner::flush() {
+  if (!buffer_.empty()) {
+    out_.write(buffer_.data(), buffer_.size());
+    out_.flush();
+    buffer_.clear();
+  }
+}
@@ -0,0 +1,149 @@
+#ifndef REPLAY_HPP
+#define REPLAY_HPP
+
+#include "client.hpp"
+#include <boost/asio.hpp>
+#include <chrono>
+#include <cstdint>
+#include <istream>
+#include <memory>
+#include <ostream>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+/// Порог сброса буфера полученных сообщений в поток вывода, байт.
+constexpr std::size_t REPLAY_FLUSH_BYTES = 64 * 1024;
+
+/// Время ожидания последних доставок после последнего события, мс.
+constexpr unsigned DEFAULT_REPLAY_LINGER_MS = 1000;
+
+/**
+ * @brief Вывод полученных сообщений в сценарном режиме.
+ */
+enum class replayOutput {
+  /// Строки «получатель<TAB>сообщение», сбрасываемые пачками.
+  buffered,
+  /// Только подсчёт.
+  count
+};
+
+/**
+ * @struct scriptEvent
+ * @brief Событие сценария: пользователь отправляет строку в момент at от
+ * начала воспроизведения.
+ */
+struct scriptEvent {
+  std::chrono::milliseconds at;
+  std::string user;
+  std::string text;
+};
+
+/**
+ * @brief Чтение сценария в формате JSONL: по объекту
+ * {"at_ms": 100, "user": "alice", "text": "привет"} в строке. Пустые
+ * строки пропускаются.
+ * @param input Поток сценария.
+ * @return События, упорядоченные по времени (одновременные — в порядке
+ * файла).
+ * @throws std::runtime_error При ошибке разбора с номером строки.
+ */
+std::vector<scriptEvent> parseScript(std::istream &input);
+
+/**
+ * @class replayRunner
+ * @brief Воспроизведение сценария: все пользователи сценария подключаются
+ * отдельными клиентами на одном io_service, строки отправляются по
+ * расписанию одним таймером.
+ *
+ * Полученные сообщения не выводятся построчно с std::endl: они либо
+ * копятся в буфере и уходят в поток вывода пачками, либо только
+ * считаются.
+ */
+class replayRunner {
+public:
+  /**
+   * @brief Конструктор.
+   * @param io_service Сервис ввода-вывода.
+   * @param endpoints Конечные точки сервера.
+   * @param events События сценария (упорядоченные по времени).
+   * @param output Режим вывода.
+   * @param out Поток вывода полученных сообщений.
+   * @param linger Ожидание последних доставок после последнего события.
+   */
+  replayRunner(boost::asio::io_service &io_service,
+               tcp::resolver::iterator endpoints,
+               std::vector<scriptEvent> events, replayOutput output,
+               std::ostream &out,
+               std::chrono::milliseconds linger =
+                   std::chrono::milliseconds(DEFAULT_REPLAY_LINGER_MS));
+
+  ~replayRunner();
+
+  /**
+   * @brief Подключение пользователей и запуск расписания. Когда сценарий
+   * закончится, клиенты закрываются и io_service остаётся без работы.
+   */
+  void start();
+
+  /**
+   * @brief Число пользователей сценария.
+   * @return Число клиентов.
+   */
+  std::size_t users() const;
+
+  /**
+   * @brief Число отправленных строк.
+   * @return Число строк.
+   */
+  std::uint64_t sent() const;
+
+  /**
+   * @brief Число полученных сообщений (всеми пользователями).
+   * @return Число сообщений.
+   */
+  std::uint64_t received() const;
+
+private:
+  /**
+   * @brief Отправка наступивших событий и ожидание следующего.
+   * @param error Код ошибки.
+   */
+  void onTimer(const boost::system::error_code &error);
+
+  /**
+   * @brief Обработка полученного сообщения.
+   * @param user Номер пользователя-получателя.
+   * @param msg Сообщение.
+   */
+  void onMessage(std::size_t user, const std::string &msg);
+
+  /**
+   * @brief Закрытие клиентов и сброс буфера.
+   */
+  void finish();
+
+  /**
+   * @brief Запись буфера в поток вывода.
+   */
+  void flush();
+
+  boost::asio::io_service &io_service_;
+  tcp::resolver::iterator endpoints_;
+  std::vector<scriptEvent> events_;
+  replayOutput output_;
+  std::ostream &out_;
+  std::chrono::milliseconds linger_;
+  boost::asio::steady_timer timer_;
+  std::chrono::steady_clock::time_point start_;
+  std::vector<std::unique_ptr<client>> clients_;
+  std::vector<std::string> names_;
+  /// Номер пользователя для каждого события.
+  std::vector<std::size_t> targets_;
+  std::size_t next_;
+  std::uint64_t sent_;
+  std::uint64_t received_;
+  std::string buffer_;
+};
+
+#endif // REPLAY_HPP
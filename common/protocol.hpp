@@ -0,0 +1,235 @@
+#ifndef PROTOCOL_HPP
+#define PROTOCOL_HPP
+
+#include <algorithm>
+#include <array>
+#include <cstdint>
+#include <cstring>
+#include <string>
+
+constexpr int MAX_NICKNAME = 16;
+constexpr int MAX_IP_PACK_SIZE = 512;
+
+/**
+ * Версия протокола передаётся в последнем байте пакета никнейма.
+ * Старые клиенты всегда оставляют там '\0', поэтому версия 0 означает
+ * фиксированные пакеты по MAX_IP_PACK_SIZE байт. Версия 2 добавляет к
+ * кадрам номера сообщений комнаты и возобновление сессии.
+ */
+constexpr std::uint8_t PROTOCOL_LEGACY = 0;
+constexpr std::uint8_t PROTOCOL_FRAMED = 1;
+constexpr std::uint8_t PROTOCOL_RESUMABLE = 2;
+constexpr std::uint8_t PROTOCOL_VERSION = PROTOCOL_RESUMABLE;
+/// Ответ на рукопожатие вместо версии: никнейм уже занят или недопустим
+/// (см. validNickname). Следом сервер
+/// отправляет уведомление в запрошенной версии протокола (старые клиенты
+/// примут ответ за неё же) и закрывает соединение.
+constexpr std::uint8_t HANDSHAKE_REJECTED = 0xFF;
+
+/**
+ * Заголовок кадра: 4 байта длины полезной нагрузки (big-endian) и 1 байт
+ * типа кадра.
+ */
+constexpr std::size_t FRAME_HEADER_SIZE = 5;
+constexpr std::uint32_t MAX_FRAME_SIZE = 64 * 1024;
+
+/**
+ * Ограничения одной пакетной записи: сколько байт и сколько буферов из
+ * очереди отправляется одним вызовом async_write.
+ */
+constexpr std::size_t DEFAULT_WRITE_BATCH_BYTES = 64 * 1024;
+constexpr std::size_t DEFAULT_WRITE_BATCH_BUFFERS = 64;
+
+/**
+ * Типы кадров: текст; проверка связи (пустой кадр, на который получатель
+ * отвечает FRAME_PONG); ответ на проверку связи.
+ *
+ * Только в версии 2:
+ * - FRAME_SEQUENCED — сообщение комнаты с номером: 8 байт номера
+ *   (big-endian), затем вложенный кадр FRAME_TEXT;
+ * - FRAME_RESUME — первый кадр клиента после рукопожатия: 8 байт номера
+ *   последнего полученного сообщения (0 — ничего не получено), затем имя
+ *   комнаты (пусто — комната по умолчанию);
+ * - FRAME_ROOM — сервер перевёл участника в комнату с этим именем, номера
+ *   дальше относятся к ней;
+ * - FRAME_GAP — недостающих сообщений у сервера уже нет, следом идёт вся
+ *   сохранённая история.
+ */
+enum frameType : std::uint8_t {
+  FRAME_TEXT = 0,
+  FRAME_PING = 1,
+  FRAME_PONG = 2,
+  FRAME_SEQUENCED = 3,
+  FRAME_RESUME = 4,
+  FRAME_ROOM = 5,
+  FRAME_GAP = 6
+};
+
+/// Размер номера сообщения в кадрах версии 2.
+constexpr std::size_t SEQUENCE_SIZE = 8;
+
+using frameHeader = std::array<char, FRAME_HEADER_SIZE>;
+using handshakePacket = std::array<char, MAX_NICKNAME>;
+
+/**
+ * @brief Запись заголовка кадра.
+ * @param length Длина полезной нагрузки.
+ * @param type Тип кадра.
+ * @param header Буфер заголовка.
+ */
+inline void encodeHeader(std::uint32_t length, frameType type,
+                         frameHeader &header) {
+  header[0] = static_cast<char>((length >> 24) & 0xFF);
+  header[1] = static_cast<char>((length >> 16) & 0xFF);
+  header[2] = static_cast<char>((length >> 8) & 0xFF);
+  header[3] = static_cast<char>(length & 0xFF);
+  header[4] = static_cast<char>(type);
+}
+
+/**
+ * @brief Разбор заголовка кадра.
+ * @param header Буфер заголовка.
+ * @param length Длина полезной нагрузки.
+ * @param type Тип кадра.
+ * @return false, если длина превышает MAX_FRAME_SIZE.
+ */
+inline bool decodeHeader(const frameHeader &header, std::uint32_t &length,
+                         frameType &type) {
+  const unsigned char *h =
+      reinterpret_cast<const unsigned char *>(header.data());
+  length = (std::uint32_t(h[0]) << 24) | (std::uint32_t(h[1]) << 16) |
+           (std::uint32_t(h[2]) << 8) | std::uint32_t(h[3]);
+  type = static_cast<frameType>(h[4]);
+  return length <= MAX_FRAME_SIZE;
+}
+
+/**
+ * @brief Кодирование сообщения в кадр (заголовок + полезная нагрузка).
+ * @param payload Полезная нагрузка.
+ * @param type Тип кадра.
+ * @return Байты кадра.
+ */
+inline std::string makeFrame(const std::string &payload,
+                             frameType type = FRAME_TEXT) {
+  frameHeader header;
+  encodeHeader(static_cast<std::uint32_t>(payload.size()), type, header);
+  std::string frame;
+  frame.reserve(FRAME_HEADER_SIZE + payload.size());
+  frame.append(header.data(), header.size());
+  frame.append(payload);
+  return frame;
+}
+
+/**
+ * @brief Запись номера сообщения (big-endian).
+ * @param seq Номер.
+ * @param out Буфер не меньше SEQUENCE_SIZE байт.
+ */
+inline void encodeSequence(std::uint64_t seq, char *out) {
+  for (std::size_t i = 0; i < SEQUENCE_SIZE; ++i) {
+    out[i] = static_cast<char>((seq >> (8 * (SEQUENCE_SIZE - 1 - i))) & 0xFF);
+  }
+}
+
+/**
+ * @brief Чтение номера сообщения.
+ * @param in Буфер не меньше SEQUENCE_SIZE байт.
+ * @return Номер.
+ */
+inline std::uint64_t decodeSequence(const char *in) {
+  std::uint64_t seq = 0;
+  for (std::size_t i = 0; i < SEQUENCE_SIZE; ++i) {
+    seq = (seq << 8) | static_cast<unsigned char>(in[i]);
+  }
+  return seq;
+}
+
+/**
+ * @brief Разбор полезной нагрузки кадра FRAME_SEQUENCED.
+ * @param payload Полезная нагрузка.
+ * @param seq Номер сообщения.
+ * @param text Текст вложенного кадра.
+ * @return false, если нагрузка повреждена.
+ */
+inline bool decodeSequenced(const std::string &payload, std::uint64_t &seq,
+                            std::string &text) {
+  if (payload.size() < SEQUENCE_SIZE + FRAME_HEADER_SIZE) {
+    return false;
+  }
+  frameHeader header;
+  std::memcpy(header.data(), payload.data() + SEQUENCE_SIZE,
+              FRAME_HEADER_SIZE);
+  std::uint32_t length;
+  frameType type;
+  if (!decodeHeader(header, length, type) ||
+      length != payload.size() - SEQUENCE_SIZE - FRAME_HEADER_SIZE) {
+    return false;
+  }
+  seq = decodeSequence(payload.data());
+  text.assign(payload, SEQUENCE_SIZE + FRAME_HEADER_SIZE, length);
+  return true;
+}
+
+/**
+ * @brief Кадр возобновления сессии.
+ * @param seq Номер последнего полученного сообщения комнаты.
+ * @param room Комната, к которой относится номер.
+ * @return Байты кадра.
+ */
+inline std::string makeResumeFrame(std::uint64_t seq,
+                                   const std::string &room) {
+  std::string payload(SEQUENCE_SIZE, '\0');
+  encodeSequence(seq, &payload[0]);
+  payload.append(room);
+  return makeFrame(payload, FRAME_RESUME);
+}
+
+/**
+ * @brief Кодирование сообщения в фиксированный пакет старого протокола.
+ * Сообщение обрезается до MAX_IP_PACK_SIZE - 1 символов.
+ * @param payload Текст сообщения.
+ * @return Пакет длиной MAX_IP_PACK_SIZE байт.
+ */
+inline std::string makeLegacyPacket(const std::string &payload) {
+  std::string packet(MAX_IP_PACK_SIZE, '\0');
+  std::size_t length =
+      std::min(payload.size(), static_cast<std::size_t>(MAX_IP_PACK_SIZE - 1));
+  std::memcpy(&packet[0], payload.data(), length);
+  return packet;
+}
+
+/**
+ * @brief Извлечение никнейма из пакета рукопожатия.
+ * @param packet Пакет рукопожатия.
+ * @return Никнейм (без байта версии).
+ */
+inline std::string handshakeNickname(const handshakePacket &packet) {
+  const char *end =
+      std::find(packet.data(), packet.data() + MAX_NICKNAME - 1, '\0');
+  return std::string(packet.data(), end);
+}
+
+/**
+ * @brief Проверка никнейма: непустой, без пробелов и управляющих символов,
+ * иначе его нельзя назвать адресатом /msg. Байты UTF-8 допустимы.
+ * @param nickname Никнейм.
+ * @return true, если никнейм допустим.
+ */
+inline bool validNickname(const std::string &nickname) {
+  return !nickname.empty() &&
+         std::none_of(nickname.begin(), nickname.end(), [](char c) {
+           unsigned char byte = static_cast<unsigned char>(c);
+           return byte <= ' ' || byte == 0x7F;
+         });
+}
+
+/**
+ * @brief Извлечение версии протокола из пакета рукопожатия.
+ * @param packet Пакет рукопожатия.
+ * @return Запрошенная клиентом версия.
+ */
+inline std::uint8_t handshakeVersion(const handshakePacket &packet) {
+  return static_cast<std::uint8_t>(packet[MAX_NICKNAME - 1]);
+}
+
+#endif // PROTOCOL_HPP
@@ -0,0 +1,927 @@
+#include "history.hpp"
+#include "logger.hpp"
+#include <algorithm>
+#include <atomic>
+#include <cctype>
+#include <cerrno>
+#include <condition_variable>
+#include <cstdio>
+#include <cstring>
+#include <dirent.h>
+#include <fcntl.h>
+#include <memory>
+#include <stdexcept>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <thread>
+#include <unistd.h>
+
+namespace {
+
+/// Заголовок записи сегмента: длина текста (u32) и время (u64).
+constexpr std::size_t RECORD_HEADER_SIZE = 12;
+
+/**
+ * @class mappedFile
+ * @brief Файл, отображённый в память только для чтения.
+ */
+class mappedFile {
+public:
+  explicit mappedFile(const std::string &path) : data_(nullptr), size_(0) {
+    int fd = ::open(path.c_str(), O_RDONLY);
+    if (fd < 0) {
+      return;
+    }
+    struct stat st;
+    if (::fstat(fd, &st) == 0 && st.st_size > 0) {
+      void *data = ::mmap(nullptr, static_cast<std::size_t>(st.st_size),
+                          PROT_READ, MAP_PRIVATE, fd, 0);
+      if (data != MAP_FAILED) {
+        data_ = static_cast<const char *>(data);
+        size_ = static_cast<std::size_t>(st.st_size);
+      }
+    }
+    ::close(fd);
+  }
+
+  ~mappedFile() {
+    if (data_) {
+      ::munmap(const_cast<char *>(data_), size_);
+    }
+  }
+
+  mappedFile(const mappedFile &) = delete;
+  mappedFile &operator=(const mappedFile &) = delete;
+
+  const char *data() const { return data_; }
+  std::size_t size() const { return size_; }
+
+private:
+  const char *data_;
+  std::size_t size_;
+};
+
+/**
+ * @brief Разбор одной записи сегмента.
+ * @param data Начало сегмента.
+ * @param size Размер сегмента.
+ * @param offset Смещение записи; при успехе сдвигается на следующую.
+ * @param record Прочитанная запись (nullptr — только пропустить).
+ * @return false, если запись недописана.
+ */
+bool parseRecord(const char *data, std::uint64_t size, std::uint64_t &offset,
+                 historyRecord *record) {
+  if (size - offset < RECORD_HEADER_SIZE) {
+    return false;
+  }
+  std::uint32_t length;
+  std::uint64_t timestamp_ms;
+  std::memcpy(&length, data + offset, sizeof(length));
+  std::memcpy(&timestamp_ms, data + offset + sizeof(length),
+              sizeof(timestamp_ms));
+  if (size - offset - RECORD_HEADER_SIZE < length) {
+    return false;
+  }
+  if (record) {
+    record->timestamp_ms = timestamp_ms;
+    record->text.assign(data + offset + RECORD_HEADER_SIZE, length);
+  }
+  offset += RECORD_HEADER_SIZE + length;
+  return true;
+}
+
+void writeAll(int fd, const std::string &data) {
+  std::size_t written = 0;
+  while (written < data.size()) {
+    ssize_t n = ::write(fd, data.data() + written, data.size() - written);
+    if (n < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      throw std::runtime_error(std::string("Ошибка записи истории: ") +
+                               std::strerror(errno));
+    }
+    written += static_cast<std::size_t>(n);
+  }
+}
+
+/**
+ * @brief Размер файла.
+ * @param path Путь к файлу.
+ * @return Размер (0, если файла нет).
+ */
+std::uint64_t fileSize(const std::string &path) {
+  struct stat st;
+  return ::stat(path.c_str(), &st) == 0 ? static_cast<std::uint64_t>(st.st_size)
+                                        : 0;
+}
+
+/**
+ * @brief Создание каталога вместе с недостающими родительскими каталогами.
+ * @param path Путь к каталогу.
+ * @throws std::runtime_error Если каталог не может быть создан.
+ */
+void makeDirectories(const std::string &path) {
+  for (std::size_t pos = path.find('/', 1);; pos = path.find('/', pos + 1)) {
+    std::string prefix = path.substr(0, pos);
+    if (::mkdir(prefix.c_str(), 0755) != 0 && errno != EEXIST) {
+      throw std::runtime_error("Не удалось создать каталог истории: " +
+                               prefix);
+    }
+    if (pos == std::string::npos) {
+      break;
+    }
+  }
+}
+
+/**
+ * @class historyCommitter
+ * @brief Фоновый поток, периодически выполняющий групповую запись всех
+ * хранилищ истории и обслуживание их индексов поиска.
+ *
+ * Список хранилищ блокируется только на время выбора очередного, чтобы
+ * долгая загрузка индекса одной комнаты не задерживала создание и
+ * удаление других; удаляемое хранилище ждёт лишь окончания своей записи.
+ */
+class historyCommitter {
+public:
+  static historyCommitter &instance() {
+    static historyCommitter committer;
+    return committer;
+  }
+
+  ~historyCommitter() { stop(); }
+
+  void add(historyStore *store) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    stores_.push_back(store);
+  }
+
+  void remove(historyStore *store) {
+    std::unique_lock<std::mutex> lock(mutex_);
+    stores_.erase(std::remove(stores_.begin(), stores_.end(), store),
+                  stores_.end());
+    idle_.wait(lock, [this, store] { return current_ != store; });
+  }
+
+  void start(unsigned commit_ms) {
+    stop();
+    commit_ms_ = commit_ms;
+    running_.store(true, std::memory_order_release);
+    thread_ = std::thread(&historyCommitter::loop, this);
+  }
+
+  void stop() {
+    if (running_.exchange(false)) {
+      thread_.join();
+      refreshAll();
+    }
+  }
+
+  bool running() const { return running_.load(std::memory_order_acquire); }
+
+private:
+  historyCommitter() : current_(nullptr), running_(false), commit_ms_(10) {}
+
+  void refreshAll() {
+    // Если хранилище удалили во время обхода, соседнее может пропустить
+    // один период — его запишет следующий.
+    for (std::size_t i = 0;; ++i) {
+      {
+        std::lock_guard<std::mutex> lock(mutex_);
+        current_ = nullptr;
+        idle_.notify_all();
+        if (i >= stores_.size()) {
+          return;
+        }
+        current_ = stores_[i];
+      }
+      try {
+        current_->refresh();
+      } catch (std::exception &e) {
+        log(e.what(), logLevel::error);
+      }
+    }
+  }
+
+  void loop() {
+    while (running_.load(std::memory_order_acquire)) {
+      std::this_thread::sleep_for(std::chrono::milliseconds(commit_ms_));
+      refreshAll();
+    }
+  }
+
+  std::mutex mutex_;
+  std::condition_variable idle_;
+  std::vector<historyStore *> stores_;
+  /// Хранилище, которое сейчас записывается (меняется под mutex_).
+  historyStore *current_;
+  std::atomic<bool> running_;
+  unsigned commit_ms_;
+  std::thread thread_;
+};
+
+/**
+ * @class storeRegistry
+ * @brief Живые хранилища истории по каталогам (см. openHistoryStore).
+ */
+class storeRegistry {
+public:
+  static storeRegistry &instance() {
+    static storeRegistry registry;
+    return registry;
+  }
+
+  std::shared_ptr<historyStore> open(const historyConfig &config,
+                                     const std::string &name) {
+    std::string directory = config.dir + "/" + name;
+    std::unique_lock<std::mutex> lock(mutex_);
+    for (auto it = stores_.find(directory); it != stores_.end();
+         it = stores_.find(directory)) {
+      if (std::shared_ptr<historyStore> store = it->second.store.lock()) {
+        return store;
+      }
+      // Последняя ссылка уже отпущена, и деструктор дописывает сегменты.
+      closed_.wait(lock);
+    }
+    std::uint64_t id = ++last_id_;
+    std::shared_ptr<historyStore> store(
+        new historyStore(config, name), [directory, id](historyStore *store) {
+          delete store;
+          instance().closed(directory, id);
+        });
+    stores_[directory] = entry{store, id};
+    return store;
+  }
+
+private:
+  struct entry {
+    std::weak_ptr<historyStore> store;
+    std::uint64_t id;
+  };
+
+  storeRegistry() : last_id_(0) {}
+
+  void closed(const std::string &directory, std::uint64_t id) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto it = stores_.find(directory);
+    if (it != stores_.end() && it->second.id == id) {
+      stores_.erase(it);
+    }
+    closed_.notify_all();
+  }
+
+  std::mutex mutex_;
+  std::condition_variable closed_;
+  std::map<std::string, entry> stores_;
+  std::uint64_t last_id_;
+};
+
+} // namespace
+
+historyStore::historyStore(const historyConfig &config,
+                           const std::string &name)
+    : config_(config), name_(name), open_(false), log_fd_(-1), index_fd_(-1),
+      segment_(0), segment_size_(0), segment_records_(0), segment_start_(0),
+      last_sync_(std::chrono::steady_clock::now()), search_ready_(false),
+      search_saved_(0), search_segment_(0), search_log_size_(0) {
+  config_.index_interval = std::max<std::uint64_t>(1, config_.index_interval);
+  historyCommitter::instance().add(this);
+}
+
+historyStore::~historyStore() {
+  historyCommitter::instance().remove(this);
+  flush();
+  std::lock_guard<std::mutex> lock(io_mutex_);
+  if (open_ && search_ready_ && search_.size() != search_saved_) {
+    saveSearch();
+  }
+  closeSegment();
+}
+
+void historyStore::append(std::uint64_t timestamp_ms, std::string text) {
+  {
+    std::lock_guard<std::mutex> lock(pending_mutex_);
+    pending_.push_back(historyRecord{timestamp_ms, std::move(text)});
+  }
+  if (!historyCommitter::instance().running()) {
+    refresh();
+  }
+}
+
+void historyStore::flush() {
+  // io_mutex_ захватывается первым, чтобы пачки попадали на диск в том же
+  // порядке, в каком их забрали из очереди.
+  std::lock_guard<std::mutex> io_lock(io_mutex_);
+  std::vector<historyRecord> batch;
+  {
+    std::lock_guard<std::mutex> lock(pending_mutex_);
+    batch.swap(pending_);
+  }
+  if (batch.empty()) {
+    return;
+  }
+  if (!open_) {
+    openForAppend();
+  }
+
+  std::string data;
+  std::string index;
+  std::uint64_t indexed = search_.size();
+  // Счётчики сегмента сдвигаются только после записи: при ошибке номера
+  // сообщений и смещения индекса не должны учитывать того, чего нет на
+  // диске.
+  std::uint64_t size = segment_size_;
+  std::uint64_t records = segment_records_;
+  std::size_t written = 0;
+  try {
+    for (std::size_t i = 0; i < batch.size(); ++i) {
+      const historyRecord &record = batch[i];
+      std::uint64_t record_size = RECORD_HEADER_SIZE + record.text.size();
+      if (records > 0 && size + record_size > config_.segment_bytes) {
+        writeSegment(data, index, size, records);
+        written = i;
+        data.clear();
+        index.clear();
+        if (config_.fsync != fsyncPolicy::none) {
+          ::fdatasync(log_fd_);
+        }
+        std::uint64_t start = segment_start_ + segment_records_;
+        saveStart(segment_ + 1, start);
+        openSegment(segment_ + 1);
+        segment_start_ = start;
+        size = 0;
+        records = 0;
+      }
+      if (records % config_.index_interval == 0) {
+        indexEntry entry{size, record.timestamp_ms, records};
+        index.append(reinterpret_cast<const char *>(&entry), sizeof(entry));
+      }
+      std::uint32_t length = static_cast<std::uint32_t>(record.text.size());
+      data.append(reinterpret_cast<const char *>(&length), sizeof(length));
+      data.append(reinterpret_cast<const char *>(&record.timestamp_ms),
+                  sizeof(record.timestamp_ms));
+      data.append(record.text);
+      size += record_size;
+      ++records;
+    }
+    writeSegment(data, index, size, records);
+  } catch (...) {
+    // Незаписанный остаток пачки уйдёт на диск следующей записью раньше
+    // новых сообщений.
+    {
+      std::lock_guard<std::mutex> lock(pending_mutex_);
+      pending_.insert(pending_.begin(),
+                      std::make_move_iterator(batch.begin() + written),
+                      std::make_move_iterator(batch.end()));
+    }
+    batch.resize(written);
+    if (log_fd_ < 0 || index_fd_ < 0) {
+      // Сегмент не открылся или не обрезался: следующая запись откроет
+      // его заново и сверит счётчики с диском.
+      closeSegment();
+      open_ = false;
+    }
+    indexRecords(batch, indexed);
+    throw;
+  }
+
+  auto now = std::chrono::steady_clock::now();
+  if (config_.fsync == fsyncPolicy::batch ||
+      (config_.fsync == fsyncPolicy::interval &&
+       now - last_sync_ >= std::chrono::milliseconds(config_.fsync_ms))) {
+    ::fdatasync(log_fd_);
+    last_sync_ = now;
+  }
+  indexRecords(batch, indexed);
+}
+
+void historyStore::writeSegment(const std::string &data,
+                                const std::string &index, std::uint64_t size,
+                                std::uint64_t records) {
+  off_t index_size = ::lseek(index_fd_, 0, SEEK_END);
+  try {
+    // Индекс пишется после данных, чтобы он не ссылался на недописанные
+    // записи.
+    writeAll(log_fd_, data);
+    writeAll(index_fd_, index);
+  } catch (...) {
+    if (index_size < 0 ||
+        ::ftruncate(log_fd_, static_cast<off_t>(segment_size_)) != 0 ||
+        ::ftruncate(index_fd_, index_size) != 0) {
+      closeSegment();
+    }
+    throw;
+  }
+  segment_size_ = size;
+  segment_records_ = records;
+}
+
+void historyStore::indexRecords(const std::vector<historyRecord> &records,
+                                std::uint64_t indexed) {
+  // Пока индекс не загружен, пачку дочитает из сегментов refresh().
+  if (records.empty() || !config_.search || !search_ready_) {
+    return;
+  }
+  {
+    std::lock_guard<std::mutex> lock(search_mutex_);
+    for (const historyRecord &record : records) {
+      search_.add(++indexed, record.timestamp_ms, record.text);
+    }
+  }
+  std::uint64_t added = search_.size() - search_saved_;
+  if (added >= config_.search_checkpoint && added >= search_.size() / 4) {
+    saveSearch();
+  }
+}
+
+void historyStore::refresh() {
+  flush();
+  if (!config_.search) {
+    return;
+  }
+  std::lock_guard<std::mutex> io_lock(io_mutex_);
+  if (!search_ready_) {
+    loadSearch();
+  } else if (!open_ && segmentsGrown()) {
+    catchUpSearch();
+  }
+}
+
+std::vector<historyRecord> historyStore::tail(std::size_t count) {
+  flush();
+  std::vector<historyRecord> records;
+  std::vector<unsigned> segments = listSegments();
+  for (auto it = segments.rbegin(); it != segments.rend(); ++it) {
+    if (records.size() >= count) {
+      break;
+    }
+    readSegmentTail(*it, count - records.size(), records);
+  }
+  return records;
+}
+
+std::uint64_t historyStore::size() {
+  flush();
+  return segmentStarts(listSegments()).back();
+}
+
+bool historyStore::searchable() const { return config_.search; }
+
+bool historyStore::searchReady() {
+  if (!config_.search) {
+    return false;
+  }
+  if (!historyCommitter::instance().running()) {
+    refresh();
+  }
+  std::lock_guard<std::mutex> lock(search_mutex_);
+  return search_ready_;
+}
+
+std::vector<historyRecord> historyStore::search(const searchQuery &query) {
+  if (!searchReady()) {
+    return std::vector<historyRecord>();
+  }
+  std::vector<std::uint64_t> ordinals;
+  {
+    std::lock_guard<std::mutex> lock(search_mutex_);
+    ordinals = search_.find(query, config_.search_results);
+  }
+  // Найденные записи уже на диске и не меняются, их можно читать без
+  // блокировок.
+  return readRecords(ordinals);
+}
+
+std::string historyStore::segmentPath(unsigned segment,
+                                      const char *extension) const {
+  char number[16];
+  std::snprintf(number, sizeof(number), "%08u", segment);
+  return directory() + "/" + number + extension;
+}
+
+std::string historyStore::directory() const {
+  return config_.dir + "/" + name_;
+}
+
+std::vector<unsigned> historyStore::listSegments() const {
+  std::vector<unsigned> segments;
+  DIR *dir = ::opendir(directory().c_str());
+  if (!dir) {
+    return segments;
+  }
+  while (struct dirent *entry = ::readdir(dir)) {
+    std::string file = entry->d_name;
+    if (file.size() != 12 || file.compare(8, 4, ".log") != 0) {
+      continue;
+    }
+    std::string number = file.substr(0, 8);
+    if (std::all_of(number.begin(), number.end(), [](char c) {
+          return std::isdigit(static_cast<unsigned char>(c));
+        })) {
+      segments.push_back(static_cast<unsigned>(std::stoul(number)));
+    }
+  }
+  ::closedir(dir);
+  std::sort(segments.begin(), segments.end());
+  return segments;
+}
+
+std::vector<historyStore::indexEntry>
+historyStore::readIndex(unsigned segment) const {
+  std::vector<indexEntry> entries;
+  mappedFile index(segmentPath(segment, ".idx"));
+  std::size_t count = index.size() / sizeof(indexEntry);
+  entries.resize(count);
+  if (count) {
+    std::memcpy(entries.data(), index.data(), count * sizeof(indexEntry));
+  }
+  return entries;
+}
+
+std::uint64_t historyStore::segmentRecords(unsigned segment) const {
+  mappedFile log(segmentPath(segment, ".log"));
+  // Нужна только последняя точка индекса, поэтому он читается с конца без
+  // копирования.
+  mappedFile index(segmentPath(segment, ".idx"));
+  std::uint64_t offset = 0;
+  std::uint64_t total = 0;
+  for (std::size_t n = index.size() / sizeof(indexEntry); n-- > 0;) {
+    indexEntry entry;
+    std::memcpy(&entry, index.data() + n * sizeof(indexEntry), sizeof(entry));
+    if (entry.offset < log.size()) {
+      offset = entry.offset;
+      total = entry.ordinal;
+      break;
+    }
+  }
+  while (parseRecord(log.data(), log.size(), offset, nullptr)) {
+    ++total;
+  }
+  return total;
+}
+
+void historyStore::readSegmentTail(unsigned segment, std::size_t count,
+                                   std::vector<historyRecord> &records) const {
+  mappedFile log(segmentPath(segment, ".log"));
+  std::vector<indexEntry> index = readIndex(segment);
+  while (!index.empty() && index.back().offset >= log.size()) {
+    index.pop_back();
+  }
+
+  // Считаем записи от последней точки индекса до конца сегмента.
+  std::uint64_t offset = index.empty() ? 0 : index.back().offset;
+  std::uint64_t total = index.empty() ? 0 : index.back().ordinal;
+  while (parseRecord(log.data(), log.size(), offset, nullptr)) {
+    ++total;
+  }
+  std::uint64_t first = total > count ? total - count : 0;
+
+  // Ближайшая точка индекса не дальше первой нужной записи.
+  offset = 0;
+  std::uint64_t ordinal = 0;
+  for (const indexEntry &entry : index) {
+    if (entry.ordinal > first) {
+      break;
+    }
+    offset = entry.offset;
+    ordinal = entry.ordinal;
+  }
+
+  std::vector<historyRecord> segment_records;
+  historyRecord record;
+  while (parseRecord(log.data(), log.size(), offset,
+                     ordinal >= first ? &record : nullptr)) {
+    if (ordinal >= first) {
+      segment_records.push_back(std::move(record));
+    }
+    ++ordinal;
+  }
+  records.insert(records.begin(),
+                 std::make_move_iterator(segment_records.begin()),
+                 std::make_move_iterator(segment_records.end()));
+}
+
+void historyStore::seekSegment(const std::vector<indexEntry> &index,
+                               std::uint64_t log_size, std::uint64_t ordinal,
+                               std::uint64_t &offset, std::uint64_t &found) {
+  auto it = std::partition_point(
+      index.begin(), index.end(), [&](const indexEntry &entry) {
+        return entry.ordinal <= ordinal && entry.offset < log_size;
+      });
+  offset = it == index.begin() ? 0 : std::prev(it)->offset;
+  found = it == index.begin() ? 0 : std::prev(it)->ordinal;
+}
+
+std::vector<std::uint64_t>
+historyStore::segmentStarts(const std::vector<unsigned> &segments) const {
+  std::map<unsigned, std::uint64_t> known = readStarts();
+  std::vector<std::uint64_t> starts(1, 0);
+  if (!segments.empty() && known.count(segments.front())) {
+    starts[0] = known[segments.front()];
+  }
+  for (std::size_t i = 0; i < segments.size(); ++i) {
+    auto next = i + 1 < segments.size() ? known.find(segments[i + 1])
+                                        : known.end();
+    starts.push_back(next != known.end()
+                         ? next->second
+                         : starts.back() + segmentRecords(segments[i]));
+  }
+  return starts;
+}
+
+void historyStore::forEachRecord(
+    std::uint64_t first,
+    const std::function<void(std::uint64_t, const historyRecord &)> &visit)
+    const {
+  std::vector<unsigned> segments = listSegments();
+  std::vector<std::uint64_t> starts = segmentStarts(segments);
+  for (std::size_t i = 0; i < segments.size(); ++i) {
+    if (starts[i + 1] < first) {
+      continue;
+    }
+    mappedFile log(segmentPath(segments[i], ".log"));
+    std::uint64_t wanted = first > starts[i] + 1 ? first - 1 - starts[i] : 0;
+    std::uint64_t offset;
+    std::uint64_t ordinal;
+    seekSegment(readIndex(segments[i]), log.size(), wanted, offset, ordinal);
+    historyRecord record;
+    while (parseRecord(log.data(), log.size(), offset,
+                       ordinal >= wanted ? &record : nullptr)) {
+      if (ordinal >= wanted) {
+        visit(starts[i] + ordinal + 1, record);
+      }
+      ++ordinal;
+    }
+  }
+}
+
+std::vector<historyRecord>
+historyStore::readRecords(const std::vector<std::uint64_t> &ordinals) const {
+  std::vector<historyRecord> records;
+  if (ordinals.empty()) {
+    return records;
+  }
+  std::vector<unsigned> segments = listSegments();
+  std::vector<std::uint64_t> starts = segmentStarts(segments);
+  std::unique_ptr<mappedFile> log;
+  std::vector<indexEntry> index;
+  std::size_t current = segments.size();
+  std::uint64_t offset = 0;
+  std::uint64_t ordinal = 0;
+  for (std::uint64_t wanted : ordinals) {
+    std::size_t i =
+        std::upper_bound(starts.begin(), starts.end(), wanted - 1) -
+        starts.begin() - 1;
+    if (wanted == 0 || i >= segments.size()) {
+      continue;
+    }
+    std::uint64_t local = wanted - 1 - starts[i];
+    if (i != current) {
+      log.reset(new mappedFile(segmentPath(segments[i], ".log")));
+      index = readIndex(segments[i]);
+      current = i;
+      ordinal = local + 1;
+    }
+    // Соседние номера дочитываются от прежней позиции, дальние — от
+    // ближайшей точки разреженного индекса.
+    if (ordinal > local || local - ordinal > config_.index_interval) {
+      seekSegment(index, log->size(), local, offset, ordinal);
+    }
+    while (ordinal < local &&
+           parseRecord(log->data(), log->size(), offset, nullptr)) {
+      ++ordinal;
+    }
+    historyRecord record;
+    if (ordinal == local &&
+        parseRecord(log->data(), log->size(), offset, &record)) {
+      records.push_back(std::move(record));
+      ++ordinal;
+    }
+  }
+  return records;
+}
+
+std::string historyStore::startsPath() const {
+  return directory() + "/segments.idx";
+}
+
+std::map<unsigned, std::uint64_t> historyStore::readStarts() const {
+  std::map<unsigned, std::uint64_t> starts;
+  mappedFile file(startsPath());
+  for (std::size_t n = 0; n < file.size() / sizeof(segmentStart); ++n) {
+    segmentStart entry;
+    std::memcpy(&entry, file.data() + n * sizeof(entry), sizeof(entry));
+    starts[static_cast<unsigned>(entry.segment)] = entry.start;
+  }
+  return starts;
+}
+
+void historyStore::saveStart(unsigned segment, std::uint64_t start) const {
+  int fd = ::open(startsPath().c_str(), O_WRONLY | O_APPEND | O_CREAT, 0644);
+  if (fd < 0) {
+    throw std::runtime_error("Не удалось открыть " + startsPath());
+  }
+  segmentStart entry{segment, start};
+  try {
+    writeAll(fd, std::string(reinterpret_cast<const char *>(&entry),
+                             sizeof(entry)));
+  } catch (...) {
+    ::close(fd);
+    throw;
+  }
+  ::close(fd);
+}
+
+std::string historyStore::searchPath() const {
+  return directory() + "/search.idx";
+}
+
+void historyStore::loadSearch() {
+  // Пока индекс не готов, поиск к нему не обращается, поэтому он
+  // заполняется без search_mutex_.
+  {
+    mappedFile checkpoint(searchPath());
+    if (checkpoint.size() &&
+        !search_.deserialize(checkpoint.data(), checkpoint.size())) {
+      log("Индекс поиска повреждён и строится заново: " + searchPath(),
+          logLevel::warning);
+    }
+  }
+  search_saved_ = search_.size();
+  catchUpSearch();
+  std::lock_guard<std::mutex> lock(search_mutex_);
+  search_ready_ = true;
+}
+
+void historyStore::catchUpSearch() {
+  std::vector<unsigned> segments = listSegments();
+  // Размер запоминается до чтения: дописанное позже дочитается в
+  // следующий раз.
+  search_segment_ = segments.empty() ? 0 : segments.back();
+  search_log_size_ = fileSize(segmentPath(search_segment_, ".log"));
+  if (search_.size() > segmentStarts(segments).back()) {
+    // История короче индекса: её удалили или заменили.
+    std::lock_guard<std::mutex> lock(search_mutex_);
+    search_.clear();
+    search_saved_ = 0;
+  }
+  std::uint64_t first = search_.size() + 1;
+  if (!search_ready_) {
+    forEachRecord(first,
+                  [this](std::uint64_t ordinal, const historyRecord &record) {
+                    search_.add(ordinal, record.timestamp_ms, record.text);
+                  });
+    return;
+  }
+  std::vector<historyRecord> fresh;
+  forEachRecord(first, [&fresh](std::uint64_t, const historyRecord &record) {
+    fresh.push_back(record);
+  });
+  std::lock_guard<std::mutex> lock(search_mutex_);
+  for (const historyRecord &record : fresh) {
+    search_.add(first++, record.timestamp_ms, record.text);
+  }
+}
+
+bool historyStore::segmentsGrown() const {
+  return fileSize(segmentPath(search_segment_, ".log")) !=
+             search_log_size_ ||
+         ::access(segmentPath(search_segment_ + 1, ".log").c_str(), F_OK) ==
+             0;
+}
+
+void historyStore::saveSearch() {
+  std::string path = searchPath();
+  std::string temporary = path + ".tmp";
+  int fd = ::open(temporary.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+  if (fd < 0) {
+    log("Не удалось записать индекс поиска: " + path, logLevel::error);
+    return;
+  }
+  try {
+    writeAll(fd, search_.serialize());
+  } catch (std::exception &e) {
+    ::close(fd);
+    log(e.what(), logLevel::error);
+    return;
+  }
+  ::close(fd);
+  if (std::rename(temporary.c_str(), path.c_str()) != 0) {
+    log("Не удалось записать индекс поиска: " + path, logLevel::error);
+    return;
+  }
+  search_saved_ = search_.size();
+}
+
+void historyStore::openForAppend() {
+  makeDirectories(directory());
+  std::vector<unsigned> segments = listSegments();
+  unsigned segment = segments.empty() ? 0 : segments.back();
+  std::vector<std::uint64_t> starts = segmentStarts(segments);
+  if (segments.empty()) {
+    // Пары от удалённой истории не должны достаться новой.
+    ::unlink(startsPath().c_str());
+  } else {
+    // История прежней версии (или сбой до записи пары): недостающие
+    // пары дописываются, чтобы больше не пересчитывать сегменты.
+    std::map<unsigned, std::uint64_t> known = readStarts();
+    for (std::size_t i = 1; i < segments.size(); ++i) {
+      if (!known.count(segments[i])) {
+        saveStart(segments[i], starts[i]);
+      }
+    }
+  }
+  openSegment(segment);
+  segment_start_ = segments.empty() ? 0 : starts[segments.size() - 1];
+
+  // Отсекаем недописанную после сбоя запись и ссылки индекса на неё.
+  std::vector<indexEntry> index = readIndex(segment);
+  std::uint64_t valid_end = 0;
+  std::uint64_t total = 0;
+  {
+    mappedFile log(segmentPath(segment, ".log"));
+    while (!index.empty() && index.back().offset >= log.size()) {
+      index.pop_back();
+    }
+    std::uint64_t offset = index.empty() ? 0 : index.back().offset;
+    total = index.empty() ? 0 : index.back().ordinal;
+    while (parseRecord(log.data(), log.size(), offset, nullptr)) {
+      ++total;
+    }
+    valid_end = offset;
+  }
+  if (::ftruncate(log_fd_, static_cast<off_t>(valid_end)) != 0 ||
+      ::ftruncate(index_fd_,
+                  static_cast<off_t>(index.size() * sizeof(indexEntry))) !=
+          0) {
+    throw std::runtime_error("Не удалось восстановить сегмент истории.");
+  }
+  segment_size_ = valid_end;
+  segment_records_ = total;
+  open_ = true;
+}
+
+void historyStore::openSegment(unsigned segment) {
+  closeSegment();
+  log_fd_ = ::open(segmentPath(segment, ".log").c_str(),
+                   O_WRONLY | O_APPEND | O_CREAT, 0644);
+  index_fd_ = ::open(segmentPath(segment, ".idx").c_str(),
+                     O_WRONLY | O_APPEND | O_CREAT, 0644);
+  if (log_fd_ < 0 || index_fd_ < 0) {
+    throw std::runtime_error("Не удалось открыть сегмент истории: " +
+                             segmentPath(segment, ".log"));
+  }
+  segment_ = segment;
+  segment_size_ = 0;
+  segment_records_ = 0;
+}
+
+void historyStore::closeSegment() {
+  if (log_fd_ >= 0) {
+    ::close(log_fd_);
+    log_fd_ = -1;
+  }
+  if (index_fd_ >= 0) {
+    ::close(index_fd_);
+    index_fd_ = -1;
+  }
+}
+
+std::shared_ptr<historyStore> openHistoryStore(const historyConfig &config,
+                                               const std::string &name) {
+  return storeRegistry::instance().open(config, name);
+}
+
+void startHistoryCommitter(unsigned commit_ms) {
+  historyCommitter::instance().start(commit_ms);
+}
+
+void stopHistoryCommitter() { historyCommitter::instance().stop(); }
+
+historyConfig parseHistoryConfig(const nlohmann::json &config) {
+  historyConfig history;
+  history.dir = config.value("history_dir", history.dir);
+  history.segment_bytes =
+      config.value("history_segment_bytes", history.segment_bytes);
+  history.index_interval =
+      config.value("history_index_interval", history.index_interval);
+  history.commit_ms = config.value("history_commit_ms", history.commit_ms);
+  std::string fsync = config.value("history_fsync", std::string("none"));
+  if (fsync == "none") {
+    history.fsync = fsyncPolicy::none;
+  } else if (fsync == "interval") {
+    history.fsync = fsyncPolicy::interval;
+  } else if (fsync == "batch") {
+    history.fsync = fsyncPolicy::batch;
+  } else {
+    throw std::runtime_error("Неизвестная политика fsync: " + fsync);
+  }
+  history.fsync_ms = config.value("history_fsync_ms", history.fsync_ms);
+  history.search = config.value("search_index", history.search);
+  history.search_checkpoint =
+      config.value("search_checkpoint", history.search_checkpoint);
+  history.search_results =
+      config.value("search_results", history.search_results);
+  return history;
+}
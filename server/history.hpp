@@ -0,0 +1,351 @@
+#ifndef HISTORY_HPP
+#define HISTORY_HPP
+
+#include "search.hpp"
+#include <chrono>
+#include <cstdint>
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <nlohmann/json.hpp>
+#include <string>
+#include <vector>
+
+/**
+ * @brief Политика fsync истории.
+ */
+enum class fsyncPolicy { none, interval, batch };
+
+/**
+ * @struct historyConfig
+ * @brief Параметры хранилища истории.
+ */
+struct historyConfig {
+  /// Каталог с сегментами истории.
+  std::string dir = "history";
+  /// Размер сегмента, после которого начинается новый файл.
+  std::uint64_t segment_bytes = 4 * 1024 * 1024;
+  /// Каждая N-я запись сегмента попадает в разреженный индекс.
+  std::uint64_t index_interval = 64;
+  /// Период групповой записи накопленных сообщений, мс.
+  unsigned commit_ms = 10;
+  /// Когда вызывать fdatasync.
+  fsyncPolicy fsync = fsyncPolicy::none;
+  /// Период fdatasync для политики interval, мс.
+  unsigned fsync_ms = 1000;
+  /// Вести обратный индекс для поиска по истории.
+  bool search = true;
+  /// Не чаще чем через столько сообщений пишется контрольная точка индекса.
+  std::uint64_t search_checkpoint = 10000;
+  /// Сколько последних совпадений возвращает поиск.
+  std::size_t search_results = 20;
+};
+
+/**
+ * @struct historyRecord
+ * @brief Сообщение, прочитанное из истории.
+ */
+struct historyRecord {
+  std::uint64_t timestamp_ms;
+  std::string text;
+};
+
+/**
+ * @class historyStore
+ * @brief Хранилище истории комнаты: только дописывание в сегменты
+ * фиксированного размера.
+ *
+ * Сегменты комнаты лежат в собственном каталоге `<dir>/<name>/`. Файл
+ * сегмента `<номер>.log` состоит из записей [длина u32][время u64][текст],
+ * рядом лежит разреженный индекс `<номер>.idx` с записями [смещение, время,
+ * порядковый номер]. В `segments.idx` при открытии каждого следующего
+ * сегмента дописывается пара [номер сегмента, записей перед ним], так что
+ * для подсчёта записей читается только хвост последнего сегмента.
+ * Сообщения накапливаются в памяти и записываются группой одним вызовом
+ * write(2) фоновым потоком (см. startHistoryCommitter) либо сразу, если он
+ * не запущен. При запуске читается только хвост последних сегментов через
+ * mmap.
+ *
+ * Обратный индекс для поиска (см. searchIndex) пополняется при групповой
+ * записи, то есть тем же фоновым потоком. Его контрольная точка лежит
+ * рядом с сегментами в `search.idx` и переписывается целиком, когда после
+ * предыдущей добавилось не меньше search_checkpoint сообщений и не меньше
+ * четверти индекса, так что запись обходится в O(1) на сообщение. Индекс
+ * читается из контрольной точки и дополняется сообщениями из сегментов,
+ * записанными после неё, тоже фоновым потоком (см. refresh), так что поиск
+ * не читает сегменты целиком и не ждёт fdatasync. Поиск видит сообщения,
+ * уже записанные группой; пока индекс загружается, он не готов.
+ */
+class historyStore {
+public:
+  /**
+   * @brief Конструктор хранилища.
+   * @param config Параметры хранилища.
+   * @param name Имя комнаты (подкаталог сегментов, может содержать '/').
+   */
+  historyStore(const historyConfig &config, const std::string &name);
+  ~historyStore();
+
+  historyStore(const historyStore &) = delete;
+  historyStore &operator=(const historyStore &) = delete;
+
+  /**
+   * @brief Добавление сообщения в очередь групповой записи.
+   * @param timestamp_ms Время сообщения, мс с начала эпохи.
+   * @param text Текст сообщения.
+   */
+  void append(std::uint64_t timestamp_ms, std::string text);
+
+  /**
+   * @brief Запись накопленных сообщений на диск. При ошибке записи
+   * незаписанные сообщения возвращаются в начало очереди, а исключение
+   * передаётся дальше.
+   */
+  void flush();
+
+  /**
+   * @brief Групповая запись и обслуживание индекса поиска: загрузка
+   * контрольной точки, а у хранилища, которое само не пишет, —
+   * дочитывание новых записей сегментов.
+   * Вызывается фоновым потоком, а если он не запущен — при записи и
+   * поиске.
+   */
+  void refresh();
+
+  /**
+   * @brief Чтение последних сообщений.
+   * @param count Сколько сообщений прочитать.
+   * @return Сообщения в порядке записи.
+   */
+  std::vector<historyRecord> tail(std::size_t count);
+
+  /**
+   * @brief Число записей во всех сегментах (с учётом ещё не записанных).
+   * Запись номер N (с единицы) — N-е сообщение комнаты. Целиком
+   * пересчитываются только сегменты, которых нет в `segments.idx`
+   * (история прежней версии).
+   * @return Число записей.
+   */
+  std::uint64_t size();
+
+  /**
+   * @brief Включён ли поиск по истории.
+   * @return true, если индекс ведётся.
+   */
+  bool searchable() const;
+
+  /**
+   * @brief Загружен ли индекс поиска.
+   * @return true, если поиск включён и индекс готов.
+   */
+  bool searchReady();
+
+  /**
+   * @brief Поиск по истории.
+   *
+   * Хранилище, которое само не пишет историю (её пишет другой процесс),
+   * дочитывает в индекс новые записи сегментов в refresh(). Реплики
+   * комнаты на шардах одного процесса делят хранилище (см.
+   * openHistoryStore).
+   * @param query Запрос.
+   * @return Не больше search_results последних совпадений в порядке
+   * записи (пусто, если индекс ещё не готов).
+   */
+  std::vector<historyRecord> search(const searchQuery &query);
+
+private:
+  struct indexEntry {
+    std::uint64_t offset;
+    std::uint64_t timestamp_ms;
+    std::uint64_t ordinal;
+  };
+
+  struct segmentStart {
+    std::uint64_t segment;
+    std::uint64_t start;
+  };
+
+  std::string directory() const;
+  std::string segmentPath(unsigned segment, const char *extension) const;
+  std::vector<unsigned> listSegments() const;
+  std::vector<indexEntry> readIndex(unsigned segment) const;
+
+  /**
+   * @brief Число целых записей сегмента: от последней точки индекса
+   * дочитываются только записи хвоста.
+   * @param segment Номер сегмента.
+   * @return Число записей.
+   */
+  std::uint64_t segmentRecords(unsigned segment) const;
+
+  /**
+   * @brief Последние count записей сегмента.
+   * @param segment Номер сегмента.
+   * @param count Сколько записей нужно.
+   * @param records Записи в порядке записи.
+   */
+  void readSegmentTail(unsigned segment, std::size_t count,
+                       std::vector<historyRecord> &records) const;
+
+  /**
+   * @brief Ближайшая к записи точка разреженного индекса сегмента.
+   * @param index Разреженный индекс сегмента.
+   * @param log_size Размер файла сегмента.
+   * @param ordinal Номер записи в сегменте (с нуля).
+   * @param offset Смещение точки (0, если подходящей нет).
+   * @param found Номер записи в точке.
+   */
+  static void seekSegment(const std::vector<indexEntry> &index,
+                          std::uint64_t log_size, std::uint64_t ordinal,
+                          std::uint64_t &offset, std::uint64_t &found);
+
+  /**
+   * @brief Число записей перед каждым сегментом: из `segments.idx`, а
+   * для сегментов, которых там нет, — подсчётом записей предыдущего.
+   * @param segments Номера сегментов по возрастанию.
+   * @return segments.size() + 1 чисел; последнее — всего записей.
+   */
+  std::vector<std::uint64_t>
+  segmentStarts(const std::vector<unsigned> &segments) const;
+
+  /**
+   * @brief Обход записей начиная с заданного номера.
+   * @param first Номер первой записи (с единицы).
+   * @param visit Вызывается для каждой записи с её номером.
+   */
+  void forEachRecord(
+      std::uint64_t first,
+      const std::function<void(std::uint64_t, const historyRecord &)> &visit)
+      const;
+
+  /**
+   * @brief Чтение записей по номерам.
+   * @param ordinals Номера по возрастанию.
+   * @return Записи в том же порядке.
+   */
+  std::vector<historyRecord>
+  readRecords(const std::vector<std::uint64_t> &ordinals) const;
+
+  std::string startsPath() const;
+  /**
+   * @brief Чтение `segments.idx`; при повторах верна последняя пара.
+   * @return Число записей перед сегментом по его номеру.
+   */
+  std::map<unsigned, std::uint64_t> readStarts() const;
+  /**
+   * @brief Запись в `segments.idx` числа записей перед сегментом.
+   * @param segment Номер сегмента.
+   * @param start Число записей во всех предыдущих сегментах.
+   */
+  void saveStart(unsigned segment, std::uint64_t start) const;
+
+  std::string searchPath() const;
+  /**
+   * @brief Загрузка контрольной точки индекса и дочитывание записей после
+   * неё.
+   */
+  void loadSearch();
+  /**
+   * @brief Добавление в индекс записей сегментов, которых в нём ещё нет.
+   * Записи читаются без search_mutex_ и добавляются одной пачкой.
+   */
+  void catchUpSearch();
+  /**
+   * @brief Изменились ли сегменты после прошлого дочитывания индекса.
+   * @return true, если последний сегмент вырос или появился следующий.
+   */
+  bool segmentsGrown() const;
+  /**
+   * @brief Запись контрольной точки индекса (через временный файл).
+   */
+  void saveSearch();
+
+  /**
+   * @brief Открытие последнего сегмента на дописывание и отсечение
+   * недописанного хвоста после сбоя.
+   */
+  void openForAppend();
+  /**
+   * @brief Дописывание части пачки в открытый сегмент. Счётчики сегмента
+   * меняются только после записи данных и индекса; при ошибке оба файла
+   * обрезаются до прежнего размера.
+   * @param data Записи.
+   * @param index Точки разреженного индекса для них.
+   * @param size Размер сегмента после записи.
+   * @param records Число записей сегмента после записи.
+   */
+  void writeSegment(const std::string &data, const std::string &index,
+                    std::uint64_t size, std::uint64_t records);
+  /**
+   * @brief Добавление записанных сообщений в индекс поиска.
+   * @param records Сообщения.
+   * @param indexed Число сообщений в индексе до них.
+   */
+  void indexRecords(const std::vector<historyRecord> &records,
+                    std::uint64_t indexed);
+  void openSegment(unsigned segment);
+  void closeSegment();
+
+  historyConfig config_;
+  std::string name_;
+
+  std::mutex pending_mutex_;
+  std::vector<historyRecord> pending_;
+
+  std::mutex io_mutex_;
+  bool open_;
+  int log_fd_;
+  int index_fd_;
+  unsigned segment_;
+  std::uint64_t segment_size_;
+  std::uint64_t segment_records_;
+  /// Число записей во всех сегментах перед открытым.
+  std::uint64_t segment_start_;
+  std::chrono::steady_clock::time_point last_sync_;
+
+  /// Индекс меняется только под io_mutex_ и search_mutex_, поиск читает
+  /// его под search_mutex_.
+  std::mutex search_mutex_;
+  searchIndex search_;
+  bool search_ready_;
+  /// Сколько сообщений покрывает контрольная точка на диске.
+  std::uint64_t search_saved_;
+  /// Последний сегмент и его размер при прошлом дочитывании индекса.
+  unsigned search_segment_;
+  std::uint64_t search_log_size_;
+};
+
+/**
+ * @brief Хранилище истории комнаты.
+ *
+ * Комнату могут удалить и сразу создать заново, пока прежний объект ещё
+ * жив. Тогда возвращается он же, а если он уже разрушается — функция ждёт,
+ * пока он допишет и закроет сегменты. Так в каталог комнаты всегда пишет
+ * одно хранилище и номера сообщений не повторяются.
+ * @param config Параметры хранилища.
+ * @param name Имя комнаты.
+ * @return Хранилище.
+ */
+std::shared_ptr<historyStore> openHistoryStore(const historyConfig &config,
+                                               const std::string &name);
+
+/**
+ * @brief Запуск фонового потока групповой записи истории.
+ * @param commit_ms Период записи, мс.
+ */
+void startHistoryCommitter(unsigned commit_ms);
+
+/**
+ * @brief Остановка фонового потока групповой записи истории.
+ */
+void stopHistoryCommitter();
+
+/**
+ * @brief Чтение параметров истории из конфигурации.
+ * @param config Конфигурация сервера.
+ * @return Параметры истории (отсутствующие ключи берутся по умолчанию).
+ */
+historyConfig parseHistoryConfig(const nlohmann::json &config);
+
+#endif // HISTORY_HPP
@@ -0,0 +1,222 @@
+#include "logger.hpp"
+#include "timestamp.hpp"
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <cstring>
+#include <fcntl.h>
+#include <fstream>
+#include <stdexcept>
+#include <unistd.h>
+
+logger::logger()
+    : mask_(0), enqueue_pos_(0), dequeue_pos_(0), running_(false),
+      level_(static_cast<int>(logLevel::info)), fd_(-1), pushed_(0),
+      dropped_(0), written_(0), batches_(0) {}
+
+logger::~logger() { stop(); }
+
+logger &logger::instance() {
+  static logger global;
+  return global;
+}
+
+void logger::start(const logConfig &config) {
+  stop();
+  config_ = config;
+
+  std::size_t size = 1;
+  while (size < std::max<std::size_t>(config_.ring_size, 2)) {
+    size <<= 1;
+  }
+  slots_.reset(new slot[size]);
+  for (std::size_t i = 0; i < size; ++i) {
+    slots_[i].sequence.store(i, std::memory_order_relaxed);
+  }
+  mask_ = size - 1;
+  enqueue_pos_.store(0, std::memory_order_relaxed);
+  dequeue_pos_ = 0;
+
+  fd_ = ::open(config_.file.c_str(), O_WRONLY | O_APPEND | O_CREAT, 0644);
+  if (fd_ < 0) {
+    throw std::runtime_error("Не удалось открыть файл журнала: " +
+                             config_.file);
+  }
+  level_.store(static_cast<int>(config_.level), std::memory_order_relaxed);
+  running_.store(true, std::memory_order_release);
+  writer_ = std::thread(&logger::writerLoop, this);
+}
+
+void logger::stop() {
+  if (!running_.exchange(false)) {
+    return;
+  }
+  writer_.join();
+  std::string batch;
+  drain(batch);
+  flush(batch);
+  ::close(fd_);
+  fd_ = -1;
+}
+
+bool logger::running() const {
+  return running_.load(std::memory_order_acquire);
+}
+
+bool logger::enabled(logLevel level) const {
+  return static_cast<int>(level) >= level_.load(std::memory_order_relaxed);
+}
+
+bool logger::push(const char *prefix, std::size_t prefix_length,
+                  const std::string &message) {
+  for (unsigned attempt = 0;; ++attempt) {
+    if (tryPush(prefix, prefix_length, message)) {
+      pushed_.fetch_add(1, std::memory_order_relaxed);
+      return true;
+    }
+    if (attempt >= config_.overflow_spins) {
+      break;
+    }
+    std::this_thread::yield();
+  }
+  dropped_.fetch_add(1, std::memory_order_relaxed);
+  return false;
+}
+
+logStats logger::stats() const {
+  logStats stats;
+  stats.pushed = pushed_.load(std::memory_order_relaxed);
+  stats.dropped = dropped_.load(std::memory_order_relaxed);
+  stats.written = written_.load(std::memory_order_relaxed);
+  stats.batches = batches_.load(std::memory_order_relaxed);
+  return stats;
+}
+
+bool logger::tryPush(const char *prefix, std::size_t prefix_length,
+                     const std::string &message) {
+  std::size_t pos = enqueue_pos_.load(std::memory_order_relaxed);
+  slot *cell;
+  for (;;) {
+    cell = &slots_[pos & mask_];
+    std::size_t sequence = cell->sequence.load(std::memory_order_acquire);
+    std::intptr_t diff =
+        static_cast<std::intptr_t>(sequence) - static_cast<std::intptr_t>(pos);
+    if (diff == 0) {
+      if (enqueue_pos_.compare_exchange_weak(pos, pos + 1,
+                                             std::memory_order_relaxed)) {
+        break;
+      }
+    } else if (diff < 0) {
+      return false;
+    } else {
+      pos = enqueue_pos_.load(std::memory_order_relaxed);
+    }
+  }
+
+  // Последний байт ячейки оставляем под перевод строки.
+  std::size_t capacity = LOG_LINE_SIZE - 1;
+  std::size_t ts_length = std::min(prefix_length, capacity);
+  std::size_t msg_length = std::min(message.size(), capacity - ts_length);
+  std::memcpy(cell->text.data(), prefix, ts_length);
+  std::memcpy(cell->text.data() + ts_length, message.data(), msg_length);
+  cell->text[ts_length + msg_length] = '\n';
+  cell->length = ts_length + msg_length + 1;
+  cell->sequence.store(pos + 1, std::memory_order_release);
+  return true;
+}
+
+std::size_t logger::drain(std::string &batch) {
+  std::size_t count = 0;
+  for (;;) {
+    slot &cell = slots_[dequeue_pos_ & mask_];
+    if (cell.sequence.load(std::memory_order_acquire) != dequeue_pos_ + 1) {
+      break;
+    }
+    batch.append(cell.text.data(), cell.length);
+    cell.sequence.store(dequeue_pos_ + mask_ + 1, std::memory_order_release);
+    ++dequeue_pos_;
+    ++count;
+  }
+  written_.fetch_add(count, std::memory_order_relaxed);
+  return count;
+}
+
+void logger::flush(std::string &batch) {
+  std::size_t offset = 0;
+  while (offset < batch.size()) {
+    ssize_t n = ::write(fd_, batch.data() + offset, batch.size() - offset);
+    if (n < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      break;
+    }
+    offset += static_cast<std::size_t>(n);
+  }
+  if (!batch.empty()) {
+    batches_.fetch_add(1, std::memory_order_relaxed);
+  }
+  batch.clear();
+}
+
+void logger::writerLoop() {
+  std::string batch;
+  batch.reserve(64 * 1024);
+  std::uint64_t reported_drops = 0;
+  while (running_.load(std::memory_order_acquire)) {
+    std::size_t count = drain(batch);
+
+    std::uint64_t drops = dropped_.load(std::memory_order_relaxed);
+    if (drops != reported_drops) {
+      batch += getTimestamp() + "Журнал переполнен, отброшено строк: " +
+               std::to_string(drops - reported_drops) + "\n";
+      reported_drops = drops;
+    }
+    flush(batch);
+
+    // При большой нагрузке забираем следующую пачку без паузы.
+    if (count <= mask_ / 2) {
+      std::this_thread::sleep_for(std::chrono::milliseconds(config_.flush_ms));
+    }
+  }
+}
+
+logConfig parseLogConfig(const nlohmann::json &config) {
+  logConfig log_config;
+  log_config.file = config.value("log_file", log_config.file);
+  std::string level = config.value("log_level", std::string("info"));
+  if (level == "debug") {
+    log_config.level = logLevel::debug;
+  } else if (level == "info") {
+    log_config.level = logLevel::info;
+  } else if (level == "warning") {
+    log_config.level = logLevel::warning;
+  } else if (level == "error") {
+    log_config.level = logLevel::error;
+  } else {
+    throw std::runtime_error("Неизвестный уровень журнала: " + level);
+  }
+  log_config.ring_size = config.value("log_ring_size", log_config.ring_size);
+  log_config.flush_ms = config.value("log_flush_ms", log_config.flush_ms);
+  log_config.overflow_spins =
+      config.value("log_overflow_spins", log_config.overflow_spins);
+  return log_config;
+}
+
+std::string getTimestamp() {
+  return std::string(cachedTimestamp(), TIMESTAMP_SIZE);
+}
+
+void log(const std::string &message, logLevel level) {
+  logger &global = logger::instance();
+  if (global.running()) {
+    if (global.enabled(level)) {
+      global.push(cachedTimestamp(), TIMESTAMP_SIZE, message);
+    }
+    return;
+  }
+  std::ofstream log_file("server.log", std::ios::app);
+  if (log_file.is_open()) {
+    log_file << cachedTimestamp() << message << std::endl;
+  }
+}
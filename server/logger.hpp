@@ -0,0 +1,186 @@
+#ifndef LOGGER_HPP
+#define LOGGER_HPP
+
+#include <array>
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <nlohmann/json.hpp>
+#include <string>
+#include <thread>
+
+/// Максимальная длина строки журнала (длинные строки обрезаются).
+constexpr std::size_t LOG_LINE_SIZE = 512;
+
+/**
+ * @brief Уровни журнала.
+ */
+enum class logLevel { debug = 0, info = 1, warning = 2, error = 3 };
+
+/**
+ * @struct logConfig
+ * @brief Параметры журнала сервера.
+ */
+struct logConfig {
+  /// Файл журнала.
+  std::string file = "server.log";
+  /// Строки ниже этого уровня отбрасываются сразу.
+  logLevel level = logLevel::info;
+  /// Ёмкость кольцевого буфера (округляется вверх до степени двойки).
+  std::size_t ring_size = 8192;
+  /// Период сброса накопленных строк на диск, мс.
+  unsigned flush_ms = 100;
+  /// Число повторных попыток при заполненном буфере перед отбрасыванием
+  /// строки (0 — отбрасывать сразу).
+  unsigned overflow_spins = 0;
+};
+
+/**
+ * @struct logStats
+ * @brief Счётчики журнала.
+ */
+struct logStats {
+  std::uint64_t pushed;
+  std::uint64_t dropped;
+  std::uint64_t written;
+  std::uint64_t batches;
+};
+
+/**
+ * @class logger
+ * @brief Асинхронный журнал.
+ *
+ * Обработчики кладут строки в ограниченное кольцо без блокировок (очередь
+ * многих производителей и одного потребителя), фоновый поток забирает их
+ * пачками и записывает одним вызовом write(2). Если кольцо заполнено,
+ * строка отбрасывается и учитывается в счётчике, поэтому потоки ввода-вывода
+ * никогда не ждут диска.
+ */
+class logger {
+public:
+  logger();
+  ~logger();
+
+  logger(const logger &) = delete;
+  logger &operator=(const logger &) = delete;
+
+  /**
+   * @brief Глобальный журнал сервера.
+   * @return Журнал.
+   */
+  static logger &instance();
+
+  /**
+   * @brief Открытие файла и запуск фонового потока записи.
+   * @param config Параметры журнала.
+   * @throws std::runtime_error Если файл журнала не может быть открыт.
+   */
+  void start(const logConfig &config);
+
+  /**
+   * @brief Запись оставшихся строк и остановка фонового потока.
+   */
+  void stop();
+
+  /**
+   * @brief Проверка, запущен ли журнал.
+   * @return true, если фоновый поток работает.
+   */
+  bool running() const;
+
+  /**
+   * @brief Проверка, пишется ли уровень в журнал.
+   * @param level Уровень.
+   * @return true, если строка этого уровня будет принята.
+   */
+  bool enabled(logLevel level) const;
+
+  /**
+   * @brief Добавление строки в кольцо без блокировки и выделения памяти.
+   * @param prefix Префикс строки (временная метка).
+   * @param prefix_length Длина префикса.
+   * @param message Текст строки.
+   * @return false, если кольцо заполнено и строка отброшена.
+   */
+  bool push(const char *prefix, std::size_t prefix_length,
+            const std::string &message);
+
+  /**
+   * @brief Получение счётчиков журнала.
+   * @return Счётчики.
+   */
+  logStats stats() const;
+
+private:
+  /**
+   * @struct slot
+   * @brief Ячейка кольца с номером поколения (очередь Вьюкова).
+   */
+  struct slot {
+    std::atomic<std::size_t> sequence;
+    std::size_t length;
+    std::array<char, LOG_LINE_SIZE> text;
+  };
+
+  /**
+   * @brief Попытка занять ячейку и записать строку.
+   */
+  bool tryPush(const char *prefix, std::size_t prefix_length,
+               const std::string &message);
+
+  /**
+   * @brief Перенос готовых строк из кольца в буфер пачки.
+   * @param batch Буфер пачки.
+   * @return Число перенесённых строк.
+   */
+  std::size_t drain(std::string &batch);
+
+  /**
+   * @brief Запись буфера пачки в файл.
+   * @param batch Буфер пачки.
+   */
+  void flush(std::string &batch);
+
+  /**
+   * @brief Цикл фонового потока записи.
+   */
+  void writerLoop();
+
+  logConfig config_;
+  std::unique_ptr<slot[]> slots_;
+  std::size_t mask_;
+  alignas(64) std::atomic<std::size_t> enqueue_pos_;
+  alignas(64) std::size_t dequeue_pos_;
+  std::atomic<bool> running_;
+  std::atomic<int> level_;
+  int fd_;
+  std::thread writer_;
+  std::atomic<std::uint64_t> pushed_;
+  std::atomic<std::uint64_t> dropped_;
+  std::atomic<std::uint64_t> written_;
+  std::atomic<std::uint64_t> batches_;
+};
+
+/**
+ * @brief Чтение параметров журнала из конфигурации.
+ * @param config Конфигурация сервера.
+ * @return Параметры журнала (отсутствующие ключи берутся по умолчанию).
+ */
+logConfig parseLogConfig(const nlohmann::json &config);
+
+/**
+ * @brief Получение текущего временного штампа.
+ * @return Временной штамп в виде строки.
+ */
+std::string getTimestamp();
+
+/**
+ * @brief Логирование сообщения в файл.
+ * До запуска глобального журнала (например, в тестах) строка дописывается
+ * в файл синхронно.
+ * @param message Сообщение для логирования.
+ * @param level Уровень сообщения.
+ */
+void log(const std::string &message, logLevel level = logLevel::info);
+
+#endif // LOGGER_HPP
@@ -0,0 +1,48 @@
+#include "memory.hpp"
+
+namespace {
+
+/// Больше блоков кеш не хранит, лишние возвращаются в кучу.
+constexpr std::size_t MAX_CACHED_BLOCKS = 4096;
+
+} // namespace
+
+blockCache &blockCache::instance() {
+  static blockCache global;
+  return global;
+}
+
+blockCache::blockCache() : block_size_(0) {}
+
+blockCache::~blockCache() {
+  for (void *block : free_) {
+    ::operator delete(block);
+  }
+}
+
+void *blockCache::allocate(std::size_t size) {
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (block_size_ == 0) {
+      block_size_ = size;
+      free_.reserve(MAX_CACHED_BLOCKS);
+    }
+    if (size == block_size_ && !free_.empty()) {
+      void *block = free_.back();
+      free_.pop_back();
+      return block;
+    }
+  }
+  return ::operator new(size);
+}
+
+void blockCache::deallocate(void *pointer, std::size_t size) {
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (size == block_size_ && free_.size() < MAX_CACHED_BLOCKS) {
+      free_.push_back(pointer);
+      return;
+    }
+  }
+  ::operator delete(pointer);
+}
@@ -0,0 +1,236 @@
+#ifndef MEMORY_HPP
+#define MEMORY_HPP
+
+#include <atomic>
+#include <boost/asio.hpp>
+#include <cstddef>
+#include <memory>
+#include <mutex>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+/// Размер встроенной памяти для обработчика одной асинхронной операции
+/// (самая крупная — составная пакетная запись вместе с привязкой к
+/// странду, около 530 байт).
+constexpr std::size_t HANDLER_MEMORY_SIZE = 576;
+
+/**
+ * @class handlerMemory
+ * @brief Память для обработчиков одной цепочки асинхронных операций сессии
+ * (чтение, запись, таймер).
+ *
+ * Операции одной цепочки не пересекаются во времени: Asio освобождает
+ * память операции до вызова обработчика, а следующая операция начинается
+ * уже из него. Поэтому одного блока хватает, и в установившемся режиме
+ * обработчики не обращаются к куче. Если блок занят или мал, память
+ * берётся из кучи.
+ *
+ * Флаг занятости атомарный: задачу таймера сессии выделяет поток колеса
+ * таймеров, а освобождает странд сессии.
+ */
+class handlerMemory {
+public:
+  handlerMemory() : in_use_(false) {}
+  handlerMemory(const handlerMemory &) = delete;
+  handlerMemory &operator=(const handlerMemory &) = delete;
+
+  /**
+   * @brief Выделение памяти под операцию.
+   * @param size Размер.
+   * @return Указатель на память.
+   */
+  void *allocate(std::size_t size) {
+    if (size <= sizeof(storage_) &&
+        !in_use_.exchange(true, std::memory_order_acquire)) {
+      return &storage_;
+    }
+    return ::operator new(size);
+  }
+
+  /**
+   * @brief Освобождение памяти операции.
+   * @param pointer Указатель на память.
+   */
+  void deallocate(void *pointer) {
+    if (pointer == &storage_) {
+      in_use_.store(false, std::memory_order_release);
+      return;
+    }
+    ::operator delete(pointer);
+  }
+
+private:
+  typename std::aligned_storage<HANDLER_MEMORY_SIZE>::type storage_;
+  std::atomic<bool> in_use_;
+};
+
+/**
+ * @class handlerAllocator
+ * @brief Аллокатор операций Asio поверх handlerMemory.
+ */
+template <typename T> class handlerAllocator {
+public:
+  typedef T value_type;
+
+  explicit handlerAllocator(handlerMemory &memory) : memory_(&memory) {}
+  template <typename U>
+  handlerAllocator(const handlerAllocator<U> &other) noexcept
+      : memory_(other.memory_) {}
+
+  T *allocate(std::size_t n) {
+    return static_cast<T *>(memory_->allocate(n * sizeof(T)));
+  }
+
+  void deallocate(T *pointer, std::size_t) { memory_->deallocate(pointer); }
+
+  template <typename U>
+  bool operator==(const handlerAllocator<U> &other) const {
+    return memory_ == other.memory_;
+  }
+  template <typename U>
+  bool operator!=(const handlerAllocator<U> &other) const {
+    return memory_ != other.memory_;
+  }
+
+private:
+  template <typename> friend class handlerAllocator;
+
+  handlerMemory *memory_;
+};
+
+/**
+ * @class allocHandler
+ * @brief Обработчик, операции которого размещаются в handlerMemory.
+ *
+ * Память передаётся через associated_allocator, поэтому привязывать
+ * обработчик к странду нужно через boost::asio::bind_executor (снаружи
+ * этой обёртки): привязка передаёт аллокатор и операции ввода-вывода, и
+ * переходу в странд, а strand::wrap его не передаёт.
+ */
+template <typename Handler> class allocHandler {
+public:
+  typedef handlerAllocator<void> allocator_type;
+
+  allocHandler(handlerMemory &memory, Handler handler)
+      : memory_(&memory), handler_(std::move(handler)) {}
+
+  template <typename... Args> void operator()(Args &&...args) {
+    handler_(std::forward<Args>(args)...);
+  }
+
+  allocator_type get_allocator() const noexcept {
+    return allocator_type(*memory_);
+  }
+
+private:
+  handlerMemory *memory_;
+  Handler handler_;
+};
+
+/**
+ * @brief Создание обработчика с памятью сессии.
+ * @param memory Память цепочки операций.
+ * @param handler Обработчик.
+ * @return Обёрнутый обработчик.
+ */
+template <typename Handler>
+allocHandler<Handler> makeAllocHandler(handlerMemory &memory,
+                                       Handler handler) {
+  return allocHandler<Handler>(memory, std::move(handler));
+}
+
+/**
+ * @class bufferView
+ * @brief Последовательность буферов поверх чужого массива.
+ *
+ * async_write хранит копию последовательности буферов до конца записи;
+ * копия std::vector означала бы выделение памяти на каждую запись, а копия
+ * пары указателей бесплатна.
+ */
+class bufferView {
+public:
+  typedef boost::asio::const_buffer value_type;
+  typedef const boost::asio::const_buffer *const_iterator;
+
+  bufferView(const_iterator begin, const_iterator end)
+      : begin_(begin), end_(end) {}
+
+  const_iterator begin() const { return begin_; }
+  const_iterator end() const { return end_; }
+
+private:
+  const_iterator begin_;
+  const_iterator end_;
+};
+
+/**
+ * @class blockCache
+ * @brief Потокобезопасный кеш освобождённых блоков одного размера.
+ *
+ * Нужен для блоков управления shared_ptr сессий из пула: сессия
+ * переиспользуется, а её блок управления создаётся заново при каждом
+ * подключении.
+ */
+class blockCache {
+public:
+  /**
+   * @brief Глобальный кеш.
+   * @return Кеш.
+   */
+  static blockCache &instance();
+
+  ~blockCache();
+
+  /**
+   * @brief Выделение блока.
+   * @param size Размер блока.
+   * @return Указатель на блок.
+   */
+  void *allocate(std::size_t size);
+
+  /**
+   * @brief Возврат блока в кеш.
+   * @param pointer Указатель на блок.
+   * @param size Размер блока.
+   */
+  void deallocate(void *pointer, std::size_t size);
+
+private:
+  blockCache();
+
+  std::mutex mutex_;
+  /// Размер кешируемых блоков (первый запрошенный размер).
+  std::size_t block_size_;
+  std::vector<void *> free_;
+};
+
+/**
+ * @class recyclingAllocator
+ * @brief Аллокатор поверх blockCache (для std::shared_ptr с удалителем).
+ */
+template <typename T> class recyclingAllocator {
+public:
+  typedef T value_type;
+
+  recyclingAllocator() = default;
+  template <typename U>
+  recyclingAllocator(const recyclingAllocator<U> &) noexcept {}
+
+  T *allocate(std::size_t n) {
+    return static_cast<T *>(blockCache::instance().allocate(n * sizeof(T)));
+  }
+
+  void deallocate(T *pointer, std::size_t n) {
+    blockCache::instance().deallocate(pointer, n * sizeof(T));
+  }
+
+  template <typename U> bool operator==(const recyclingAllocator<U> &) const {
+    return true;
+  }
+  template <typename U> bool operator!=(const recyclingAllocator<U> &) const {
+    return false;
+  }
+};
+
+#endif // MEMORY_HPP
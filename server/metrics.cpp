@@ -0,0 +1,255 @@
+#include "metrics.hpp"
+#include "logger.hpp"
+#include <algorithm>
+#include <cstdio>
+#include <fstream>
+
+namespace {
+
+const char *const COUNTER_NAMES[] = {
+    "accepts",      "accept_errors",  "messages_in", "bytes_in",
+    "messages_out", "bytes_out",      "deliveries",  "dropped_oldest",
+    "dropped_newest", "coalesced",    "disconnected", "timeouts",
+    "sessions_closed", "worker_errors", "resumes", "resume_gaps",
+    "reads", "throttled", "room_throttled", "nickname_rejects",
+    "direct_messages", "searches"};
+
+const char *const HISTOGRAM_NAMES[] = {"fanout_size", "fanout_ns",
+                                       "write_queue_depth", "write_ns"};
+
+static_assert(sizeof(COUNTER_NAMES) / sizeof(COUNTER_NAMES[0]) ==
+                  static_cast<unsigned>(metricCounter::count),
+              "Имена счётчиков не совпадают с metricCounter");
+static_assert(sizeof(HISTOGRAM_NAMES) / sizeof(HISTOGRAM_NAMES[0]) ==
+                  static_cast<unsigned>(metricHistogram::count),
+              "Имена гистограмм не совпадают с metricHistogram");
+
+/// Сколько административное подключение может занимать сервер, мс.
+const unsigned ADMIN_SESSION_TIMEOUT_MS = 2000;
+
+/**
+ * @struct adminSession
+ * @brief Подключение к административному порту.
+ *
+ * Клиент, который не читает ответ или не закрывает соединение, не держит
+ * сокет дольше ADMIN_SESSION_TIMEOUT_MS.
+ */
+struct adminSession : std::enable_shared_from_this<adminSession> {
+  explicit adminSession(boost::asio::io_service &io_service)
+      : socket(io_service), strand(io_service), deadline(io_service) {}
+
+  void start() {
+    std::string body = metrics::instance().snapshot().dump(2) + "\n";
+    response = "HTTP/1.0 200 OK\r\nContent-Type: application/json\r\n"
+               "Content-Length: " +
+               std::to_string(body.size()) + "\r\n\r\n" + body;
+    auto self(shared_from_this());
+    deadline.expires_after(
+        std::chrono::milliseconds(ADMIN_SESSION_TIMEOUT_MS));
+    deadline.async_wait(boost::asio::bind_executor(
+        strand, [self](const boost::system::error_code &error) {
+          if (error != boost::asio::error::operation_aborted) {
+            self->finish();
+          }
+        }));
+    boost::asio::async_write(
+        socket, boost::asio::buffer(response),
+        boost::asio::bind_executor(
+            strand,
+            [self](const boost::system::error_code &error, std::size_t) {
+              if (error) {
+                self->finish();
+                return;
+              }
+              // Дочитываем запрос до закрытия соединения клиентом, чтобы
+              // непрочитанные байты не превратили закрытие в RST.
+              boost::system::error_code ignored;
+              self->socket.shutdown(
+                  boost::asio::ip::tcp::socket::shutdown_send, ignored);
+              self->drain();
+            }));
+  }
+
+  void drain() {
+    auto self(shared_from_this());
+    socket.async_read_some(
+        boost::asio::buffer(scratch),
+        boost::asio::bind_executor(
+            strand,
+            [self](const boost::system::error_code &error, std::size_t) {
+              if (error) {
+                self->finish();
+              } else {
+                self->drain();
+              }
+            }));
+  }
+
+  void finish() {
+    boost::system::error_code ignored;
+    deadline.cancel(ignored);
+    socket.close(ignored);
+  }
+
+  boost::asio::ip::tcp::socket socket;
+  boost::asio::io_service::strand strand;
+  boost::asio::steady_timer deadline;
+  std::string response;
+  std::array<char, 1024> scratch;
+};
+
+} // namespace
+
+std::uint64_t histogramBucketLimit(unsigned bucket) {
+  if (bucket < HISTOGRAM_LINEAR) {
+    return bucket;
+  }
+  unsigned exponent = ((bucket - HISTOGRAM_LINEAR) >> HISTOGRAM_SUB_BITS) + 4;
+  std::uint64_t sub = (bucket - HISTOGRAM_LINEAR) &
+                      ((1u << HISTOGRAM_SUB_BITS) - 1);
+  unsigned shift = exponent - HISTOGRAM_SUB_BITS;
+  std::uint64_t lower = (std::uint64_t(1 << HISTOGRAM_SUB_BITS) + sub)
+                        << shift;
+  return lower + ((std::uint64_t(1) << shift) - 1);
+}
+
+threadMetrics::threadMetrics() {
+  for (auto &counter : counters) {
+    counter.store(0, std::memory_order_relaxed);
+  }
+  for (auto &h : histograms) {
+    for (auto &bucket : h.buckets) {
+      bucket.store(0, std::memory_order_relaxed);
+    }
+    h.sum.store(0, std::memory_order_relaxed);
+    h.max.store(0, std::memory_order_relaxed);
+  }
+}
+
+metrics::metrics() : started_(std::chrono::steady_clock::now()) {}
+
+metrics &metrics::instance() {
+  static metrics global;
+  return global;
+}
+
+threadMetrics *metrics::registerThread() {
+  // Метрики завершившихся потоков остаются в реестре, чтобы их вклад не
+  // пропадал из сумм.
+  std::lock_guard<std::mutex> lock(mutex_);
+  threads_.emplace_back(new threadMetrics());
+  return threads_.back().get();
+}
+
+std::uint64_t metrics::total(metricCounter counter) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  std::uint64_t sum = 0;
+  for (auto &thread : threads_) {
+    sum += thread->counters[static_cast<unsigned>(counter)].load(
+        std::memory_order_relaxed);
+  }
+  return sum;
+}
+
+nlohmann::json metrics::snapshot() {
+  std::lock_guard<std::mutex> lock(mutex_);
+  nlohmann::json result;
+  result["uptime_s"] = std::chrono::duration<double>(
+                           std::chrono::steady_clock::now() - started_)
+                           .count();
+  result["threads"] = threads_.size();
+  result["io_backend"] = ioBackend();
+
+  nlohmann::json counters = nlohmann::json::object();
+  for (unsigned c = 0; c < static_cast<unsigned>(metricCounter::count); ++c) {
+    std::uint64_t sum = 0;
+    for (auto &thread : threads_) {
+      sum += thread->counters[c].load(std::memory_order_relaxed);
+    }
+    counters[COUNTER_NAMES[c]] = sum;
+  }
+  result["counters"] = counters;
+
+  nlohmann::json histograms = nlohmann::json::object();
+  for (unsigned h = 0; h < static_cast<unsigned>(metricHistogram::count);
+       ++h) {
+    std::vector<std::uint64_t> buckets(HISTOGRAM_BUCKETS, 0);
+    std::uint64_t count = 0;
+    std::uint64_t sum = 0;
+    std::uint64_t max = 0;
+    for (auto &thread : threads_) {
+      const threadMetrics::histogram &source = thread->histograms[h];
+      for (unsigned b = 0; b < HISTOGRAM_BUCKETS; ++b) {
+        std::uint64_t n = source.buckets[b].load(std::memory_order_relaxed);
+        buckets[b] += n;
+        count += n;
+      }
+      sum += source.sum.load(std::memory_order_relaxed);
+      max = std::max(max, source.max.load(std::memory_order_relaxed));
+    }
+
+    nlohmann::json summary = {{"count", count},
+                              {"mean", count ? double(sum) / count : 0.0},
+                              {"max", max}};
+    const std::pair<const char *, double> quantiles[] = {
+        {"p50", 0.5}, {"p90", 0.9}, {"p99", 0.99}, {"p999", 0.999}};
+    for (const auto &quantile : quantiles) {
+      std::uint64_t rank =
+          static_cast<std::uint64_t>(quantile.second * count);
+      std::uint64_t seen = 0;
+      std::uint64_t value = 0;
+      for (unsigned b = 0; b < HISTOGRAM_BUCKETS && count; ++b) {
+        seen += buckets[b];
+        if (seen > rank) {
+          value = std::min(histogramBucketLimit(b), max);
+          break;
+        }
+      }
+      summary[quantile.first] = value;
+    }
+    histograms[HISTOGRAM_NAMES[h]] = summary;
+  }
+  result["histograms"] = histograms;
+
+  logStats log_stats = logger::instance().stats();
+  result["log"] = {{"pushed", log_stats.pushed},
+                   {"dropped", log_stats.dropped},
+                   {"written", log_stats.written},
+                   {"batches", log_stats.batches}};
+  return result;
+}
+
+void dumpMetrics(const std::string &file) {
+  std::string temporary = file + ".tmp";
+  {
+    std::ofstream out(temporary, std::ios::trunc);
+    if (!out.is_open()) {
+      log("Не удалось записать снимок метрик: " + file, logLevel::error);
+      return;
+    }
+    out << metrics::instance().snapshot().dump(2) << "\n";
+  }
+  if (std::rename(temporary.c_str(), file.c_str()) != 0) {
+    log("Не удалось записать снимок метрик: " + file, logLevel::error);
+    return;
+  }
+  log("Снимок метрик записан в " + file);
+}
+
+metricsEndpoint::metricsEndpoint(
+    boost::asio::io_service &io_service,
+    const boost::asio::ip::tcp::endpoint &endpoint)
+    : io_service_(io_service), acceptor_(io_service, endpoint) {
+  accept();
+}
+
+void metricsEndpoint::accept() {
+  auto session = std::make_shared<adminSession>(io_service_);
+  acceptor_.async_accept(session->socket,
+                         [this, session](const boost::system::error_code &e) {
+                           if (!e) {
+                             session->start();
+                           }
+                           accept();
+                         });
+}
@@ -0,0 +1,245 @@
+#ifndef METRICS_HPP
+#define METRICS_HPP
+
+#include <array>
+#include <atomic>
+#include <boost/asio.hpp>
+#include <chrono>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <nlohmann/json.hpp>
+#include <string>
+#include <vector>
+
+/**
+ * @brief Счётчики сервера.
+ */
+enum class metricCounter : unsigned {
+  accepts,
+  accept_errors,
+  messages_in,
+  bytes_in,
+  messages_out,
+  bytes_out,
+  deliveries,
+  dropped_oldest,
+  dropped_newest,
+  coalesced,
+  disconnected,
+  timeouts,
+  sessions_closed,
+  worker_errors,
+  resumes,
+  resume_gaps,
+  reads,
+  throttled,
+  room_throttled,
+  nickname_rejects,
+  direct_messages,
+  searches,
+  count
+};
+
+/**
+ * @brief Гистограммы сервера.
+ */
+enum class metricHistogram : unsigned {
+  /// Число получателей одной рассылки.
+  fanout_size,
+  /// Время рассылки сообщения участникам комнаты, нс.
+  fanout_ns,
+  /// Длина очереди записи участника после постановки сообщения.
+  write_queue_depth,
+  /// Время пакетной записи в сокет, нс.
+  write_ns,
+  count
+};
+
+/// Значения меньше этого порога попадают каждое в свою корзину.
+constexpr unsigned HISTOGRAM_LINEAR = 16;
+/// Число линейных подкорзин на каждую степень двойки (2^3).
+constexpr unsigned HISTOGRAM_SUB_BITS = 3;
+/// Число корзин гистограммы для 64-битных значений.
+constexpr unsigned HISTOGRAM_BUCKETS =
+    HISTOGRAM_LINEAR + (64 - 4) * (1u << HISTOGRAM_SUB_BITS);
+
+/**
+ * @brief Номер корзины логарифмически-линейной гистограммы: до 16 — точное
+ * значение, дальше восемь равных корзин на каждую степень двойки
+ * (относительная ошибка не больше 12,5%).
+ * @param value Значение.
+ * @return Номер корзины.
+ */
+inline unsigned histogramBucket(std::uint64_t value) {
+  if (value < HISTOGRAM_LINEAR) {
+    return static_cast<unsigned>(value);
+  }
+  unsigned exponent = 63 - static_cast<unsigned>(__builtin_clzll(value));
+  unsigned sub =
+      static_cast<unsigned>(value >> (exponent - HISTOGRAM_SUB_BITS)) &
+      ((1u << HISTOGRAM_SUB_BITS) - 1);
+  return HISTOGRAM_LINEAR + ((exponent - 4) << HISTOGRAM_SUB_BITS) + sub;
+}
+
+/**
+ * @brief Наибольшее значение, попадающее в корзину.
+ * @param bucket Номер корзины.
+ * @return Верхняя граница корзины.
+ */
+std::uint64_t histogramBucketLimit(unsigned bucket);
+
+/**
+ * @struct threadMetrics
+ * @brief Метрики одного потока.
+ *
+ * Пишет в них только поток-владелец, поэтому обновление — это обычные
+ * загрузка и сохранение без барьеров и без lock-префикса; атомики нужны
+ * лишь для того, чтобы снимок с другого потока читал целые значения.
+ */
+struct threadMetrics {
+  struct histogram {
+    std::array<std::atomic<std::uint64_t>, HISTOGRAM_BUCKETS> buckets;
+    std::atomic<std::uint64_t> sum;
+    std::atomic<std::uint64_t> max;
+  };
+
+  threadMetrics();
+
+  std::array<std::atomic<std::uint64_t>,
+             static_cast<unsigned>(metricCounter::count)>
+      counters;
+  std::array<histogram, static_cast<unsigned>(metricHistogram::count)>
+      histograms;
+};
+
+/**
+ * @class metrics
+ * @brief Реестр метрик: метрики всех потоков и их сводный снимок.
+ */
+class metrics {
+public:
+  /**
+   * @brief Глобальный реестр.
+   * @return Реестр.
+   */
+  static metrics &instance();
+
+  /**
+   * @brief Метрики текущего потока (создаются при первом обращении).
+   * @return Метрики потока.
+   */
+  static threadMetrics &local() {
+    thread_local threadMetrics *local = instance().registerThread();
+    return *local;
+  }
+
+  /**
+   * @brief Сумма счётчика по всем потокам.
+   * @param counter Счётчик.
+   * @return Значение.
+   */
+  std::uint64_t total(metricCounter counter);
+
+  /**
+   * @brief Сводный снимок всех метрик.
+   * @return Снимок в JSON: счётчики, перцентили гистограмм, журнал.
+   */
+  nlohmann::json snapshot();
+
+private:
+  metrics();
+
+  threadMetrics *registerThread();
+
+  std::mutex mutex_;
+  std::vector<std::unique_ptr<threadMetrics>> threads_;
+  std::chrono::steady_clock::time_point started_;
+};
+
+/**
+ * @brief Увеличение счётчика текущего потока.
+ * @param counter Счётчик.
+ * @param value Приращение.
+ */
+inline void metricAdd(metricCounter counter, std::uint64_t value = 1) {
+  std::atomic<std::uint64_t> &cell =
+      metrics::local().counters[static_cast<unsigned>(counter)];
+  cell.store(cell.load(std::memory_order_relaxed) + value,
+             std::memory_order_relaxed);
+}
+
+/**
+ * @brief Запись значения в гистограмму текущего потока.
+ * @param histogram Гистограмма.
+ * @param value Значение.
+ */
+inline void metricRecord(metricHistogram histogram, std::uint64_t value) {
+  threadMetrics::histogram &h =
+      metrics::local().histograms[static_cast<unsigned>(histogram)];
+  std::atomic<std::uint64_t> &bucket = h.buckets[histogramBucket(value)];
+  bucket.store(bucket.load(std::memory_order_relaxed) + 1,
+               std::memory_order_relaxed);
+  h.sum.store(h.sum.load(std::memory_order_relaxed) + value,
+              std::memory_order_relaxed);
+  if (value > h.max.load(std::memory_order_relaxed)) {
+    h.max.store(value, std::memory_order_relaxed);
+  }
+}
+
+/**
+ * @brief Наносекунды, прошедшие с момента start.
+ * @param start Начало интервала.
+ * @return Длительность, нс.
+ */
+inline std::uint64_t
+elapsedNs(std::chrono::steady_clock::time_point start) {
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(
+             std::chrono::steady_clock::now() - start)
+      .count();
+}
+
+/**
+ * @brief Бэкенд ввода-вывода, с которым собран сервер (опция CMake
+ * CHAT_IO_URING).
+ * @return "io_uring" или "epoll".
+ */
+inline const char *ioBackend() {
+#if defined(BOOST_ASIO_HAS_IO_URING) && defined(BOOST_ASIO_DISABLE_EPOLL)
+  return "io_uring";
+#else
+  return "epoll";
+#endif
+}
+
+/**
+ * @brief Запись снимка метрик в файл (через временный файл и rename, чтобы
+ * читатель не увидел половину снимка).
+ * @param file Путь к файлу.
+ */
+void dumpMetrics(const std::string &file);
+
+/**
+ * @class metricsEndpoint
+ * @brief Административный порт: каждому подключившемуся отправляется
+ * снимок метрик в JSON (в виде ответа HTTP/1.0), после чего соединение
+ * закрывается.
+ */
+class metricsEndpoint {
+public:
+  /**
+   * @brief Конструктор. Начинает принимать подключения.
+   * @param io_service Сервис ввода-вывода.
+   * @param endpoint Адрес административного порта.
+   */
+  metricsEndpoint(boost::asio::io_service &io_service,
+                  const boost::asio::ip::tcp::endpoint &endpoint);
+
+private:
+  void accept();
+
+  boost::asio::io_service &io_service_;
+  boost::asio::ip::tcp::acceptor acceptor_;
+};
+
+#endif // METRICS_HPP
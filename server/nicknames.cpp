@@ -0,0 +1,89 @@
+#include "nicknames.hpp"
+#include <stdexcept>
+
+nicknameTable &nicknameTable::instance() {
+  static nicknameTable table;
+  return table;
+}
+
+nicknameTable::nicknameTable() : next_(0) {
+  for (std::atomic<entry *> &chunk : chunks_) {
+    chunk.store(nullptr, std::memory_order_relaxed);
+  }
+}
+
+nicknameTable::~nicknameTable() {
+  for (std::atomic<entry *> &chunk : chunks_) {
+    delete[] chunk.load(std::memory_order_relaxed);
+  }
+}
+
+nicknameId nicknameTable::acquire(const std::string &nickname) {
+  std::string key = nickname.substr(0, MAX_NICKNAME);
+  std::lock_guard<std::mutex> lock(mutex_);
+  auto it = index_.find(key);
+  if (it != index_.end()) {
+    at(it->second).refs.fetch_add(1, std::memory_order_relaxed);
+    return it->second;
+  }
+
+  nicknameId id;
+  if (!free_.empty()) {
+    id = free_.back();
+    free_.pop_back();
+  } else {
+    if (next_ == NICKNAME_CHUNK * MAX_NICKNAME_CHUNKS) {
+      throw std::runtime_error("Таблица никнеймов заполнена.");
+    }
+    id = next_++;
+    std::atomic<entry *> &chunk = chunks_[id / NICKNAME_CHUNK];
+    if (!chunk.load(std::memory_order_relaxed)) {
+      chunk.store(new entry[NICKNAME_CHUNK], std::memory_order_release);
+    }
+  }
+  entry &record = at(id);
+  record.name = key;
+  record.refs.store(1, std::memory_order_relaxed);
+  index_.emplace(std::move(key), id);
+  return id;
+}
+
+void nicknameTable::retain(nicknameId id) {
+  at(id).refs.fetch_add(1, std::memory_order_relaxed);
+}
+
+void nicknameTable::release(nicknameId id) {
+  entry &record = at(id);
+  if (record.refs.fetch_sub(1, std::memory_order_acq_rel) != 1) {
+    return;
+  }
+  // Пока мьютекс не захвачен, никнейм могли зарегистрировать снова.
+  std::lock_guard<std::mutex> lock(mutex_);
+  if (record.refs.load(std::memory_order_relaxed) != 0) {
+    return;
+  }
+  auto it = index_.find(record.name);
+  if (it != index_.end() && it->second == id) {
+    index_.erase(it);
+    free_.push_back(id);
+  }
+}
+
+const std::string &nicknameTable::name(nicknameId id) const {
+  return at(id).name;
+}
+
+std::size_t nicknameTable::size() {
+  std::lock_guard<std::mutex> lock(mutex_);
+  return index_.size();
+}
+
+nicknameTable::entry &nicknameTable::at(nicknameId id) const {
+  return chunks_[id / NICKNAME_CHUNK].load(
+      std::memory_order_acquire)[id % NICKNAME_CHUNK];
+}
+
+const std::string &internedName::str() const {
+  static const std::string empty;
+  return id_ == INVALID_NICKNAME ? empty : nicknameTable::instance().name(id_);
+}
@@ -0,0 +1,160 @@
+#ifndef NICKNAMES_HPP
+#define NICKNAMES_HPP
+
+#include "protocol.hpp"
+#include <array>
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+/// Номер никнейма в таблице.
+typedef std::uint32_t nicknameId;
+
+/// Номер, не соответствующий ни одному никнейму.
+constexpr nicknameId INVALID_NICKNAME = ~nicknameId(0);
+
+/// Записей в одном блоке таблицы никнеймов.
+constexpr std::size_t NICKNAME_CHUNK = 1024;
+/// Максимум блоков (около четырёх миллионов одновременных никнеймов).
+constexpr std::size_t MAX_NICKNAME_CHUNKS = 4096;
+
+/**
+ * @class nicknameTable
+ * @brief Таблица никнеймов: каждая строка хранится один раз и получает
+ * целочисленный номер.
+ *
+ * Записи живут в блоках, которые не перемещаются, поэтому имя по номеру
+ * читается без мьютекса; мьютекс нужен только для регистрации и
+ * освобождения. Запись освобождается, когда на неё не остаётся ссылок
+ * internedName, и её номер переиспользуется.
+ */
+class nicknameTable {
+public:
+  /**
+   * @brief Глобальная таблица.
+   * @return Таблица.
+   */
+  static nicknameTable &instance();
+
+  ~nicknameTable();
+
+  /**
+   * @brief Регистрация никнейма (или новая ссылка на уже
+   * зарегистрированный).
+   * @param nickname Никнейм (обрезается до MAX_NICKNAME байт).
+   * @return Номер никнейма.
+   * @throws std::runtime_error Если таблица заполнена.
+   */
+  nicknameId acquire(const std::string &nickname);
+
+  /**
+   * @brief Дополнительная ссылка на зарегистрированный никнейм.
+   * @param id Номер никнейма.
+   */
+  void retain(nicknameId id);
+
+  /**
+   * @brief Снятие ссылки; запись без ссылок освобождается.
+   * @param id Номер никнейма.
+   */
+  void release(nicknameId id);
+
+  /**
+   * @brief Никнейм по номеру (без блокировки).
+   * @param id Номер никнейма, на который у вызывающего есть ссылка.
+   * @return Никнейм.
+   */
+  const std::string &name(nicknameId id) const;
+
+  /**
+   * @brief Число зарегистрированных никнеймов.
+   * @return Число записей.
+   */
+  std::size_t size();
+
+private:
+  nicknameTable();
+
+  /**
+   * @struct entry
+   * @brief Запись таблицы.
+   */
+  struct entry {
+    std::string name;
+    std::atomic<std::uint32_t> refs{0};
+  };
+
+  entry &at(nicknameId id) const;
+
+  std::mutex mutex_;
+  std::array<std::atomic<entry *>, MAX_NICKNAME_CHUNKS> chunks_;
+  std::unordered_map<std::string, nicknameId> index_;
+  std::vector<nicknameId> free_;
+  nicknameId next_;
+};
+
+/**
+ * @class internedName
+ * @brief Ссылка на никнейм в nicknameTable: четыре байта вместо строки,
+ * копирование не выделяет память.
+ */
+class internedName {
+public:
+  internedName() : id_(INVALID_NICKNAME) {}
+
+  /**
+   * @brief Регистрация никнейма.
+   * @param nickname Никнейм (обрезается до MAX_NICKNAME байт).
+   */
+  explicit internedName(const std::string &nickname)
+      : id_(nicknameTable::instance().acquire(nickname)) {}
+
+  internedName(const internedName &other) : id_(other.id_) {
+    if (id_ != INVALID_NICKNAME) {
+      nicknameTable::instance().retain(id_);
+    }
+  }
+
+  internedName(internedName &&other) noexcept : id_(other.id_) {
+    other.id_ = INVALID_NICKNAME;
+  }
+
+  internedName &operator=(internedName other) noexcept {
+    std::swap(id_, other.id_);
+    return *this;
+  }
+
+  ~internedName() {
+    if (id_ != INVALID_NICKNAME) {
+      nicknameTable::instance().release(id_);
+    }
+  }
+
+  /**
+   * @brief Номер никнейма.
+   * @return Номер или INVALID_NICKNAME для пустой ссылки.
+   */
+  nicknameId id() const { return id_; }
+
+  /**
+   * @brief Никнейм.
+   * @return Строка никнейма (пустая для пустой ссылки).
+   */
+  const std::string &str() const;
+
+  bool operator==(const internedName &other) const {
+    return id_ == other.id_;
+  }
+  bool operator!=(const internedName &other) const {
+    return id_ != other.id_;
+  }
+
+private:
+  nicknameId id_;
+};
+
+#endif // NICKNAMES_HPP
@@ -0,0 +1,51 @@
+#include "participants.hpp"
+
+memberHandle participantTable::insert(std::shared_ptr<participant> session,
+                                      internedName nickname) {
+  std::uint32_t slot;
+  if (free_slots_.empty()) {
+    slot = static_cast<std::uint32_t>(slots_.size());
+    slots_.push_back(slotEntry{0, 0});
+  } else {
+    slot = free_slots_.back();
+    free_slots_.pop_back();
+  }
+  slots_[slot].index = static_cast<std::uint32_t>(members_.size());
+
+  member entry;
+  entry.session = std::move(session);
+  entry.nickname = std::move(nickname);
+  entry.slot = slot;
+  members_.push_back(std::move(entry));
+  return (memberHandle(slots_[slot].generation) << 32) | slot;
+}
+
+bool participantTable::erase(memberHandle handle) {
+  if (!find(handle)) {
+    return false;
+  }
+  slotEntry &entry = slots_[static_cast<std::uint32_t>(handle)];
+  std::uint32_t index = entry.index;
+  if (index + 1 != members_.size()) {
+    members_[index] = std::move(members_.back());
+    slots_[members_[index].slot].index = index;
+  }
+  members_.pop_back();
+  ++entry.generation;
+  free_slots_.push_back(static_cast<std::uint32_t>(handle));
+  return true;
+}
+
+const member *participantTable::find(memberHandle handle) const {
+  std::uint32_t slot = static_cast<std::uint32_t>(handle);
+  if (slot >= slots_.size() ||
+      slots_[slot].generation != static_cast<std::uint32_t>(handle >> 32)) {
+    return nullptr;
+  }
+  // Свободный слот того же поколения не ссылается на участника.
+  std::uint32_t index = slots_[slot].index;
+  if (index >= members_.size() || members_[index].slot != slot) {
+    return nullptr;
+  }
+  return &members_[index];
+}
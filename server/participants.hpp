@@ -0,0 +1,106 @@
+#ifndef PARTICIPANTS_HPP
+#define PARTICIPANTS_HPP
+
+#include "nicknames.hpp"
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+class participant;
+
+/// Устойчивый номер участника комнаты: младшие 32 бита — слот, старшие —
+/// поколение слота (номер вышедшего участника не совпадёт с номером
+/// нового).
+typedef std::uint64_t memberHandle;
+
+/// Номер, не соответствующий ни одному участнику.
+constexpr memberHandle INVALID_MEMBER = ~memberHandle(0);
+
+/**
+ * @struct member
+ * @brief Участник комнаты: указатель на сессию и номер никнейма рядом с
+ * ним.
+ */
+struct member {
+  std::shared_ptr<participant> session;
+  /// Никнейм с разделителем ": " (не длиннее MAX_NICKNAME).
+  internedName nickname;
+  /// Слот, ссылающийся на этого участника.
+  std::uint32_t slot;
+
+  /**
+   * @brief Получение никнейма.
+   * @return Никнейм.
+   */
+  const std::string &name() const { return nickname.str(); }
+};
+
+/**
+ * @class participantTable
+ * @brief Плотная таблица участников комнаты (slot map).
+ *
+ * Участники лежат подряд в одном векторе, поэтому рассылка — линейный
+ * проход по памяти. Номер участника указывает на слот, а слот — на
+ * позицию в векторе; при выходе на место ушедшего переносится последний
+ * участник, и обновляется только его слот. Вход, выход и поиск — O(1) без
+ * хеширования.
+ */
+class participantTable {
+public:
+  /**
+   * @brief Добавление участника.
+   * @param session Указатель на участника.
+   * @param nickname Никнейм из таблицы никнеймов.
+   * @return Номер участника.
+   */
+  memberHandle insert(std::shared_ptr<participant> session,
+                      internedName nickname);
+
+  /**
+   * @brief Удаление участника.
+   * @param handle Номер участника.
+   * @return false, если номер устарел или неизвестен.
+   */
+  bool erase(memberHandle handle);
+
+  /**
+   * @brief Поиск участника.
+   * @param handle Номер участника.
+   * @return Участник или nullptr, если номер устарел.
+   */
+  const member *find(memberHandle handle) const;
+
+  /**
+   * @brief Число участников.
+   * @return Число участников.
+   */
+  std::size_t size() const { return members_.size(); }
+
+  /**
+   * @brief Проверка, пуста ли таблица.
+   * @return true, если участников нет.
+   */
+  bool empty() const { return members_.empty(); }
+
+  std::vector<member>::const_iterator begin() const {
+    return members_.begin();
+  }
+  std::vector<member>::const_iterator end() const { return members_.end(); }
+
+private:
+  /**
+   * @struct slotEntry
+   * @brief Слот: позиция участника в плотном векторе и поколение.
+   */
+  struct slotEntry {
+    std::uint32_t index;
+    std::uint32_t generation;
+  };
+
+  std::vector<member> members_;
+  std::vector<slotEntry> slots_;
+  std::vector<std::uint32_t> free_slots_;
+};
+
+#endif // PARTICIPANTS_HPP
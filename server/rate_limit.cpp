@@ -0,0 +1,37 @@
+#include "rate_limit.hpp"
+#include <algorithm>
+#include <chrono>
+
+tokenBucket::tokenBucket() : interval_ns_(0), tolerance_ns_(0), next_ns_(0) {}
+
+void tokenBucket::configure(double rate, double burst) {
+  interval_ns_ = rate > 0 ? static_cast<std::uint64_t>(1e9 / rate) : 0;
+  if (rate > 0 && interval_ns_ == 0) {
+    interval_ns_ = 1;
+  }
+  tolerance_ns_ =
+      static_cast<std::uint64_t>((std::max(burst, 1.0) - 1) * interval_ns_);
+  reset();
+}
+
+void tokenBucket::reset() { next_ns_ = 0; }
+
+bool tokenBucket::enabled() const { return interval_ns_ != 0; }
+
+std::uint64_t tokenBucket::take(std::uint64_t now_ns) {
+  if (interval_ns_ == 0) {
+    return 0;
+  }
+  std::uint64_t next = std::max(next_ns_, now_ns);
+  if (next - now_ns > tolerance_ns_) {
+    return next - now_ns - tolerance_ns_;
+  }
+  next_ns_ = next + interval_ns_;
+  return 0;
+}
+
+std::uint64_t rateClockNs() {
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(
+             std::chrono::steady_clock::now().time_since_epoch())
+      .count();
+}
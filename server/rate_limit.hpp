@@ -0,0 +1,65 @@
+#ifndef RATE_LIMIT_HPP
+#define RATE_LIMIT_HPP
+
+#include <cstdint>
+
+/**
+ * @class tokenBucket
+ * @brief Ведро токенов: не больше rate сообщений в секунду в среднем и не
+ * больше burst подряд.
+ *
+ * Вместо числа токенов хранится одно время — когда ведро снова станет
+ * полным без учёта запаса burst (алгоритм GCRA), так что пополнение не
+ * требует таймера. Объект не синхронизирован: ведро сессии используется
+ * только в её странде, ведро комнаты — под мьютексом комнаты или на её
+ * домашнем шарде.
+ */
+class tokenBucket {
+public:
+  /**
+   * @brief Конструктор выключенного ведра (пропускает всё).
+   */
+  tokenBucket();
+
+  /**
+   * @brief Установка ограничения; ведро становится полным.
+   * @param rate Сообщений в секунду (0 — без ограничения).
+   * @param burst Сколько сообщений можно отправить подряд (не меньше 1).
+   */
+  void configure(double rate, double burst);
+
+  /**
+   * @brief Ведро снова становится полным.
+   */
+  void reset();
+
+  /**
+   * @brief Проверка, задано ли ограничение.
+   * @return true, если ограничение задано.
+   */
+  bool enabled() const;
+
+  /**
+   * @brief Взятие токена.
+   * @param now_ns Текущее время по монотонным часам, нс.
+   * @return 0, если токен взят; иначе через сколько наносекунд он появится
+   * (токен при этом не берётся).
+   */
+  std::uint64_t take(std::uint64_t now_ns);
+
+private:
+  /// Интервал между сообщениями при средней частоте, нс (0 — выключено).
+  std::uint64_t interval_ns_;
+  /// Запас на burst - 1 сообщений сверх средней частоты, нс.
+  std::uint64_t tolerance_ns_;
+  /// Теоретическое время следующего сообщения, нс.
+  std::uint64_t next_ns_;
+};
+
+/**
+ * @brief Текущее время по монотонным часам для ведер токенов.
+ * @return Время, нс.
+ */
+std::uint64_t rateClockNs();
+
+#endif // RATE_LIMIT_HPP
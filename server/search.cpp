@@ -0,0 +1,410 @@
+#include "search.hpp"
+#include "protocol.hpp"
+#include "timestamp.hpp"
+#include <algorithm>
+#include <cctype>
+#include <cstring>
+#include <sstream>
+
+namespace {
+
+/// Ключи отправителей отделены от слов непечатным префиксом.
+const char SENDER_PREFIX = '\x01';
+
+/// Сигнатура и версия файла контрольной точки.
+const char CHECKPOINT_MAGIC[] = {'C', 'S', 'I', '1'};
+
+void putVarint(std::uint64_t value, std::string &out) {
+  while (value >= 0x80) {
+    out.push_back(static_cast<char>((value & 0x7F) | 0x80));
+    value >>= 7;
+  }
+  out.push_back(static_cast<char>(value));
+}
+
+/**
+ * @brief Чтение varint.
+ * @param data Текущая позиция; сдвигается за прочитанное число.
+ * @param end Конец данных.
+ * @param value Прочитанное число.
+ * @return false, если данные оборваны.
+ */
+bool getVarint(const char *&data, const char *end, std::uint64_t &value) {
+  value = 0;
+  for (unsigned shift = 0; data < end && shift < 64; shift += 7) {
+    unsigned char byte = static_cast<unsigned char>(*data++);
+    value |= std::uint64_t(byte & 0x7F) << shift;
+    if (!(byte & 0x80)) {
+      return true;
+    }
+  }
+  return false;
+}
+
+void tokenizeRange(const char *begin, const char *end,
+                   std::vector<std::string> &tokens) {
+  std::string token;
+  auto finish = [&]() {
+    if (!token.empty()) {
+      if (token.size() > MAX_SEARCH_TOKEN) {
+        token.resize(MAX_SEARCH_TOKEN);
+      }
+      tokens.push_back(std::move(token));
+      token.clear();
+    }
+  };
+  for (const char *p = begin; p != end; ++p) {
+    unsigned char c = static_cast<unsigned char>(*p);
+    if (c < 0x80) {
+      if (std::isalnum(c)) {
+        token.push_back(static_cast<char>(std::tolower(c)));
+      } else {
+        finish();
+      }
+    } else if (c == 0xD0 && p + 1 != end) {
+      // Заглавные А-Я и Ё (D0 90..AF, D0 81) в строчные.
+      unsigned char next = static_cast<unsigned char>(*++p);
+      if (next >= 0x90 && next <= 0x9F) {
+        token.push_back('\xD0');
+        token.push_back(static_cast<char>(next + 0x20));
+      } else if (next >= 0xA0 && next <= 0xAF) {
+        token.push_back('\xD1');
+        token.push_back(static_cast<char>(next - 0x20));
+      } else if (next == 0x81) {
+        token.append("\xD1\x91");
+      } else {
+        token.push_back(static_cast<char>(c));
+        token.push_back(static_cast<char>(next));
+      }
+    } else {
+      token.push_back(static_cast<char>(c));
+    }
+  }
+  finish();
+}
+
+bool parseMilliseconds(const std::string &digits, std::uint64_t &value) {
+  if (digits.empty() || digits.size() > 19 ||
+      !std::all_of(digits.begin(), digits.end(), [](char c) {
+        return std::isdigit(static_cast<unsigned char>(c));
+      })) {
+    return false;
+  }
+  value = std::stoull(digits);
+  return true;
+}
+
+} // namespace
+
+bool parseSearchQuery(const std::string &request, searchQuery &query) {
+  std::istringstream in(request);
+  std::string word;
+  while (in >> word) {
+    if (word.compare(0, 5, "from:") == 0 && word.size() > 5) {
+      query.sender = word.substr(5);
+    } else if (word.compare(0, 6, "since:") == 0) {
+      if (!parseMilliseconds(word.substr(6), query.since_ms)) {
+        return false;
+      }
+    } else if (word.compare(0, 6, "until:") == 0) {
+      if (!parseMilliseconds(word.substr(6), query.until_ms)) {
+        return false;
+      }
+    } else {
+      tokenize(word, query.words);
+    }
+  }
+  std::sort(query.words.begin(), query.words.end());
+  query.words.erase(std::unique(query.words.begin(), query.words.end()),
+                    query.words.end());
+  return !query.words.empty() || !query.sender.empty() ||
+         query.since_ms > 0 || query.until_ms != UINT64_MAX;
+}
+
+void tokenize(const std::string &text, std::vector<std::string> &tokens) {
+  tokenizeRange(text.data(), text.data() + text.size(), tokens);
+}
+
+searchIndex::searchIndex() {}
+
+void searchIndex::add(std::uint64_t ordinal, std::uint64_t timestamp_ms,
+                      const std::string &text) {
+  if (ordinal <= times_.size()) {
+    return;
+  }
+  times_.resize(ordinal, timestamp_ms);
+
+  // Сохранённый текст: "[ГГГГ-ММ-ДД ЧЧ:ММ:СС] никнейм: текст".
+  const char *begin = text.data();
+  const char *end = begin + text.size();
+  if (text.size() >= TIMESTAMP_SIZE && text[0] == '[') {
+    begin += TIMESTAMP_SIZE;
+  }
+  const char *colon = std::search(begin, end, ": ", ": " + 2);
+  if (colon != end && colon != begin &&
+      static_cast<std::size_t>(colon - begin) < MAX_NICKNAME) {
+    term_.assign(1, SENDER_PREFIX).append(begin, colon);
+    post(term_, ordinal);
+    begin = colon + 2;
+  }
+  tokens_.clear();
+  tokenizeRange(begin, end, tokens_);
+  for (const std::string &token : tokens_) {
+    post(token, ordinal);
+  }
+}
+
+std::uint64_t searchIndex::size() const { return times_.size(); }
+
+std::size_t searchIndex::terms() const { return postings_.size(); }
+
+void searchIndex::clear() {
+  postings_.clear();
+  times_.clear();
+}
+
+void searchIndex::post(const std::string &term, std::uint64_t ordinal) {
+  postingList &list = postings_[term];
+  if (list.count == 0 || list.last != ordinal) {
+    append(list, ordinal);
+  }
+}
+
+void searchIndex::append(postingList &list, std::uint64_t ordinal) {
+  if (list.count % SEARCH_SKIP_INTERVAL == 0) {
+    list.skips.push_back(skipPoint{list.last, list.deltas.size()});
+  }
+  putVarint(ordinal - list.last, list.deltas);
+  list.last = ordinal;
+  ++list.count;
+}
+
+void searchIndex::decodeBlock(const postingList &list, std::size_t block,
+                              std::uint64_t first, std::uint64_t last,
+                              std::vector<std::uint64_t> &ordinals) {
+  const char *data = list.deltas.data() + list.skips[block].offset;
+  const char *end = block + 1 < list.skips.size()
+                        ? list.deltas.data() + list.skips[block + 1].offset
+                        : list.deltas.data() + list.deltas.size();
+  std::uint64_t ordinal = list.skips[block].base;
+  std::uint64_t delta;
+  while (ordinal < last && getVarint(data, end, delta)) {
+    ordinal += delta;
+    if (ordinal >= first && ordinal <= last) {
+      ordinals.push_back(ordinal);
+    }
+  }
+}
+
+void searchIndex::decodeRange(const postingList &list, std::uint64_t first,
+                              std::uint64_t last,
+                              std::vector<std::uint64_t> &ordinals) {
+  // Последний блок, который начинается раньше first.
+  auto it = std::partition_point(
+      list.skips.begin(), list.skips.end(),
+      [first](const skipPoint &skip) { return skip.base < first; });
+  std::size_t block = it - list.skips.begin();
+  block = block ? block - 1 : 0;
+  for (; block < list.skips.size() && list.skips[block].base < last;
+       ++block) {
+    decodeBlock(list, block, first, last, ordinals);
+  }
+}
+
+std::vector<std::uint64_t> searchIndex::find(const searchQuery &query,
+                                             std::size_t limit) const {
+  std::vector<std::uint64_t> result;
+  if (times_.empty() || limit == 0) {
+    return result;
+  }
+  // Номера [first, last] сообщений из диапазона времени.
+  auto lower = std::partition_point(
+      times_.begin(), times_.end(),
+      [&](std::uint64_t t) { return t < query.since_ms; });
+  auto upper = std::partition_point(
+      lower, times_.end(),
+      [&](std::uint64_t t) { return t <= query.until_ms; });
+  std::uint64_t first = (lower - times_.begin()) + 1;
+  std::uint64_t last = upper - times_.begin();
+  if (first > last) {
+    return result;
+  }
+
+  std::vector<const postingList *> lists;
+  for (const std::string &word : query.words) {
+    auto it = postings_.find(word);
+    if (it == postings_.end()) {
+      return result;
+    }
+    lists.push_back(&it->second);
+  }
+  if (!query.sender.empty()) {
+    auto it = postings_.find(SENDER_PREFIX + query.sender);
+    if (it == postings_.end()) {
+      return result;
+    }
+    lists.push_back(&it->second);
+  }
+  if (lists.empty()) {
+    std::uint64_t count = std::min<std::uint64_t>(last - first + 1, limit);
+    for (std::uint64_t ordinal = last - count + 1; ordinal <= last;
+         ++ordinal) {
+      result.push_back(ordinal);
+    }
+    return result;
+  }
+
+  // Блоки самого короткого списка перебираются с конца; остальные списки
+  // раскодируются только в пределах номеров очередного блока.
+  std::sort(lists.begin(), lists.end(),
+            [](const postingList *a, const postingList *b) {
+              return a->count < b->count;
+            });
+  const postingList &driver = *lists.front();
+  std::vector<std::uint64_t> matches;
+  std::vector<std::uint64_t> other;
+  std::vector<std::uint64_t> both;
+  for (std::size_t block = driver.skips.size();
+       block-- > 0 && result.size() < limit;) {
+    if (driver.skips[block].base >= last) {
+      continue;
+    }
+    matches.clear();
+    decodeBlock(driver, block, first, last, matches);
+    for (std::size_t i = 1; i < lists.size() && !matches.empty(); ++i) {
+      other.clear();
+      decodeRange(*lists[i], matches.front(), matches.back(), other);
+      both.clear();
+      std::set_intersection(matches.begin(), matches.end(), other.begin(),
+                            other.end(), std::back_inserter(both));
+      matches.swap(both);
+    }
+    result.insert(result.end(), matches.rbegin(), matches.rend());
+    if (driver.skips[block].base < first) {
+      break;
+    }
+  }
+  if (result.size() > limit) {
+    result.resize(limit);
+  }
+  std::reverse(result.begin(), result.end());
+  return result;
+}
+
+std::string searchIndex::serialize() const {
+  std::string out(CHECKPOINT_MAGIC, sizeof(CHECKPOINT_MAGIC));
+  putVarint(times_.size(), out);
+  std::uint64_t previous = 0;
+  for (std::uint64_t t : times_) {
+    // Разность времени со знаком (zigzag): часы могли перевести назад.
+    std::int64_t delta = static_cast<std::int64_t>(t - previous);
+    putVarint((static_cast<std::uint64_t>(delta) << 1) ^
+                  static_cast<std::uint64_t>(delta >> 63),
+              out);
+    previous = t;
+  }
+  putVarint(postings_.size(), out);
+  for (const auto &entry : postings_) {
+    putVarint(entry.first.size(), out);
+    out.append(entry.first);
+    putVarint(entry.second.count, out);
+    putVarint(entry.second.last, out);
+    putVarint(entry.second.deltas.size(), out);
+    out.append(entry.second.deltas);
+    // Точки пропуска пишутся разностями, чтобы загрузка не раскодировала
+    // списки целиком.
+    const skipPoint *previous_skip = nullptr;
+    for (const skipPoint &skip : entry.second.skips) {
+      putVarint(skip.base - (previous_skip ? previous_skip->base : 0), out);
+      putVarint(skip.offset - (previous_skip ? previous_skip->offset : 0),
+                out);
+      previous_skip = &skip;
+    }
+  }
+  return out;
+}
+
+bool searchIndex::deserialize(const char *data, std::size_t size) {
+  clear();
+  const char *end = data + size;
+  if (size < sizeof(CHECKPOINT_MAGIC) ||
+      std::memcmp(data, CHECKPOINT_MAGIC, sizeof(CHECKPOINT_MAGIC)) != 0) {
+    return false;
+  }
+  data += sizeof(CHECKPOINT_MAGIC);
+  std::uint64_t count;
+  if (!getVarint(data, end, count) ||
+      count > static_cast<std::uint64_t>(end - data)) {
+    return false;
+  }
+  times_.reserve(count);
+  std::uint64_t previous = 0;
+  for (std::uint64_t i = 0; i < count; ++i) {
+    std::uint64_t zigzag;
+    if (!getVarint(data, end, zigzag)) {
+      clear();
+      return false;
+    }
+    previous += (zigzag >> 1) ^ (~(zigzag & 1) + 1);
+    times_.push_back(previous);
+  }
+  std::uint64_t terms;
+  if (!getVarint(data, end, terms)) {
+    clear();
+    return false;
+  }
+  postings_.reserve(static_cast<std::size_t>(
+      std::min<std::uint64_t>(terms, static_cast<std::uint64_t>(end - data))));
+  for (std::uint64_t i = 0; i < terms; ++i) {
+    std::uint64_t length, postings, last, bytes;
+    if (!getVarint(data, end, length) ||
+        length > static_cast<std::uint64_t>(end - data)) {
+      clear();
+      return false;
+    }
+    std::string term(data, static_cast<std::size_t>(length));
+    data += length;
+    if (!getVarint(data, end, postings) || !getVarint(data, end, last) ||
+        !getVarint(data, end, bytes) ||
+        bytes > static_cast<std::uint64_t>(end - data) ||
+        last > times_.size()) {
+      clear();
+      return false;
+    }
+    postingList &list = postings_[term];
+    if (list.count != 0) {
+      clear();
+      return false;
+    }
+    list.deltas.assign(data, static_cast<std::size_t>(bytes));
+    data += bytes;
+    list.count = static_cast<std::uint32_t>(postings);
+    list.last = last;
+    std::uint64_t skips =
+        (postings + SEARCH_SKIP_INTERVAL - 1) / SEARCH_SKIP_INTERVAL;
+    if (postings == 0 || postings > bytes ||
+        skips > static_cast<std::uint64_t>(end - data)) {
+      clear();
+      return false;
+    }
+    list.skips.resize(static_cast<std::size_t>(skips));
+    skipPoint previous_skip{0, 0};
+    for (skipPoint &skip : list.skips) {
+      std::uint64_t base, offset;
+      if (!getVarint(data, end, base) || !getVarint(data, end, offset) ||
+          offset > bytes - previous_skip.offset ||
+          base > last - previous_skip.base) {
+        clear();
+        return false;
+      }
+      skip.base = previous_skip.base + base;
+      skip.offset = previous_skip.offset + static_cast<std::size_t>(offset);
+      previous_skip = skip;
+    }
+  }
+  if (data != end) {
+    clear();
+    return false;
+  }
+  return true;
+}
@@ -0,0 +1,169 @@
+#ifndef SEARCH_HPP
+#define SEARCH_HPP
+
+#include <cstdint>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+/// Слова длиннее этого числа байт обрезаются (и в индексе, и в запросе).
+constexpr std::size_t MAX_SEARCH_TOKEN = 32;
+/// Номеров в блоке списка вхождений между точками пропуска.
+constexpr std::uint32_t SEARCH_SKIP_INTERVAL = 128;
+
+/**
+ * @struct searchQuery
+ * @brief Запрос поиска по истории комнаты.
+ */
+struct searchQuery {
+  /// Слова, которые должны встретиться в тексте сообщения (все сразу).
+  std::vector<std::string> words;
+  /// Никнейм отправителя (пусто — любой).
+  std::string sender;
+  /// Только сообщения не раньше этого времени, мс с начала эпохи.
+  std::uint64_t since_ms = 0;
+  /// Только сообщения не позже этого времени, мс с начала эпохи.
+  std::uint64_t until_ms = UINT64_MAX;
+};
+
+/**
+ * @brief Разбор аргумента команды /search: слова, `from:<никнейм>`,
+ * `since:<мс>` и `until:<мс>` через пробел.
+ * @param request Аргумент команды.
+ * @param query Разобранный запрос.
+ * @return false, если запрос пуст или в нём неверное время.
+ */
+bool parseSearchQuery(const std::string &request, searchQuery &query);
+
+/**
+ * @brief Разбиение текста на слова для индекса: латинские буквы и кириллица
+ * приводятся к нижнему регистру, разделителем служит всё, кроме букв, цифр
+ * и прочих символов UTF-8.
+ * @param text Текст.
+ * @param tokens Слова добавляются в конец.
+ */
+void tokenize(const std::string &text, std::vector<std::string> &tokens);
+
+/**
+ * @class searchIndex
+ * @brief Обратный индекс истории комнаты: слово или отправитель — список
+ * номеров сообщений, где они встречаются.
+ *
+ * Номера сообщений возрастают, поэтому список хранится разностями в
+ * формате varint (обычно байт-два на вхождение) и дописывается за O(1).
+ * Каждые SEARCH_SKIP_INTERVAL номеров запоминается точка пропуска, так что
+ * поиск раскодирует списки блоками с конца и останавливается, набрав
+ * нужное число последних совпадений.
+ *
+ * Рядом хранится время каждого сообщения. Время назначает владелец истории
+ * комнаты, и оно не убывает, так что границы диапазона времени ищутся
+ * двоичным поиском; если часы переводили назад, сообщения у самых границ
+ * диапазона могут не найтись.
+ *
+ * Объект не синхронизирован: его защищают блокировки хранилища истории.
+ */
+class searchIndex {
+public:
+  searchIndex();
+
+  /**
+   * @brief Добавление очередного сообщения.
+   * @param ordinal Номер сообщения (на единицу больше size()).
+   * @param timestamp_ms Время сообщения, мс с начала эпохи.
+   * @param text Сохранённый текст "[время] никнейм: текст".
+   */
+  void add(std::uint64_t ordinal, std::uint64_t timestamp_ms,
+           const std::string &text);
+
+  /**
+   * @brief Число проиндексированных сообщений (номер последнего).
+   * @return Число сообщений.
+   */
+  std::uint64_t size() const;
+
+  /**
+   * @brief Число различных слов и отправителей в индексе.
+   * @return Число ключей.
+   */
+  std::size_t terms() const;
+
+  /**
+   * @brief Очистка индекса.
+   */
+  void clear();
+
+  /**
+   * @brief Поиск сообщений.
+   * @param query Запрос.
+   * @param limit Не больше скольких последних совпадений вернуть.
+   * @return Номера найденных сообщений по возрастанию.
+   */
+  std::vector<std::uint64_t> find(const searchQuery &query,
+                                  std::size_t limit) const;
+
+  /**
+   * @brief Сериализация индекса для контрольной точки на диске.
+   * @return Содержимое файла.
+   */
+  std::string serialize() const;
+
+  /**
+   * @brief Восстановление индекса из контрольной точки.
+   * @param data Содержимое файла.
+   * @param size Размер содержимого.
+   * @return false, если файл повреждён или другой версии (индекс пуст).
+   */
+  bool deserialize(const char *data, std::size_t size);
+
+private:
+  /**
+   * @brief Начало блока списка вхождений.
+   */
+  struct skipPoint {
+    /// Номер перед блоком (разности блока отсчитываются от него).
+    std::uint64_t base;
+    /// Смещение блока в deltas.
+    std::size_t offset;
+  };
+
+  struct postingList {
+    /// Разности номеров в формате varint.
+    std::string deltas;
+    /// Последний добавленный номер.
+    std::uint64_t last = 0;
+    std::uint32_t count = 0;
+    /// Точки пропуска в начале каждого блока.
+    std::vector<skipPoint> skips;
+  };
+
+  void post(const std::string &term, std::uint64_t ordinal);
+
+  /**
+   * @brief Добавление номера в конец списка.
+   */
+  static void append(postingList &list, std::uint64_t ordinal);
+
+  /**
+   * @brief Номера блока списка в пределах [first, last].
+   */
+  static void decodeBlock(const postingList &list, std::size_t block,
+                          std::uint64_t first, std::uint64_t last,
+                          std::vector<std::uint64_t> &ordinals);
+
+  /**
+   * @brief Номера списка в пределах [first, last]; раскодирование
+   * начинается с блока, где может лежать first.
+   */
+  static void decodeRange(const postingList &list, std::uint64_t first,
+                          std::uint64_t last,
+                          std::vector<std::uint64_t> &ordinals);
+
+  std::unordered_map<std::string, postingList> postings_;
+  /// Время сообщения номер N хранится в times_[N - 1].
+  std::vector<std::uint64_t> times_;
+  /// Буферы разбора сообщения (чтобы не выделять память на каждое).
+  std::vector<std::string> tokens_;
+  std::string term_;
+};
+
+#endif // SEARCH_HPP
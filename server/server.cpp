@@ -1,43 +1,98 @@
 #include "server.hpp"
+#include "logger.hpp"
+#include "metrics.hpp"
+#include "shard.hpp"
+#include "timestamp.hpp"
+#include <algorithm>
 #include <boost/asio.hpp>
 #include <boost/bind/bind.hpp>
 #include <boost/thread.hpp>
 #include <boost/thread/thread.hpp>
-#include <ctime>
+#include <cctype>
+#include <chrono>
+#include <cstring>
 #include <fstream>
-#include <iomanip>
 #include <iostream>
 #include <list>
-#include <sstream>
 #include <thread>
 
 using namespace boost::placeholders;
+
+namespace {
+
 /**
- * @brief Получение текущего временного штампа.
- * @return Временной штамп в виде строки.
+ * @brief Параметры истории комнат порта: у каждого порта свой каталог.
+ * @param history Параметры истории сервера.
+ * @param port Порт.
+ * @return Параметры истории порта.
  */
-std::string getTimestamp() {
-  time_t t = time(0);
-  struct tm *now = localtime(&t);
-  std::stringstream ss;
-  ss << '[' << (now->tm_year + 1900) << '-' << std::setfill('0') << std::setw(2)
-     << (now->tm_mon + 1) << '-' << std::setfill('0') << std::setw(2)
-     << now->tm_mday << ' ' << std::setfill('0') << std::setw(2) << now->tm_hour
-     << ":" << std::setfill('0') << std::setw(2) << now->tm_min << ":"
-     << std::setfill('0') << std::setw(2) << now->tm_sec << "] ";
-  return ss.str();
+historyConfig portHistory(const historyConfig &history, unsigned short port) {
+  historyConfig port_history = history;
+  port_history.dir += "/port-" + std::to_string(port);
+  return port_history;
 }
+
 /**
- * @brief Логирование сообщения в файл.
- * @param message Сообщение для логирования.
+ * @brief Ожидание SIGUSR1 для записи снимка метрик в файл.
+ * @param signals Набор сигналов.
+ * @param file Файл снимка.
  */
-void log(const std::string &message) {
-  std::ofstream log_file("server.log", std::ios::app);
-  if (log_file.is_open()) {
-    log_file << getTimestamp() << message << std::endl;
-  }
+void waitMetricsSignal(boost::asio::signal_set &signals,
+                       const std::string &file) {
+  signals.async_wait(
+      [&signals, file](const boost::system::error_code &error, int) {
+        if (error) {
+          return;
+        }
+        dumpMetrics(file);
+        waitMetricsSignal(signals, file);
+      });
+}
+
+/**
+ * @brief Ошибка означает, что клиент просто ушёл, а не сбой сервера.
+ * @param error Код ошибки.
+ * @return true для закрытия и сброса соединения.
+ */
+bool peerGone(const boost::system::error_code &error) {
+  return error == boost::asio::error::eof ||
+         error == boost::asio::error::connection_reset ||
+         error == boost::asio::error::broken_pipe;
+}
+
+/// Заголовок FRAME_SEQUENCED и номер перед вложенным кадром FRAME_TEXT.
+constexpr std::size_t SEQUENCE_PREFIX_SIZE = FRAME_HEADER_SIZE + SEQUENCE_SIZE;
+
+/**
+ * @brief Начало кадра FRAME_SEQUENCED: заголовок и номер сообщения.
+ * @param seq Номер сообщения.
+ * @param length Длина текста во вложенном кадре.
+ * @param frame Строка, в которую дописывается начало кадра.
+ */
+void appendSequencePrefix(std::uint64_t seq, std::size_t length,
+                          std::string &frame) {
+  frameHeader header;
+  encodeHeader(
+      static_cast<std::uint32_t>(SEQUENCE_SIZE + FRAME_HEADER_SIZE + length),
+      FRAME_SEQUENCED, header);
+  frame.append(header.data(), header.size());
+  char number[SEQUENCE_SIZE];
+  encodeSequence(seq, number);
+  frame.append(number, SEQUENCE_SIZE);
+}
+
+/**
+ * @brief Наибольшая длина текста в кадре сообщения.
+ * @param seq Номер сообщения (0 — без номера).
+ * @return Длина, при которой весь кадр укладывается в MAX_FRAME_SIZE.
+ */
+std::size_t maxText(std::uint64_t seq) {
+  return seq ? MAX_FRAME_SIZE - SEQUENCE_SIZE - FRAME_HEADER_SIZE
+             : MAX_FRAME_SIZE;
 }
 
+} // namespace
+
 void loadConfig(const std::string &filename, nlohmann::json &config) {
   std::ifstream config_file(filename);
   if (!config_file.is_open()) {
@@ -46,180 +101,1720 @@ void loadConfig(const std::string &filename, nlohmann::json &config) {
   config_file >> config;
 }
 
-chatRoom::chatRoom() { loadHistory(); }
+sessionConfig parseSessionConfig(const nlohmann::json &config) {
+  sessionConfig session;
+  session.write_batch_bytes =
+      config.value("write_batch_bytes", session.write_batch_bytes);
+  session.write_batch_buffers =
+      std::max<std::size_t>(1, config.value("write_batch_buffers",
+                                             session.write_batch_buffers));
+  session.write_coalesce_us =
+      config.value("write_coalesce_us", session.write_coalesce_us);
+  session.max_queue_bytes =
+      config.value("max_queue_bytes", session.max_queue_bytes);
+  session.max_queue_messages = std::max<std::size_t>(
+      1, config.value("max_queue_messages", session.max_queue_messages));
+  std::string policy = config.value("overflow_policy", std::string("coalesce"));
+  if (policy == "drop_oldest") {
+    session.overflow_policy = overflowPolicy::drop_oldest;
+  } else if (policy == "drop_newest") {
+    session.overflow_policy = overflowPolicy::drop_newest;
+  } else if (policy == "coalesce") {
+    session.overflow_policy = overflowPolicy::coalesce;
+  } else if (policy == "disconnect") {
+    session.overflow_policy = overflowPolicy::disconnect;
+  } else {
+    throw std::runtime_error("Неизвестная политика переполнения: " + policy);
+  }
+  session.overflow_grace_ms =
+      config.value("overflow_grace_ms", session.overflow_grace_ms);
+  session.idle_sessions = config.value("idle_sessions", session.idle_sessions);
+  session.handshake_timeout_ms =
+      config.value("handshake_timeout_ms", session.handshake_timeout_ms);
+  session.idle_timeout_ms =
+      config.value("idle_timeout_ms", session.idle_timeout_ms);
+  session.write_stall_timeout_ms =
+      config.value("write_stall_timeout_ms", session.write_stall_timeout_ms);
+  session.heartbeat_ms = config.value("heartbeat_ms", session.heartbeat_ms);
+  session.timer_tick_ms = std::max(
+      1u, config.value("timer_tick_ms", session.timer_tick_ms));
+  session.read_buffer_bytes = std::max<std::size_t>(
+      MAX_IP_PACK_SIZE,
+      config.value("read_buffer_bytes", session.read_buffer_bytes));
+  session.message_rate = config.value("message_rate", session.message_rate);
+  session.message_burst =
+      config.value("message_burst", session.message_burst);
+  std::string throttle =
+      config.value("throttle_policy", std::string("notice"));
+  if (throttle == "drop") {
+    session.throttle_policy = throttlePolicy::drop;
+  } else if (throttle == "notice") {
+    session.throttle_policy = throttlePolicy::notice;
+  } else if (throttle == "delay") {
+    session.throttle_policy = throttlePolicy::delay;
+  } else {
+    throw std::runtime_error("Неизвестная политика ограничения частоты: " +
+                             throttle);
+  }
+  return session;
+}
+
+overflowStats sessionOverflowStats() {
+  metrics &registry = metrics::instance();
+  overflowStats stats;
+  stats.dropped_oldest = registry.total(metricCounter::dropped_oldest);
+  stats.dropped_newest = registry.total(metricCounter::dropped_newest);
+  stats.coalesced = registry.total(metricCounter::coalesced);
+  stats.disconnected = registry.total(metricCounter::disconnected);
+  return stats;
+}
+
+listenerConfig parseListenerConfig(const nlohmann::json &config,
+                                   listenerConfig base) {
+  base.pending_accepts =
+      std::max(1u, config.value("pending_accepts", base.pending_accepts));
+  base.listen_backlog = config.value("listen_backlog", base.listen_backlog);
+  base.tcp_nodelay = config.value("tcp_nodelay", base.tcp_nodelay);
+  base.send_buffer_bytes =
+      config.value("send_buffer_bytes", base.send_buffer_bytes);
+  base.receive_buffer_bytes =
+      config.value("receive_buffer_bytes", base.receive_buffer_bytes);
+  base.defer_accept_s = config.value("defer_accept_s", base.defer_accept_s);
+  base.keepalive = config.value("keepalive", base.keepalive);
+  base.keepalive_idle_s =
+      config.value("keepalive_idle_s", base.keepalive_idle_s);
+  base.keepalive_interval_s =
+      config.value("keepalive_interval_s", base.keepalive_interval_s);
+  base.keepalive_count =
+      config.value("keepalive_count", base.keepalive_count);
+  return base;
+}
+
+const listenerConfig &portListenerConfig(const serverConfig &config,
+                                         unsigned short port) {
+  auto it = config.port_listeners.find(port);
+  return it != config.port_listeners.end() ? it->second : config.listener;
+}
+
+serverConfig parseServerConfig(const nlohmann::json &config) {
+  serverConfig server_config;
+  server_config.session = parseSessionConfig(config);
+  server_config.history = parseHistoryConfig(config);
+  server_config.room_limits.message_rate = config.value(
+      "room_message_rate", server_config.room_limits.message_rate);
+  server_config.room_limits.message_burst = config.value(
+      "room_message_burst", server_config.room_limits.message_burst);
+  if (config.contains("listener")) {
+    server_config.listener = parseListenerConfig(config["listener"]);
+  }
+  // Параметры портов задаются поверх общих: {"12346": {"tcp_nodelay": true}}.
+  if (config.contains("port_listeners")) {
+    for (auto &item : config["port_listeners"].items()) {
+      unsigned long port = std::stoul(item.key());
+      if (port == 0 || port > 65535) {
+        throw std::runtime_error("Неверный порт в port_listeners: " +
+                                 item.key());
+      }
+      server_config.port_listeners[static_cast<unsigned short>(port)] =
+          parseListenerConfig(item.value(), server_config.listener);
+    }
+  }
+  return server_config;
+}
+
+void pinThread(boost::thread &thread, unsigned cpu) {
+#ifdef __linux__
+  cpu_set_t cpuset;
+  CPU_ZERO(&cpuset);
+  CPU_SET(cpu, &cpuset);
+  pthread_setaffinity_np(thread.native_handle(), sizeof(cpu_set_t), &cpuset);
+#endif
+}
+
+void runWorker(boost::asio::io_service &io_service) {
+  for (;;) {
+    try {
+      io_service.run();
+      return;
+    } catch (std::exception &e) {
+      metricAdd(metricCounter::worker_errors);
+      log(std::string("Исключение в рабочем потоке: ") + e.what(),
+          logLevel::error);
+    }
+  }
+}
 
-void chatRoom::enter(std::shared_ptr<participant> participant,
-                     const std::string &nickname) {
-  participants_.insert(participant);
-  name_table_[participant] = nickname;
-  for (auto &msg : recent_msgs_) {
-    participant->onMessage(msg);
+messagePtr chatMessage::make(const std::string &text,
+                             std::uint64_t timestamp_ms, std::uint64_t seq) {
+  std::size_t length = std::min(text.size(), maxText(seq));
+  std::string frame;
+  frame.reserve((seq ? SEQUENCE_PREFIX_SIZE : 0) + FRAME_HEADER_SIZE +
+                length);
+  if (seq) {
+    appendSequencePrefix(seq, length, frame);
   }
-  log("Пользователь " + nickname + " вошел в комнату.");
+  frameHeader header;
+  encodeHeader(static_cast<std::uint32_t>(length), FRAME_TEXT, header);
+  frame.append(header.data(), header.size());
+  frame.append(text, 0, length);
+  return std::make_shared<const chatMessage>(std::move(frame), false,
+                                             timestamp_ms, seq);
 }
 
-void chatRoom::leave(std::shared_ptr<participant> participant) {
-  std::string nickname = name_table_[participant];
-  participants_.erase(participant);
-  name_table_.erase(participant);
-  log("Пользователь " + nickname + " вышел из комнаты.");
+messagePtr chatMessage::makeRaw(const std::string &bytes) {
+  return std::make_shared<const chatMessage>(bytes, true);
 }
 
-void chatRoom::broadcast(std::array<char, MAX_IP_PACK_SIZE> &msg,
-                         std::shared_ptr<participant> participant) {
-  std::string timestamp = getTimestamp();
-  std::string nickname = getNickname(participant);
-  std::array<char, MAX_IP_PACK_SIZE> formatted_msg;
+messagePtr chatMessage::render(const std::string &nickname,
+                               std::uint64_t timestamp_ms,
+                               const std::string &body, std::uint64_t seq) {
+  std::size_t length = std::min<std::size_t>(
+      TIMESTAMP_SIZE + nickname.size() + body.size(), maxText(seq));
+  std::size_t prefix = seq ? SEQUENCE_PREFIX_SIZE : 0;
+  frameHeader header;
+  encodeHeader(static_cast<std::uint32_t>(length), FRAME_TEXT, header);
+  std::string frame;
+  frame.reserve(prefix + FRAME_HEADER_SIZE + TIMESTAMP_SIZE +
+                nickname.size() + body.size());
+  if (seq) {
+    appendSequencePrefix(seq, length, frame);
+  }
+  frame.append(header.data(), header.size());
+  frame.append(cachedTimestamp(static_cast<std::time_t>(timestamp_ms / 1000)),
+               TIMESTAMP_SIZE);
+  frame.append(nickname).append(body);
+  frame.resize(prefix + FRAME_HEADER_SIZE + length);
+  return std::make_shared<const chatMessage>(std::move(frame), false,
+                                             timestamp_ms, seq);
+}
+
+messagePtr chatMessage::makeBatch(const std::vector<messagePtr> &msgs) {
+  if (msgs.size() <= 1) {
+    return msgs.empty() ? nullptr : msgs.front();
+  }
+  std::size_t bytes = 0;
+  std::size_t plain_bytes = 0;
+  std::size_t count = 0;
+  for (const messagePtr &msg : msgs) {
+    bytes += msg->frame_.size();
+    plain_bytes += msg->frame_.size() - msg->offset_;
+    count += msg->count_;
+  }
+  std::string frames;
+  frames.reserve(bytes);
+  for (const messagePtr &msg : msgs) {
+    frames.append(msg->frame_);
+  }
+  // Кадры версии 1 нужны отдельной строкой, только если есть номера.
+  std::string plain;
+  if (plain_bytes != bytes) {
+    plain.reserve(plain_bytes);
+    for (const messagePtr &msg : msgs) {
+      plain.append(msg->frame_, msg->offset_, std::string::npos);
+    }
+  }
+  const chatMessage &last = *msgs.back();
+  return std::make_shared<const chatMessage>(std::move(frames), false,
+                                             last.timestamp_ms_, last.seq_,
+                                             count, std::move(plain));
+}
 
-  strcpy(formatted_msg.data(), timestamp.c_str());
-  strcat(formatted_msg.data(), nickname.c_str());
-  strcat(formatted_msg.data(), msg.data());
+chatMessage::chatMessage(std::string bytes, bool raw,
+                         std::uint64_t timestamp_ms, std::uint64_t seq,
+                         std::size_t count, std::string plain)
+    : frame_(std::move(bytes)), raw_(raw), timestamp_ms_(timestamp_ms),
+      seq_(seq), count_(count),
+      offset_(seq && count == 1 ? SEQUENCE_PREFIX_SIZE : 0),
+      plain_(std::move(plain)) {}
+
+std::string chatMessage::text() const {
+  if (raw_) {
+    return frame_;
+  }
+  if (count_ == 1) {
+    return frame_.substr(offset_ + FRAME_HEADER_SIZE);
+  }
+  std::string text;
+  for (const std::string &payload : payloads()) {
+    if (!text.empty()) {
+      text += '\n';
+    }
+    text += payload;
+  }
+  return text;
+}
+
+std::vector<std::string> chatMessage::payloads() const {
+  std::vector<std::string> result;
+  std::size_t offset = 0;
+  while (offset + FRAME_HEADER_SIZE <= frame_.size()) {
+    frameHeader header;
+    std::copy(frame_.begin() + offset,
+              frame_.begin() + offset + FRAME_HEADER_SIZE, header.begin());
+    std::uint32_t length;
+    frameType type;
+    decodeHeader(header, length, type);
+    // Из кадра с номером берётся текст вложенного кадра.
+    std::size_t skip = type == FRAME_SEQUENCED
+                           ? FRAME_HEADER_SIZE + SEQUENCE_PREFIX_SIZE
+                           : FRAME_HEADER_SIZE;
+    result.push_back(
+        frame_.substr(offset + skip, FRAME_HEADER_SIZE + length - skip));
+    offset += FRAME_HEADER_SIZE + length;
+  }
+  return result;
+}
+
+boost::asio::const_buffer chatMessage::wire(std::uint8_t version) const {
+  if (raw_ || version >= PROTOCOL_RESUMABLE) {
+    return boost::asio::buffer(frame_);
+  }
+  if (version == PROTOCOL_FRAMED) {
+    if (!plain_.empty()) {
+      return boost::asio::buffer(plain_);
+    }
+    return boost::asio::buffer(frame_.data() + offset_,
+                               frame_.size() - offset_);
+  }
+  std::call_once(legacy_once_, [this]() {
+    for (const std::string &payload : payloads()) {
+      legacy_ += makeLegacyPacket(payload);
+    }
+  });
+  return boost::asio::buffer(legacy_);
+}
+
+chatRoom::chatRoom(const std::string &name, const historyConfig &history)
+    : name_(name), group_(nullptr), history_(openHistoryStore(history, name)),
+      recent_msgs_(max_recent_msgs), last_seq_(0) {
+  loadHistory();
+}
+
+const std::string &chatRoom::name() const { return name_; }
+
+bool chatRoom::empty() {
+  std::lock_guard<std::mutex> lock(mutex_);
+  return members_.empty();
+}
+
+std::size_t chatRoom::size() {
+  std::lock_guard<std::mutex> lock(mutex_);
+  return members_.size();
+}
+
+memberHandle chatRoom::enter(std::shared_ptr<participant> participant,
+                             const internedName &nickname,
+                             std::uint64_t after_seq) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  // История уходит участнику одним сообщением-пачкой.
+  messagePtr backlog;
+  if (after_seq == 0) {
+    backlog = batchLocked(0);
+  } else {
+    metricAdd(metricCounter::resumes);
+    std::size_t first = recent_msgs_.size();
+    while (first > 0 && recent_msgs_[first - 1]->seq() > after_seq) {
+      --first;
+    }
+    std::uint64_t newest =
+        recent_msgs_.empty() ? last_seq_ : recent_msgs_.back()->seq();
+    bool gap = after_seq > newest ||
+               (first == 0 && !recent_msgs_.empty() &&
+                recent_msgs_.front()->seq() > after_seq + 1);
+    if (!gap) {
+      backlog = batchLocked(first);
+      // Пропуск не влез в предел пачки целиком.
+      gap = backlog && backlog->count() < recent_msgs_.size() - first;
+    }
+    if (gap) {
+      static const messagePtr gap_frame =
+          chatMessage::makeRaw(makeFrame(std::string(), FRAME_GAP));
+      metricAdd(metricCounter::resume_gaps);
+      participant->onMessage(gap_frame);
+      backlog = batchLocked(0);
+    }
+  }
+  if (backlog) {
+    participant->onMessage(backlog);
+  }
+  log("Пользователь " + nickname.str() + " вошел в комнату.");
+  return members_.insert(std::move(participant), nickname);
+}
+
+memberHandle chatRoom::enter(std::shared_ptr<participant> participant,
+                             const std::string &nickname) {
+  return enter(std::move(participant), internedName(nickname));
+}
+
+void chatRoom::leave(memberHandle handle) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  const member *entry = members_.find(handle);
+  if (!entry) {
+    return;
+  }
+  log("Пользователь " + entry->name() + " вышел из комнаты.");
+  members_.erase(handle);
+}
+
+bool nicknameIndex::claim(const std::string &nickname,
+                          std::weak_ptr<participant> owner) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  std::weak_ptr<participant> &entry = owners_[nickname];
+  if (!entry.expired()) {
+    return false;
+  }
+  entry = std::move(owner);
+  return true;
+}
+
+void nicknameIndex::release(const std::string &nickname,
+                            const participant *owner) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  auto it = owners_.find(nickname);
+  if (it == owners_.end()) {
+    return;
+  }
+  std::shared_ptr<participant> current = it->second.lock();
+  if (!current || current.get() == owner) {
+    owners_.erase(it);
+  }
+}
+
+std::shared_ptr<participant> nicknameIndex::find(const std::string &nickname) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  auto it = owners_.find(nickname);
+  return it != owners_.end() ? it->second.lock() : nullptr;
+}
+
+std::size_t nicknameIndex::size() {
+  std::lock_guard<std::mutex> lock(mutex_);
+  return owners_.size();
+}
+
+bool chatRoom::broadcast(const std::string &msg, memberHandle sender) {
+  std::unique_lock<std::mutex> lock(mutex_);
+  const member *entry = members_.find(sender);
+  if (!entry) {
+    return true;
+  }
+  std::uint64_t now = std::chrono::duration_cast<std::chrono::milliseconds>(
+                          std::chrono::system_clock::now().time_since_epoch())
+                          .count();
+  if (group_) {
+    chatRecord record{entry->nickname, now, msg};
+    lock.unlock();
+    group_->publish(name_, std::move(record));
+    return true;
+  }
+  if (!admitLocked()) {
+    return false;
+  }
+  deliverLocked(commit(entry->name(), now, msg));
+  return true;
+}
+
+void chatRoom::setRateLimit(const roomLimits &limits) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  limiter_.configure(limits.message_rate, limits.message_burst);
+}
+
+bool chatRoom::admit() {
+  std::lock_guard<std::mutex> lock(mutex_);
+  return admitLocked();
+}
+
+bool chatRoom::admitLocked() {
+  if (limiter_.take(rateClockNs()) != 0) {
+    metricAdd(metricCounter::room_throttled);
+    return false;
+  }
+  return true;
+}
 
+void chatRoom::attach(roomGroup *group) { group_ = group; }
+
+messagePtr chatRoom::commit(const std::string &nickname,
+                            std::uint64_t timestamp_ms,
+                            const std::string &msg) {
+  messagePtr formatted_msg =
+      chatMessage::render(nickname, timestamp_ms, msg, ++last_seq_);
+  if (logger::instance().enabled(logLevel::info)) {
+    std::string line;
+    line.reserve(13 + nickname.size() + msg.size());
+    line.append("Сообщение от ").append(nickname).append(msg);
+    log(line);
+  }
+  saveMessage(timestamp_ms, formatted_msg->text());
+  return formatted_msg;
+}
+
+void chatRoom::deliver(const messagePtr &formatted_msg) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  deliverLocked(formatted_msg);
+}
+
+void chatRoom::deliverLocked(const messagePtr &formatted_msg) {
+  auto start = std::chrono::steady_clock::now();
+  // Кольцевой буфер сам вытесняет самое старое сообщение.
   recent_msgs_.push_back(formatted_msg);
-  while (recent_msgs_.size() > max_recent_msgs) {
-    recent_msgs_.pop_front();
+  backlog_.reset();
+
+  for (const member &m : members_) {
+    m.session->onMessage(formatted_msg);
   }
+  metricAdd(metricCounter::deliveries, members_.size());
+  metricRecord(metricHistogram::fanout_size, members_.size());
+  metricRecord(metricHistogram::fanout_ns, elapsedNs(start));
+}
 
-  log("Сообщение от " + nickname + ": " + msg.data());
-  saveMessage(formatted_msg);
+messagePtr chatRoom::backlog(std::size_t count, std::uint64_t since_ms) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  return backlogLocked(count, since_ms);
+}
 
-  for (auto &p : participants_) {
-    p->onMessage(formatted_msg);
+messagePtr chatRoom::backlogLocked(std::size_t count,
+                                   std::uint64_t since_ms) {
+  std::size_t first =
+      recent_msgs_.size() - std::min(count, recent_msgs_.size());
+  while (first < recent_msgs_.size() &&
+         recent_msgs_[first]->timestamp() < since_ms) {
+    ++first;
+  }
+  return batchLocked(first);
+}
+
+messagePtr chatRoom::batchLocked(std::size_t first) {
+  // Самые старые сообщения, не влезающие в предел пачки, отбрасываются.
+  std::size_t bytes = 0;
+  std::size_t last = recent_msgs_.size();
+  std::size_t begin = last;
+  while (begin > first) {
+    std::size_t size =
+        recent_msgs_[begin - 1]->wire(PROTOCOL_RESUMABLE).size();
+    if (bytes + size > MAX_BACKLOG_BYTES) {
+      break;
+    }
+    bytes += size;
+    --begin;
   }
+  if (begin == last) {
+    return nullptr;
+  }
+  // Запрос всей истории (как при входе) обслуживается из кеша.
+  bool full = first == 0;
+  if (full && backlog_) {
+    return backlog_;
+  }
+  std::vector<messagePtr> msgs(recent_msgs_.begin() + begin,
+                               recent_msgs_.end());
+  messagePtr batch = chatMessage::makeBatch(msgs);
+  if (full) {
+    backlog_ = batch;
+  }
+  return batch;
 }
 
-std::string chatRoom::getNickname(std::shared_ptr<participant> participant) {
-  return name_table_[participant];
+internedName chatRoom::getNickname(memberHandle handle) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  const member *entry = members_.find(handle);
+  return entry ? entry->nickname : internedName();
 }
 
-void chatRoom::saveMessage(const std::array<char, MAX_IP_PACK_SIZE> &msg) {
-  std::ofstream file("chat_history.txt", std::ios::app);
-  if (file.is_open()) {
-    file << msg.data() << std::endl;
+messagePtr chatRoom::search(const searchQuery &query) {
+  // Мьютекс комнаты не нужен: у хранилища истории свои блокировки.
+  std::vector<messagePtr> found;
+  for (const historyRecord &record : history_->search(query)) {
+    found.push_back(chatMessage::make(record.text, record.timestamp_ms));
   }
+  return chatMessage::makeBatch(found);
+}
+
+bool chatRoom::searchable() const { return history_->searchable(); }
+
+bool chatRoom::searchReady() { return history_->searchReady(); }
+
+void chatRoom::saveMessage(std::uint64_t timestamp_ms, std::string msg) {
+  history_->append(timestamp_ms, std::move(msg));
 }
 
 void chatRoom::loadHistory() {
-  std::ifstream file("chat_history.txt");
-  if (file.is_open()) {
-    std::string line;
-    while (std::getline(file, line)) {
-      std::array<char, MAX_IP_PACK_SIZE> msg;
-      std::fill(msg.begin(), msg.end(), 0);
-      std::copy(line.begin(), line.end(), msg.begin());
-      recent_msgs_.push_back(msg);
+  // Читается только хвост, нужный для истории новых участников. Номер
+  // сообщения — его порядковый номер в хранилище.
+  std::vector<historyRecord> records = history_->tail(max_recent_msgs);
+  last_seq_ = history_->size();
+  std::uint64_t seq = last_seq_ - records.size();
+  for (historyRecord &record : records) {
+    recent_msgs_.push_back(
+        chatMessage::make(record.text, record.timestamp_ms, ++seq));
+  }
+}
+
+roomRegistry::roomRegistry(const historyConfig &history,
+                           const roomLimits &limits)
+    : history_(history), limits_(limits),
+      nicknames_(std::make_shared<nicknameIndex>()), group_(nullptr),
+      shard_index_(0) {
+  obtainLocked(DEFAULT_ROOM);
+}
+
+nicknameIndex &roomRegistry::nicknames() { return *nicknames_; }
+
+bool roomRegistry::validName(const std::string &name) {
+  if (name.empty() || name.size() > MAX_ROOM_NAME) {
+    return false;
+  }
+  return std::all_of(name.begin(), name.end(), [](char c) {
+    return std::isalnum(static_cast<unsigned char>(c)) || c == '_' ||
+           c == '-';
+  });
+}
+
+std::shared_ptr<chatRoom>
+roomRegistry::join(const std::string &name,
+                   std::shared_ptr<participant> participant,
+                   const std::string &nickname, memberHandle &handle) {
+  return join(name, std::move(participant), internedName(nickname), handle);
+}
+
+std::shared_ptr<chatRoom>
+roomRegistry::join(const std::string &name,
+                   std::shared_ptr<participant> participant,
+                   const internedName &nickname, memberHandle &handle,
+                   std::uint64_t after_seq) {
+  // Вход выполняется под мьютексом реестра, чтобы комнату не удалили
+  // между поиском и входом.
+  std::lock_guard<std::mutex> lock(mutex_);
+  std::shared_ptr<chatRoom> room = obtainLocked(name)->second.room;
+  handle = room->enter(std::move(participant), nickname, after_seq);
+  return room;
+}
+
+void roomRegistry::leave(const std::shared_ptr<chatRoom> &room,
+                         memberHandle handle) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  room->leave(handle);
+  auto it = rooms_.find(room->name());
+  if (it != rooms_.end() && it->second.room == room) {
+    collectLocked(it);
+  }
+}
+
+std::shared_ptr<chatRoom> roomRegistry::find(const std::string &name) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  auto it = rooms_.find(name);
+  return it == rooms_.end() ? nullptr : it->second.room;
+}
+
+chatRoom &roomRegistry::defaultRoom() { return *find(DEFAULT_ROOM); }
+
+std::size_t roomRegistry::size() {
+  std::lock_guard<std::mutex> lock(mutex_);
+  return rooms_.size();
+}
+
+void roomRegistry::attach(roomGroup *group, std::size_t shard_index,
+                          std::shared_ptr<nicknameIndex> nicknames) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  group_ = group;
+  shard_index_ = shard_index;
+  nicknames_ = std::move(nicknames);
+  for (auto &entry : rooms_) {
+    entry.second.room->attach(group_);
+    if (!homeLocked(entry.first)) {
+      group_->replica(entry.first, shard_index_, true);
+    }
+  }
+}
+
+messagePtr roomRegistry::commit(const std::string &name,
+                                const chatRecord &record,
+                                std::vector<std::size_t> &shards) {
+  std::shared_ptr<chatRoom> room;
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    roomMap::iterator it = obtainLocked(name);
+    room = it->second.room;
+    shards = it->second.replicas;
+  }
+  if (!room->admit()) {
+    shards.clear();
+    return nullptr;
+  }
+  messagePtr formatted_msg =
+      room->commit(record.sender.str(), record.timestamp_ms, record.body);
+  room->deliver(formatted_msg);
+  if (shards.empty() && room->empty()) {
+    // Реплики успели исчезнуть, пока сообщение шло на домашний шард.
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto it = rooms_.find(name);
+    if (it != rooms_.end() && it->second.room == room) {
+      collectLocked(it);
+    }
+  }
+  return formatted_msg;
+}
+
+void roomRegistry::deliver(const std::string &name,
+                           const messagePtr &formatted_msg) {
+  // Реплику могли удалить, пока сообщение шло с домашнего шарда.
+  std::shared_ptr<chatRoom> room = find(name);
+  if (room) {
+    room->deliver(formatted_msg);
+  }
+}
+
+void roomRegistry::replica(const std::string &name, std::size_t shard_index,
+                           bool alive) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  if (alive) {
+    std::vector<std::size_t> &replicas = obtainLocked(name)->second.replicas;
+    if (std::find(replicas.begin(), replicas.end(), shard_index) ==
+        replicas.end()) {
+      replicas.push_back(shard_index);
     }
+    return;
+  }
+  auto it = rooms_.find(name);
+  if (it == rooms_.end()) {
+    return;
+  }
+  std::vector<std::size_t> &replicas = it->second.replicas;
+  replicas.erase(std::remove(replicas.begin(), replicas.end(), shard_index),
+                 replicas.end());
+  collectLocked(it);
+}
+
+roomRegistry::roomMap::iterator
+roomRegistry::obtainLocked(const std::string &name) {
+  auto it = rooms_.find(name);
+  if (it != rooms_.end()) {
+    return it;
+  }
+  auto room = std::make_shared<chatRoom>(name, history_);
+  room->setRateLimit(limits_);
+  if (group_) {
+    room->attach(group_);
+  }
+  it = rooms_.emplace(name, roomEntry{room, {}}).first;
+  if (!homeLocked(name)) {
+    group_->replica(name, shard_index_, true);
+  }
+  return it;
+}
+
+void roomRegistry::collectLocked(roomMap::iterator it) {
+  if (it->first == DEFAULT_ROOM || !it->second.replicas.empty() ||
+      !it->second.room->empty()) {
+    return;
+  }
+  std::string name = it->first;
+  rooms_.erase(it);
+  if (!homeLocked(name)) {
+    group_->replica(name, shard_index_, false);
   }
 }
 
+bool roomRegistry::homeLocked(const std::string &name) const {
+  return !group_ || group_->home(name) == shard_index_;
+}
+
 personInRoom::personInRoom(boost::asio::io_service &io_service,
-                           boost::asio::io_service::strand &strand,
-                           chatRoom &room)
-    : socket_(io_service), strand_(strand), room_(room) {}
+                           roomRegistry &rooms, const sessionConfig &config)
+    : socket_(io_service), strand_(io_service), rooms_(rooms),
+      member_(INVALID_MEMBER), rejected_(false), config_(config),
+      coalesce_timer_(io_service),
+      throttle_timer_(io_service), throttle_noticed_(false),
+      body_pending_(false), flush_scheduled_(false), stalled_(false),
+      writing_(0), writing_bytes_(0), queued_bytes_(0), skipped_(0),
+      version_(PROTOCOL_LEGACY),
+      read_buf_(std::max<std::size_t>(config.read_buffer_bytes,
+                                      MAX_IP_PACK_SIZE)),
+      read_begin_(0), read_end_(0),
+      wheel_(boost::asio::use_service<timingWheel>(io_service)),
+      armed_until_(std::chrono::steady_clock::time_point::max()),
+      handshaken_(false), read_type_(FRAME_TEXT) {
+  nickname_.fill('\0');
+  limiter_.configure(config.message_rate, config.message_burst);
+}
+
+personInRoom::~personInRoom() { wheel_.cancel(timer_); }
+
+void personInRoom::recycle() {
+  wheel_.cancel(timer_);
+  armed_until_ = std::chrono::steady_clock::time_point::max();
+  timer_.target.reset();
+  handshaken_ = false;
+  boost::system::error_code ignored;
+  socket_.close(ignored);
+  room_.reset();
+  member_ = INVALID_MEMBER;
+  display_name_ = internedName();
+  if (!claimed_nickname_.empty()) {
+    rooms_.nicknames().release(claimed_nickname_, this);
+    claimed_nickname_.clear();
+  }
+  rejected_ = false;
+  flush_scheduled_ = false;
+  stalled_ = false;
+  limiter_.reset();
+  throttle_noticed_ = false;
+  body_pending_ = false;
+  writing_ = 0;
+  writing_bytes_ = 0;
+  queued_bytes_ = 0;
+  skipped_ = 0;
+  write_bufs_.clear();
+  write_msgs_.clear();
+  version_ = PROTOCOL_LEGACY;
+  nickname_.fill('\0');
+  read_begin_ = 0;
+  read_end_ = 0;
+  // Буфер под случайный длинный кадр в пуле не держим.
+  if (read_body_.capacity() > MAX_IP_PACK_SIZE) {
+    std::string().swap(read_body_);
+  } else {
+    read_body_.clear();
+  }
+  std::lock_guard<std::mutex> lock(inbox_mutex_);
+  inbox_.clear();
+  draining_.clear();
+}
 
 tcp::socket &personInRoom::socket() { return socket_; }
 
 void personInRoom::start() {
   auto self(shared_from_this());
+  timer_.target = self;
+  last_read_ = std::chrono::steady_clock::now();
+  last_ping_ = last_read_;
+  armTimer();
   boost::asio::async_read(
       socket_, boost::asio::buffer(nickname_, nickname_.size()),
-      strand_.wrap(boost::bind(&personInRoom::nicknameHandler, self, _1)));
+      boost::asio::bind_executor(strand_, makeAllocHandler(
+          read_memory_,
+          boost::bind(&personInRoom::nicknameHandler, self, _1))));
 }
 
-void personInRoom::onMessage(std::array<char, MAX_IP_PACK_SIZE> &msg) {
+void personInRoom::onMessage(const messagePtr &msg) {
+  std::lock_guard<std::mutex> lock(inbox_mutex_);
+  inbox_.push_back(msg);
+  if (inbox_.size() == 1) {
+    // Задача уже стоит в странде, если входящие не пусты.
+    auto self(shared_from_this());
+    strand_.post(makeAllocHandler(
+        inbox_memory_, boost::bind(&personInRoom::drainInbox, self)));
+  }
+}
+
+void personInRoom::expired() {
   auto self(shared_from_this());
-  bool write_in_progress = !write_msgs_.empty();
+  strand_.post(makeAllocHandler(
+      timer_memory_, boost::bind(&personInRoom::timerHandler, self)));
+}
+
+void personInRoom::armTimer() {
+  typedef std::chrono::milliseconds ms;
+  std::chrono::steady_clock::time_point deadline =
+      std::chrono::steady_clock::time_point::max();
+  if (!handshaken_ && config_.handshake_timeout_ms != 0) {
+    deadline = std::min(deadline,
+                        last_read_ + ms(config_.handshake_timeout_ms));
+  }
+  if (handshaken_ && config_.idle_timeout_ms != 0) {
+    deadline = std::min(deadline, last_read_ + ms(config_.idle_timeout_ms));
+  }
+  if (handshaken_ && version_ != PROTOCOL_LEGACY &&
+      config_.heartbeat_ms != 0) {
+    deadline = std::min(deadline, std::max(last_read_, last_ping_) +
+                                      ms(config_.heartbeat_ms));
+  }
+  if (writing_ != 0 && config_.write_stall_timeout_ms != 0) {
+    deadline = std::min(deadline,
+                        write_started_ + ms(config_.write_stall_timeout_ms));
+  }
+  if (stalled_) {
+    deadline = std::min(deadline, stall_deadline_);
+  }
+  // Колесо общее для потоков пула, а перевзвод идёт при каждой отправке
+  // (срок зависшей записи). Более поздний срок колесо всё равно не примет,
+  // поэтому его мьютекс берётся, только если новый срок раньше взведённого.
+  if (deadline < armed_until_) {
+    armed_until_ = deadline;
+    wheel_.arm(timer_, deadline);
+  }
+}
+
+void personInRoom::timerHandler() {
+  // Таймер снят колесом; ниже он взводится заново.
+  armed_until_ = std::chrono::steady_clock::time_point::max();
+  if (!socket_.is_open()) {
+    return;
+  }
+  // Входящие данные и записи таймер не перевзводят: сроки сверяются здесь,
+  // а таймер взводится на ближайший из них.
+  typedef std::chrono::milliseconds ms;
+  auto now = std::chrono::steady_clock::now();
+  if (!handshaken_ && config_.handshake_timeout_ms != 0 &&
+      now - last_read_ >= ms(config_.handshake_timeout_ms)) {
+    timeout("не прислал никнейм");
+    return;
+  }
+  if (writing_ != 0 && config_.write_stall_timeout_ms != 0 &&
+      now - write_started_ >= ms(config_.write_stall_timeout_ms)) {
+    timeout("не принимает данные");
+    return;
+  }
+  if (stalled_ && now >= stall_deadline_) {
+    stalled_ = false;
+    if (!drained()) {
+      log("Участник " + display_name_.str() + "не успевает читать сообщения, " +
+              "в очереди " + std::to_string(write_msgs_.size()) +
+              " сообщений, отключение",
+          logLevel::warning);
+      metricAdd(metricCounter::disconnected);
+      teardown();
+      return;
+    }
+  }
+  if (handshaken_ && config_.idle_timeout_ms != 0 &&
+      now - last_read_ >= ms(config_.idle_timeout_ms)) {
+    timeout("молчит");
+    return;
+  }
+  if (handshaken_ && version_ != PROTOCOL_LEGACY &&
+      config_.heartbeat_ms != 0 &&
+      now - std::max(last_read_, last_ping_) >= ms(config_.heartbeat_ms)) {
+    static const messagePtr ping =
+        chatMessage::makeRaw(makeFrame(std::string(), FRAME_PING));
+    last_ping_ = now;
+    deliver(ping);
+  }
+  armTimer();
+}
+
+void personInRoom::timeout(const std::string &reason) {
+  log("Участник " + display_name_.str() + reason + ", отключение по таймауту",
+      logLevel::warning);
+  metricAdd(metricCounter::timeouts);
+  teardown();
+}
+
+void personInRoom::drainInbox() {
+  {
+    std::lock_guard<std::mutex> lock(inbox_mutex_);
+    inbox_.swap(draining_);
+  }
+  for (const messagePtr &msg : draining_) {
+    deliver(msg);
+  }
+  draining_.clear();
+}
+
+void personInRoom::reserveQueue() {
+  if (write_msgs_.full()) {
+    write_msgs_.set_capacity(
+        std::max<std::size_t>(16, 2 * write_msgs_.capacity()));
+  }
+}
+
+void personInRoom::enqueue(const messagePtr &msg) {
+  reserveQueue();
   write_msgs_.push_back(msg);
-  if (!write_in_progress) {
-    boost::asio::async_write(
-        socket_,
-        boost::asio::buffer(write_msgs_.front(), write_msgs_.front().size()),
-        strand_.wrap(boost::bind(&personInRoom::writeHandler, self, _1)));
+  queued_bytes_ += msg->wire(version_).size();
+}
+
+void personInRoom::deliver(const messagePtr &msg) {
+  // Служебные кадры (FRAME_ROOM, FRAME_GAP, проверка связи) встают в
+  // очередь всегда: без них клиент неверно отнесёт номера сообщений.
+  std::size_t bytes = msg->wire(version_).size();
+  if (!msg->raw() && !fits(bytes) && !makeRoom(bytes)) {
+    return;
+  }
+  enqueue(msg);
+  metricRecord(metricHistogram::write_queue_depth, write_msgs_.size());
+  if (writing_ != 0 || flush_scheduled_) {
+    return;
+  }
+  if (config_.write_coalesce_us == 0) {
+    startWrite();
+    return;
+  }
+  // Сокет простаивает: ждём окно накопления, чтобы отправить пачку.
+  flush_scheduled_ = true;
+  auto self(shared_from_this());
+  coalesce_timer_.expires_after(
+      std::chrono::microseconds(config_.write_coalesce_us));
+  coalesce_timer_.async_wait(boost::asio::bind_executor(
+      strand_,
+      makeAllocHandler(coalesce_memory_,
+                       boost::bind(&personInRoom::coalesceHandler, self, _1))));
+}
+
+bool personInRoom::fits(std::size_t bytes) const {
+  return write_msgs_.size() < config_.max_queue_messages &&
+         queued_bytes_ + bytes <= config_.max_queue_bytes;
+}
+
+bool personInRoom::drained() const {
+  return 2 * write_msgs_.size() <= config_.max_queue_messages &&
+         2 * queued_bytes_ <= config_.max_queue_bytes;
+}
+
+bool personInRoom::makeRoom(std::size_t bytes) {
+  if (config_.overflow_policy == overflowPolicy::drop_newest ||
+      config_.overflow_policy == overflowPolicy::disconnect) {
+    metricAdd(metricCounter::dropped_newest);
+    if (config_.overflow_policy == overflowPolicy::disconnect && !stalled_) {
+      stalled_ = true;
+      stall_deadline_ = std::chrono::steady_clock::now() +
+                        std::chrono::milliseconds(config_.overflow_grace_ms);
+      armTimer();
+    }
+    return false;
+  }
+
+  // Сообщения, которые уже пишутся в сокет, и служебные кадры вытеснять
+  // нельзя.
+  std::size_t evicted = 0;
+  for (std::size_t i = writing_; i < write_msgs_.size() && !fits(bytes);) {
+    if (write_msgs_[i]->raw()) {
+      ++i;
+      continue;
+    }
+    queued_bytes_ -= write_msgs_[i]->wire(version_).size();
+    write_msgs_.erase(write_msgs_.begin() + i);
+    ++evicted;
+  }
+  if (config_.overflow_policy == overflowPolicy::coalesce) {
+    skipped_ += evicted;
+    metricAdd(metricCounter::coalesced, evicted);
+  } else {
+    metricAdd(metricCounter::dropped_oldest, evicted);
+  }
+  if (!fits(bytes)) {
+    metricAdd(metricCounter::dropped_newest);
+    return false;
+  }
+  return true;
+}
+
+void personInRoom::coalesceHandler(const boost::system::error_code &error) {
+  flush_scheduled_ = false;
+  if (!error && writing_ == 0 && !write_msgs_.empty()) {
+    startWrite();
+  }
+}
+
+void personInRoom::startWrite() {
+  if (skipped_ != 0) {
+    // Вытесненные сообщения заменяются одним уведомлением о пропуске.
+    messagePtr notice = chatMessage::make("Пропущено сообщений: " +
+                                          std::to_string(skipped_));
+    reserveQueue();
+    write_msgs_.push_front(notice);
+    queued_bytes_ += notice->wire(version_).size();
+    skipped_ = 0;
+  }
+
+  // Отправляем одной записью столько сообщений из очереди, сколько
+  // помещается в ограничения; первое уходит всегда.
+  write_bufs_.clear();
+  std::size_t bytes = 0;
+  for (const messagePtr &msg : write_msgs_) {
+    boost::asio::const_buffer buf = msg->wire(version_);
+    if (!write_bufs_.empty() &&
+        (write_bufs_.size() >= config_.write_batch_buffers ||
+         bytes + buf.size() > config_.write_batch_bytes)) {
+      break;
+    }
+    write_bufs_.push_back(buf);
+    bytes += buf.size();
   }
+  writing_ = write_bufs_.size();
+  writing_bytes_ = bytes;
+  write_started_ = std::chrono::steady_clock::now();
+  if (config_.write_stall_timeout_ms != 0) {
+    armTimer();
+  }
+
+  auto self(shared_from_this());
+  boost::asio::async_write(
+      socket_,
+      bufferView(write_bufs_.data(), write_bufs_.data() + write_bufs_.size()),
+      boost::asio::bind_executor(strand_, makeAllocHandler(
+          write_memory_,
+          boost::bind(&personInRoom::writeHandler, self, _1))));
+}
+
+void personInRoom::startRead() {
+  // Недочитанный хвост переносится в начало буфера, и одним вызовом
+  // читается столько пакетов, сколько поместится.
+  if (read_begin_ != 0) {
+    std::memmove(read_buf_.data(), read_buf_.data() + read_begin_,
+                 read_end_ - read_begin_);
+    read_end_ -= read_begin_;
+    read_begin_ = 0;
+  }
+  auto self(shared_from_this());
+  socket_.async_read_some(
+      boost::asio::buffer(read_buf_.data() + read_end_,
+                          read_buf_.size() - read_end_),
+      boost::asio::bind_executor(strand_, makeAllocHandler(
+          read_memory_,
+          boost::bind(&personInRoom::readHandler, self, _1, _2))));
 }
 
 void personInRoom::nicknameHandler(const boost::system::error_code &error) {
+  if (error == boost::asio::error::operation_aborted) {
+    // Сокет закрыл сам сервер (никнейм не пришёл вовремя).
+    return;
+  }
   if (error) {
-    room_.leave(shared_from_this());
-    log("Ошибка подключения: " + error.message());
-    throw std::runtime_error("Ошибка подключения: " + error.message());
+    // Клиент ушёл, не представившись: при большой текучке соединений это
+    // обычное дело, а не повод останавливать рабочий поток.
+    if (peerGone(error)) {
+      log("Клиент закрыл соединение до рукопожатия");
+    } else {
+      log("Ошибка подключения: " + error.message(), logLevel::error);
+    }
+    teardown();
     return;
   }
 
-  if (strlen(nickname_.data()) <= MAX_NICKNAME - 2) {
-    strcat(nickname_.data(), ": ");
-  } else {
-    nickname_[MAX_NICKNAME - 2] = ':';
-    nickname_[MAX_NICKNAME - 1] = ' ';
+  // Клиент запрашивает версию протокола в последнем байте пакета никнейма,
+  // сервер отвечает одним байтом с согласованной версией. Старым клиентам
+  // ответ не отправляется.
+  version_ = std::min(handshakeVersion(nickname_), PROTOCOL_VERSION);
+  std::string nickname = handshakeNickname(nickname_);
+  if (nickname.size() > MAX_NICKNAME - 2) {
+    nickname.resize(MAX_NICKNAME - 2);
+  }
+  if (!validNickname(nickname)) {
+    rejectNickname("Никнейм не может быть пустым или содержать пробелы и "
+                   "управляющие символы");
+    return;
   }
+  if (!rooms_.nicknames().claim(nickname, shared_from_this())) {
+    rejectNickname("Никнейм " + nickname + " уже занят");
+    return;
+  }
+  claimed_nickname_ = nickname;
+  display_name_ = internedName(nickname + ": ");
+  if (version_ != PROTOCOL_LEGACY) {
+    enqueue(
+        chatMessage::makeRaw(std::string(1, static_cast<char>(version_))));
+    if (writing_ == 0) {
+      startWrite();
+    }
+  }
+  // Клиент версии 2 сам называет комнату и последний номер в FRAME_RESUME.
+  if (version_ < PROTOCOL_RESUMABLE) {
+    enterRoom(DEFAULT_ROOM, 0);
+  }
+  handshaken_ = true;
+  last_read_ = std::chrono::steady_clock::now();
+  armTimer();
 
-  room_.enter(shared_from_this(), std::string(nickname_.data()));
+  startRead();
+}
 
+void personInRoom::rejectNickname(const std::string &notice) {
+  log(notice, logLevel::warning);
+  metricAdd(metricCounter::nickname_rejects);
+  rejected_ = true;
+  if (version_ != PROTOCOL_LEGACY) {
+    enqueue(chatMessage::makeRaw(
+        std::string(1, static_cast<char>(HANDSHAKE_REJECTED))));
+  }
+  enqueue(chatMessage::make(notice));
+  if (writing_ == 0) {
+    startWrite();
+  }
+}
+
+void personInRoom::drainRejected(const boost::system::error_code &error) {
+  if (error) {
+    teardown();
+    return;
+  }
   auto self(shared_from_this());
-  boost::asio::async_read(
-      socket_, boost::asio::buffer(read_msg_, read_msg_.size()),
-      strand_.wrap(boost::bind(&personInRoom::readHandler, self, _1)));
+  socket_.async_read_some(
+      boost::asio::buffer(read_buf_),
+      boost::asio::bind_executor(strand_, makeAllocHandler(
+          read_memory_,
+          boost::bind(&personInRoom::drainRejected, self, _1))));
 }
 
-void personInRoom::readHandler(const boost::system::error_code &error) {
+void personInRoom::readHandler(const boost::system::error_code &error,
+                               std::size_t bytes) {
+  if (error == boost::asio::error::operation_aborted ||
+      (error && !socket_.is_open())) {
+    // Сокет закрыл сам сервер (переполнение очереди, слишком длинный кадр,
+    // ошибка записи).
+    return;
+  }
   if (error) {
-    if (error == boost::asio::error::eof) {
+    if (peerGone(error)) {
       log("Клиент закрыл соединение: " + error.message());
     } else {
-      log("Ошибка чтения сообщения: " + error.message());
+      log("Ошибка чтения сообщения: " + error.message(), logLevel::error);
     }
-    room_.leave(shared_from_this());
-    throw std::runtime_error("Ошибка чтения сообщения: " + error.message());
+    teardown();
     return;
   }
 
-  room_.broadcast(read_msg_, shared_from_this());
+  last_read_ = std::chrono::steady_clock::now();
+  metricAdd(metricCounter::reads);
+  metricAdd(metricCounter::bytes_in, bytes);
+  read_end_ += bytes;
+  if (processInput()) {
+    startRead();
+  }
+}
+
+bool personInRoom::processInput() {
+  // Разбираем все целые пакеты или кадры, прочитанные одним вызовом.
+  while (socket_.is_open()) {
+    const char *data = read_buf_.data() + read_begin_;
+    std::size_t available = read_end_ - read_begin_;
+    if (version_ == PROTOCOL_LEGACY) {
+      if (available < MAX_IP_PACK_SIZE) {
+        break;
+      }
+      if (!readyForText()) {
+        return false;
+      }
+      const char *end = std::find(data, data + MAX_IP_PACK_SIZE, '\0');
+      read_body_.assign(data, end);
+      read_begin_ += MAX_IP_PACK_SIZE;
+      read_type_ = FRAME_TEXT;
+      handleFrame();
+      continue;
+    }
+
+    if (available < FRAME_HEADER_SIZE) {
+      break;
+    }
+    frameHeader header;
+    std::memcpy(header.data(), data, FRAME_HEADER_SIZE);
+    std::uint32_t length;
+    if (!decodeHeader(header, length, read_type_)) {
+      log("Слишком длинный кадр: " + std::to_string(length) + " байт",
+          logLevel::warning);
+      teardown();
+      return false;
+    }
+    if (available < FRAME_HEADER_SIZE + length) {
+      if (FRAME_HEADER_SIZE + length <= read_buf_.size()) {
+        break;
+      }
+      // Кадр больше буфера чтения: начало переносится в read_body_, тело
+      // дочитывается прямо туда.
+      std::size_t have = available - FRAME_HEADER_SIZE;
+      read_body_.assign(data + FRAME_HEADER_SIZE, have);
+      read_body_.resize(length);
+      read_begin_ = read_end_ = 0;
+      auto self(shared_from_this());
+      boost::asio::async_read(
+          socket_, boost::asio::buffer(&read_body_[have], length - have),
+          boost::asio::bind_executor(strand_, makeAllocHandler(
+              read_memory_,
+              boost::bind(&personInRoom::readBodyHandler, self, _1, _2))));
+      return false;
+    }
+    if (read_type_ == FRAME_TEXT && !readyForText()) {
+      return false;
+    }
+    read_body_.assign(data + FRAME_HEADER_SIZE, length);
+    read_begin_ += FRAME_HEADER_SIZE + length;
+    handleFrame();
+  }
+  return socket_.is_open();
+}
+
+void personInRoom::readBodyHandler(const boost::system::error_code &error,
+                                   std::size_t bytes) {
+  if (error) {
+    readHandler(error, 0);
+    return;
+  }
 
+  last_read_ = std::chrono::steady_clock::now();
+  metricAdd(metricCounter::reads);
+  metricAdd(metricCounter::bytes_in, bytes);
+  if (read_type_ == FRAME_TEXT && !readyForText()) {
+    body_pending_ = true;
+    return;
+  }
+  handleFrame();
+  if (processInput()) {
+    startRead();
+  }
+}
+
+bool personInRoom::readyForText() {
+  if (config_.throttle_policy != throttlePolicy::delay) {
+    return true;
+  }
+  std::uint64_t wait = limiter_.take(rateClockNs());
+  if (wait == 0) {
+    return true;
+  }
+  // Кадр остаётся в буфере, а сокет не читается до появления токена.
+  metricAdd(metricCounter::throttled);
   auto self(shared_from_this());
-  boost::asio::async_read(
-      socket_, boost::asio::buffer(read_msg_, read_msg_.size()),
-      strand_.wrap(boost::bind(&personInRoom::readHandler, self, _1)));
+  throttle_timer_.expires_after(std::chrono::nanoseconds(wait));
+  throttle_timer_.async_wait(boost::asio::bind_executor(
+      strand_,
+      makeAllocHandler(throttle_memory_,
+                       boost::bind(&personInRoom::throttleHandler, self, _1))));
+  return false;
+}
+
+bool personInRoom::admitText() {
+  if (config_.throttle_policy == throttlePolicy::delay) {
+    // Токен уже взят в readyForText.
+    return true;
+  }
+  if (limiter_.take(rateClockNs()) != 0) {
+    metricAdd(metricCounter::throttled);
+    throttleNotice();
+    return false;
+  }
+  return true;
+}
+
+void personInRoom::throttleNotice() {
+  if (config_.throttle_policy == throttlePolicy::drop || throttle_noticed_) {
+    return;
+  }
+  static const messagePtr notice =
+      chatMessage::make("Слишком много сообщений, часть из них отброшена");
+  throttle_noticed_ = true;
+  deliver(notice);
+}
+
+void personInRoom::throttleHandler(const boost::system::error_code &error) {
+  if (error || !socket_.is_open()) {
+    return;
+  }
+  if (body_pending_) {
+    if (!readyForText()) {
+      return;
+    }
+    body_pending_ = false;
+    handleFrame();
+  }
+  if (processInput()) {
+    startRead();
+  }
+}
+
+void personInRoom::handleFrame() {
+  if (read_type_ == FRAME_TEXT) {
+    metricAdd(metricCounter::messages_in);
+    if (!admitText()) {
+      return;
+    }
+    handleText(read_body_);
+  } else if (read_type_ == FRAME_PING) {
+    static const messagePtr pong =
+        chatMessage::makeRaw(makeFrame(std::string(), FRAME_PONG));
+    deliver(pong);
+  } else if (read_type_ == FRAME_RESUME &&
+             version_ >= PROTOCOL_RESUMABLE) {
+    resume(read_body_);
+  }
+}
+
+void personInRoom::handleText(const std::string &text) {
+  static const std::string join_command = "/join ";
+  if (!room_) {
+    // Клиент версии 2 заговорил, не возобновив сессию.
+    enterRoom(DEFAULT_ROOM, 0);
+  }
+  if (text.compare(0, join_command.size(), join_command) == 0) {
+    switchRoom(text.substr(join_command.size()));
+  } else if (text == "/leave") {
+    switchRoom(DEFAULT_ROOM);
+  } else if (text == "/history" || text.compare(0, 9, "/history ") == 0) {
+    sendHistory(text.size() > 9 ? text.substr(9) : std::string());
+  } else if (text == "/search" || text.compare(0, 8, "/search ") == 0) {
+    sendSearch(text.size() > 8 ? text.substr(8) : std::string());
+  } else if (text.compare(0, 5, "/msg ") == 0) {
+    sendDirect(text.substr(5));
+  } else if (room_) {
+    if (room_->broadcast(text, member_)) {
+      throttle_noticed_ = false;
+    } else {
+      throttleNotice();
+    }
+  }
+}
+
+void personInRoom::sendDirect(const std::string &request) {
+  std::size_t space = request.find(' ');
+  if (space == 0 || space == std::string::npos ||
+      space + 1 == request.size()) {
+    deliver(chatMessage::make("Нужно /msg <никнейм> <текст>"));
+    return;
+  }
+  std::string target_name = request.substr(0, space);
+  std::shared_ptr<participant> target =
+      rooms_.nicknames().find(target_name);
+  if (!target) {
+    deliver(chatMessage::make("Участника " + target_name + " нет в сети"));
+    return;
+  }
+  std::uint64_t now = std::chrono::duration_cast<std::chrono::milliseconds>(
+                          std::chrono::system_clock::now().time_since_epoch())
+                          .count();
+  messagePtr msg = chatMessage::render(
+      claimed_nickname_ + " -> " + target_name + ": ", now,
+      request.substr(space + 1));
+  metricAdd(metricCounter::direct_messages);
+  target->onMessage(msg);
+  if (target.get() != this) {
+    deliver(msg);
+  }
+}
+
+void personInRoom::sendHistory(const std::string &request) {
+  if (!room_) {
+    return;
+  }
+  static const std::string since = "since ";
+  auto number = [](const std::string &digits, std::uint64_t &value) {
+    if (digits.empty() || digits.size() > 19 ||
+        !std::all_of(digits.begin(), digits.end(), [](char c) {
+          return std::isdigit(static_cast<unsigned char>(c));
+        })) {
+      return false;
+    }
+    value = std::stoull(digits);
+    return true;
+  };
+  std::uint64_t value = 0;
+  messagePtr backlog;
+  if (request.empty()) {
+    backlog = room_->backlog();
+  } else if (number(request, value)) {
+    backlog = room_->backlog(static_cast<std::size_t>(value));
+  } else if (request.compare(0, since.size(), since) == 0 &&
+             number(request.substr(since.size()), value)) {
+    backlog = room_->backlog(SIZE_MAX, value);
+  } else {
+    deliver(chatMessage::make(
+        "Неверный запрос истории, нужно /history [N | since <мс>]"));
+    return;
+  }
+  deliver(backlog ? backlog : chatMessage::make("История пуста"));
+}
+
+void personInRoom::sendSearch(const std::string &request) {
+  if (!room_) {
+    return;
+  }
+  if (!room_->searchable()) {
+    deliver(chatMessage::make("Поиск по истории отключён"));
+    return;
+  }
+  searchQuery query;
+  if (!parseSearchQuery(request, query)) {
+    deliver(chatMessage::make("Неверный запрос поиска, нужно /search [слова] "
+                              "[from:<никнейм>] [since:<мс>] [until:<мс>]"));
+    return;
+  }
+  if (!room_->searchReady()) {
+    deliver(chatMessage::make("Индекс поиска ещё загружается, повторите "
+                              "запрос позже"));
+    return;
+  }
+  metricAdd(metricCounter::searches);
+  messagePtr found = room_->search(query);
+  deliver(found ? found : chatMessage::make("Ничего не найдено"));
+}
+
+void personInRoom::switchRoom(const std::string &name) {
+  if (!roomRegistry::validName(name)) {
+    deliver(chatMessage::make("Недопустимое имя комнаты: " + name));
+    return;
+  }
+  if (!room_ || room_->name() != name) {
+    leaveRoom();
+    enterRoom(name, 0);
+  }
+  deliver(chatMessage::make("Вы в комнате " + name));
+}
+
+void personInRoom::enterRoom(const std::string &name,
+                             std::uint64_t after_seq) {
+  if (version_ >= PROTOCOL_RESUMABLE) {
+    // Через входящие, чтобы кадр встал после сообщений прежней комнаты и
+    // перед историей новой.
+    onMessage(chatMessage::makeRaw(makeFrame(name, FRAME_ROOM)));
+  }
+  room_ = rooms_.join(name, shared_from_this(), display_name_, member_,
+                      after_seq);
+}
+
+void personInRoom::resume(const std::string &payload) {
+  if (room_) {
+    log("Участник " + display_name_.str() + "повторно возобновляет сессию",
+        logLevel::warning);
+    return;
+  }
+  std::uint64_t after_seq = 0;
+  std::string name = DEFAULT_ROOM;
+  if (payload.size() >= SEQUENCE_SIZE) {
+    after_seq = decodeSequence(payload.data());
+    if (payload.size() > SEQUENCE_SIZE) {
+      name = payload.substr(SEQUENCE_SIZE);
+    }
+  }
+  if (!roomRegistry::validName(name)) {
+    name = DEFAULT_ROOM;
+    after_seq = 0;
+  }
+  enterRoom(name, after_seq);
+}
+
+void personInRoom::leaveRoom() {
+  if (room_) {
+    rooms_.leave(room_, member_);
+    room_.reset();
+    member_ = INVALID_MEMBER;
+  }
+}
+
+void personInRoom::teardown() {
+  if (socket_.is_open()) {
+    metricAdd(metricCounter::sessions_closed);
+  }
+  leaveRoom();
+  if (!claimed_nickname_.empty()) {
+    rooms_.nicknames().release(claimed_nickname_, this);
+    claimed_nickname_.clear();
+  }
+  wheel_.cancel(timer_);
+  armed_until_ = std::chrono::steady_clock::time_point::max();
+  boost::system::error_code ignored;
+  coalesce_timer_.cancel(ignored);
+  throttle_timer_.cancel(ignored);
+  socket_.close(ignored);
 }
 
 void personInRoom::writeHandler(const boost::system::error_code &error) {
   if (error) {
-    log("Ошибка записи сообщения: " + error.message());
-    room_.leave(shared_from_this());
+    // Запись на уже закрытый сервером сокет ошибкой не считается.
+    if (peerGone(error)) {
+      log("Клиент закрыл соединение: " + error.message());
+    } else if (socket_.is_open()) {
+      log("Ошибка записи сообщения: " + error.message(), logLevel::error);
+    }
+    teardown();
     return;
   }
-  write_msgs_.pop_front();
+  metricRecord(metricHistogram::write_ns, elapsedNs(write_started_));
+  metricAdd(metricCounter::messages_out, writing_);
+  metricAdd(metricCounter::bytes_out, writing_bytes_);
+  write_msgs_.erase_begin(writing_);
+  queued_bytes_ -= writing_bytes_;
+  writing_ = 0;
+  if (stalled_ && drained()) {
+    stalled_ = false;
+  }
   if (!write_msgs_.empty()) {
-    auto self(shared_from_this());
-    boost::asio::async_write(
-        socket_,
-        boost::asio::buffer(write_msgs_.front(), write_msgs_.front().size()),
-        strand_.wrap(boost::bind(&personInRoom::writeHandler, self, _1)));
+    startWrite();
+  } else if (rejected_) {
+    // Отказ отправлен: закрываем свою сторону и ждём, пока закроет клиент.
+    boost::system::error_code ignored;
+    socket_.shutdown(tcp::socket::shutdown_send, ignored);
+    drainRejected(boost::system::error_code());
+  }
+}
+
+sessionPool::sessionPool(boost::asio::io_service &io_service,
+                         roomRegistry &rooms, const sessionConfig &config)
+    : io_service_(io_service), rooms_(rooms), config_(config) {}
+
+sessionPool::~sessionPool() {
+  for (personInRoom *session : idle_) {
+    delete session;
+  }
+}
+
+std::shared_ptr<personInRoom> sessionPool::acquire() {
+  personInRoom *session = nullptr;
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (!idle_.empty()) {
+      session = idle_.back();
+      idle_.pop_back();
+    }
+  }
+  if (!session) {
+    session = new personInRoom(io_service_, rooms_, config_);
+  }
+  // Удалитель держит пул слабой ссылкой: сессия может пережить сервер.
+  std::weak_ptr<sessionPool> pool = shared_from_this();
+  return std::shared_ptr<personInRoom>(
+      session,
+      [pool](personInRoom *released) {
+        if (std::shared_ptr<sessionPool> owner = pool.lock()) {
+          owner->release(released);
+        } else {
+          delete released;
+        }
+      },
+      recyclingAllocator<personInRoom>());
+}
+
+std::size_t sessionPool::idle() {
+  std::lock_guard<std::mutex> lock(mutex_);
+  return idle_.size();
+}
+
+void sessionPool::release(personInRoom *session) {
+  session->recycle();
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (idle_.size() < config_.idle_sessions) {
+      idle_.push_back(session);
+      return;
+    }
+  }
+  delete session;
+}
+
+namespace {
+
+/**
+ * @brief Установка параметров сокетов участников.
+ * @param socket Акцептор или сокет участника.
+ * @param config Параметры порта.
+ * @param ec Код первой ошибки.
+ */
+template <typename Socket>
+void applySocketOptions(Socket &socket, const listenerConfig &config,
+                        boost::system::error_code &ec) {
+  if (config.tcp_nodelay && !ec) {
+    socket.set_option(tcp::no_delay(true), ec);
+  }
+  if (config.send_buffer_bytes > 0 && !ec) {
+    socket.set_option(
+        boost::asio::socket_base::send_buffer_size(config.send_buffer_bytes),
+        ec);
+  }
+  if (config.receive_buffer_bytes > 0 && !ec) {
+    socket.set_option(boost::asio::socket_base::receive_buffer_size(
+                          config.receive_buffer_bytes),
+                      ec);
   }
+  if (!config.keepalive || ec) {
+    return;
+  }
+  socket.set_option(boost::asio::socket_base::keep_alive(true), ec);
+#ifdef TCP_KEEPIDLE
+  if (config.keepalive_idle_s > 0 && !ec) {
+    socket.set_option(keepAliveIdle(config.keepalive_idle_s), ec);
+  }
+  if (config.keepalive_interval_s > 0 && !ec) {
+    socket.set_option(keepAliveInterval(config.keepalive_interval_s), ec);
+  }
+  if (config.keepalive_count > 0 && !ec) {
+    socket.set_option(keepAliveCount(config.keepalive_count), ec);
+  }
+#endif
 }
 
+} // namespace
+
 server::server(boost::asio::io_service &io_service,
-               boost::asio::io_service::strand &strand,
-               const tcp::endpoint &endpoint)
-    : io_service_(io_service), strand_(strand),
-      acceptor_(io_service, endpoint) {
-  run();
+               const tcp::endpoint &endpoint, bool reuse_port,
+               const serverConfig &config)
+    : io_service_(io_service), acceptor_(io_service),
+      accept_strand_(io_service), config_(config),
+      listener_(portListenerConfig(config, endpoint.port())),
+      rooms_(portHistory(config.history, endpoint.port()),
+             config.room_limits),
+      sessions_(std::make_shared<sessionPool>(io_service, rooms_,
+                                              config.session)) {
+  boost::asio::use_service<timingWheel>(io_service)
+      .setTick(std::chrono::milliseconds(config.session.timer_tick_ms));
+  acceptor_.open(endpoint.protocol());
+  acceptor_.set_option(tcp::acceptor::reuse_address(true));
+  if (reuse_port) {
+#ifdef SO_REUSEPORT
+    acceptor_.set_option(reusePort(true));
+#else
+    throw std::runtime_error("SO_REUSEPORT не поддерживается.");
+#endif
+  }
+  // В Linux подключения наследуют параметры сокета акцептора, так что
+  // они устанавливаются один раз на порт, а не на каждое подключение.
+  // Размер буфера приёма к тому же должен быть известен до рукопожатия
+  // TCP, чтобы согласовать масштаб окна.
+  boost::system::error_code ec;
+  applySocketOptions(acceptor_, listener_, ec);
+  if (ec) {
+    throw boost::system::system_error(ec, "Параметры сокета");
+  }
+  if (listener_.defer_accept_s > 0) {
+#ifdef TCP_DEFER_ACCEPT
+    acceptor_.set_option(deferAccept(listener_.defer_accept_s));
+#else
+    throw std::runtime_error("TCP_DEFER_ACCEPT не поддерживается.");
+#endif
+  }
+  acceptor_.bind(endpoint);
+  acceptor_.listen(listener_.listen_backlog > 0
+                       ? listener_.listen_backlog
+                       : boost::asio::socket_base::max_listen_connections);
+  // Несколько ожиданий подключения сразу: пока одно подключение
+  // обрабатывается, следующие уже забираются из очереди listen.
+  for (unsigned i = 0; i < listener_.pending_accepts; ++i) {
+    run();
+  }
 }
 
+chatRoom &server::room() { return rooms_.defaultRoom(); }
+
+roomRegistry &server::rooms() { return rooms_; }
+
+sessionPool &server::sessions() { return *sessions_; }
+
+tcp::acceptor &server::acceptor() { return acceptor_; }
+
 void server::run() {
-  std::shared_ptr<personInRoom> new_participant(
-      new personInRoom(io_service_, strand_, room_));
+  // Ожидания подключения перезапускаются из своих обработчиков, поэтому
+  // при нескольких ожиданиях обработчики проходят через странд, чтобы
+  // акцептор не использовался из двух потоков сразу.
+  std::shared_ptr<personInRoom> new_participant = sessions_->acquire();
   acceptor_.async_accept(
       new_participant->socket(),
-      strand_.wrap(boost::bind(&server::onAccept, this, new_participant, _1)));
+      accept_strand_.wrap(
+          boost::bind(&server::onAccept, this, new_participant, _1)));
 }
 
 void server::onAccept(std::shared_ptr<personInRoom> new_participant,
                       const boost::system::error_code &error) {
   if (!error) {
+    metricAdd(metricCounter::accepts);
+#ifndef __linux__
+    boost::system::error_code ec;
+    applySocketOptions(new_participant->socket(), listener_, ec);
+    if (ec) {
+      log("Не удалось установить параметры сокета: " + ec.message(),
+          logLevel::warning);
+    }
+#endif
     new_participant->start();
     log("Подключение нового участника");
   } else {
-    log("Ошибка подключения нового участника: " + error.message());
+    metricAdd(metricCounter::accept_errors);
+    log("Ошибка подключения нового участника: " + error.message(),
+        logLevel::error);
   }
   run();
 }
@@ -236,39 +1831,93 @@ int main(int argc, char *argv[]) {
       return 1;
     }
 
-    std::shared_ptr<boost::asio::io_service> io_service(
-        new boost::asio::io_service);
-    boost::shared_ptr<boost::asio::io_service::work> work(
-        new boost::asio::io_service::work(*io_service));
-    boost::shared_ptr<boost::asio::io_service::strand> strand(
-        new boost::asio::io_service::strand(*io_service));
+    // 0 потоков означает число аппаратных потоков машины
+    unsigned threads = config.value("threads", 0u);
+    if (threads == 0) {
+      threads = std::max(1u, boost::thread::hardware_concurrency());
+    }
+    bool pin_threads = config.value("pin_threads", true);
+    serverConfig server_config = parseServerConfig(config);
+
+    // "pool" — общий io_service на все потоки; "sharded" — по io_service
+    // и акцептору с SO_REUSEPORT на каждый поток
+    std::string mode = config.value("mode", std::string("pool"));
+    if (mode != "pool" && mode != "sharded") {
+      std::cerr << "Неизвестный режим сервера: " << mode << "\n";
+      return 1;
+    }
+
+    logger::instance().start(parseLogConfig(config));
+    startHistoryCommitter(server_config.history.commit_ms);
 
     std::cout << "[" << std::this_thread::get_id() << "] Сервер запущен"
               << std::endl;
-    log("Сервер запущен");
+    log("Сервер запущен, режим " + mode +
+        ", рабочих потоков: " + std::to_string(threads) +
+        ", ввод-вывод: " + ioBackend());
 
+    unsigned cpus = std::max(1u, boost::thread::hardware_concurrency());
+    boost::thread_group workers;
+
+    std::shared_ptr<boost::asio::io_service> io_service;
+    boost::shared_ptr<boost::asio::io_service::work> work;
     std::list<std::shared_ptr<server>> servers;
+    std::vector<std::unique_ptr<shard>> shards;
+    std::list<std::unique_ptr<roomGroup>> groups;
+
+    if (mode == "pool") {
+      io_service.reset(new boost::asio::io_service(threads));
+      work.reset(new boost::asio::io_service::work(*io_service));
 
-    for (int port : ports) {
-      tcp::endpoint endpoint(tcp::v4(), port);
-      std::shared_ptr<server> a_server(
-          new server(*io_service, *strand, endpoint));
-      servers.push_back(a_server);
+      for (int port : ports) {
+        tcp::endpoint endpoint(tcp::v4(), port);
+        std::shared_ptr<server> a_server(
+            new server(*io_service, endpoint, false, server_config));
+        servers.push_back(a_server);
+      }
+
+      for (unsigned i = 0; i < threads; ++i) {
+        boost::thread *t = new boost::thread{
+            boost::bind(&runWorker, boost::ref(*io_service))};
+        if (pin_threads) {
+          // привязка процессора для рабочей нити в Linux
+          pinThread(*t, i % cpus);
+        }
+        workers.add_thread(t);
+      }
+    } else {
+      std::vector<shard *> shard_ptrs;
+      for (unsigned i = 0; i < threads; ++i) {
+        shards.emplace_back(new shard(i, ports, server_config));
+        shard_ptrs.push_back(shards.back().get());
+      }
+      for (std::size_t p = 0; p < ports.size(); ++p) {
+        groups.emplace_back(new roomGroup(shard_ptrs, p));
+      }
+
+      for (unsigned i = 0; i < threads; ++i) {
+        boost::thread *t =
+            new boost::thread{boost::bind(&shard::run, shards[i].get())};
+        if (pin_threads) {
+          pinThread(*t, i % cpus);
+        }
+        workers.add_thread(t);
+      }
     }
 
-    boost::thread_group workers;
-    for (int i = 0; i < 1; ++i) {
-      boost::thread *t = new boost::thread{
-          boost::bind(&boost::asio::io_service::run, io_service)};
-#ifdef __linux__
-      // привязка процессора для рабочей нити в Linux
-      cpu_set_t cpuset;
-      CPU_ZERO(&cpuset);
-      CPU_SET(i, &cpuset);
-      pthread_setaffinity_np(t->native_handle(), sizeof(cpu_set_t), &cpuset);
-#endif
-      workers.add_thread(t);
+    // Административный порт и SIGUSR1 обслуживает первый рабочий поток.
+    boost::asio::io_service &admin_service =
+        io_service ? *io_service : shards.front()->ioService();
+    std::unique_ptr<metricsEndpoint> admin;
+    unsigned short admin_port = config.value("admin_port", 0);
+    if (admin_port != 0) {
+      admin.reset(new metricsEndpoint(
+          admin_service,
+          tcp::endpoint(boost::asio::ip::address_v4::loopback(), admin_port)));
     }
+    boost::asio::signal_set signals(admin_service, SIGUSR1);
+    waitMetricsSignal(signals, config.value("metrics_file",
+                                            std::string("metrics.json")));
 
     workers.join_all();
   } catch (std::exception &e) {
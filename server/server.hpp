@@ -1,20 +1,352 @@
 #ifndef SERVER_HPP
 #define SERVER_HPP
 
+#include "history.hpp"
+#include "memory.hpp"
+#include "nicknames.hpp"
+#include "participants.hpp"
+#include "protocol.hpp"
+#include "rate_limit.hpp"
+#include "timing_wheel.hpp"
 #include <array>
 #include <boost/asio.hpp>
-#include <deque>
+#include <boost/circular_buffer.hpp>
+#include <boost/thread/thread.hpp>
+#include <chrono>
+#include <cstdint>
 #include <memory>
+#include <mutex>
 #include <nlohmann/json.hpp>
 #include <string>
 #include <unordered_map>
-#include <unordered_set>
-
-constexpr int MAX_NICKNAME = 16;
-constexpr int MAX_IP_PACK_SIZE = 512;
+#include <vector>
 
 using boost::asio::ip::tcp;
 
+#ifdef SO_REUSEPORT
+/// Опция SO_REUSEPORT: несколько акцепторов на одном порту.
+typedef boost::asio::detail::socket_option::boolean<SOL_SOCKET, SO_REUSEPORT>
+    reusePort;
+#endif
+#ifdef TCP_DEFER_ACCEPT
+/// Опция TCP_DEFER_ACCEPT: подключение отдаётся акцептору, только когда
+/// клиент прислал первые данные.
+typedef boost::asio::detail::socket_option::integer<IPPROTO_TCP,
+                                                    TCP_DEFER_ACCEPT>
+    deferAccept;
+#endif
+#ifdef TCP_KEEPIDLE
+/// Опции TCP_KEEPIDLE, TCP_KEEPINTVL, TCP_KEEPCNT: когда и как часто
+/// проверять keepalive молчащее соединение.
+typedef boost::asio::detail::socket_option::integer<IPPROTO_TCP, TCP_KEEPIDLE>
+    keepAliveIdle;
+typedef boost::asio::detail::socket_option::integer<IPPROTO_TCP,
+                                                    TCP_KEEPINTVL>
+    keepAliveInterval;
+typedef boost::asio::detail::socket_option::integer<IPPROTO_TCP, TCP_KEEPCNT>
+    keepAliveCount;
+#endif
+
+class roomGroup;
+
+/// Комната, в которую участник попадает после рукопожатия.
+const std::string DEFAULT_ROOM = "general";
+/// Максимальная длина имени комнаты.
+constexpr std::size_t MAX_ROOM_NAME = 32;
+/// Предел размера пачки истории, отправляемой одной записью (старые
+/// сообщения сверх предела не попадают в пачку).
+constexpr std::size_t MAX_BACKLOG_BYTES = 256 * 1024;
+/// Размер буфера чтения сессии по умолчанию.
+constexpr std::size_t DEFAULT_READ_BUFFER_BYTES = 4096;
+
+/**
+ * @brief Что делать с сообщением для участника, очередь записи которого
+ * заполнена.
+ */
+enum class overflowPolicy {
+  /// Отбросить самые старые неотправленные сообщения.
+  drop_oldest,
+  /// Отбросить новое сообщение.
+  drop_newest,
+  /// Отбросить самые старые и отправить вместо них уведомление о пропуске.
+  coalesce,
+  /// Отбрасывать новые сообщения и отключить участника, если очередь не
+  /// освободится за отведённое время.
+  disconnect
+};
+
+/**
+ * @brief Что делать с сообщением участника, превысившего ограничение
+ * частоты.
+ */
+enum class throttlePolicy {
+  /// Молча отбросить.
+  drop,
+  /// Отбросить и сообщить отправителю (один раз до следующего принятого
+  /// сообщения).
+  notice,
+  /// Не отбрасывать: приостановить чтение из сокета участника, пока не
+  /// появится токен (клиента сдерживает окно TCP).
+  delay
+};
+
+/**
+ * @struct sessionConfig
+ * @brief Параметры сессий участников, общие для всего сервера.
+ */
+struct sessionConfig {
+  /// Максимум байт в одной пакетной записи.
+  std::size_t write_batch_bytes = DEFAULT_WRITE_BATCH_BYTES;
+  /// Максимум буферов (iovec) в одной пакетной записи.
+  std::size_t write_batch_buffers = DEFAULT_WRITE_BATCH_BUFFERS;
+  /// Окно накопления сообщений перед записью в простаивающий сокет, мкс
+  /// (0 — писать сразу).
+  unsigned write_coalesce_us = 0;
+  /// Максимум байт в очереди записи участника.
+  std::size_t max_queue_bytes = 1024 * 1024;
+  /// Максимум сообщений в очереди записи участника.
+  std::size_t max_queue_messages = 1024;
+  /// Поведение при заполненной очереди.
+  overflowPolicy overflow_policy = overflowPolicy::coalesce;
+  /// Сколько очередь может оставаться заполненной до отключения
+  /// участника (политика disconnect), мс.
+  unsigned overflow_grace_ms = 5000;
+  /// Сколько отключившихся сессий держать в пуле для новых подключений.
+  std::size_t idle_sessions = 256;
+  /// Время на получение никнейма после подключения, мс (0 — без
+  /// ограничения).
+  unsigned handshake_timeout_ms = 10000;
+  /// Время без входящих данных до отключения участника, мс (0 — без
+  /// ограничения).
+  unsigned idle_timeout_ms = 0;
+  /// Время, за которое должна завершиться начатая запись в сокет, мс
+  /// (0 — без ограничения).
+  unsigned write_stall_timeout_ms = 30000;
+  /// Период проверки связи с молчащим участником кадром FRAME_PING, мс
+  /// (0 — не проверять; старому протоколу проверки не отправляются).
+  unsigned heartbeat_ms = 0;
+  /// Шаг колеса таймеров сессий, мс.
+  unsigned timer_tick_ms = DEFAULT_WHEEL_TICK_MS;
+  /// Размер буфера чтения сессии: одним вызовом читается и разбирается
+  /// столько пакетов или кадров, сколько в него поместится.
+  std::size_t read_buffer_bytes = DEFAULT_READ_BUFFER_BYTES;
+  /// Сообщений в секунду от одного участника (0 — без ограничения).
+  double message_rate = 0;
+  /// Сколько сообщений участник может отправить подряд.
+  double message_burst = 20;
+  /// Поведение при превышении ограничения.
+  throttlePolicy throttle_policy = throttlePolicy::notice;
+};
+
+/**
+ * @struct roomLimits
+ * @brief Ограничение частоты сообщений одной комнаты (от всех участников
+ * вместе).
+ */
+struct roomLimits {
+  /// Сообщений в секунду (0 — без ограничения).
+  double message_rate = 0;
+  /// Сколько сообщений комната может принять подряд.
+  double message_burst = 100;
+};
+
+/**
+ * @struct listenerConfig
+ * @brief Параметры акцептора порта и сокетов его участников.
+ */
+struct listenerConfig {
+  /// Сколько подключений акцептор ожидает одновременно.
+  unsigned pending_accepts = 1;
+  /// Длина очереди подключений listen (0 — наибольшая в системе).
+  int listen_backlog = 0;
+  /// TCP_NODELAY: отправлять короткие записи без задержки Нейгла.
+  bool tcp_nodelay = false;
+  /// SO_SNDBUF и SO_RCVBUF, байт (0 — по умолчанию системы).
+  int send_buffer_bytes = 0;
+  int receive_buffer_bytes = 0;
+  /// TCP_DEFER_ACCEPT, с (0 — выключено).
+  int defer_accept_s = 0;
+  /// SO_KEEPALIVE и его параметры (0 — по умолчанию системы).
+  bool keepalive = false;
+  int keepalive_idle_s = 0;
+  int keepalive_interval_s = 0;
+  int keepalive_count = 0;
+};
+
+/**
+ * @struct overflowStats
+ * @brief Счётчики срабатывания политик переполнения очередей записи.
+ */
+struct overflowStats {
+  std::uint64_t dropped_oldest;
+  std::uint64_t dropped_newest;
+  std::uint64_t coalesced;
+  std::uint64_t disconnected;
+};
+
+/**
+ * @brief Получение счётчиков переполнения очередей всех участников.
+ * @return Счётчики.
+ */
+overflowStats sessionOverflowStats();
+
+/**
+ * @struct serverConfig
+ * @brief Параметры сервера, передаваемые комнатам и сессиям.
+ */
+struct serverConfig {
+  sessionConfig session;
+  historyConfig history;
+  roomLimits room_limits;
+  /// Параметры акцепторов по умолчанию.
+  listenerConfig listener;
+  /// Параметры акцепторов отдельных портов.
+  std::unordered_map<unsigned short, listenerConfig> port_listeners;
+};
+
+/**
+ * @class chatMessage
+ * @brief Неизменяемое сообщение чата.
+ *
+ * Один экземпляр разделяют очереди записи всех получателей и история
+ * комнаты. Кадр протокола кодируется один раз при создании, пакет старого
+ * протокола — при первом обращении. У сообщения с номером хранится кадр
+ * FRAME_SEQUENCED версии 2; вложенный в него кадр FRAME_TEXT и есть кадр
+ * версии 1, так что обе версии отправляются из одного буфера. Пачка
+ * истории — тоже одно сообщение: кадры подряд, которые уходят участнику
+ * одной записью.
+ */
+class chatMessage {
+public:
+  /**
+   * @brief Создание сообщения.
+   * @param text Текст сообщения.
+   * @param timestamp_ms Время сообщения, мс с начала эпохи.
+   * @param seq Номер сообщения в комнате (0 — служебное сообщение без
+   * номера).
+   * @return Указатель на сообщение.
+   */
+  static std::shared_ptr<const chatMessage>
+  make(const std::string &text, std::uint64_t timestamp_ms = 0,
+       std::uint64_t seq = 0);
+
+  /**
+   * @brief Создание служебной посылки, которая отправляется как есть, без
+   * кадрирования.
+   * @param bytes Байты посылки.
+   * @return Указатель на посылку.
+   */
+  static std::shared_ptr<const chatMessage> makeRaw(const std::string &bytes);
+
+  /**
+   * @brief Оформление сообщения участника: временная метка, никнейм и
+   * текст пишутся сразу в кадр, без промежуточных строк.
+   * @param nickname Никнейм отправителя (с разделителем).
+   * @param timestamp_ms Время отправки, мс с начала эпохи.
+   * @param body Текст сообщения.
+   * @param seq Номер сообщения в комнате (0 — без номера).
+   * @return Указатель на сообщение.
+   */
+  static std::shared_ptr<const chatMessage>
+  render(const std::string &nickname, std::uint64_t timestamp_ms,
+         const std::string &body, std::uint64_t seq = 0);
+
+  /**
+   * @brief Склейка сообщений в пачку, которая отправляется одной записью.
+   * @param msgs Сообщения (не служебные посылки) в порядке отправки.
+   * @return Пачка, само сообщение, если оно одно, или nullptr, если
+   * сообщений нет.
+   */
+  static std::shared_ptr<const chatMessage>
+  makeBatch(const std::vector<std::shared_ptr<const chatMessage>> &msgs);
+
+  /**
+   * @brief Конструктор (используйте make/makeRaw/render/makeBatch).
+   * @param bytes Кадры или служебная посылка.
+   * @param raw Признак служебной посылки.
+   * @param timestamp_ms Время сообщения (для пачки — последнего в ней).
+   * @param seq Номер сообщения (для пачки — последнего в ней).
+   * @param count Число кадров.
+   * @param plain Кадры пачки в версии 1, если в ней есть сообщения с
+   * номерами.
+   */
+  chatMessage(std::string bytes, bool raw, std::uint64_t timestamp_ms = 0,
+              std::uint64_t seq = 0, std::size_t count = 1,
+              std::string plain = std::string());
+
+  /**
+   * @brief Получение текста сообщения.
+   * @return Текст сообщения (тексты пачки разделяются переводом строки).
+   */
+  std::string text() const;
+
+  /**
+   * @brief Время сообщения.
+   * @return Мс с начала эпохи (0 для служебных сообщений).
+   */
+  std::uint64_t timestamp() const { return timestamp_ms_; }
+
+  /**
+   * @brief Число сообщений в пачке.
+   * @return 1 для обычного сообщения.
+   */
+  std::size_t count() const { return count_; }
+
+  /**
+   * @brief Номер сообщения в комнате.
+   * @return Номер (0 для сообщений без номера).
+   */
+  std::uint64_t seq() const { return seq_; }
+
+  /**
+   * @brief Служебная ли это посылка (подтверждение рукопожатия или
+   * управляющий кадр протокола).
+   * @return true для посылок makeRaw.
+   */
+  bool raw() const { return raw_; }
+
+  /**
+   * @brief Получение байтов для отправки участнику.
+   * @param version Согласованная с участником версия протокола.
+   * @return Буфер, живущий столько же, сколько сообщение.
+   */
+  boost::asio::const_buffer wire(std::uint8_t version) const;
+
+private:
+  /**
+   * @brief Полезные нагрузки всех кадров.
+   * @return Тексты в порядке кадров.
+   */
+  std::vector<std::string> payloads() const;
+
+  std::string frame_;
+  bool raw_;
+  std::uint64_t timestamp_ms_;
+  std::uint64_t seq_;
+  std::size_t count_;
+  /// Начало кадра версии 1 внутри frame_.
+  std::size_t offset_;
+  std::string plain_;
+  mutable std::once_flag legacy_once_;
+  mutable std::string legacy_;
+};
+
+using messagePtr = std::shared_ptr<const chatMessage>;
+
+/**
+ * @struct chatRecord
+ * @brief Сообщение участника до оформления: номер никнейма отправителя,
+ * время и текст.
+ *
+ * В таком виде сообщение идёт на домашний шард комнаты; в текст для
+ * клиентов оно превращается один раз, в chatRoom::commit.
+ */
+struct chatRecord {
+  internedName sender;
+  std::uint64_t timestamp_ms;
+  std::string body;
+};
+
 /**
  * @class participant
  * @brief Абстрактный класс для участников чата.
@@ -22,79 +354,455 @@ using boost::asio::ip::tcp;
 class participant {
 public:
   virtual ~participant() {}
-  virtual void onMessage(std::array<char, MAX_IP_PACK_SIZE> &msg) = 0;
+  virtual void onMessage(const messagePtr &msg) = 0;
+};
+
+/**
+ * @class nicknameIndex
+ * @brief Участники порта по никнеймам: для личных сообщений и проверки,
+ * что никнейм не занят.
+ *
+ * Никнейм занимается при рукопожатии и освобождается при завершении
+ * сессии. Индекс хранит слабые ссылки, поэтому запись сессии, ушедшей без
+ * освобождения, считается свободной. В режиме шардов индекс порта общий
+ * для всех шардов; мьютекс берётся только при рукопожатии, завершении
+ * сессии и отправке личного сообщения.
+ */
+class nicknameIndex {
+public:
+  /**
+   * @brief Занятие никнейма.
+   * @param nickname Никнейм.
+   * @param owner Сессия.
+   * @return false, если никнейм занят другой живой сессией.
+   */
+  bool claim(const std::string &nickname, std::weak_ptr<participant> owner);
+
+  /**
+   * @brief Освобождение никнейма, если он занят этой сессией.
+   * @param nickname Никнейм.
+   * @param owner Сессия.
+   */
+  void release(const std::string &nickname, const participant *owner);
+
+  /**
+   * @brief Поиск участника по никнейму.
+   * @param nickname Никнейм.
+   * @return Участник или nullptr.
+   */
+  std::shared_ptr<participant> find(const std::string &nickname);
+
+  /**
+   * @brief Число занятых никнеймов.
+   * @return Число записей.
+   */
+  std::size_t size();
+
+private:
+  std::mutex mutex_;
+  std::unordered_map<std::string, std::weak_ptr<participant>> owners_;
 };
 
 /**
  * @class chatRoom
  * @brief Класс для управления комнатой чата.
+ *
+ * Методы комнаты вызываются из обработчиков разных участников, которые
+ * выполняются на разных рабочих потоках, поэтому состояние комнаты
+ * защищено собственным мьютексом.
  */
 class chatRoom {
 public:
-  chatRoom();
+  /**
+   * @brief Конструктор комнаты. Загружает хвост истории.
+   * @param name Имя комнаты (определяет каталог истории).
+   * @param history Параметры хранилища истории.
+   */
+  explicit chatRoom(const std::string &name = "chat",
+                    const historyConfig &history = historyConfig());
+
+  /**
+   * @brief Получение имени комнаты.
+   * @return Имя комнаты.
+   */
+  const std::string &name() const;
 
   /**
-   * @brief Участник заходит в комнату.
+   * @brief Проверка, остались ли в комнате участники.
+   * @return true, если комната пуста.
+   */
+  bool empty();
+
+  /**
+   * @brief Число участников комнаты.
+   * @return Число участников.
+   */
+  std::size_t size();
+
+  /**
+   * @brief Участник заходит в комнату и получает историю одной пачкой.
+   *
+   * Возобновляющий сессию участник получает только сообщения с номерами
+   * больше after_seq. Если их у комнаты уже нет (или номер из будущего,
+   * например после очистки истории), сначала уходит FRAME_GAP, затем вся
+   * сохранённая история.
+   * @param participant Указатель на участника.
+   * @param nickname Никнейм участника из таблицы никнеймов.
+   * @param after_seq Номер последнего полученного сообщения (0 — вся
+   * история).
+   * @return Номер участника в комнате.
+   */
+  memberHandle enter(std::shared_ptr<participant> participant,
+                     const internedName &nickname,
+                     std::uint64_t after_seq = 0);
+
+  /**
+   * @brief Участник заходит в комнату (никнейм регистрируется в таблице).
    * @param participant Указатель на участника.
    * @param nickname Никнейм участника.
+   * @return Номер участника в комнате.
    */
-  void enter(std::shared_ptr<participant> participant,
-             const std::string &nickname);
+  memberHandle enter(std::shared_ptr<participant> participant,
+                     const std::string &nickname);
 
   /**
    * @brief Участник выходит из комнаты.
-   * @param participant Указатель на участника.
+   * @param handle Номер участника.
    */
-  void leave(std::shared_ptr<participant> participant);
+  void leave(memberHandle handle);
 
   /**
    * @brief Отправка сообщения всем участникам.
+   *
+   * Ограничение частоты комнаты проверяется до рассылки. В режиме шардов
+   * его проверяет домашний шард комнаты, и отправитель о сброшенном
+   * сообщении не узнаёт.
    * @param msg Сообщение для отправки.
-   * @param participant Указатель на участника, отправившего сообщение.
+   * @param sender Номер участника, отправившего сообщение.
+   * @return false, если сообщение отброшено ограничением частоты комнаты.
+   */
+  bool broadcast(const std::string &msg, memberHandle sender);
+
+  /**
+   * @brief Установка ограничения частоты сообщений комнаты.
+   * @param limits Ограничение.
+   */
+  void setRateLimit(const roomLimits &limits);
+
+  /**
+   * @brief Взятие токена из ведра комнаты перед рассылкой сообщения.
+   * @return true, если сообщение можно разослать.
+   */
+  bool admit();
+
+  /**
+   * @brief Пачка последних сообщений комнаты для отправки одной записью.
+   *
+   * Полная пачка кешируется: толпа переподключений после перезапуска
+   * получает один и тот же экземпляр. Каждое новое сообщение сбрасывает
+   * кеш, и пачка пересобирается при следующем запросе.
+   * @param count Не больше скольких последних сообщений.
+   * @param since_ms Только сообщения не раньше этого времени, мс.
+   * @return Пачка или nullptr, если подходящих сообщений нет.
+   */
+  messagePtr backlog(std::size_t count = SIZE_MAX,
+                     std::uint64_t since_ms = 0);
+
+  /**
+   * @brief Поиск по всей сохранённой истории комнаты.
+   *
+   * Найденные сообщения уходят обычными текстовыми кадрами без номеров,
+   * чтобы не сбить клиенту позицию для возобновления сессии.
+   * @param query Запрос.
+   * @return Пачка найденных сообщений или nullptr, если ничего не нашлось.
+   */
+  messagePtr search(const searchQuery &query);
+
+  /**
+   * @brief Ведётся ли индекс для поиска по истории.
+   * @return true, если поиск включён.
    */
-  void broadcast(std::array<char, MAX_IP_PACK_SIZE> &msg,
-                 std::shared_ptr<participant> participant);
+  bool searchable() const;
+
+  /**
+   * @brief Загружен ли индекс поиска (его загружает поток групповой
+   * записи истории).
+   * @return true, если можно искать.
+   */
+  bool searchReady();
 
   /**
    * @brief Получение никнейма участника.
-   * @param participant Указатель на участника.
-   * @return Никнейм участника.
+   * @param handle Номер участника.
+   * @return Ссылка на никнейм (пустая, если участник уже вышел).
+   */
+  internedName getNickname(memberHandle handle);
+
+  /**
+   * @brief Подключение комнаты к группе реплик на разных шардах.
+   * После подключения сообщения рассылаются через домашний шард группы.
+   * @param group Группа реплик комнаты.
+   */
+  void attach(roomGroup *group);
+
+  /**
+   * @brief Оформление и сохранение сообщения (выполняется одним владельцем
+   * истории комнаты).
+   * @param nickname Никнейм отправителя.
+   * @param timestamp_ms Время отправки, мс с начала эпохи.
+   * @param msg Текст сообщения.
+   * @return Сообщение с временной меткой и никнеймом.
    */
-  std::string getNickname(std::shared_ptr<participant> participant);
+  messagePtr commit(const std::string &nickname, std::uint64_t timestamp_ms,
+                    const std::string &msg);
+
+  /**
+   * @brief Доставка оформленного сообщения локальным участникам.
+   * @param formatted_msg Оформленное сообщение.
+   */
+  void deliver(const messagePtr &formatted_msg);
 
 private:
   /**
-   * @brief Сохранение сообщения в файл.
+   * @brief Сборка пачки истории при захваченном мьютексе комнаты.
+   * @param count Не больше скольких последних сообщений.
+   * @param since_ms Только сообщения не раньше этого времени, мс.
+   * @return Пачка или nullptr.
+   */
+  messagePtr backlogLocked(std::size_t count, std::uint64_t since_ms);
+
+  /**
+   * @brief Пачка сообщений recent_msgs_ начиная с first, урезанная до
+   * MAX_BACKLOG_BYTES (отбрасываются самые старые).
+   * @param first Индекс первого сообщения в recent_msgs_.
+   * @return Пачка или nullptr.
+   */
+  messagePtr batchLocked(std::size_t first);
+
+  /**
+   * @brief Взятие токена при захваченном мьютексе комнаты.
+   * @return true, если сообщение можно разослать.
+   */
+  bool admitLocked();
+
+  /**
+   * @brief Доставка сообщения при захваченном мьютексе комнаты.
+   * @param formatted_msg Оформленное сообщение.
+   */
+  void deliverLocked(const messagePtr &formatted_msg);
+
+  /**
+   * @brief Сохранение сообщения в историю.
+   * @param timestamp_ms Время сообщения, мс с начала эпохи.
    * @param msg Сообщение для сохранения.
    */
-  void saveMessage(const std::array<char, MAX_IP_PACK_SIZE> &msg);
+  void saveMessage(std::uint64_t timestamp_ms, std::string msg);
 
   /**
-   * @brief Загрузка истории сообщений из файла.
+   * @brief Загрузка последних сообщений истории.
    */
   void loadHistory();
 
-  std::unordered_set<std::shared_ptr<participant>> participants_;
-  std::unordered_map<std::shared_ptr<participant>, std::string> name_table_;
-  std::deque<std::array<char, MAX_IP_PACK_SIZE>> recent_msgs_;
+  std::string name_;
+  std::mutex mutex_;
+  roomGroup *group_;
+  /// Общее с прежней комнатой того же имени, если та ещё не разрушена.
+  std::shared_ptr<historyStore> history_;
+  participantTable members_;
+  boost::circular_buffer<messagePtr> recent_msgs_;
+  /// Кеш полной пачки recent_msgs_ (пуст, пока её не запросят).
+  messagePtr backlog_;
+  /// Номер последнего сообщения комнаты (ведёт владелец истории).
+  std::uint64_t last_seq_;
+  tokenBucket limiter_;
   enum { max_recent_msgs = 100 };
 };
 
+/**
+ * @class roomRegistry
+ * @brief Именованные комнаты одного порта.
+ *
+ * Комнаты создаются при первом входе и удаляются, когда из них выходит
+ * последний участник; комната по умолчанию существует всегда. Поиск
+ * комнаты по имени — одно обращение к хеш-таблице. Каждая комната хранит
+ * историю в своём подкаталоге каталога истории порта.
+ *
+ * В режиме шардов у каждого шарда свой реестр. Реестр домашнего шарда
+ * комнаты помнит, на каких шардах есть её реплики, и держит комнату, пока
+ * хотя бы одна реплика жива.
+ */
+class roomRegistry {
+public:
+  /**
+   * @brief Конструктор реестра. Создаёт комнату по умолчанию.
+   * @param history Параметры хранилища истории порта.
+   * @param limits Ограничение частоты сообщений каждой комнаты.
+   */
+  explicit roomRegistry(const historyConfig &history = historyConfig(),
+                        const roomLimits &limits = roomLimits());
+
+  /**
+   * @brief Проверка имени комнаты: 1–MAX_ROOM_NAME символов из латинских
+   * букв, цифр, '_' и '-'.
+   * @param name Имя комнаты.
+   * @return true, если имя допустимо.
+   */
+  static bool validName(const std::string &name);
+
+  /**
+   * @brief Вход участника в комнату; комната создаётся при необходимости.
+   * @param name Имя комнаты.
+   * @param participant Указатель на участника.
+   * @param nickname Никнейм участника из таблицы никнеймов.
+   * @param handle Номер участника в комнате.
+   * @param after_seq Номер последнего полученного сообщения комнаты (см.
+   * chatRoom::enter).
+   * @return Комната, в которую вошёл участник.
+   */
+  std::shared_ptr<chatRoom> join(const std::string &name,
+                                 std::shared_ptr<participant> participant,
+                                 const internedName &nickname,
+                                 memberHandle &handle,
+                                 std::uint64_t after_seq = 0);
+
+  /**
+   * @brief Вход участника в комнату (никнейм регистрируется в таблице).
+   * @param name Имя комнаты.
+   * @param participant Указатель на участника.
+   * @param nickname Никнейм участника.
+   * @param handle Номер участника в комнате.
+   * @return Комната, в которую вошёл участник.
+   */
+  std::shared_ptr<chatRoom> join(const std::string &name,
+                                 std::shared_ptr<participant> participant,
+                                 const std::string &nickname,
+                                 memberHandle &handle);
+
+  /**
+   * @brief Выход участника из комнаты; пустая комната удаляется.
+   * @param room Комната.
+   * @param handle Номер участника в комнате.
+   */
+  void leave(const std::shared_ptr<chatRoom> &room, memberHandle handle);
+
+  /**
+   * @brief Поиск комнаты по имени.
+   * @param name Имя комнаты.
+   * @return Комната или nullptr, если её нет.
+   */
+  std::shared_ptr<chatRoom> find(const std::string &name);
+
+  /**
+   * @brief Получение комнаты по умолчанию.
+   * @return Комната по умолчанию.
+   */
+  chatRoom &defaultRoom();
+
+  /**
+   * @brief Число существующих комнат.
+   * @return Число комнат.
+   */
+  std::size_t size();
+
+  /**
+   * @brief Подключение реестра к группе реестров шардов.
+   * @param group Группа реестров порта.
+   * @param shard_index Номер шарда этого реестра.
+   * @param nicknames Общий для шардов индекс никнеймов порта.
+   */
+  void attach(roomGroup *group, std::size_t shard_index,
+              std::shared_ptr<nicknameIndex> nicknames);
+
+  /**
+   * @brief Индекс никнеймов порта.
+   * @return Индекс.
+   */
+  nicknameIndex &nicknames();
+
+  /**
+   * @brief Оформление и сохранение сообщения на домашнем шарде комнаты.
+   * @param name Имя комнаты.
+   * @param record Сообщение участника.
+   * @param shards Шарды, на которых есть реплики комнаты.
+   * @return Оформленное сообщение или nullptr, если сообщение отброшено
+   * ограничением частоты комнаты.
+   */
+  messagePtr commit(const std::string &name, const chatRecord &record,
+                    std::vector<std::size_t> &shards);
+
+  /**
+   * @brief Доставка оформленного сообщения локальной реплике комнаты.
+   * @param name Имя комнаты.
+   * @param formatted_msg Оформленное сообщение.
+   */
+  void deliver(const std::string &name, const messagePtr &formatted_msg);
+
+  /**
+   * @brief Учёт реплики комнаты на другом шарде (на домашнем шарде).
+   * @param name Имя комнаты.
+   * @param shard_index Номер шарда реплики.
+   * @param alive true — реплика создана, false — удалена.
+   */
+  void replica(const std::string &name, std::size_t shard_index, bool alive);
+
+private:
+  /**
+   * @struct roomEntry
+   * @brief Комната и шарды, на которых живут её реплики.
+   */
+  struct roomEntry {
+    std::shared_ptr<chatRoom> room;
+    std::vector<std::size_t> replicas;
+  };
+
+  typedef std::unordered_map<std::string, roomEntry> roomMap;
+
+  /**
+   * @brief Поиск или создание комнаты при захваченном мьютексе реестра.
+   * @param name Имя комнаты.
+   * @return Запись комнаты.
+   */
+  roomMap::iterator obtainLocked(const std::string &name);
+
+  /**
+   * @brief Удаление комнаты, если она больше никому не нужна.
+   * @param it Запись комнаты.
+   */
+  void collectLocked(roomMap::iterator it);
+
+  /**
+   * @brief Проверка, является ли этот шард домашним для комнаты.
+   * @param name Имя комнаты.
+   * @return true без группы или на домашнем шарде.
+   */
+  bool homeLocked(const std::string &name) const;
+
+  std::mutex mutex_;
+  historyConfig history_;
+  roomLimits limits_;
+  std::shared_ptr<nicknameIndex> nicknames_;
+  roomGroup *group_;
+  std::size_t shard_index_;
+  roomMap rooms_;
+};
+
 /**
  * @class personInRoom
  * @brief Класс для управления участником в комнате.
  */
 class personInRoom : public participant,
+                     public timerTarget,
                      public std::enable_shared_from_this<personInRoom> {
 public:
   /**
    * @brief Конструктор.
    * @param io_service Сервис ввода-вывода Boost.Asio.
-   * @param strand Странд Boost.Asio.
-   * @param room Комната чата.
+   * @param rooms Реестр комнат порта.
+   * @param config Параметры сессии.
    */
-  personInRoom(boost::asio::io_service &io_service,
-               boost::asio::io_service::strand &strand, chatRoom &room);
+  personInRoom(boost::asio::io_service &io_service, roomRegistry &rooms,
+               const sessionConfig &config = sessionConfig());
+  ~personInRoom();
   /**
    * @brief Получение сокета.
    * @return Сокет.
@@ -104,23 +812,212 @@ public:
    * @brief Запуск участника.
    */
   void start();
+  /**
+   * @brief Возврат сессии в исходное состояние перед повторным
+   * использованием (вызывается пулом, когда на сессию не осталось ссылок).
+   */
+  void recycle();
   /**
    * @brief Обработка входящего сообщения.
+   * Может вызываться с любого потока: сообщение передаётся в странд
+   * участника.
    * @param msg Сообщение.
    */
-  void onMessage(std::array<char, MAX_IP_PACK_SIZE> &msg);
+  void onMessage(const messagePtr &msg);
+  /**
+   * @brief Срабатывание таймера сессии в колесе (с потока колеса).
+   */
+  void expired() override;
   /**
    * @brief Обработчик никнейма.
    * @param error Код ошибки.
    */
   void nicknameHandler(const boost::system::error_code &error);
   /**
-   * @brief Обработчик чтения.
+   * @brief Обработчик чтения в буфер сессии: разбирает все целые пакеты
+   * или кадры и запускает следующее чтение.
+   * @param error Код ошибки.
+   * @param bytes Число прочитанных байт.
+   */
+  void readHandler(const boost::system::error_code &error,
+                   std::size_t bytes = 0);
+  /**
+   * @brief Обработчик дочитывания кадра, не поместившегося в буфер чтения.
    * @param error Код ошибки.
+   * @param bytes Число прочитанных байт.
    */
-  void readHandler(const boost::system::error_code &error);
+  void readBodyHandler(const boost::system::error_code &error,
+                       std::size_t bytes);
 
 private:
+  /**
+   * @brief Разбор целых пакетов или кадров из буфера чтения.
+   * @return true, если нужно продолжить чтение в буфер; false, если
+   * сессия закрыта, запущено дочитывание длинного кадра или чтение
+   * приостановлено ограничением частоты.
+   */
+  bool processInput();
+  /**
+   * @brief Обработка прочитанного кадра (тип в read_type_, тело в
+   * read_body_).
+   */
+  void handleFrame();
+  /**
+   * @brief Взятие токена перед разбором текстового кадра (политика
+   * delay). Если токена нет, чтение приостанавливается до его появления.
+   * @return true, если кадр можно разобрать сейчас.
+   */
+  bool readyForText();
+  /**
+   * @brief Взятие токена для принятого текста (политики drop и notice).
+   * @return true, если текст можно обработать; иначе он отбрасывается.
+   */
+  bool admitText();
+  /**
+   * @brief Уведомление участника о сброшенном сообщении (не чаще одного
+   * раза до следующего разосланного сообщения; при политике drop —
+   * никогда).
+   */
+  void throttleNotice();
+  /**
+   * @brief Обработчик окончания паузы чтения по ограничению частоты.
+   * @param error Код ошибки.
+   */
+  void throttleHandler(const boost::system::error_code &error);
+  /**
+   * @brief Перенос накопленных входящих сообщений в очередь записи
+   * (выполняется в странде).
+   */
+  void drainInbox();
+  /**
+   * @brief Постановка сообщения в очередь записи (выполняется в странде).
+   * @param msg Сообщение.
+   */
+  void deliver(const messagePtr &msg);
+  /**
+   * @brief Добавление сообщения в конец очереди записи без проверки
+   * ограничений; объём очереди учитывается здесь и только здесь.
+   * @param msg Сообщение.
+   */
+  void enqueue(const messagePtr &msg);
+  /**
+   * @brief Расширение кольцевой очереди записи, если она заполнена.
+   */
+  void reserveQueue();
+  /**
+   * @brief Освобождение места в заполненной очереди по политике
+   * переполнения.
+   * @param bytes Размер нового сообщения.
+   * @return false, если новое сообщение нужно отбросить.
+   */
+  bool makeRoom(std::size_t bytes);
+  /**
+   * @brief Проверка, помещается ли в очередь ещё одно сообщение.
+   * @param bytes Размер сообщения.
+   * @return true, если лимиты очереди не будут превышены.
+   */
+  bool fits(std::size_t bytes) const;
+  /**
+   * @brief Проверка, освободилась ли очередь хотя бы наполовину (после
+   * этого медленного участника больше не собираются отключать).
+   * @return true, если очередь заполнена не больше чем наполовину.
+   */
+  bool drained() const;
+  /**
+   * @brief Проверка сроков сессии (выполняется в странде): рукопожатие,
+   * простой, зависшая запись, отсрочка медленного участника, проверка
+   * связи.
+   */
+  void timerHandler();
+  /**
+   * @brief Взвод таймера сессии на ближайший срок.
+   */
+  void armTimer();
+  /**
+   * @brief Отключение участника по истечении срока.
+   * @param reason Причина для журнала.
+   */
+  void timeout(const std::string &reason);
+  /**
+   * @brief Обработка текста от участника: команды /join, /leave, /history и
+   * /msg или отправка сообщения в текущую комнату.
+   * @param text Текст.
+   */
+  void handleText(const std::string &text);
+  /**
+   * @brief Личное сообщение участнику порта (команда /msg): доставляется
+   * только получателю и копия — отправителю, мимо рассылки комнаты и
+   * истории.
+   * @param request Аргумент команды: "<никнейм> <текст>".
+   */
+  void sendDirect(const std::string &request);
+  /**
+   * @brief Отказ в рукопожатии: никнейм уже занят или недопустим.
+   * Участнику уходят ответ HANDSHAKE_REJECTED и уведомление, после чего
+   * соединение закрывается.
+   * @param notice Текст уведомления (он же пишется в журнал).
+   */
+  void rejectNickname(const std::string &notice);
+  /**
+   * @brief Чтение и отбрасывание данных отвергнутого клиента до закрытия
+   * им соединения (чтобы закрытие не обернулось сбросом и клиент успел
+   * прочитать уведомление).
+   * @param error Код ошибки.
+   */
+  void drainRejected(const boost::system::error_code &error);
+  /**
+   * @brief Ответ на запрос истории текущей комнаты одной пачкой.
+   * @param request Аргумент команды /history: пусто (вся история), число
+   * последних сообщений или "since <мс с начала эпохи>".
+   */
+  void sendHistory(const std::string &request);
+  /**
+   * @brief Ответ на поиск по истории текущей комнаты одной пачкой.
+   * @param request Аргумент команды /search: слова, "from:<никнейм>",
+   * "since:<мс>" и "until:<мс>".
+   */
+  void sendSearch(const std::string &request);
+  /**
+   * @brief Переход в другую комнату.
+   * @param name Имя комнаты.
+   */
+  void switchRoom(const std::string &name);
+  /**
+   * @brief Вход в комнату; участнику версии 2 перед историей уходит
+   * FRAME_ROOM с именем комнаты.
+   * @param name Имя комнаты.
+   * @param after_seq Номер последнего полученного сообщения комнаты.
+   */
+  void enterRoom(const std::string &name, std::uint64_t after_seq);
+  /**
+   * @brief Обработка FRAME_RESUME: вход в комнату с досылкой только
+   * пропущенных сообщений.
+   * @param payload Номер последнего полученного сообщения и имя комнаты.
+   */
+  void resume(const std::string &payload);
+  /**
+   * @brief Выход из текущей комнаты при завершении сессии.
+   */
+  void leaveRoom();
+  /**
+   * @brief Завершение сессии без исключений: выход из комнаты, отмена
+   * таймеров и закрытие сокета. Незавершённые операции вернутся с
+   * operation_aborted, и после последнего обработчика сессия уйдёт в пул.
+   */
+  void teardown();
+  /**
+   * @brief Запуск чтения следующего сообщения в согласованном протоколе.
+   */
+  void startRead();
+  /**
+   * @brief Запуск пакетной записи накопленных в очереди сообщений.
+   */
+  void startWrite();
+  /**
+   * @brief Обработчик окончания окна накопления сообщений.
+   * @param error Код ошибки.
+   */
+  void coalesceHandler(const boost::system::error_code &error);
   /**
    * @brief Обработчик записи.
    * @param error Код ошибки.
@@ -128,11 +1025,112 @@ private:
   void writeHandler(const boost::system::error_code &error);
 
   tcp::socket socket_;
-  boost::asio::io_service::strand &strand_;
-  chatRoom &room_;
-  std::array<char, MAX_NICKNAME> nickname_;
-  std::array<char, MAX_IP_PACK_SIZE> read_msg_;
-  std::deque<std::array<char, MAX_IP_PACK_SIZE>> write_msgs_;
+  boost::asio::io_service::strand strand_;
+  roomRegistry &rooms_;
+  std::shared_ptr<chatRoom> room_;
+  memberHandle member_;
+  /// Никнейм с разделителем ": ", зарегистрированный при рукопожатии.
+  internedName display_name_;
+  /// Никнейм, занятый в индексе никнеймов порта.
+  std::string claimed_nickname_;
+  /// Рукопожатие отвергнуто: после отправки ответа соединение закрывается.
+  bool rejected_;
+  sessionConfig config_;
+  boost::asio::steady_timer coalesce_timer_;
+  boost::asio::steady_timer throttle_timer_;
+  tokenBucket limiter_;
+  /// Уведомление о сброшенном сообщении уже отправлено.
+  bool throttle_noticed_;
+  /// Длинный кадр дочитан в read_body_ и ждёт токена.
+  bool body_pending_;
+  bool flush_scheduled_;
+  bool stalled_;
+  std::size_t writing_;
+  std::size_t writing_bytes_;
+  std::chrono::steady_clock::time_point write_started_;
+  std::size_t queued_bytes_;
+  std::size_t skipped_;
+  std::vector<boost::asio::const_buffer> write_bufs_;
+  handshakePacket nickname_;
+  std::uint8_t version_;
+  /// Буфер чтения выделяется один раз и остаётся у сессии в пуле;
+  /// непрочитанные данные лежат в [read_begin_, read_end_).
+  std::vector<char> read_buf_;
+  std::size_t read_begin_;
+  std::size_t read_end_;
+  std::string read_body_;
+  boost::circular_buffer<messagePtr> write_msgs_;
+  /// Сообщения, доставленные участнику с других потоков, но ещё не
+  /// перенесённые в очередь записи; в странд ставится одна задача на пачку.
+  std::mutex inbox_mutex_;
+  std::vector<messagePtr> inbox_;
+  std::vector<messagePtr> draining_;
+  handlerMemory read_memory_;
+  handlerMemory write_memory_;
+  handlerMemory inbox_memory_;
+  handlerMemory coalesce_memory_;
+  handlerMemory throttle_memory_;
+  handlerMemory timer_memory_;
+  timingWheel &wheel_;
+  wheelTimer timer_;
+  /// Срок, на который таймер уже взведён (max — не взведён). Пока новый
+  /// срок не раньше, колесо и его мьютекс не трогаются.
+  std::chrono::steady_clock::time_point armed_until_;
+  bool handshaken_;
+  /// Время последних входящих данных (или подключения).
+  std::chrono::steady_clock::time_point last_read_;
+  std::chrono::steady_clock::time_point last_ping_;
+  /// Срок отключения медленного участника (политика disconnect).
+  std::chrono::steady_clock::time_point stall_deadline_;
+  frameType read_type_;
+};
+
+/**
+ * @class sessionPool
+ * @brief Пул сессий порта.
+ *
+ * Сессия, на которую не осталось ссылок, не удаляется, а сбрасывается и
+ * возвращается в пул вместе с уже выделенными буферами; следующее
+ * подключение берёт её из пула. Блоки управления shared_ptr тоже
+ * переиспользуются (recyclingAllocator).
+ */
+class sessionPool : public std::enable_shared_from_this<sessionPool> {
+public:
+  /**
+   * @brief Конструктор.
+   * @param io_service Сервис ввода-вывода сессий.
+   * @param rooms Реестр комнат порта.
+   * @param config Параметры сессий.
+   */
+  sessionPool(boost::asio::io_service &io_service, roomRegistry &rooms,
+              const sessionConfig &config);
+  ~sessionPool();
+
+  /**
+   * @brief Получение свободной сессии (из пула или новой).
+   * @return Сессия; после освобождения последней ссылки она вернётся в
+   * пул.
+   */
+  std::shared_ptr<personInRoom> acquire();
+
+  /**
+   * @brief Число свободных сессий в пуле.
+   * @return Число сессий.
+   */
+  std::size_t idle();
+
+private:
+  /**
+   * @brief Возврат сессии в пул.
+   * @param session Сессия.
+   */
+  void release(personInRoom *session);
+
+  boost::asio::io_service &io_service_;
+  roomRegistry &rooms_;
+  sessionConfig config_;
+  std::mutex mutex_;
+  std::vector<personInRoom *> idle_;
 };
 
 /**
@@ -144,16 +1142,41 @@ public:
   /**
    * @brief Конструктор сервера.
    * @param io_service Сервис ввода-вывода Boost.Asio.
-   * @param strand Странд Boost.Asio.
    * @param endpoint Конечная точка подключения.
+   * @param reuse_port Открыть акцептор с SO_REUSEPORT, чтобы несколько
+   * шардов слушали один порт.
+   * @param config Параметры сервера.
+   */
+  server(boost::asio::io_service &io_service, const tcp::endpoint &endpoint,
+         bool reuse_port = false, const serverConfig &config = serverConfig());
+
+  /**
+   * @brief Получение комнаты сервера по умолчанию.
+   * @return Комната чата.
+   */
+  chatRoom &room();
+
+  /**
+   * @brief Получение реестра комнат сервера.
+   * @return Реестр комнат.
+   */
+  roomRegistry &rooms();
+
+  /**
+   * @brief Получение пула сессий сервера.
+   * @return Пул сессий.
    */
-  server(boost::asio::io_service &io_service,
-         boost::asio::io_service::strand &strand,
-         const tcp::endpoint &endpoint);
+  sessionPool &sessions();
+
+  /**
+   * @brief Получение акцептора сервера.
+   * @return Акцептор.
+   */
+  tcp::acceptor &acceptor();
 
 private:
   /**
-   * @brief Запуск сервера.
+   * @brief Запуск ожидания следующего подключения.
    */
   void run();
 
@@ -166,9 +1189,13 @@ private:
                 const boost::system::error_code &error);
 
   boost::asio::io_service &io_service_;
-  boost::asio::io_service::strand &strand_;
   tcp::acceptor acceptor_;
-  chatRoom room_;
+  /// Упорядочивает завершения ожиданий подключения, когда их несколько.
+  boost::asio::io_service::strand accept_strand_;
+  serverConfig config_;
+  listenerConfig listener_;
+  roomRegistry rooms_;
+  std::shared_ptr<sessionPool> sessions_;
 };
 /**
  * @brief Загружает конфигурацию из файла и парсит её в объект JSON.
@@ -180,4 +1207,51 @@ private:
  */
 void loadConfig(const std::string &filename, nlohmann::json &config);
 
+/**
+ * @brief Чтение параметров сессий из конфигурации.
+ * @param config Конфигурация сервера.
+ * @return Параметры сессий (отсутствующие ключи берутся по умолчанию).
+ */
+sessionConfig parseSessionConfig(const nlohmann::json &config);
+
+/**
+ * @brief Чтение параметров акцептора из объекта конфигурации поверх
+ * заданных.
+ * @param config Объект с параметрами (отсутствующие ключи не меняются).
+ * @param base Исходные параметры.
+ * @return Параметры акцептора.
+ */
+listenerConfig parseListenerConfig(const nlohmann::json &config,
+                                   listenerConfig base = listenerConfig());
+
+/**
+ * @brief Параметры акцептора порта.
+ * @param config Параметры сервера.
+ * @param port Порт.
+ * @return Параметры порта или общие, если для порта они не заданы.
+ */
+const listenerConfig &portListenerConfig(const serverConfig &config,
+                                         unsigned short port);
+
+/**
+ * @brief Чтение всех параметров сервера из конфигурации.
+ * @param config Конфигурация сервера.
+ * @return Параметры сервера.
+ */
+serverConfig parseServerConfig(const nlohmann::json &config);
+
+/**
+ * @brief Привязка потока к процессору (только Linux).
+ * @param thread Поток.
+ * @param cpu Номер процессора.
+ */
+void pinThread(boost::thread &thread, unsigned cpu);
+
+/**
+ * @brief Цикл рабочего потока. Исключение из обработчика одной сессии
+ * записывается в журнал, и поток возвращается к обслуживанию остальных.
+ * @param io_service Сервис ввода-вывода.
+ */
+void runWorker(boost::asio::io_service &io_service);
+
 #endif // SERVER_HPP
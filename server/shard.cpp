@@ -0,0 +1,101 @@
+#include "shard.hpp"
+#include <boost/bind/bind.hpp>
+#include <utility>
+
+shard::shard(std::size_t index, const std::vector<int> &ports,
+             const serverConfig &config)
+    : index_(index), io_service_(1), work_(io_service_) {
+  for (int port : ports) {
+    tcp::endpoint endpoint(tcp::v4(), port);
+    servers_.emplace_back(new server(io_service_, endpoint, true, config));
+  }
+}
+
+void shard::run() { runWorker(io_service_); }
+
+void shard::stop() { io_service_.stop(); }
+
+void shard::post(std::function<void()> task) {
+  bool idle;
+  {
+    std::lock_guard<std::mutex> lock(mailbox_mutex_);
+    idle = mailbox_.empty();
+    mailbox_.push_back(std::move(task));
+  }
+  // Пока ящик не опустошён, drain уже запланирован и заберёт новую задачу.
+  if (idle) {
+    io_service_.post(boost::bind(&shard::drain, this));
+  }
+}
+
+void shard::drain() {
+  std::vector<std::function<void()>> tasks;
+  {
+    std::lock_guard<std::mutex> lock(mailbox_mutex_);
+    tasks.swap(mailbox_);
+  }
+  for (auto &task : tasks) {
+    task();
+  }
+}
+
+boost::asio::io_service &shard::ioService() { return io_service_; }
+
+chatRoom &shard::room(std::size_t port_index) {
+  return servers_.at(port_index)->room();
+}
+
+roomRegistry &shard::rooms(std::size_t port_index) {
+  return servers_.at(port_index)->rooms();
+}
+
+std::size_t shard::index() const { return index_; }
+
+roomGroup::roomGroup(const std::vector<shard *> &shards,
+                     std::size_t port_index)
+    : shards_(shards), port_index_(port_index) {
+  for (shard *s : shards_) {
+    registries_.push_back(&s->rooms(port_index));
+  }
+  // Никнеймы уникальны в пределах порта, а не шарда.
+  auto nicknames = std::make_shared<nicknameIndex>();
+  for (std::size_t i = 0; i < registries_.size(); ++i) {
+    registries_[i]->attach(this, i, nicknames);
+  }
+}
+
+std::size_t roomGroup::home(const std::string &room) const {
+  // Комнаты по умолчанию разных портов живут на разных шардах, как и
+  // прежде единственные комнаты портов.
+  if (room == DEFAULT_ROOM) {
+    return port_index_ % shards_.size();
+  }
+  return std::hash<std::string>()(room) % shards_.size();
+}
+
+void roomGroup::publish(const std::string &room, chatRecord record) {
+  std::size_t home_index = home(room);
+  shards_[home_index]->post(
+      [this, home_index, room, record = std::move(record)]() {
+        std::vector<std::size_t> replicas;
+        messagePtr formatted_msg =
+            registries_[home_index]->commit(room, record, replicas);
+        // Пустой указатель: сообщение отброшено ограничением частоты
+        // комнаты, реплики ничего не получают.
+        for (std::size_t i : replicas) {
+          roomRegistry *registry = registries_[i];
+          shards_[i]->post([registry, room, formatted_msg]() {
+            registry->deliver(room, formatted_msg);
+          });
+        }
+      });
+}
+
+void roomGroup::replica(const std::string &room, std::size_t shard_index,
+                        bool alive) {
+  std::size_t home_index = home(room);
+  roomRegistry *registry = registries_[home_index];
+  shards_[home_index]->post([registry, room, shard_index, alive]() {
+    registry->replica(room, shard_index, alive);
+  });
+}
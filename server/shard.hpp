@@ -0,0 +1,133 @@
+#ifndef SHARD_HPP
+#define SHARD_HPP
+
+#include "server.hpp"
+#include <boost/asio.hpp>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+/**
+ * @class shard
+ * @brief Шард сервера: собственный io_service, обслуживаемый одним потоком,
+ * свои акцепторы на всех портах (SO_REUSEPORT) и принятые ими участники.
+ *
+ * Шарды не разделяют состояние комнат: задачи для другого шарда передаются
+ * через его почтовый ящик и выполняются на его потоке.
+ */
+class shard {
+public:
+  /**
+   * @brief Конструктор шарда.
+   * @param index Номер шарда.
+   * @param ports Порты, которые слушает шард.
+   * @param config Параметры сервера.
+   */
+  shard(std::size_t index, const std::vector<int> &ports,
+        const serverConfig &config = serverConfig());
+
+  /**
+   * @brief Цикл обработки событий шарда (вызывается в потоке шарда).
+   */
+  void run();
+
+  /**
+   * @brief Остановка цикла обработки событий.
+   */
+  void stop();
+
+  /**
+   * @brief Передача задачи в почтовый ящик шарда.
+   * Может вызываться с любого потока.
+   * @param task Задача.
+   */
+  void post(std::function<void()> task);
+
+  /**
+   * @brief Получение сервиса ввода-вывода шарда.
+   * @return Сервис ввода-вывода.
+   */
+  boost::asio::io_service &ioService();
+
+  /**
+   * @brief Получение локальной реплики комнаты порта.
+   * @param port_index Номер порта в конфигурации.
+   * @return Комната чата.
+   */
+  chatRoom &room(std::size_t port_index);
+
+  /**
+   * @brief Получение реестра комнат порта на этом шарде.
+   * @param port_index Номер порта в конфигурации.
+   * @return Реестр комнат.
+   */
+  roomRegistry &rooms(std::size_t port_index);
+
+  /**
+   * @brief Получение номера шарда.
+   * @return Номер шарда.
+   */
+  std::size_t index() const;
+
+private:
+  /**
+   * @brief Выполнение всех накопленных задач почтового ящика.
+   */
+  void drain();
+
+  std::size_t index_;
+  boost::asio::io_service io_service_;
+  boost::asio::io_service::work work_;
+  std::vector<std::unique_ptr<server>> servers_;
+  std::mutex mailbox_mutex_;
+  std::vector<std::function<void()>> mailbox_;
+};
+
+/**
+ * @class roomGroup
+ * @brief Группа реестров комнат одного порта на всех шардах.
+ *
+ * Сообщения каждой комнаты упорядочивает её домашний шард (выбирается по
+ * хешу имени): он оформляет и сохраняет сообщение, доставляет его своим
+ * участникам и рассылает шардам, на которых есть реплики комнаты.
+ */
+class roomGroup {
+public:
+  /**
+   * @brief Конструктор группы. Подключает реестры шардов к группе.
+   * @param shards Шарды сервера.
+   * @param port_index Номер порта в конфигурации.
+   */
+  roomGroup(const std::vector<shard *> &shards, std::size_t port_index);
+
+  /**
+   * @brief Номер домашнего шарда комнаты.
+   * @param room Имя комнаты.
+   * @return Номер шарда.
+   */
+  std::size_t home(const std::string &room) const;
+
+  /**
+   * @brief Публикация сообщения в комнату с любого шарда.
+   * @param room Имя комнаты.
+   * @param record Сообщение участника (оформляется на домашнем шарде).
+   */
+  void publish(const std::string &room, chatRecord record);
+
+  /**
+   * @brief Уведомление домашнего шарда о создании или удалении реплики.
+   * @param room Имя комнаты.
+   * @param shard_index Номер шарда реплики.
+   * @param alive true — реплика создана, false — удалена.
+   */
+  void replica(const std::string &room, std::size_t shard_index, bool alive);
+
+private:
+  std::vector<shard *> shards_;
+  std::vector<roomRegistry *> registries_;
+  std::size_t port_index_;
+};
+
+#endif // SHARD_HPP
@@ -0,0 +1,65 @@
+#include "timestamp.hpp"
+#include <time.h>
+
+namespace {
+
+inline void putDigits(char *out, int value, int digits) {
+  for (int i = digits - 1; i >= 0; --i) {
+    out[i] = static_cast<char>('0' + value % 10);
+    value /= 10;
+  }
+}
+
+/**
+ * @struct timestampCache
+ * @brief Отформатированный штамп последней секунды, своя копия у каждого
+ * потока.
+ */
+struct timestampCache {
+  std::time_t second = -1;
+  char text[TIMESTAMP_SIZE + 1];
+};
+
+thread_local timestampCache cache;
+
+} // namespace
+
+void formatTimestamp(std::time_t seconds, char *buffer) {
+  struct tm now;
+  localtime_r(&seconds, &now);
+  buffer[0] = '[';
+  putDigits(buffer + 1, now.tm_year + 1900, 4);
+  buffer[5] = '-';
+  putDigits(buffer + 6, now.tm_mon + 1, 2);
+  buffer[8] = '-';
+  putDigits(buffer + 9, now.tm_mday, 2);
+  buffer[11] = ' ';
+  putDigits(buffer + 12, now.tm_hour, 2);
+  buffer[14] = ':';
+  putDigits(buffer + 15, now.tm_min, 2);
+  buffer[17] = ':';
+  putDigits(buffer + 18, now.tm_sec, 2);
+  buffer[20] = ']';
+  buffer[21] = ' ';
+  buffer[TIMESTAMP_SIZE] = '\0';
+}
+
+const char *cachedTimestamp() {
+  std::time_t seconds;
+#ifdef CLOCK_REALTIME_COARSE
+  struct timespec ts;
+  clock_gettime(CLOCK_REALTIME_COARSE, &ts);
+  seconds = ts.tv_sec;
+#else
+  seconds = std::time(nullptr);
+#endif
+  return cachedTimestamp(seconds);
+}
+
+const char *cachedTimestamp(std::time_t seconds) {
+  if (seconds != cache.second) {
+    formatTimestamp(seconds, cache.text);
+    cache.second = seconds;
+  }
+  return cache.text;
+}
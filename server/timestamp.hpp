@@ -0,0 +1,36 @@
+#ifndef TIMESTAMP_HPP
+#define TIMESTAMP_HPP
+
+#include <cstddef>
+#include <ctime>
+
+/// Длина префикса "[YYYY-MM-DD HH:MM:SS] ".
+constexpr std::size_t TIMESTAMP_SIZE = 22;
+
+/**
+ * @brief Форматирование временного штампа в буфер без выделения памяти.
+ * @param seconds Время, секунды с начала эпохи.
+ * @param buffer Буфер не короче TIMESTAMP_SIZE + 1 байт.
+ */
+void formatTimestamp(std::time_t seconds, char *buffer);
+
+/**
+ * @brief Временной штамп текущей секунды.
+ *
+ * Штамп хранится в буфере потока и переформатируется не чаще раза в
+ * секунду; время берётся грубыми часами (CLOCK_REALTIME_COARSE в Linux).
+ * @return Строка длиной TIMESTAMP_SIZE, действительная до следующего вызова
+ * в этом же потоке.
+ */
+const char *cachedTimestamp();
+
+/**
+ * @brief Временной штамп заданной секунды из того же кеша потока (для
+ * сообщений, отправленных мгновение назад, он почти всегда готов).
+ * @param seconds Время, секунды с начала эпохи.
+ * @return Строка длиной TIMESTAMP_SIZE, действительная до следующего вызова
+ * в этом же потоке.
+ */
+const char *cachedTimestamp(std::time_t seconds);
+
+#endif // TIMESTAMP_HPP
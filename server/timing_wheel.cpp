@@ -0,0 +1,142 @@
+#include "timing_wheel.hpp"
+#include <algorithm>
+
+boost::asio::io_service::id timingWheel::id;
+
+timingWheel::timingWheel(boost::asio::io_service &io_service)
+    : boost::asio::io_service::service(io_service), timer_(io_service),
+      origin_(std::chrono::steady_clock::now()),
+      tick_(DEFAULT_WHEEL_TICK_MS), slots_(WHEEL_SLOTS), processed_(0),
+      size_(0), ticking_(false), stopped_(false) {
+  for (wheelTimer &slot : slots_) {
+    slot.prev = &slot;
+    slot.next = &slot;
+  }
+}
+
+void timingWheel::setTick(std::chrono::milliseconds tick) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  if (size_ == 0 && !ticking_ && tick.count() > 0) {
+    tick_ = tick;
+  }
+}
+
+void timingWheel::arm(wheelTimer &timer,
+                      std::chrono::steady_clock::time_point deadline) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  if (stopped_) {
+    return;
+  }
+  if (!ticking_) {
+    // Колесо стояло: отсчёт продолжается с текущего тика.
+    processed_ = currentTick();
+  }
+  std::uint64_t tick = 0;
+  if (deadline > origin_) {
+    tick = static_cast<std::uint64_t>((deadline - origin_ + tick_ -
+                                       std::chrono::nanoseconds(1)) /
+                                      tick_);
+  }
+  tick = std::max(tick, processed_ + 1);
+
+  if (timer.next) {
+    if (timer.tick <= tick) {
+      return;
+    }
+    unlink(timer);
+  } else {
+    ++size_;
+  }
+  timer.tick = tick;
+  wheelTimer &slot = slots_[tick % WHEEL_SLOTS];
+  timer.prev = slot.prev;
+  timer.next = &slot;
+  slot.prev->next = &timer;
+  slot.prev = &timer;
+
+  if (!ticking_) {
+    ticking_ = true;
+    scheduleTickLocked();
+  }
+}
+
+void timingWheel::cancel(wheelTimer &timer) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  if (timer.next) {
+    unlink(timer);
+    --size_;
+  }
+}
+
+std::size_t timingWheel::size() {
+  std::lock_guard<std::mutex> lock(mutex_);
+  return size_;
+}
+
+void timingWheel::shutdown() {
+  std::lock_guard<std::mutex> lock(mutex_);
+  stopped_ = true;
+  boost::system::error_code ignored;
+  timer_.cancel(ignored);
+}
+
+std::uint64_t timingWheel::currentTick() const {
+  return static_cast<std::uint64_t>(
+      (std::chrono::steady_clock::now() - origin_) / tick_);
+}
+
+void timingWheel::scheduleTickLocked() {
+  timer_.expires_at(origin_ + tick_ * (processed_ + 1));
+  timer_.async_wait(
+      [this](const boost::system::error_code &error) { onTick(error); });
+}
+
+void timingWheel::onTick(const boost::system::error_code &error) {
+  if (error == boost::asio::error::operation_aborted) {
+    return;
+  }
+  // Список сработавших локальный: в режиме пула шаг может выполняться на
+  // другом потоке, пока этот ещё уведомляет владельцев.
+  std::vector<std::shared_ptr<timerTarget>> fired;
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    std::uint64_t target = std::max(currentTick(), processed_);
+    // После долгой паузы достаточно одного прохода по всем ячейкам.
+    std::uint64_t steps =
+        std::min<std::uint64_t>(target - processed_, WHEEL_SLOTS);
+    for (std::uint64_t step = 1; step <= steps; ++step) {
+      wheelTimer &slot = slots_[(processed_ + step) % WHEEL_SLOTS];
+      wheelTimer *timer = slot.next;
+      while (timer != &slot) {
+        wheelTimer *next = timer->next;
+        if (timer->tick <= target) {
+          unlink(*timer);
+          --size_;
+          if (std::shared_ptr<timerTarget> owner = timer->target.lock()) {
+            fired.push_back(std::move(owner));
+          }
+        }
+        timer = next;
+      }
+    }
+    processed_ = target;
+    if (size_ != 0 && !stopped_) {
+      scheduleTickLocked();
+    } else {
+      ticking_ = false;
+    }
+  }
+
+  // Владельцы уведомляются без мьютекса: они могут сразу перевзвести
+  // таймер, а последняя ссылка на владельца может освободиться здесь же.
+  for (const std::shared_ptr<timerTarget> &owner : fired) {
+    owner->expired();
+  }
+}
+
+void timingWheel::unlink(wheelTimer &timer) {
+  timer.prev->next = timer.next;
+  timer.next->prev = timer.prev;
+  timer.prev = nullptr;
+  timer.next = nullptr;
+}
@@ -0,0 +1,131 @@
+#ifndef TIMING_WHEEL_HPP
+#define TIMING_WHEEL_HPP
+
+#include <boost/asio.hpp>
+#include <chrono>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+/// Число ячеек колеса (таймеры дальше одного оборота ждут своего круга).
+constexpr std::size_t WHEEL_SLOTS = 512;
+
+/// Шаг колеса по умолчанию, мс.
+constexpr unsigned DEFAULT_WHEEL_TICK_MS = 100;
+
+/**
+ * @class timerTarget
+ * @brief Владелец таймера колеса, которого уведомляют о срабатывании.
+ */
+class timerTarget {
+public:
+  virtual ~timerTarget() {}
+  /**
+   * @brief Срабатывание таймера. Вызывается на потоке колеса без его
+   * мьютекса; владелец сам переносит работу в свой странд.
+   */
+  virtual void expired() = 0;
+};
+
+/**
+ * @struct wheelTimer
+ * @brief Таймер колеса: узел двусвязного списка ячейки.
+ *
+ * Встраивается в объект-владельца, поэтому взвод и отмена не выделяют
+ * память. Поля меняет только колесо под своим мьютексом.
+ */
+struct wheelTimer {
+  wheelTimer *prev = nullptr;
+  wheelTimer *next = nullptr;
+  /// Тик срабатывания.
+  std::uint64_t tick = 0;
+  /// Владелец; слабая ссылка не продлевает ему жизнь.
+  std::weak_ptr<timerTarget> target;
+};
+
+/**
+ * @class timingWheel
+ * @brief Хешированное колесо таймеров, одно на io_service (то есть на
+ * рабочий поток в режиме sharded).
+ *
+ * Вместо системного таймера на каждое соединение колесо держит один
+ * периодический таймер с шагом tick; таймер соединения лежит в ячейке
+ * tick % WHEEL_SLOTS. Взвод и отмена — O(1), на каждом шаге проверяется
+ * одна ячейка. Пока взведённых таймеров нет, колесо не тикает.
+ */
+class timingWheel : public boost::asio::io_service::service {
+public:
+  static boost::asio::io_service::id id;
+
+  /**
+   * @brief Конструктор (используйте boost::asio::use_service).
+   * @param io_service Сервис ввода-вывода.
+   */
+  explicit timingWheel(boost::asio::io_service &io_service);
+
+  /**
+   * @brief Установка шага колеса. Действует, только пока нет взведённых
+   * таймеров.
+   * @param tick Шаг.
+   */
+  void setTick(std::chrono::milliseconds tick);
+
+  /**
+   * @brief Взвод таймера не позже заданного момента. Если таймер уже
+   * взведён на более ранний тик, ничего не меняется: владелец сам
+   * перевзводит таймер при срабатывании.
+   * @param timer Таймер.
+   * @param deadline Момент срабатывания (округляется вверх до шага).
+   */
+  void arm(wheelTimer &timer, std::chrono::steady_clock::time_point deadline);
+
+  /**
+   * @brief Отмена таймера.
+   * @param timer Таймер.
+   */
+  void cancel(wheelTimer &timer);
+
+  /**
+   * @brief Число взведённых таймеров.
+   * @return Число таймеров.
+   */
+  std::size_t size();
+
+private:
+  void shutdown() override;
+
+  /**
+   * @brief Текущий тик по часам.
+   * @return Номер тика.
+   */
+  std::uint64_t currentTick() const;
+
+  /**
+   * @brief Ожидание следующего шага (под мьютексом).
+   */
+  void scheduleTickLocked();
+
+  /**
+   * @brief Обработчик шага: снимает истёкшие таймеры и уведомляет их
+   * владельцев.
+   * @param error Код ошибки.
+   */
+  void onTick(const boost::system::error_code &error);
+
+  static void unlink(wheelTimer &timer);
+
+  std::mutex mutex_;
+  boost::asio::steady_timer timer_;
+  std::chrono::steady_clock::time_point origin_;
+  std::chrono::milliseconds tick_;
+  /// Заголовки кольцевых списков ячеек.
+  std::vector<wheelTimer> slots_;
+  /// Последний обработанный тик.
+  std::uint64_t processed_;
+  std::size_t size_;
+  bool ticking_;
+  bool stopped_;
+};
+
+#endif // TIMING_WHEEL_HPP
@@ -1,7 +1,11 @@
 #define DOCTEST_CONFIG_IMPLEMENT_WITH_MAIN
 #include "../client/client.hpp"
+#include "../client/replay.hpp"
 #include <../external/doctest/doctest.h>
 #include <boost/asio.hpp>
+#include <sstream>
+#include <thread>
+#include <vector>
 
 TEST_CASE("Создание клиента") {
   boost::asio::io_service io_service;
@@ -22,6 +26,13 @@ TEST_CASE("Создание клиента") {
         [&]() { client cli(empty_nickname, io_service, iterator); }(),
         std::runtime_error);
   }
+
+  SUBCASE("Отрицательный тест: пробел в никнейме") {
+    std::array<char, MAX_NICKNAME> spaced_nickname = {'a', ' ', 'b', '\0'};
+    CHECK_THROWS_AS(
+        [&]() { client cli(spaced_nickname, io_service, iterator); }(),
+        std::runtime_error);
+  }
 }
 
 TEST_CASE("Отправка сообщений и закрытие клиента") {
@@ -67,3 +78,191 @@ TEST_CASE("Подключение клиента") {
     CHECK_THROWS_AS(cli.onConnect(ec), std::runtime_error);
   }
 }
+
+TEST_CASE("Сценарий воспроизведения") {
+  SUBCASE("Положительный тест: события упорядочиваются по времени") {
+    std::istringstream input(
+        "{\"at_ms\": 20, \"user\": \"bob\", \"text\": \"second\"}\n"
+        "\n"
+        "{\"at_ms\": 0, \"user\": \"alice\", \"text\": \"/join room\"}\n"
+        "{\"at_ms\": 20, \"user\": \"alice\", \"text\": \"third\"}\n");
+    std::vector<scriptEvent> events = parseScript(input);
+    REQUIRE(events.size() == 3);
+    CHECK(events[0].user == "alice");
+    CHECK(events[0].text == "/join room");
+    CHECK(events[1].text == "second");
+    CHECK(events[2].text == "third");
+    CHECK(events[2].at == std::chrono::milliseconds(20));
+  }
+
+  SUBCASE("Отрицательный тест: ошибка указывает строку") {
+    std::istringstream input(
+        "{\"at_ms\": 0, \"user\": \"alice\", \"text\": \"hi\"}\n"
+        "{\"at_ms\": 5, \"user\": \"a_very_long_nickname\", \"text\": \"\"}\n");
+    CHECK_THROWS_WITH_AS(parseScript(input),
+                         doctest::Contains("Строка 2"), std::runtime_error);
+  }
+
+  SUBCASE("Положительный тест: пользователи на одном io_service") {
+    // Сервер-заглушка: подтверждает рукопожатие, отвечает каждому
+    // пользователю одним кадром и ждёт, пока клиенты закроются.
+    boost::asio::io_service server_service;
+    tcp::acceptor acceptor(server_service,
+                           tcp::endpoint(tcp::v4(), 12380));
+    std::thread stub([&acceptor, &server_service]() {
+      std::vector<tcp::socket> sockets;
+      for (int i = 0; i < 2; ++i) {
+        sockets.emplace_back(server_service);
+        acceptor.accept(sockets.back());
+        handshakePacket packet;
+        boost::asio::read(sockets.back(), boost::asio::buffer(packet));
+        std::string reply = std::string(1, static_cast<char>(
+                                               PROTOCOL_FRAMED)) +
+                            makeFrame("hello " + handshakeNickname(packet));
+        boost::asio::write(sockets.back(), boost::asio::buffer(reply));
+      }
+      for (tcp::socket &socket : sockets) {
+        std::array<char, 256> sink;
+        boost::system::error_code ec;
+        while (!ec) {
+          socket.read_some(boost::asio::buffer(sink), ec);
+        }
+      }
+    });
+
+    std::istringstream input(
+        "{\"at_ms\": 0, \"user\": \"alice\", \"text\": \"one\"}\n"
+        "{\"at_ms\": 10, \"user\": \"bob\", \"text\": \"two\"}\n"
+        "{\"at_ms\": 20, \"user\": \"alice\", \"text\": \"three\"}\n");
+    boost::asio::io_service io_service;
+    tcp::resolver resolver(io_service);
+    std::ostringstream out;
+    replayRunner runner(io_service,
+                        resolver.resolve(tcp::resolver::query("127.0.0.1",
+                                                              "12380")),
+                        parseScript(input), replayOutput::buffered, out,
+                        std::chrono::milliseconds(50));
+    runner.start();
+    io_service.run();
+    stub.join();
+
+    CHECK(runner.users() == 2);
+    CHECK(runner.sent() == 3);
+    CHECK(runner.received() == 2);
+    CHECK(out.str().find("alice\thello alice\n") != std::string::npos);
+    CHECK(out.str().find("bob\thello bob\n") != std::string::npos);
+  }
+}
+
+TEST_CASE("Переподключение с досылкой пропущенного") {
+  // Сервер-заглушка версии 2: в первом соединении отдаёт два сообщения с
+  // номерами и обрывает связь, во втором проверяет FRAME_RESUME и досылает
+  // третье.
+  boost::asio::io_service server_service;
+  tcp::acceptor acceptor(server_service, tcp::endpoint(tcp::v4(), 12381));
+  auto sequenced = [](std::uint64_t seq, const std::string &text) {
+    std::string payload(SEQUENCE_SIZE, '\0');
+    encodeSequence(seq, &payload[0]);
+    return makeFrame(payload + makeFrame(text), FRAME_SEQUENCED);
+  };
+  std::vector<std::uint64_t> resumed_seq;
+  std::vector<std::string> resumed_room;
+  std::thread stub([&]() {
+    for (int i = 0; i < 2; ++i) {
+      tcp::socket socket(server_service);
+      acceptor.accept(socket);
+      handshakePacket packet;
+      boost::asio::read(socket, boost::asio::buffer(packet));
+      char version = static_cast<char>(PROTOCOL_RESUMABLE);
+      boost::asio::write(socket, boost::asio::buffer(&version, 1));
+      frameHeader header;
+      boost::asio::read(socket, boost::asio::buffer(header));
+      std::uint32_t length;
+      frameType type;
+      decodeHeader(header, length, type);
+      std::string payload(length, '\0');
+      boost::asio::read(socket, boost::asio::buffer(&payload[0], length));
+      if (type == FRAME_RESUME && length >= SEQUENCE_SIZE) {
+        resumed_seq.push_back(decodeSequence(payload.data()));
+        resumed_room.push_back(payload.substr(SEQUENCE_SIZE));
+      }
+      std::string reply;
+      if (i == 0) {
+        reply = makeFrame("general", FRAME_ROOM) + sequenced(1, "one") +
+                sequenced(2, "two");
+        boost::asio::write(socket, boost::asio::buffer(reply));
+        continue;
+      }
+      reply = sequenced(3, "three");
+      boost::asio::write(socket, boost::asio::buffer(reply));
+      std::array<char, 256> sink;
+      boost::system::error_code ec;
+      while (!ec) {
+        socket.read_some(boost::asio::buffer(sink), ec);
+      }
+    }
+  });
+
+  boost::asio::io_service io_service;
+  tcp::resolver resolver(io_service);
+  std::array<char, MAX_NICKNAME> nickname;
+  nickname.fill('\0');
+  nickname[0] = 'm';
+  client cli(nickname, io_service,
+             resolver.resolve(tcp::resolver::query("127.0.0.1", "12381")));
+  std::vector<std::string> received;
+  cli.setMessageHandler([&](const std::string &msg) {
+    received.push_back(msg);
+    if (msg == "three") {
+      cli.close();
+    }
+  });
+  io_service.run();
+  stub.join();
+
+  REQUIRE(resumed_seq.size() == 2);
+  CHECK(resumed_seq[0] == 0);
+  CHECK(resumed_room[0].empty());
+  CHECK(resumed_seq[1] == 2);
+  CHECK(resumed_room[1] == "general");
+  CHECK(received == std::vector<std::string>{"one", "two", "three"});
+  CHECK(cli.lastSeq() == 3);
+  CHECK(cli.reconnects() == 1);
+}
+
+TEST_CASE("Отказ в занятом никнейме") {
+  // Сервер-заглушка отвечает HANDSHAKE_REJECTED и уведомлением; клиент
+  // сообщает об отказе и не переподключается.
+  boost::asio::io_service server_service;
+  tcp::acceptor acceptor(server_service, tcp::endpoint(tcp::v4(), 12382));
+  std::thread stub([&]() {
+    tcp::socket socket(server_service);
+    acceptor.accept(socket);
+    handshakePacket packet;
+    boost::asio::read(socket, boost::asio::buffer(packet));
+    std::string reply(1, static_cast<char>(HANDSHAKE_REJECTED));
+    reply += makeFrame("taken");
+    boost::asio::write(socket, boost::asio::buffer(reply));
+    std::array<char, 256> sink;
+    boost::system::error_code ec;
+    while (!ec) {
+      socket.read_some(boost::asio::buffer(sink), ec);
+    }
+  });
+
+  boost::asio::io_service io_service;
+  tcp::resolver resolver(io_service);
+  std::array<char, MAX_NICKNAME> nickname;
+  nickname.fill('\0');
+  nickname[0] = 'd';
+  client cli(nickname, io_service,
+             resolver.resolve(tcp::resolver::query("127.0.0.1", "12382")));
+  std::vector<std::string> received;
+  cli.setMessageHandler(
+      [&](const std::string &msg) { received.push_back(msg); });
+  io_service.run();
+  stub.join();
+
+  CHECK(received == std::vector<std::string>{"Nickname is already taken"});
+  CHECK(cli.reconnects() == 0);
+}
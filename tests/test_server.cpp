@@ -1,15 +1,134 @@
 #define DOCTEST_CONFIG_IMPLEMENT_WITH_MAIN
+#include "../server/history.hpp"
+#include "../server/logger.hpp"
+#include "../server/metrics.hpp"
+#include "../server/search.hpp"
 #include "../server/server.hpp"
+#include "../server/shard.hpp"
+#include "../server/timestamp.hpp"
 #include <../external/doctest/doctest.h>
+#include <atomic>
 #include <boost/asio.hpp>
+#include <csignal>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+#include <fstream>
+#include <functional>
+#include <sys/resource.h>
+#include <thread>
+#include <unistd.h>
+
+namespace {
+
+/// Считать ли выделения памяти (для проверки пути доставки без кучи).
+std::atomic<bool> count_allocations(false);
+std::atomic<std::size_t> allocations(0);
+
+} // namespace
+
+void *operator new(std::size_t size) {
+  if (count_allocations.load(std::memory_order_relaxed)) {
+    allocations.fetch_add(1, std::memory_order_relaxed);
+  }
+  void *pointer = std::malloc(size ? size : 1);
+  if (!pointer) {
+    throw std::bad_alloc();
+  }
+  return pointer;
+}
+
+void operator delete(void *pointer) noexcept { std::free(pointer); }
+
+void operator delete(void *pointer, std::size_t) noexcept {
+  std::free(pointer);
+}
+
+/**
+ * @brief Подключение тестового клиента по кадровому протоколу.
+ * @param io_service Сервис ввода-вывода.
+ * @param port Порт сервера.
+ * @param nickname Никнейм.
+ * @return Подключённый сокет (байт подтверждения версии уже прочитан).
+ */
+tcp::socket connectFramed(boost::asio::io_service &io_service,
+                          unsigned short port, const std::string &nickname) {
+  tcp::socket socket(io_service);
+  socket.connect(tcp::endpoint(
+      boost::asio::ip::address::from_string("127.0.0.1"), port));
+  handshakePacket packet;
+  packet.fill('\0');
+  std::copy(nickname.begin(), nickname.end(), packet.begin());
+  packet[MAX_NICKNAME - 1] = static_cast<char>(PROTOCOL_FRAMED);
+  boost::asio::write(socket, boost::asio::buffer(packet));
+  return socket;
+}
+
+/**
+ * @brief Чтение одного кадра из сокета тестового клиента.
+ * @param socket Сокет.
+ * @return Полезная нагрузка кадра.
+ */
+std::string readFrame(tcp::socket &socket) {
+  frameHeader header;
+  boost::asio::read(socket, boost::asio::buffer(header));
+  std::uint32_t length;
+  frameType type;
+  decodeHeader(header, length, type);
+  std::string payload(length, '\0');
+  boost::asio::read(socket, boost::asio::buffer(&payload[0], length));
+  return payload;
+}
+
+/**
+ * @brief Подключение участника с пропуском подтверждения и истории.
+ * @param io_service Сервис ввода-вывода сервера.
+ * @param port Порт сервера.
+ * @param nickname Никнейм.
+ * @return Подключённый сокет.
+ */
+tcp::socket joinQuietly(boost::asio::io_service &io_service,
+                        unsigned short port, const std::string &nickname) {
+  tcp::socket socket = connectFramed(io_service, port, nickname);
+  io_service.run_for(std::chrono::milliseconds(50));
+  char ack = 0;
+  boost::asio::read(socket, boost::asio::buffer(&ack, 1));
+  socket.non_blocking(true);
+  std::array<char, 4096> drain;
+  boost::system::error_code ec;
+  while (socket.read_some(boost::asio::buffer(drain), ec) > 0) {
+  }
+  socket.non_blocking(false);
+  return socket;
+}
+
+/**
+ * @brief Владелец таймера колеса, считающий срабатывания.
+ */
+class countingTarget : public timerTarget {
+public:
+  void expired() override { ++fired; }
+  int fired = 0;
+};
+
+/**
+ * @brief Участник, запоминающий доставленные ему сообщения.
+ */
+class recordingParticipant : public participant {
+public:
+  void onMessage(const messagePtr &msg) override {
+    messages.push_back(msg->text());
+  }
+  std::vector<std::string> messages;
+};
 
 TEST_CASE("Запуск сервера") {
   boost::asio::io_service io_service;
-  boost::asio::io_service::strand strand(io_service);
   tcp::endpoint endpoint(tcp::v4(), 12345);
 
   SUBCASE("Положительный тест") {
-    CHECK_NOTHROW(server srv(io_service, strand, endpoint));
+    CHECK_NOTHROW(server srv(io_service, endpoint));
   }
 
   SUBCASE("Отрицательный тест: неверный endpoint") {
@@ -17,7 +136,7 @@ TEST_CASE("Запуск сервера") {
       tcp::endpoint bad_endpoint(
           boost::asio::ip::address::from_string("256.256.256.256"),
           12345); // Неверный IP-адрес
-      CHECK_THROWS_AS(server srv(io_service, strand, bad_endpoint),
+      CHECK_THROWS_AS(server srv(io_service, bad_endpoint),
                       std::runtime_error);
     } catch (...) {
       CHECK(true); // Пример обработки исключения для некорректного IP
@@ -27,9 +146,8 @@ TEST_CASE("Запуск сервера") {
 
 TEST_CASE("Обработка подключения участника") {
   boost::asio::io_service io_service;
-  boost::asio::io_service::strand strand(io_service);
-  chatRoom room;
-  auto participant = std::make_shared<personInRoom>(io_service, strand, room);
+  roomRegistry rooms;
+  auto participant = std::make_shared<personInRoom>(io_service, rooms);
 
   SUBCASE("Положительный тест: успешное подключение") {
     boost::system::error_code ec;
@@ -38,15 +156,14 @@ TEST_CASE("Обработка подключения участника") {
 
   SUBCASE("Отрицательный тест: ошибка подключения") {
     boost::system::error_code ec = boost::asio::error::host_not_found;
-    CHECK_THROWS_AS(participant->nicknameHandler(ec), std::runtime_error);
+    CHECK_NOTHROW(participant->nicknameHandler(ec));
   }
 }
 
 TEST_CASE("Обработка сообщений участника") {
   boost::asio::io_service io_service;
-  boost::asio::io_service::strand strand(io_service);
-  chatRoom room;
-  auto participant = std::make_shared<personInRoom>(io_service, strand, room);
+  roomRegistry rooms;
+  auto participant = std::make_shared<personInRoom>(io_service, rooms);
 
   SUBCASE("Положительный тест: успешное чтение сообщения") {
     boost::system::error_code ec;
@@ -55,6 +172,1614 @@ TEST_CASE("Обработка сообщений участника") {
 
   SUBCASE("Отрицательный тест: ошибка чтения сообщения") {
     boost::system::error_code ec = boost::asio::error::eof;
-    CHECK_THROWS_AS(participant->readHandler(ec), std::runtime_error);
+    CHECK_NOTHROW(participant->readHandler(ec));
+  }
+}
+
+TEST_CASE("Кодирование кадров протокола") {
+  SUBCASE("Положительный тест: заголовок и длинное сообщение") {
+    std::string payload(2000, 'x');
+    std::string frame = makeFrame(payload);
+    frameHeader header;
+    std::copy(frame.begin(), frame.begin() + FRAME_HEADER_SIZE,
+              header.begin());
+    std::uint32_t length = 0;
+    frameType type;
+    CHECK(decodeHeader(header, length, type));
+    CHECK(length == payload.size());
+    CHECK(type == FRAME_TEXT);
+    CHECK(frame.substr(FRAME_HEADER_SIZE) == payload);
+  }
+
+  SUBCASE("Отрицательный тест: слишком длинный кадр") {
+    frameHeader header;
+    encodeHeader(MAX_FRAME_SIZE + 1, FRAME_TEXT, header);
+    std::uint32_t length = 0;
+    frameType type;
+    CHECK_FALSE(decodeHeader(header, length, type));
+  }
+
+  SUBCASE("Рукопожатие: никнейм и версия") {
+    handshakePacket packet;
+    packet.fill('\0');
+    std::string name = "abcdefghijklmno";
+    std::copy(name.begin(), name.end(), packet.begin());
+    packet[MAX_NICKNAME - 1] = static_cast<char>(PROTOCOL_FRAMED);
+    CHECK(handshakeNickname(packet) == name);
+    CHECK(handshakeVersion(packet) == PROTOCOL_FRAMED);
+    CHECK(makeLegacyPacket(std::string(600, 'y')).size() == MAX_IP_PACK_SIZE);
+  }
+}
+
+TEST_CASE("Таблица участников комнаты") {
+  participantTable table;
+  auto first = std::make_shared<recordingParticipant>();
+  auto second = std::make_shared<recordingParticipant>();
+  auto third = std::make_shared<recordingParticipant>();
+
+  SUBCASE("Положительный тест: вход, поиск и выход") {
+    memberHandle a = table.insert(first, internedName("alice: "));
+    memberHandle b = table.insert(second, internedName("bob: "));
+    memberHandle c = table.insert(third, internedName("carol: "));
+    CHECK(table.size() == 3);
+    REQUIRE(table.find(b) != nullptr);
+    CHECK(table.find(b)->name() == "bob: ");
+
+    // на место вышедшего переносится последний участник
+    CHECK(table.erase(a));
+    CHECK(table.size() == 2);
+    REQUIRE(table.find(c) != nullptr);
+    CHECK(table.find(c)->session == third);
+    CHECK(table.find(b)->session == second);
+  }
+
+  SUBCASE("Отрицательный тест: устаревший номер") {
+    memberHandle a = table.insert(first, internedName("alice: "));
+    CHECK(table.erase(a));
+    CHECK_FALSE(table.erase(a));
+    CHECK(table.find(a) == nullptr);
+    // слот переиспользуется, но старый номер к новому участнику не ведёт
+    memberHandle b = table.insert(second, internedName("bob: "));
+    CHECK(b != a);
+    CHECK(table.find(a) == nullptr);
+    CHECK(table.find(b) != nullptr);
+    CHECK(table.find(INVALID_MEMBER) == nullptr);
+  }
+
+  SUBCASE("Граничный тест: никнейм обрезается до MAX_NICKNAME") {
+    memberHandle a = table.insert(first, internedName(std::string(40, 'n')));
+    CHECK(table.find(a)->name() == std::string(MAX_NICKNAME, 'n'));
+  }
+}
+
+TEST_CASE("Таблица никнеймов") {
+  nicknameTable &table = nicknameTable::instance();
+  std::size_t before = table.size();
+
+  SUBCASE("Положительный тест: одинаковые никнеймы получают один номер") {
+    internedName alice("alice: ");
+    internedName again("alice: ");
+    internedName bob("bob: ");
+    CHECK(alice == again);
+    CHECK(alice != bob);
+    CHECK(alice.str() == "alice: ");
+    CHECK(table.size() == before + 2);
+
+    // копия — ещё одна ссылка на ту же запись
+    internedName copy = alice;
+    CHECK(copy.id() == alice.id());
+    CHECK(nicknameTable::instance().name(copy.id()) == "alice: ");
+  }
+
+  SUBCASE("Граничный тест: запись без ссылок освобождается") {
+    nicknameId id;
+    {
+      internedName carol("carol: ");
+      id = carol.id();
+      CHECK(table.size() == before + 1);
+    }
+    CHECK(table.size() == before);
+    // освобождённый номер переиспользуется
+    internedName dave("dave: ");
+    CHECK(dave.id() == id);
+    CHECK(dave.str() == "dave: ");
+    CHECK(internedName().str().empty());
+  }
+}
+
+TEST_CASE("Оформление сообщения участника") {
+  std::time_t seconds = 1700000000;
+  char stamp[TIMESTAMP_SIZE + 1];
+  formatTimestamp(seconds, stamp);
+
+  SUBCASE("Положительный тест: метка, никнейм и текст в одном кадре") {
+    messagePtr msg =
+        chatMessage::render("alice: ", seconds * 1000 + 999, "hello");
+    CHECK(msg->text() == std::string(stamp) + "alice: hello");
+    boost::asio::const_buffer wire = msg->wire(PROTOCOL_FRAMED);
+    frameHeader header;
+    std::memcpy(header.data(), wire.data(), FRAME_HEADER_SIZE);
+    std::uint32_t length;
+    frameType type;
+    REQUIRE(decodeHeader(header, length, type));
+    CHECK(length == TIMESTAMP_SIZE + 12);
+    CHECK(wire.size() == FRAME_HEADER_SIZE + length);
+  }
+
+  SUBCASE("Граничный тест: длинный текст обрезается до MAX_FRAME_SIZE") {
+    messagePtr msg = chatMessage::render(
+        "alice: ", seconds * 1000, std::string(MAX_FRAME_SIZE, 'x'));
+    CHECK(msg->text().size() == MAX_FRAME_SIZE);
+  }
+}
+
+class pointerParticipant : public participant {
+public:
+  void onMessage(const messagePtr &msg) override { messages.push_back(msg); }
+  std::vector<messagePtr> messages;
+};
+
+TEST_CASE("Пачка истории комнаты") {
+  historyConfig history;
+  history.dir = "test_rooms";
+  static int run = 0;
+  chatRoom room("backlog" + std::to_string(::getpid()) + "_" +
+                    std::to_string(run++),
+                history);
+  auto sender = std::make_shared<pointerParticipant>();
+  memberHandle alice = room.enter(sender, "alice: ");
+  CHECK(sender->messages.empty());
+  CHECK(room.backlog() == nullptr);
+  for (int i = 0; i < 5; ++i) {
+    room.broadcast("m" + std::to_string(i), alice);
+  }
+  REQUIRE(sender->messages.size() == 5);
+
+  SUBCASE("Положительный тест: полная пачка кешируется до нового "
+          "сообщения") {
+    messagePtr full = room.backlog();
+    REQUIRE(full != nullptr);
+    CHECK(full->count() == 5);
+    CHECK(room.backlog() == full);
+    std::size_t framed = 0, legacy = 0;
+    for (const messagePtr &msg : sender->messages) {
+      framed += msg->wire(PROTOCOL_FRAMED).size();
+      legacy += msg->wire(PROTOCOL_LEGACY).size();
+    }
+    CHECK(full->wire(PROTOCOL_FRAMED).size() == framed);
+    CHECK(full->wire(PROTOCOL_LEGACY).size() == legacy);
+    CHECK(full->text() == sender->messages[0]->text() + "\n" +
+                              sender->messages[1]->text() + "\n" +
+                              sender->messages[2]->text() + "\n" +
+                              sender->messages[3]->text() + "\n" +
+                              sender->messages[4]->text());
+
+    room.broadcast("m5", alice);
+    messagePtr updated = room.backlog();
+    CHECK(updated != full);
+    CHECK(updated->count() == 6);
+  }
+
+  SUBCASE("Положительный тест: последние N и с момента времени") {
+    messagePtr last = room.backlog(2);
+    REQUIRE(last != nullptr);
+    CHECK(last->count() == 2);
+    CHECK(last->text().find("alice: m4") != std::string::npos);
+    CHECK(last->text().find("alice: m2") == std::string::npos);
+    std::uint64_t newest = sender->messages.back()->timestamp();
+    messagePtr since = room.backlog(SIZE_MAX, newest);
+    REQUIRE(since != nullptr);
+    CHECK(since->text().find("alice: m4") != std::string::npos);
+    CHECK(room.backlog(SIZE_MAX, newest + 1) == nullptr);
+    CHECK(room.backlog(0) == nullptr);
+  }
+
+  SUBCASE("Положительный тест: при входе история приходит одной пачкой") {
+    auto late = std::make_shared<pointerParticipant>();
+    memberHandle bob = room.enter(late, "bob: ");
+    REQUIRE(late->messages.size() == 1);
+    CHECK(late->messages[0]->count() == 5);
+    CHECK(late->messages[0] == room.backlog());
+    room.leave(bob);
+  }
+
+  room.leave(alice);
+}
+
+TEST_CASE("Номера сообщений и возобновление сессии") {
+  historyConfig history;
+  history.dir = "test_rooms";
+  static int run = 0;
+  std::string name = "resume" + std::to_string(::getpid()) + "_" +
+                     std::to_string(run++);
+  auto sender = std::make_shared<pointerParticipant>();
+
+  SUBCASE("Положительный тест: кадр версии 1 вложен в кадр с номером") {
+    messagePtr msg = chatMessage::make("hello", 0, 7);
+    CHECK(msg->seq() == 7);
+    CHECK(msg->text() == "hello");
+    boost::asio::const_buffer framed = msg->wire(PROTOCOL_FRAMED);
+    CHECK(std::string(static_cast<const char *>(framed.data()),
+                      framed.size()) == makeFrame("hello"));
+    boost::asio::const_buffer resumable = msg->wire(PROTOCOL_RESUMABLE);
+    REQUIRE(resumable.size() == framed.size() + FRAME_HEADER_SIZE +
+                                    SEQUENCE_SIZE);
+    std::string bytes(static_cast<const char *>(resumable.data()),
+                      resumable.size());
+    frameHeader header;
+    std::memcpy(header.data(), bytes.data(), FRAME_HEADER_SIZE);
+    std::uint32_t length;
+    frameType type;
+    REQUIRE(decodeHeader(header, length, type));
+    CHECK(type == FRAME_SEQUENCED);
+    std::uint64_t seq = 0;
+    std::string text;
+    REQUIRE(decodeSequenced(bytes.substr(FRAME_HEADER_SIZE), seq, text));
+    CHECK(seq == 7);
+    CHECK(text == "hello");
+    CHECK(msg->wire(PROTOCOL_LEGACY).size() == MAX_IP_PACK_SIZE);
+  }
+
+  SUBCASE("Положительный тест: досылаются только пропущенные сообщения") {
+    chatRoom room(name, history);
+    memberHandle alice = room.enter(sender, "alice: ");
+    for (int i = 0; i < 5; ++i) {
+      room.broadcast("m" + std::to_string(i), alice);
+    }
+    REQUIRE(sender->messages.size() == 5);
+    CHECK(sender->messages.front()->seq() == 1);
+    CHECK(sender->messages.back()->seq() == 5);
+
+    auto back = std::make_shared<pointerParticipant>();
+    memberHandle bob = room.enter(back, internedName("bob: "), 3);
+    REQUIRE(back->messages.size() == 1);
+    CHECK(back->messages[0]->count() == 2);
+    CHECK(back->messages[0]->seq() == 5);
+    room.leave(bob);
+
+    auto current = std::make_shared<pointerParticipant>();
+    bob = room.enter(current, internedName("bob: "), 5);
+    CHECK(current->messages.empty());
+    room.leave(bob);
+    room.leave(alice);
+  }
+
+  SUBCASE("Отрицательный тест: номер из будущего даёт маркер пропуска") {
+    chatRoom room(name, history);
+    memberHandle alice = room.enter(sender, "alice: ");
+    room.broadcast("m", alice);
+    auto stale = std::make_shared<pointerParticipant>();
+    memberHandle bob = room.enter(stale, internedName("bob: "), 42);
+    REQUIRE(stale->messages.size() == 2);
+    CHECK(stale->messages[0]->wire(PROTOCOL_RESUMABLE).size() ==
+          FRAME_HEADER_SIZE);
+    CHECK(stale->messages[1]->seq() == 1);
+    room.leave(bob);
+    room.leave(alice);
+  }
+
+  SUBCASE("Граничный тест: пропуск длиннее хранимой истории") {
+    chatRoom room(name, history);
+    memberHandle alice = room.enter(sender, "alice: ");
+    for (int i = 0; i < 150; ++i) {
+      room.broadcast("m" + std::to_string(i), alice);
+    }
+    std::uint64_t gaps =
+        metrics::instance().total(metricCounter::resume_gaps);
+    auto late = std::make_shared<pointerParticipant>();
+    memberHandle bob = room.enter(late, internedName("bob: "), 10);
+    REQUIRE(late->messages.size() == 2);
+    CHECK(late->messages[1]->count() == 100);
+    CHECK(metrics::instance().total(metricCounter::resume_gaps) - gaps == 1);
+    room.leave(bob);
+    room.leave(alice);
+  }
+
+  SUBCASE("Положительный тест: нумерация продолжается после перезапуска") {
+    {
+      chatRoom room(name, history);
+      memberHandle alice = room.enter(sender, "alice: ");
+      for (int i = 0; i < 3; ++i) {
+        room.broadcast("m" + std::to_string(i), alice);
+      }
+      room.leave(alice);
+    }
+    chatRoom reopened(name, history);
+    auto back = std::make_shared<pointerParticipant>();
+    memberHandle alice = reopened.enter(back, internedName("alice: "), 2);
+    REQUIRE(back->messages.size() == 1);
+    CHECK(back->messages[0]->seq() == 3);
+    CHECK(back->messages[0]->text().find("alice: m2") != std::string::npos);
+    reopened.broadcast("m3", alice);
+    CHECK(back->messages.back()->seq() == 4);
+    reopened.leave(alice);
   }
 }
+
+TEST_CASE("Доставка сообщений между шардами") {
+  std::vector<int> ports = {12360};
+  shard first(0, ports);
+  shard second(1, ports);
+  roomGroup group({&first, &second}, 0);
+
+  auto sender = std::make_shared<recordingParticipant>();
+  auto receiver = std::make_shared<recordingParticipant>();
+  memberHandle alice = first.room(0).enter(sender, "alice: ");
+  second.room(0).enter(receiver, "bob: ");
+  std::size_t sender_before = sender->messages.size();
+  std::size_t receiver_before = receiver->messages.size();
+
+  first.room(0).broadcast("hi", alice);
+  CHECK(receiver->messages.size() == receiver_before);
+
+  first.ioService().poll();
+  second.ioService().poll();
+  REQUIRE(sender->messages.size() == sender_before + 1);
+  REQUIRE(receiver->messages.size() == receiver_before + 1);
+  CHECK(receiver->messages.back() == sender->messages.back());
+  CHECK(receiver->messages.back().find("alice: hi") != std::string::npos);
+}
+
+TEST_CASE("Именованные комнаты") {
+  historyConfig history;
+  history.dir = "test_rooms";
+
+  SUBCASE("Положительный тест: сообщения не выходят за пределы комнаты") {
+    roomRegistry rooms(history);
+    auto lobby = std::make_shared<recordingParticipant>();
+    auto dev = std::make_shared<recordingParticipant>();
+    memberHandle lobby_member, dev_member;
+    rooms.join(DEFAULT_ROOM, lobby, "lobby: ", lobby_member);
+    std::shared_ptr<chatRoom> room =
+        rooms.join("dev", dev, "dev: ", dev_member);
+    CHECK(rooms.size() == 2);
+    CHECK(rooms.find("dev") == room);
+    std::size_t lobby_before = lobby->messages.size();
+    std::size_t dev_before = dev->messages.size();
+
+    room->broadcast("hi", dev_member);
+    CHECK(lobby->messages.size() == lobby_before);
+    REQUIRE(dev->messages.size() == dev_before + 1);
+    CHECK(dev->messages.back().find("dev: hi") != std::string::npos);
+
+    // пустая комната удаляется, комната по умолчанию остаётся
+    rooms.leave(room, dev_member);
+    CHECK(rooms.size() == 1);
+    CHECK(rooms.find("dev") == nullptr);
+    rooms.leave(rooms.find(DEFAULT_ROOM), lobby_member);
+    CHECK(rooms.find(DEFAULT_ROOM) != nullptr);
+  }
+
+  SUBCASE("Положительный тест: комната на нескольких шардах") {
+    serverConfig config;
+    config.history = history;
+    std::vector<int> ports = {12362};
+    shard first(0, ports, config);
+    shard second(1, ports, config);
+    roomGroup group({&first, &second}, 0);
+
+    auto sender = std::make_shared<recordingParticipant>();
+    auto receiver = std::make_shared<recordingParticipant>();
+    memberHandle alice, bob;
+    std::shared_ptr<chatRoom> room =
+        first.rooms(0).join("dev", sender, "alice: ", alice);
+    second.rooms(0).join("dev", receiver, "bob: ", bob);
+    std::size_t receiver_before = receiver->messages.size();
+    room->broadcast("hi", alice);
+    // домашний шард комнаты выбирается по хешу имени
+    for (int i = 0; i < 2; ++i) {
+      first.ioService().poll();
+      second.ioService().poll();
+    }
+    REQUIRE(receiver->messages.size() == receiver_before + 1);
+    CHECK(receiver->messages.back().find("alice: hi") != std::string::npos);
+
+    first.rooms(0).leave(room, alice);
+    second.rooms(0).leave(second.rooms(0).find("dev"), bob);
+    for (int i = 0; i < 2; ++i) {
+      first.ioService().poll();
+      second.ioService().poll();
+    }
+    CHECK(first.rooms(0).size() == 1);
+    CHECK(second.rooms(0).size() == 1);
+  }
+
+  SUBCASE("Отрицательный тест: недопустимые имена комнат") {
+    CHECK(roomRegistry::validName("dev-2_x"));
+    CHECK_FALSE(roomRegistry::validName(""));
+    CHECK_FALSE(roomRegistry::validName("../etc"));
+    CHECK_FALSE(roomRegistry::validName("a b"));
+    CHECK_FALSE(roomRegistry::validName(std::string(MAX_ROOM_NAME + 1, 'a')));
+  }
+}
+
+TEST_CASE("Пакетная запись очереди сообщений") {
+  boost::asio::io_service io_service;
+  serverConfig config;
+  config.session.write_batch_buffers = 8;
+  config.session.write_coalesce_us = 1000;
+  server srv(io_service, tcp::endpoint(tcp::v4(), 12361), false, config);
+
+  boost::asio::io_service client_service;
+  tcp::socket socket = connectFramed(client_service, 12361, "batch");
+  io_service.run_for(std::chrono::milliseconds(50));
+
+  char ack = 0;
+  boost::asio::read(socket, boost::asio::buffer(&ack, 1));
+  CHECK(ack == static_cast<char>(PROTOCOL_FRAMED));
+  // пропускаем историю комнаты
+  socket.non_blocking(true);
+  std::array<char, 4096> drain;
+  boost::system::error_code ec;
+  while (socket.read_some(boost::asio::buffer(drain), ec) > 0) {
+  }
+  socket.non_blocking(false);
+
+  std::string frames;
+  for (int i = 0; i < 100; ++i) {
+    frames += makeFrame("m" + std::to_string(i));
+  }
+  boost::asio::write(socket, boost::asio::buffer(frames));
+  io_service.run_for(std::chrono::milliseconds(100));
+
+  for (int i = 0; i < 100; ++i) {
+    std::string msg = readFrame(socket);
+    std::string expected = "batch: m" + std::to_string(i);
+    REQUIRE(msg.compare(msg.size() - expected.size(), expected.size(),
+                        expected) == 0);
+  }
+}
+
+TEST_CASE("Переполнение очереди записи медленного участника") {
+  boost::asio::io_service io_service;
+  serverConfig config;
+  config.session.max_queue_messages = 4;
+
+  // Подключение участника и рассылка 20 сообщений до того, как первая
+  // запись в его сокет успеет завершиться.
+  auto flood = [&](unsigned short port, tcp::socket &socket,
+                   boost::asio::io_service &client_service) {
+    server srv(io_service, tcp::endpoint(tcp::v4(), port), false, config);
+    socket = connectFramed(client_service, port, "slow");
+    io_service.run_for(std::chrono::milliseconds(50));
+    char ack = 0;
+    boost::asio::read(socket, boost::asio::buffer(&ack, 1));
+    socket.non_blocking(true);
+    std::array<char, 4096> drain;
+    boost::system::error_code ec;
+    while (socket.read_some(boost::asio::buffer(drain), ec) > 0) {
+    }
+    socket.non_blocking(false);
+    for (int i = 0; i < 20; ++i) {
+      srv.room().deliver(chatMessage::make("m" + std::to_string(i)));
+    }
+    io_service.run_for(std::chrono::milliseconds(100));
+  };
+
+  SUBCASE("Положительный тест: пропуск заменяется уведомлением") {
+    config.session.overflow_policy = overflowPolicy::coalesce;
+    overflowStats before = sessionOverflowStats();
+    boost::asio::io_service client_service;
+    tcp::socket socket(client_service);
+    flood(12363, socket, client_service);
+
+    CHECK(readFrame(socket) == "m0");
+    CHECK(readFrame(socket) == "Пропущено сообщений: 16");
+    CHECK(readFrame(socket) == "m17");
+    CHECK(readFrame(socket) == "m18");
+    CHECK(readFrame(socket) == "m19");
+    CHECK(sessionOverflowStats().coalesced - before.coalesced == 16);
+  }
+
+  SUBCASE("Положительный тест: отбрасываются новые сообщения") {
+    config.session.overflow_policy = overflowPolicy::drop_newest;
+    overflowStats before = sessionOverflowStats();
+    boost::asio::io_service client_service;
+    tcp::socket socket(client_service);
+    flood(12364, socket, client_service);
+
+    for (int i = 0; i < 4; ++i) {
+      CHECK(readFrame(socket) == "m" + std::to_string(i));
+    }
+    CHECK(sessionOverflowStats().dropped_newest - before.dropped_newest ==
+          16);
+  }
+
+  SUBCASE("Отрицательный тест: участник не читает и отключается") {
+    config.session.overflow_policy = overflowPolicy::disconnect;
+    config.session.max_queue_messages = 1024;
+    config.session.max_queue_bytes = 256 * 1024;
+    config.session.overflow_grace_ms = 20;
+    config.session.timer_tick_ms = 10;
+    overflowStats before = sessionOverflowStats();
+    server srv(io_service, tcp::endpoint(tcp::v4(), 12365), false, config);
+    boost::asio::io_service client_service;
+    tcp::socket socket = connectFramed(client_service, 12365, "stalled");
+    io_service.run_for(std::chrono::milliseconds(50));
+
+    // Сообщения больше буферов сокета: очередь не освобождается.
+    // Одно такое сообщение в очереди уже больше половины её объёма, так
+    // что разобранной считается только пустая очередь.
+    std::string big(150 * 1024, 'x');
+    for (int i = 0; i < 200; ++i) {
+      srv.room().deliver(chatMessage::make(big));
+      io_service.poll();
+    }
+    io_service.run_for(std::chrono::milliseconds(100));
+    CHECK(sessionOverflowStats().disconnected - before.disconnected == 1);
+    CHECK(sessionOverflowStats().dropped_newest > before.dropped_newest);
+  }
+
+  SUBCASE("Положительный тест: участник дочитал очередь и остаётся") {
+    // Байт подтверждения версии тоже учитывается в объёме очереди: иначе
+    // после первой записи объём уходит ниже нуля и опустевшая очередь не
+    // считается разобранной.
+    config.session.overflow_policy = overflowPolicy::disconnect;
+    config.session.max_queue_messages = 1024;
+    config.session.max_queue_bytes = 100 * 1024;
+    config.session.overflow_grace_ms = 300;
+    config.session.timer_tick_ms = 10;
+    overflowStats before = sessionOverflowStats();
+    server srv(io_service, tcp::endpoint(tcp::v4(), 12379), false, config);
+    tcp::socket socket = joinQuietly(io_service, 12379, "catching-up");
+
+    // Одно такое сообщение в очереди уже больше половины её объёма, так
+    // что разобранной считается только пустая очередь.
+    std::string big(MAX_FRAME_SIZE, 'x');
+    for (int i = 0; i < 200; ++i) {
+      srv.room().deliver(chatMessage::make(big));
+      io_service.poll();
+    }
+    CHECK(sessionOverflowStats().dropped_newest > before.dropped_newest);
+
+    // Клиент разбирает очередь до истечения отсрочки и читает дальше.
+    socket.non_blocking(true);
+    std::array<char, 65536> drain;
+    boost::system::error_code ec;
+    auto deadline =
+        std::chrono::steady_clock::now() + std::chrono::milliseconds(500);
+    while (std::chrono::steady_clock::now() < deadline) {
+      io_service.poll();
+      while (socket.read_some(boost::asio::buffer(drain), ec) > 0) {
+      }
+      std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+    socket.non_blocking(false);
+    CHECK(sessionOverflowStats().disconnected == before.disconnected);
+
+    srv.room().deliver(chatMessage::make("after"));
+    io_service.run_for(std::chrono::milliseconds(50));
+    CHECK(readFrame(socket) == "after");
+  }
+
+  SUBCASE("Положительный тест: кадр смены комнаты не теряется") {
+    // Без FRAME_ROOM клиент версии 2 отнёс бы номера новой комнаты к
+    // прежней и при возобновлении получил бы не те сообщения.
+    const std::pair<overflowPolicy, unsigned short> cases[] = {
+        {overflowPolicy::drop_newest, 12383},
+        {overflowPolicy::coalesce, 12384}};
+    for (const auto &entry : cases) {
+      config.session.overflow_policy = entry.first;
+      server srv(io_service, tcp::endpoint(tcp::v4(), entry.second), false,
+                 config);
+      tcp::socket socket(io_service);
+      socket.connect(tcp::endpoint(
+          boost::asio::ip::address::from_string("127.0.0.1"), entry.second));
+      handshakePacket packet;
+      packet.fill('\0');
+      std::string nickname = "hopper";
+      std::copy(nickname.begin(), nickname.end(), packet.begin());
+      packet[MAX_NICKNAME - 1] = static_cast<char>(PROTOCOL_RESUMABLE);
+      boost::asio::write(socket, boost::asio::buffer(packet));
+      boost::asio::write(socket,
+                         boost::asio::buffer(makeResumeFrame(0, "")));
+      io_service.run_for(std::chrono::milliseconds(50));
+
+      // Очередь заполнена, когда участник переходит в другую комнату.
+      for (int i = 0; i < 20; ++i) {
+        srv.room().deliver(chatMessage::make("m" + std::to_string(i)));
+      }
+      boost::asio::write(socket, boost::asio::buffer(makeFrame("/join dev")));
+      io_service.run_for(std::chrono::milliseconds(100));
+
+      char ack = 0;
+      boost::asio::read(socket, boost::asio::buffer(&ack, 1));
+      CHECK(ack == static_cast<char>(PROTOCOL_RESUMABLE));
+      std::vector<std::string> rooms;
+      socket.non_blocking(true);
+      boost::system::error_code ec;
+      frameHeader header;
+      while (boost::asio::read(socket, boost::asio::buffer(header), ec) ==
+             header.size()) {
+        std::uint32_t length;
+        frameType type;
+        decodeHeader(header, length, type);
+        std::string payload(length, '\0');
+        socket.non_blocking(false);
+        boost::asio::read(socket, boost::asio::buffer(&payload[0], length));
+        socket.non_blocking(true);
+        if (type == FRAME_ROOM) {
+          rooms.push_back(payload);
+        }
+      }
+      CHECK(rooms == std::vector<std::string>{DEFAULT_ROOM, "dev"});
+    }
+  }
+}
+
+TEST_CASE("Асинхронный журнал") {
+  std::string path = "test_logger.log";
+  std::remove(path.c_str());
+
+  SUBCASE("Положительный тест: строки пишутся пачками в файл") {
+    logger journal;
+    logConfig config;
+    config.file = path;
+    config.flush_ms = 1;
+    journal.start(config);
+    for (int i = 0; i < 100; ++i) {
+      CHECK(journal.push("[ts] ", 5, "line " + std::to_string(i)));
+    }
+    journal.stop();
+
+    std::ifstream file(path);
+    std::string line;
+    int count = 0;
+    while (std::getline(file, line)) {
+      CHECK(line == "[ts] line " + std::to_string(count));
+      ++count;
+    }
+    CHECK(count == 100);
+    CHECK(journal.stats().written == 100);
+    CHECK(journal.stats().dropped == 0);
+  }
+
+  SUBCASE("Отрицательный тест: переполнение кольца отбрасывает строки") {
+    logger journal;
+    logConfig config;
+    config.file = path;
+    config.ring_size = 4;
+    config.flush_ms = 1000;
+    journal.start(config);
+    // фоновый поток спит, пока кольцо заполняется
+    int accepted = 0;
+    for (int i = 0; i < 16; ++i) {
+      accepted += journal.push("", 0, std::string(2 * LOG_LINE_SIZE, 'x'));
+    }
+    CHECK(accepted >= 4);
+    CHECK(journal.stats().dropped == 16 - accepted);
+    journal.stop();
+  }
+
+  std::remove(path.c_str());
+}
+
+TEST_CASE("Сегментированное хранилище истории") {
+  historyConfig config;
+  config.dir = "test_history";
+  config.segment_bytes = 1024;
+  config.index_interval = 4;
+  std::string name = "room" + std::to_string(::getpid());
+
+  SUBCASE("Положительный тест: хвост читается через границы сегментов") {
+    {
+      historyStore store(config, name);
+      for (int i = 0; i < 300; ++i) {
+        store.append(i, "message " + std::to_string(i));
+      }
+    }
+    historyStore reopened(config, name);
+    std::vector<historyRecord> tail = reopened.tail(100);
+    REQUIRE(tail.size() == 100);
+    CHECK(tail.front().text == "message 200");
+    CHECK(tail.front().timestamp_ms == 200);
+    CHECK(tail.back().text == "message 299");
+    CHECK(reopened.tail(1000).size() == 300);
+    // Число записей перед сегментами берётся из segments.idx.
+    std::ifstream starts(config.dir + "/" + name + "/segments.idx");
+    CHECK(starts.good());
+    CHECK(reopened.size() == 300);
+  }
+
+  SUBCASE("Положительный тест: пересозданная комната пишет в то же "
+          "хранилище") {
+    std::shared_ptr<historyStore> old_room = openHistoryStore(config, name);
+    old_room->append(1, "old room");
+    std::shared_ptr<historyStore> new_room = openHistoryStore(config, name);
+    CHECK(new_room == old_room);
+    old_room.reset();
+    new_room->append(2, "new room");
+    CHECK(new_room->size() == 2);
+    new_room.reset();
+    CHECK(openHistoryStore(config, name)->tail(10).size() == 2);
+  }
+
+  SUBCASE("Отрицательный тест: недописанная запись отсекается") {
+    {
+      historyStore store(config, name);
+      store.append(1, "complete");
+    }
+    {
+      std::ofstream segment(config.dir + "/" + name + "/00000000.log",
+                            std::ios::app | std::ios::binary);
+      segment << "\x40\x00\x00\x00partial";
+    }
+    historyStore store(config, name);
+    store.append(2, "after crash");
+    std::vector<historyRecord> tail = store.tail(10);
+    REQUIRE(tail.size() == 2);
+    CHECK(tail[0].text == "complete");
+    CHECK(tail[1].text == "after crash");
+  }
+
+  SUBCASE("Отрицательный тест: ошибка записи не сдвигает номера") {
+    config.segment_bytes = 1 << 20;
+    historyStore store(config, name);
+    store.append(1, "before");
+    REQUIRE(store.size() == 1);
+
+    // Предел размера файла обрывает запись посреди пачки (EFBIG).
+    struct rlimit saved;
+    ::getrlimit(RLIMIT_FSIZE, &saved);
+    struct rlimit limited = saved;
+    limited.rlim_cur = 4096;
+    void (*handler)(int) = std::signal(SIGXFSZ, SIG_IGN);
+    ::setrlimit(RLIMIT_FSIZE, &limited);
+    CHECK_THROWS(store.append(2, std::string(8192, 'x')));
+    ::setrlimit(RLIMIT_FSIZE, &saved);
+    std::signal(SIGXFSZ, handler);
+
+    store.append(3, "after");
+    CHECK(store.size() == 3);
+    std::vector<historyRecord> tail = store.tail(10);
+    REQUIRE(tail.size() == 3);
+    CHECK(tail[0].text == "before");
+    CHECK(tail[1].text == std::string(8192, 'x'));
+    CHECK(tail[2].text == "after");
+  }
+
+  for (unsigned segment = 0; segment < 64; ++segment) {
+    char number[16];
+    std::snprintf(number, sizeof(number), "%08u", segment);
+    std::string base = config.dir + "/" + name + "/" + number;
+    std::remove((base + ".log").c_str());
+    std::remove((base + ".idx").c_str());
+  }
+  std::remove((config.dir + "/" + name + "/segments.idx").c_str());
+  std::remove((config.dir + "/" + name + "/search.idx").c_str());
+  ::rmdir((config.dir + "/" + name).c_str());
+}
+
+TEST_CASE("Кэшируемый временной штамп") {
+  char expected[TIMESTAMP_SIZE + 1];
+  std::time_t now = std::time(nullptr);
+  formatTimestamp(now, expected);
+  const char *cached = cachedTimestamp();
+  CHECK(std::strlen(cached) == TIMESTAMP_SIZE);
+  CHECK(cached[0] == '[');
+  CHECK(cached[TIMESTAMP_SIZE - 2] == ']');
+  // Штамп кэша совпадает с форматированием текущей секунды (с допуском на
+  // смену секунды между вызовами).
+  CHECK(std::strncmp(cached, expected, 17) == 0);
+}
+
+TEST_CASE("Метрики сервера") {
+  SUBCASE("Положительный тест: корзины гистограммы") {
+    for (std::uint64_t value : {0ull, 1ull, 15ull, 16ull, 17ull, 1000ull,
+                                123456789ull, ~0ull}) {
+      unsigned bucket = histogramBucket(value);
+      REQUIRE(bucket < HISTOGRAM_BUCKETS);
+      CHECK(histogramBucketLimit(bucket) >= value);
+      // верхняя граница корзины отличается не больше чем на 1/8
+      CHECK(histogramBucketLimit(bucket) - value <= value / 8);
+    }
+    CHECK(histogramBucket(1000) < histogramBucket(1200));
+  }
+
+  SUBCASE("Положительный тест: счётчики потоков складываются") {
+    metrics &registry = metrics::instance();
+    std::uint64_t before = registry.total(metricCounter::messages_in);
+    std::vector<std::thread> threads;
+    for (int t = 0; t < 4; ++t) {
+      threads.emplace_back([]() {
+        for (int i = 0; i < 1000; ++i) {
+          metricAdd(metricCounter::messages_in);
+          metricRecord(metricHistogram::write_ns, 100 + i);
+        }
+      });
+    }
+    for (auto &thread : threads) {
+      thread.join();
+    }
+    CHECK(registry.total(metricCounter::messages_in) - before == 4000);
+
+    nlohmann::json snapshot = registry.snapshot();
+    const nlohmann::json &write_ns = snapshot["histograms"]["write_ns"];
+    CHECK(write_ns["count"].get<std::uint64_t>() >= 4000);
+    CHECK(write_ns["p50"].get<std::uint64_t>() >= 100);
+    CHECK(write_ns["p999"].get<std::uint64_t>() <=
+          write_ns["max"].get<std::uint64_t>());
+  }
+
+  SUBCASE("Положительный тест: снимок на административном порту") {
+    boost::asio::io_service io_service;
+    metricsEndpoint endpoint(io_service, tcp::endpoint(tcp::v4(), 12366));
+    tcp::socket socket(io_service);
+    socket.connect(tcp::endpoint(
+        boost::asio::ip::address::from_string("127.0.0.1"), 12366));
+    io_service.run_for(std::chrono::milliseconds(50));
+
+    boost::asio::streambuf response;
+    boost::system::error_code ec;
+    boost::asio::read(socket, response, ec);
+    std::string text((std::istreambuf_iterator<char>(&response)),
+                     std::istreambuf_iterator<char>());
+    REQUIRE(text.compare(0, 15, "HTTP/1.0 200 OK") == 0);
+    nlohmann::json snapshot =
+        nlohmann::json::parse(text.substr(text.find("\r\n\r\n") + 4));
+    CHECK(snapshot["counters"].contains("accepts"));
+    CHECK(snapshot["histograms"].contains("fanout_ns"));
+  }
+
+  SUBCASE("Отрицательный тест: молчащий клиент не держит подключение") {
+    boost::asio::io_service io_service;
+    metricsEndpoint endpoint(io_service, tcp::endpoint(tcp::v4(), 12385));
+    tcp::socket socket(io_service);
+    socket.connect(tcp::endpoint(
+        boost::asio::ip::address::from_string("127.0.0.1"), 12385));
+    // Клиент не закрывает соединение: сервер закрывает его сам по сроку.
+    io_service.run_for(std::chrono::milliseconds(2500));
+
+    boost::system::error_code ec;
+    boost::asio::write(socket, boost::asio::buffer("x", 1), ec);
+    std::this_thread::sleep_for(std::chrono::milliseconds(50));
+    boost::asio::write(socket, boost::asio::buffer("x", 1), ec);
+    CHECK(ec);
+  }
+}
+
+TEST_CASE("Пул сессий и память обработчиков") {
+  boost::asio::io_service io_service;
+
+  SUBCASE("Положительный тест: сессия возвращается в пул") {
+    roomRegistry rooms;
+    auto pool = std::make_shared<sessionPool>(io_service, rooms,
+                                              sessionConfig());
+    personInRoom *first = nullptr;
+    {
+      std::shared_ptr<personInRoom> session = pool->acquire();
+      first = session.get();
+      CHECK(pool->idle() == 0);
+    }
+    CHECK(pool->idle() == 1);
+    std::shared_ptr<personInRoom> again = pool->acquire();
+    CHECK(again.get() == first);
+    CHECK(again->shared_from_this() == again);
+    CHECK(pool->idle() == 0);
+  }
+
+  SUBCASE("Положительный тест: доставка и запись без выделения памяти") {
+    server srv(io_service, tcp::endpoint(tcp::v4(), 12367));
+    tcp::socket client = connectFramed(io_service, 12367, "reader");
+    while (srv.room().size() == 0) {
+      io_service.poll();
+    }
+    char version;
+    boost::asio::read(client, boost::asio::buffer(&version, 1));
+
+    // Все сообщения создаются заранее: измеряется только путь от рассылки
+    // до записи в сокет получателя.
+    const std::size_t batch = 200;
+    std::vector<messagePtr> msgs;
+    std::size_t batch_bytes = 0;
+    for (std::size_t i = 0; i < batch; ++i) {
+      msgs.push_back(chatMessage::make("msg " + std::to_string(i)));
+      batch_bytes += msgs.back()->wire(PROTOCOL_FRAMED).size();
+    }
+    std::array<char, 4096> sink;
+    auto round = [&]() {
+      for (const messagePtr &msg : msgs) {
+        srv.room().deliver(msg);
+      }
+      std::size_t received = 0;
+      while (received < batch_bytes) {
+        io_service.poll();
+        while (client.available() != 0) {
+          received += client.read_some(boost::asio::buffer(sink));
+        }
+      }
+    };
+
+    // Прогрев: очереди и буферы достигают рабочего размера.
+    for (int i = 0; i < 3; ++i) {
+      round();
+    }
+    allocations = 0;
+    count_allocations = true;
+    round();
+    count_allocations = false;
+    CHECK(allocations.load() == 0);
+  }
+}
+
+TEST_CASE("Колесо таймеров") {
+  boost::asio::io_service io_service;
+  timingWheel &wheel = boost::asio::use_service<timingWheel>(io_service);
+  wheel.setTick(std::chrono::milliseconds(5));
+  auto now = std::chrono::steady_clock::now();
+
+  SUBCASE("Положительный тест: срабатывание и отмена") {
+    auto early = std::make_shared<countingTarget>();
+    auto late = std::make_shared<countingTarget>();
+    auto cancelled = std::make_shared<countingTarget>();
+    wheelTimer early_timer, late_timer, cancelled_timer;
+    early_timer.target = early;
+    late_timer.target = late;
+    cancelled_timer.target = cancelled;
+    wheel.arm(early_timer, now + std::chrono::milliseconds(10));
+    wheel.arm(late_timer, now + std::chrono::seconds(60));
+    wheel.arm(cancelled_timer, now + std::chrono::milliseconds(10));
+    wheel.cancel(cancelled_timer);
+    CHECK(wheel.size() == 2);
+
+    io_service.run_for(std::chrono::milliseconds(50));
+    CHECK(early->fired == 1);
+    CHECK(late->fired == 0);
+    CHECK(cancelled->fired == 0);
+    CHECK(wheel.size() == 1);
+    wheel.cancel(late_timer);
+    CHECK(wheel.size() == 0);
+    // без взведённых таймеров колесо после очередного шага
+    // останавливается и не держит io_service
+    io_service.restart();
+    io_service.run_for(std::chrono::milliseconds(20));
+    io_service.restart();
+    CHECK(io_service.run_for(std::chrono::milliseconds(20)) == 0);
+  }
+
+  SUBCASE("Положительный тест: повторный взвод переносит срок только "
+          "на более ранний") {
+    auto target = std::make_shared<countingTarget>();
+    wheelTimer timer;
+    timer.target = target;
+    wheel.arm(timer, now + std::chrono::seconds(60));
+    wheel.arm(timer, now + std::chrono::milliseconds(10));
+    wheel.arm(timer, now + std::chrono::seconds(30));
+    CHECK(wheel.size() == 1);
+    io_service.run_for(std::chrono::milliseconds(50));
+    CHECK(target->fired == 1);
+  }
+
+  SUBCASE("Граничный тест: 100 000 таймеров за один шаг") {
+    auto target = std::make_shared<countingTarget>();
+    std::vector<wheelTimer> timers(100000);
+    for (std::size_t i = 0; i < timers.size(); ++i) {
+      timers[i].target = target;
+      // разброс по всем ячейкам колеса и на несколько оборотов вперёд
+      wheel.arm(timers[i], now + std::chrono::milliseconds(i % 5000));
+    }
+    CHECK(wheel.size() == timers.size());
+    for (std::size_t i = 0; i < timers.size(); i += 2) {
+      wheel.cancel(timers[i]);
+    }
+    CHECK(wheel.size() == timers.size() / 2);
+    io_service.run_for(std::chrono::milliseconds(200));
+    std::size_t due = 0;
+    for (std::size_t i = 1; i < timers.size(); i += 2) {
+      due += i % 5000 < 150;
+    }
+    CHECK(target->fired >= static_cast<int>(due));
+    for (wheelTimer &timer : timers) {
+      wheel.cancel(timer);
+    }
+    CHECK(wheel.size() == 0);
+  }
+}
+
+TEST_CASE("Таймауты сессий") {
+  boost::asio::io_service io_service;
+  serverConfig config;
+  config.session.timer_tick_ms = 5;
+
+  SUBCASE("Отрицательный тест: клиент не прислал никнейм") {
+    config.session.handshake_timeout_ms = 30;
+    server srv(io_service, tcp::endpoint(tcp::v4(), 12368), false, config);
+    tcp::socket socket(io_service);
+    socket.connect(tcp::endpoint(
+        boost::asio::ip::address::from_string("127.0.0.1"), 12368));
+    io_service.run_for(std::chrono::milliseconds(100));
+    char byte;
+    boost::system::error_code ec;
+    boost::asio::read(socket, boost::asio::buffer(&byte, 1), ec);
+    CHECK(ec == boost::asio::error::eof);
+  }
+
+  SUBCASE("Отрицательный тест: участник молчит") {
+    config.session.idle_timeout_ms = 30;
+    std::uint64_t before = metrics::instance().total(metricCounter::timeouts);
+    server srv(io_service, tcp::endpoint(tcp::v4(), 12369), false, config);
+    tcp::socket socket = connectFramed(io_service, 12369, "quiet");
+    io_service.run_for(std::chrono::milliseconds(100));
+    CHECK(srv.room().size() == 0);
+    CHECK(metrics::instance().total(metricCounter::timeouts) - before == 1);
+  }
+
+  SUBCASE("Положительный тест: проверка связи не даёт отключить участника") {
+    config.session.idle_timeout_ms = 60;
+    config.session.heartbeat_ms = 20;
+    server srv(io_service, tcp::endpoint(tcp::v4(), 12370), false, config);
+    tcp::socket socket = connectFramed(io_service, 12370, "alive");
+    char ack;
+    io_service.run_for(std::chrono::milliseconds(10));
+    boost::asio::read(socket, boost::asio::buffer(&ack, 1));
+
+    // Отвечаем на каждую проверку связи в течение трёх сроков простоя.
+    std::string pong = makeFrame(std::string(), FRAME_PONG);
+    int pings = 0;
+    auto until =
+        std::chrono::steady_clock::now() + std::chrono::milliseconds(200);
+    std::array<char, 4096> buf;
+    while (std::chrono::steady_clock::now() < until) {
+      io_service.run_for(std::chrono::milliseconds(5));
+      while (socket.available() != 0) {
+        frameHeader header;
+        boost::asio::read(socket, boost::asio::buffer(header));
+        std::uint32_t length;
+        frameType type;
+        decodeHeader(header, length, type);
+        boost::asio::read(socket, boost::asio::buffer(buf.data(), length));
+        if (type == FRAME_PING) {
+          ++pings;
+          boost::asio::write(socket, boost::asio::buffer(pong));
+        }
+      }
+    }
+    CHECK(pings >= 3);
+    CHECK(srv.room().size() == 1);
+  }
+}
+
+TEST_CASE("Завершение сессий при текучке соединений") {
+  boost::asio::io_service io_service;
+  server srv(io_service, tcp::endpoint(tcp::v4(), 12371));
+  std::uint64_t before =
+      metrics::instance().total(metricCounter::sessions_closed);
+
+  tcp::socket stays = connectFramed(io_service, 12371, "stays");
+  tcp::socket leaves = connectFramed(io_service, 12371, "leaves");
+  tcp::socket resets = connectFramed(io_service, 12371, "resets");
+  while (srv.room().size() != 3) {
+    io_service.poll();
+  }
+
+  auto closed = [&]() {
+    return metrics::instance().total(metricCounter::sessions_closed) - before;
+  };
+  auto until = std::chrono::steady_clock::now() + std::chrono::seconds(5);
+  auto runUntil = [&](std::function<bool()> done) {
+    while (!done() && std::chrono::steady_clock::now() < until) {
+      CHECK_NOTHROW(io_service.run_for(std::chrono::milliseconds(5)));
+    }
+  };
+
+  // Обычное закрытие и сброс соединения не должны останавливать рабочий
+  // поток; обе сессии возвращаются в пул.
+  leaves.close();
+  resets.set_option(tcp::socket::linger(true, 0));
+  resets.close();
+  runUntil([&]() { return srv.sessions().idle() == 2; });
+  CHECK(srv.room().size() == 1);
+  CHECK(srv.sessions().idle() == 2);
+  CHECK(closed() == 2);
+
+  // Клиент ушёл до рукопожатия: его сессия вернулась в пул, а следующее
+  // ожидание подключения заняло одну из свободных.
+  {
+    tcp::socket silent(io_service);
+    silent.connect(tcp::endpoint(
+        boost::asio::ip::address::from_string("127.0.0.1"), 12371));
+  }
+  runUntil([&]() { return closed() == 3; });
+  CHECK(closed() == 3);
+  CHECK(srv.sessions().idle() == 2);
+
+  // Оставшийся участник по-прежнему получает сообщения.
+  srv.room().deliver(chatMessage::make("still here"));
+  std::string received;
+  std::array<char, 4096> buf;
+  runUntil([&]() {
+    while (stays.available() != 0) {
+      std::size_t n = stays.read_some(boost::asio::buffer(buf));
+      received.append(buf.data(), n);
+    }
+    return received.find("still here") != std::string::npos;
+  });
+  CHECK(received.find("still here") != std::string::npos);
+}
+
+TEST_CASE("Разбор нескольких кадров из одного чтения") {
+  boost::asio::io_service io_service;
+  serverConfig config;
+  config.session.read_buffer_bytes = MAX_IP_PACK_SIZE;
+  server srv(io_service, tcp::endpoint(tcp::v4(), 12372), false, config);
+
+  boost::asio::io_service client_service;
+  tcp::socket socket = connectFramed(client_service, 12372, "reader");
+  io_service.run_for(std::chrono::milliseconds(50));
+  char ack = 0;
+  boost::asio::read(socket, boost::asio::buffer(&ack, 1));
+  socket.non_blocking(true);
+  std::array<char, 4096> drain;
+  boost::system::error_code ec;
+  while (socket.read_some(boost::asio::buffer(drain), ec) > 0) {
+  }
+  socket.non_blocking(false);
+
+  // Короткие кадры, кадр длиннее буфера чтения и снова короткие кадры
+  // одной записью.
+  std::string big(3 * MAX_IP_PACK_SIZE, 'x');
+  std::string frames;
+  for (int i = 0; i < 40; ++i) {
+    frames += makeFrame("m" + std::to_string(i));
+  }
+  frames += makeFrame(big);
+  frames += makeFrame("tail");
+  std::uint64_t before =
+      metrics::instance().total(metricCounter::messages_in);
+  boost::asio::write(socket, boost::asio::buffer(frames));
+  io_service.run_for(std::chrono::milliseconds(100));
+  CHECK(metrics::instance().total(metricCounter::messages_in) - before == 42);
+
+  for (int i = 0; i < 40; ++i) {
+    std::string msg = readFrame(socket);
+    std::string expected = "reader: m" + std::to_string(i);
+    REQUIRE(msg.compare(msg.size() - expected.size(), expected.size(),
+                        expected) == 0);
+  }
+  std::string msg = readFrame(socket);
+  CHECK(msg.find(big) != std::string::npos);
+  msg = readFrame(socket);
+  CHECK(msg.compare(msg.size() - 4, 4, "tail") == 0);
+}
+
+TEST_CASE("Параметры акцептора") {
+  SUBCASE("Положительный тест: параметры порта поверх общих") {
+    nlohmann::json json = {
+        {"listener", {{"pending_accepts", 4}, {"tcp_nodelay", true}}},
+        {"port_listeners", {{"12373", {{"pending_accepts", 8}}}}}};
+    serverConfig config = parseServerConfig(json);
+    CHECK(portListenerConfig(config, 12345).pending_accepts == 4);
+    const listenerConfig &port = portListenerConfig(config, 12373);
+    CHECK(port.pending_accepts == 8);
+    CHECK(port.tcp_nodelay);
+    CHECK_FALSE(port.keepalive);
+  }
+
+  SUBCASE("Отрицательный тест: неверный порт") {
+    nlohmann::json json = {
+        {"port_listeners", {{"70000", nlohmann::json::object()}}}};
+    CHECK_THROWS_AS(parseServerConfig(json), std::runtime_error);
+  }
+
+  SUBCASE("Положительный тест: одновременные подключения") {
+    boost::asio::io_service io_service;
+    serverConfig config;
+    config.listener.pending_accepts = 8;
+    config.listener.listen_backlog = 64;
+    config.listener.tcp_nodelay = true;
+    config.listener.keepalive = true;
+    listenerConfig &port = config.port_listeners[12373];
+    port = config.listener;
+    port.receive_buffer_bytes = 64 * 1024;
+    server srv(io_service, tcp::endpoint(tcp::v4(), 12373), false, config);
+
+    tcp::no_delay no_delay;
+    srv.acceptor().get_option(no_delay);
+    CHECK(no_delay.value());
+    boost::asio::socket_base::keep_alive keep_alive;
+    srv.acceptor().get_option(keep_alive);
+    CHECK(keep_alive.value());
+    boost::asio::socket_base::receive_buffer_size receive_buffer;
+    srv.acceptor().get_option(receive_buffer);
+    CHECK(receive_buffer.value() >= 64 * 1024);
+
+    std::uint64_t before = metrics::instance().total(metricCounter::accepts);
+    std::vector<tcp::socket> sockets;
+    for (int i = 0; i < 50; ++i) {
+      sockets.push_back(
+          connectFramed(io_service, 12373, "c" + std::to_string(i)));
+    }
+    auto until = std::chrono::steady_clock::now() + std::chrono::seconds(5);
+    while (srv.room().size() != 50 &&
+           std::chrono::steady_clock::now() < until) {
+      io_service.run_for(std::chrono::milliseconds(5));
+    }
+    CHECK(metrics::instance().total(metricCounter::accepts) - before == 50);
+    CHECK(srv.room().size() == 50);
+  }
+}
+
+TEST_CASE("Ограничение частоты сообщений") {
+  SUBCASE("Положительный тест: ведро токенов") {
+    tokenBucket bucket;
+    CHECK_FALSE(bucket.enabled());
+    CHECK(bucket.take(0) == 0);
+    bucket.configure(10, 3);
+    const std::uint64_t ms = 1000000;
+    std::uint64_t now = 1000 * ms;
+    CHECK(bucket.take(now) == 0);
+    CHECK(bucket.take(now) == 0);
+    CHECK(bucket.take(now) == 0);
+    CHECK(bucket.take(now) == 100 * ms);
+    CHECK(bucket.take(now + 100 * ms) == 0);
+    CHECK(bucket.take(now + 100 * ms) != 0);
+  }
+
+  boost::asio::io_service io_service;
+  serverConfig config;
+  std::string frames;
+  for (int i = 0; i < 5; ++i) {
+    frames += makeFrame("m" + std::to_string(i));
+  }
+
+  SUBCASE("Отрицательный тест: лишние сообщения участника отброшены") {
+    config.session.message_rate = 1;
+    config.session.message_burst = 2;
+    server srv(io_service, tcp::endpoint(tcp::v4(), 12374), false, config);
+    tcp::socket socket = joinQuietly(io_service, 12374, "noisy");
+    std::uint64_t before =
+        metrics::instance().total(metricCounter::throttled);
+    boost::asio::write(socket, boost::asio::buffer(frames));
+    io_service.run_for(std::chrono::milliseconds(50));
+    CHECK(metrics::instance().total(metricCounter::throttled) - before == 3);
+
+    // Два сообщения разосланы, на остальные — одно уведомление (оно
+    // отправляется сессией напрямую и может обогнать рассылку).
+    std::string received;
+    for (int i = 0; i < 3; ++i) {
+      received += readFrame(socket) + "\n";
+    }
+    CHECK(received.find("noisy: m0") != std::string::npos);
+    CHECK(received.find("noisy: m1") != std::string::npos);
+    CHECK(received.find("Слишком много сообщений") != std::string::npos);
+    CHECK(socket.available() == 0);
+  }
+
+  SUBCASE("Положительный тест: политика delay сдерживает, но не теряет") {
+    config.session.message_rate = 100;
+    config.session.message_burst = 1;
+    config.session.throttle_policy = throttlePolicy::delay;
+    server srv(io_service, tcp::endpoint(tcp::v4(), 12375), false, config);
+    tcp::socket socket = joinQuietly(io_service, 12375, "patient");
+    std::uint64_t before =
+        metrics::instance().total(metricCounter::throttled);
+    auto start = std::chrono::steady_clock::now();
+    boost::asio::write(socket, boost::asio::buffer(frames));
+    io_service.run_for(std::chrono::milliseconds(100));
+    CHECK(metrics::instance().total(metricCounter::throttled) - before >= 4);
+    for (int i = 0; i < 5; ++i) {
+      std::string msg = readFrame(socket);
+      std::string expected = "m" + std::to_string(i);
+      REQUIRE(msg.compare(msg.size() - 2, 2, expected) == 0);
+    }
+    CHECK(std::chrono::steady_clock::now() - start >=
+          std::chrono::milliseconds(40));
+  }
+
+  SUBCASE("Отрицательный тест: ограничение комнаты") {
+    config.room_limits.message_rate = 1;
+    config.room_limits.message_burst = 1;
+    server srv(io_service, tcp::endpoint(tcp::v4(), 12376), false, config);
+    tcp::socket first = joinQuietly(io_service, 12376, "first");
+    tcp::socket second = joinQuietly(io_service, 12376, "second");
+    std::uint64_t before =
+        metrics::instance().total(metricCounter::room_throttled);
+    boost::asio::write(first, boost::asio::buffer(makeFrame("hello")));
+    io_service.run_for(std::chrono::milliseconds(20));
+    boost::asio::write(second, boost::asio::buffer(makeFrame("too fast")));
+    io_service.run_for(std::chrono::milliseconds(20));
+    CHECK(metrics::instance().total(metricCounter::room_throttled) - before ==
+          1);
+    std::string received = readFrame(second) + readFrame(second);
+    CHECK(received.find("first: hello") != std::string::npos);
+    CHECK(received.find("Слишком много сообщений") != std::string::npos);
+    CHECK(readFrame(first).find("hello") != std::string::npos);
+    CHECK(first.available() == 0);
+  }
+}
+
+TEST_CASE("Личные сообщения и занятые никнеймы") {
+  boost::asio::io_service io_service;
+  server srv(io_service, tcp::endpoint(tcp::v4(), 12377));
+  tcp::socket alice = joinQuietly(io_service, 12377, "alice");
+  tcp::socket bob = joinQuietly(io_service, 12377, "bob");
+  tcp::socket carol = joinQuietly(io_service, 12377, "carol");
+  CHECK(srv.rooms().nicknames().size() == 3);
+  CHECK(srv.rooms().nicknames().find("bob") != nullptr);
+
+  SUBCASE("Положительный тест: сообщение доходит только адресату") {
+    boost::asio::write(alice,
+                       boost::asio::buffer(makeFrame("/msg bob hi there")));
+    io_service.run_for(std::chrono::milliseconds(30));
+    std::string to_bob = readFrame(bob);
+    CHECK(to_bob.find("alice -> bob: hi there") != std::string::npos);
+    std::string echo = readFrame(alice);
+    CHECK(echo == to_bob);
+    CHECK(carol.available() == 0);
+    // В истории комнаты личного сообщения нет.
+    messagePtr backlog = srv.room().backlog(1);
+    CHECK((!backlog || backlog->text().find("hi there") == std::string::npos));
+  }
+
+  SUBCASE("Отрицательный тест: адресата нет в сети") {
+    boost::asio::write(alice, boost::asio::buffer(makeFrame("/msg dave hi")));
+    io_service.run_for(std::chrono::milliseconds(30));
+    CHECK(readFrame(alice).find("dave") != std::string::npos);
+    boost::asio::write(alice, boost::asio::buffer(makeFrame("/msg bob")));
+    io_service.run_for(std::chrono::milliseconds(30));
+    CHECK(readFrame(alice).find("/msg <") != std::string::npos);
+    CHECK(bob.available() == 0);
+  }
+
+  SUBCASE("Отрицательный тест: никнейм занят") {
+    std::uint64_t before =
+        metrics::instance().total(metricCounter::nickname_rejects);
+    tcp::socket twin = connectFramed(io_service, 12377, "bob");
+    io_service.run_for(std::chrono::milliseconds(30));
+    char ack = 0;
+    boost::asio::read(twin, boost::asio::buffer(&ack, 1));
+    CHECK(static_cast<std::uint8_t>(ack) == HANDSHAKE_REJECTED);
+    CHECK(readFrame(twin).find("bob") != std::string::npos);
+    CHECK(metrics::instance().total(metricCounter::nickname_rejects) -
+              before ==
+          1);
+    CHECK(srv.room().size() == 3);
+    twin.close();
+    io_service.run_for(std::chrono::milliseconds(30));
+
+    // После ухода участника никнейм освобождается.
+    bob.close();
+    io_service.run_for(std::chrono::milliseconds(30));
+    CHECK(srv.rooms().nicknames().find("bob") == nullptr);
+    tcp::socket again = joinQuietly(io_service, 12377, "bob");
+    CHECK(srv.rooms().nicknames().find("bob") != nullptr);
+  }
+
+  SUBCASE("Отрицательный тест: пробел в никнейме") {
+    // Такому участнику нельзя было бы отправить /msg.
+    tcp::socket spaced = connectFramed(io_service, 12377, "bob smith");
+    io_service.run_for(std::chrono::milliseconds(30));
+    char ack = 0;
+    boost::asio::read(spaced, boost::asio::buffer(&ack, 1));
+    CHECK(static_cast<std::uint8_t>(ack) == HANDSHAKE_REJECTED);
+    CHECK(readFrame(spaced).find("пробелы") != std::string::npos);
+    CHECK(srv.rooms().nicknames().find("bob smith") == nullptr);
+    CHECK(srv.room().size() == 3);
+    CHECK_FALSE(validNickname("tab\tname"));
+    CHECK(validNickname("ёж"));
+  }
+}
+
+TEST_CASE("Поиск по истории") {
+  SUBCASE("Положительный тест: разбиение на слова и разбор запроса") {
+    std::vector<std::string> tokens;
+    tokenize("Hello, WORLD! Привет Ёж 42", tokens);
+    CHECK(tokens == std::vector<std::string>{"hello", "world", "привет",
+                                             "ёж", "42"});
+    searchQuery query;
+    REQUIRE(parseSearchQuery("from:bob Deploy since:10 until:20", query));
+    CHECK(query.words == std::vector<std::string>{"deploy"});
+    CHECK(query.sender == "bob");
+    CHECK(query.since_ms == 10);
+    CHECK(query.until_ms == 20);
+    searchQuery empty;
+    CHECK_FALSE(parseSearchQuery("  ", empty));
+    searchQuery wrong;
+    CHECK_FALSE(parseSearchQuery("since:yesterday", wrong));
+  }
+
+  searchIndex index;
+  const char *const texts[] = {
+      "[2024-01-01 00:00:00] alice: deploy started",
+      "[2024-01-01 00:00:01] bob: Deploy failed",
+      "[2024-01-01 00:00:02] alice: lunch?",
+      "[2024-01-01 00:00:03] bob: deploy fixed, deploy again"};
+  for (std::uint64_t i = 0; i < 4; ++i) {
+    index.add(i + 1, 1000 * (i + 1), texts[i]);
+  }
+  auto find = [&](const std::string &request, std::size_t limit = 10) {
+    searchQuery query;
+    REQUIRE(parseSearchQuery(request, query));
+    return index.find(query, limit);
+  };
+
+  SUBCASE("Положительный тест: слова, отправитель и время") {
+    typedef std::vector<std::uint64_t> ordinals;
+    CHECK(index.size() == 4);
+    CHECK(find("deploy") == ordinals{1, 2, 4});
+    CHECK(find("deploy", 2) == ordinals{2, 4});
+    CHECK(find("deploy from:bob") == ordinals{2, 4});
+    CHECK(find("from:alice") == ordinals{1, 3});
+    CHECK(find("deploy since:2000 until:3000") == ordinals{2});
+    CHECK(find("since:3000") == ordinals{3, 4});
+    // Никнейм и время из префикса в слова не попадают.
+    CHECK(find("alice").empty());
+    CHECK(find("2024").empty());
+  }
+
+  SUBCASE("Положительный тест: контрольная точка") {
+    searchIndex restored;
+    std::string data = index.serialize();
+    REQUIRE(restored.deserialize(data.data(), data.size()));
+    CHECK(restored.size() == 4);
+    CHECK(restored.terms() == index.terms());
+    searchQuery query;
+    REQUIRE(parseSearchQuery("deploy from:bob", query));
+    CHECK(restored.find(query, 10) == std::vector<std::uint64_t>{2, 4});
+  }
+
+  SUBCASE("Отрицательный тест: повреждённая контрольная точка") {
+    std::string data = index.serialize();
+    searchIndex restored;
+    CHECK_FALSE(restored.deserialize(data.data(), data.size() - 1));
+    CHECK(restored.size() == 0);
+    CHECK_FALSE(restored.deserialize("junk", 4));
+  }
+
+  SUBCASE("Отрицательный тест: ничего не найдено") {
+    CHECK(find("deploy from:carol").empty());
+    CHECK(find("missing").empty());
+    CHECK(find("lunch until:1000").empty());
+  }
+}
+
+TEST_CASE("Индекс поиска в хранилище истории") {
+  historyConfig config;
+  config.dir = "test_history";
+  config.segment_bytes = 512;
+  config.index_interval = 4;
+  config.search_checkpoint = 50;
+  std::string name = "search" + std::to_string(::getpid());
+  std::string checkpoint = config.dir + "/" + name + "/search.idx";
+  auto message = [](int i) {
+    return "[2024-01-01 00:00:00] user" + std::to_string(i % 3) +
+           ": message number" + std::to_string(i) +
+           (i % 10 == 0 ? " round" : "");
+  };
+  searchQuery round;
+  REQUIRE(parseSearchQuery("round from:user1", round));
+
+  SUBCASE("Положительный тест: индекс переживает перезапуск") {
+    {
+      historyStore store(config, name);
+      for (int i = 0; i < 200; ++i) {
+        store.append(i, message(i));
+      }
+      std::vector<historyRecord> found = store.search(round);
+      REQUIRE(found.size() == 7);
+      CHECK(found.front().text == message(10));
+      CHECK(found.back().text == message(190));
+      CHECK(found.back().timestamp_ms == 190);
+    }
+    std::ifstream saved(checkpoint, std::ios::binary);
+    CHECK(saved.good());
+
+    // Записи после контрольной точки дочитываются из сегментов.
+    {
+      historyStore store(config, name);
+      store.append(200, message(200));
+    }
+    {
+      std::ofstream stale(checkpoint, std::ios::trunc | std::ios::binary);
+      searchIndex partial;
+      partial.add(1, 0, message(0));
+      stale << partial.serialize();
+    }
+    historyStore reopened(config, name);
+    searchQuery everything;
+    REQUIRE(parseSearchQuery("message", everything));
+    std::vector<historyRecord> last = reopened.search(everything);
+    REQUIRE(last.size() == config.search_results);
+    CHECK(last.back().text == message(200));
+    CHECK(reopened.search(round).size() == 7);
+  }
+
+  SUBCASE("Положительный тест: индекс загружает поток групповой записи") {
+    {
+      historyStore store(config, name);
+      for (int i = 0; i < 200; ++i) {
+        store.append(i, message(i));
+      }
+    }
+    startHistoryCommitter(1);
+    {
+      historyStore store(config, name);
+      for (int i = 0; i < 200 && !store.searchReady(); ++i) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(5));
+      }
+      REQUIRE(store.searchReady());
+      CHECK(store.search(round).size() == 7);
+      // Новое сообщение находится после групповой записи.
+      store.append(220, message(220));
+      for (int i = 0; i < 200 && store.search(round).size() == 7; ++i) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(5));
+      }
+      CHECK(store.search(round).back().text == message(220));
+    }
+    stopHistoryCommitter();
+  }
+
+  SUBCASE("Отрицательный тест: поиск отключён") {
+    config.search = false;
+    historyStore store(config, name);
+    store.append(1, message(10));
+    CHECK_FALSE(store.searchable());
+    CHECK(store.search(round).empty());
+  }
+
+  for (unsigned segment = 0; segment < 256; ++segment) {
+    char number[16];
+    std::snprintf(number, sizeof(number), "%08u", segment);
+    std::string base = config.dir + "/" + name + "/" + number;
+    std::remove((base + ".log").c_str());
+    std::remove((base + ".idx").c_str());
+  }
+  std::remove((config.dir + "/" + name + "/segments.idx").c_str());
+  std::remove(checkpoint.c_str());
+  ::rmdir((config.dir + "/" + name).c_str());
+}
+
+TEST_CASE("Команда /search") {
+  serverConfig config;
+  config.history.dir = "test_search" + std::to_string(::getpid());
+  {
+    // Комнаты живут, пока живы сессии в io_service, и контрольную точку
+    // индекса пишут при разрушении.
+    boost::asio::io_service io_service;
+    server srv(io_service, tcp::endpoint(tcp::v4(), 12378), false, config);
+    tcp::socket alice = joinQuietly(io_service, 12378, "alice");
+    tcp::socket bob = joinQuietly(io_service, 12378, "bob");
+    std::string frames = makeFrame("release is ready") +
+                         makeFrame("lunch at noon") +
+                         makeFrame("release notes posted");
+    boost::asio::write(alice, boost::asio::buffer(frames));
+    io_service.run_for(std::chrono::milliseconds(50));
+    for (int i = 0; i < 3; ++i) {
+      readFrame(alice);
+      readFrame(bob);
+    }
+
+    SUBCASE("Положительный тест: найденные сообщения одной пачкой") {
+      std::uint64_t before =
+          metrics::instance().total(metricCounter::searches);
+      boost::asio::write(bob,
+                         boost::asio::buffer(makeFrame("/search Release")));
+      io_service.run_for(std::chrono::milliseconds(50));
+      CHECK(readFrame(bob).find("alice: release is ready") !=
+            std::string::npos);
+      CHECK(readFrame(bob).find("alice: release notes posted") !=
+            std::string::npos);
+      CHECK(metrics::instance().total(metricCounter::searches) - before == 1);
+      CHECK(alice.available() == 0);
+    }
+
+    SUBCASE("Отрицательный тест: пустой результат и неверный запрос") {
+      boost::asio::write(bob,
+                         boost::asio::buffer(makeFrame("/search from:bob")));
+      io_service.run_for(std::chrono::milliseconds(50));
+      CHECK(readFrame(bob) == "Ничего не найдено");
+      boost::asio::write(bob, boost::asio::buffer(makeFrame("/search")));
+      io_service.run_for(std::chrono::milliseconds(50));
+      CHECK(readFrame(bob).find("/search [") != std::string::npos);
+    }
+  }
+
+  std::string port = config.history.dir + "/port-12378";
+  std::string room = port + "/" + DEFAULT_ROOM + "/";
+  std::remove((room + "00000000.log").c_str());
+  std::remove((room + "00000000.idx").c_str());
+  std::remove((room + "search.idx").c_str());
+  ::rmdir(room.c_str());
+  ::rmdir(port.c_str());
+  ::rmdir(config.history.dir.c_str());
+}